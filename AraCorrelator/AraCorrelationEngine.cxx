@@ -0,0 +1,222 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraCorrelationEngine.cxx        Batched cross-correlations        /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Cross-correlates many antenna pairs, transforming each         /////
+/////     waveform only once                                             /////
+//////////////////////////////////////////////////////////////////////////////
+
+#include "AraCorrelationEngine.h"
+#include "TGraph.h"
+#include "TMath.h"
+#include <cmath>
+#include <cstdio>
+
+AraCorrelationEngine::AraCorrelationEngine()
+    : fNumPairs(0)
+{
+    //Default Constructor
+}
+
+AraCorrelationEngine::~AraCorrelationEngine()
+{
+    //Default Destructor
+}
+
+void AraCorrelationEngine::clearWaveforms()
+{
+    fTimes.clear();
+    fVolts.clear();
+    fSpectra.clear();
+}
+
+void AraCorrelationEngine::setWaveform(Int_t ant, TGraph *gr)
+{
+    setWaveform(ant, gr->GetN(), gr->GetX(), gr->GetY());
+}
+
+void AraCorrelationEngine::setWaveform(Int_t ant, Int_t numPoints, const Double_t *times, const Double_t *volts)
+{
+    fTimes[ant].assign(times, times+numPoints);
+    fVolts[ant].assign(volts, volts+numPoints);
+
+    //! The spectra of the old waveform are no longer valid
+    std::map< std::pair<Int_t, std::pair<Int_t, Int_t> >, Spectrum_t >::iterator it = fSpectra.lower_bound(std::make_pair(ant, std::make_pair(-1, -1)));
+    while(it!=fSpectra.end() && it->first.first==ant) fSpectra.erase(it++);
+}
+
+Bool_t AraCorrelationEngine::hasWaveform(Int_t ant) const
+{
+    return fVolts.count(ant)>0;
+}
+
+/*!
+    Pads the waveform of an antenna to length points, starting at firstRealSamp, exactly as getCorrelationGraph pads it, and transforms it.
+    \param ant the antenna
+    \param length the padded length
+    \param firstRealSamp the padded sample the waveform starts at
+    \param needSumSquares also fill the running sum of squares, for the waveform weight
+    \return the spectrum, which stays valid until the waveform of the antenna is changed
+*/
+const AraCorrelationEngine::Spectrum_t &AraCorrelationEngine::getSpectrum(Int_t ant, Int_t length, Int_t firstRealSamp, Bool_t needSumSquares)
+{
+    Spectrum_t &spectrum = fSpectra[std::make_pair(ant, std::make_pair(length, firstRealSamp))];
+    if(!spectrum.fft.empty() && (!needSumSquares || !spectrum.sumSquares.empty())) return spectrum;
+
+    const std::vector<Double_t> &volts = fVolts[ant];
+    fPadded.assign(length, 0);
+    for(int i=firstRealSamp;i<length && i-firstRealSamp<(Int_t)volts.size();i++) {
+        fPadded[i]=volts[i-firstRealSamp];
+    }
+
+    if(spectrum.fft.empty()) {
+        FFTWComplex *theFFT=FFTtools::doFFT(length, &fPadded[0]);
+        spectrum.fft.assign(theFFT, theFFT+(length/2)+1);
+        delete [] theFFT;
+    }
+    if(needSumSquares && spectrum.sumSquares.empty()) {
+        spectrum.sumSquares.resize(length+1);
+        spectrum.sumSquares[0]=0;
+        for(int i=0;i<length;i++) {
+            spectrum.sumSquares[i+1]=spectrum.sumSquares[i]+fPadded[i]*fPadded[i];
+        }
+    }
+    return spectrum;
+}
+
+//! Sum of the squares of the padded samples first to last-1, clamped to the padded waveform
+static Double_t sumSquaresInRange(const std::vector<Double_t> &sumSquares, Int_t first, Int_t last)
+{
+    const Int_t length=(Int_t)sumSquares.size()-1;
+    if(first<0) first=0;
+    if(last>length) last=length;
+    if(last<=first) return 0;
+    return sumSquares[last]-sumSquares[first];
+}
+
+/*!
+    Each pair is correlated as FFTtools::getCorrelationGraph (kFFTtools) or RayTraceCorrelator::getCorrelationGraph_WFweight (kWaveformWeight)
+    would with the first antenna as gr1 and the second as gr2, including their zero padding and lags.
+    \param pairs the antennas of each pair
+    \param corType the normalisation
+    \param hilbertEnvelope replace each correlation function with its Hilbert envelope, as FFTtools::getHilbertEnvelope
+    \return kTRUE on success
+*/
+Bool_t AraCorrelationEngine::correlate(const std::vector< std::pair<Int_t, Int_t> > &pairs, AraCorrelationType::AraCorrelationType_t corType, Bool_t hilbertEnvelope)
+{
+    fNumPairs=0;
+    if(corType<0 || corType>=AraCorrelationType::kNotACorrelationType) {
+        fprintf(stderr, "AraCorrelationEngine::correlate -- ERROR Unknown correlation type %d\n", (int)corType);
+        return kFALSE;
+    }
+    for(size_t pair=0;pair<pairs.size();pair++) {
+        const Int_t ants[2]={pairs[pair].first, pairs[pair].second};
+        for(int i=0;i<2;i++) {
+            if(!hasWaveform(ants[i]) || fVolts[ants[i]].size()<2) {
+                fprintf(stderr, "AraCorrelationEngine::correlate -- ERROR Antenna %d in pair %d has no waveform\n", ants[i], (int)pair);
+                return kFALSE;
+            }
+        }
+    }
+
+    const Bool_t waveformWeight = (corType==AraCorrelationType::kWaveformWeight);
+    fNumPairs=(Int_t)pairs.size();
+    fCorrLength.resize(fNumPairs);
+    fCorrDeltaT.resize(fNumPairs);
+    fCorrOffset.resize(fNumPairs);
+    if((Int_t)fCorrValues.size()<fNumPairs) fCorrValues.resize(fNumPairs);
+
+    for(int pair=0;pair<fNumPairs;pair++) {
+        const Int_t ant1=pairs[pair].first;
+        const Int_t ant2=pairs[pair].second;
+        const std::vector<Double_t> &times1=fTimes[ant1];
+        const std::vector<Double_t> &times2=fTimes[ant2];
+
+        //The padding of getCorrelationGraph
+        int length=(int)times1.size();
+        int length2=(int)times2.size();
+        int N=int(TMath::Power(2,int(TMath::Log2(length))+2));
+        if(N<length2)
+            N=int(TMath::Power(2,int(TMath::Log2(length2))+2));
+        int firstRealSamp=(N-length)/2;
+        double deltaT=times1[1]-times1[0];
+        double waveOffset=times1[0]-times2[0];
+        int offsetBin=(int)(waveOffset/deltaT);
+
+        const Spectrum_t &spec1=getSpectrum(ant1, N, firstRealSamp, waveformWeight);
+        const Spectrum_t &spec2=getSpectrum(ant2, N, firstRealSamp, waveformWeight);
+
+        int newLength=(N/2)+1;
+        int no2=N>>1;
+        fCrossSpectrum.resize(newLength);
+        for(int i=0;i<newLength;i++) {
+            double reFFT1=spec1.fft[i].re;
+            double imFFT1=spec1.fft[i].im;
+            double reFFT2=spec2.fft[i].re;
+            double imFFT2=spec2.fft[i].im;
+            fCrossSpectrum[i].re=(reFFT1*reFFT2+imFFT1*imFFT2);
+            fCrossSpectrum[i].im=(imFFT1*reFFT2-reFFT1*imFFT2);
+            if(corType==AraCorrelationType::kFFTtools) {
+                fCrossSpectrum[i].re/=double(no2);
+                fCrossSpectrum[i].im/=double(no2);
+            }
+        }
+        double *corVals=FFTtools::doInvFFT(N, &fCrossSpectrum[0]);
+
+        //Negative lags first, as in the graphs
+        std::vector<Double_t> &values=fCorrValues[pair];
+        values.resize(N);
+        for(int i=0;i<N;i++) {
+            int point = i<N/2 ? i+(N/2) : i-(N/2);
+            values[point]=corVals[i];
+            if(waveformWeight) {
+                int dBin = (i<N/2 ? i : i-N) + offsetBin;
+                double norm1 = dBin<0 ? sumSquaresInRange(spec1.sumSquares, -dBin, N) : sumSquaresInRange(spec1.sumSquares, 0, N-dBin);
+                double norm2 = dBin<0 ? sumSquaresInRange(spec2.sumSquares, 0, N+dBin) : sumSquaresInRange(spec2.sumSquares, dBin, N);
+                if(norm1>0. && norm2>0.)
+                    values[point]/=(sqrt(norm1)*sqrt(norm2));
+            }
+        }
+        delete [] corVals;
+
+        if(hilbertEnvelope) {
+            double *hilbert=FFTtools::getHilbertTransform(N, &values[0]);
+            for(int i=0;i<N;i++) {
+                values[i]=sqrt(values[i]*values[i]+hilbert[i]*hilbert[i]);
+            }
+            delete [] hilbert;
+        }
+
+        fCorrLength[pair]=N;
+        fCorrDeltaT[pair]=deltaT;
+        fCorrOffset[pair]=waveOffset;
+    }
+    return kTRUE;
+}
+
+/*!
+    \param pair the pair, in the order given to correlate
+    \param lag the lag (ns)
+    \return the correlation at lag, the end points of the function are extrapolated linearly
+*/
+Double_t AraCorrelationEngine::evalCorrelation(Int_t pair, Double_t lag) const
+{
+    const Int_t numPoints=fCorrLength[pair];
+    if(numPoints<2) return 0;
+    const Double_t dx=fCorrDeltaT[pair];
+    if(dx<=0) return 0;
+    const Double_t *yVals=&fCorrValues[pair][0];
+
+    Int_t p0=Int_t((lag-getCorrFirstLag(pair))/dx);
+    if(p0<0) p0=0;
+    if(p0>numPoints-2) p0=numPoints-2;
+    return FFTtools::simpleInterploate(getCorrLag(pair, p0),yVals[p0],getCorrLag(pair, p0+1),yVals[p0+1],lag);
+}
+
+TGraph *AraCorrelationEngine::makeCorrGraph(Int_t pair) const
+{
+    const Int_t numPoints=fCorrLength[pair];
+    std::vector<Double_t> lags(numPoints);
+    for(int i=0;i<numPoints;i++) lags[i]=getCorrLag(pair, i);
+    return new TGraph(numPoints, &lags[0], &fCorrValues[pair][0]);
+}
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraCorrelationEngine.h        Batched cross-correlations          /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Cross-correlates many antenna pairs, transforming each         /////
+/////     waveform only once                                             /////
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARACORRELATIONENGINE_H
+#define ARACORRELATIONENGINE_H
+
+//Includes
+#include <TObject.h>
+#include "FFTtools.h"
+#include <map>
+#include <utility>
+#include <vector>
+
+class TGraph;
+
+//!  AraCorrelationType -- The normalisation of the correlation functions
+namespace AraCorrelationType {
+    typedef enum EAraCorrelationType {
+        kNoNorm = 0,        ///< Plain cross-correlation, as RayTraceCorrelator::getCorrelation_NoNorm
+        kFFTtools,          ///< Divided by N/2, as FFTtools::getCorrelationGraph
+        kWaveformWeight,    ///< Divided by the waveform power in the overlap at each lag, as RayTraceCorrelator::getCorrelationGraph_WFweight
+        kNotACorrelationType
+    } AraCorrelationType_t;
+}
+
+//! Part of AraCorrelator library. Cross-correlates a set of antenna pairs, transforming each waveform once
+/*!
+    FFTtools::getCorrelationGraph and RayTraceCorrelator::getCorrelationGraph_WFweight pad and transform both waveforms of every pair,
+    so in a 16 antenna (120 pair) map each spectrum is computed 15 times.
+    The engine keeps the zero padded spectrum of each antenna (and, for the waveform weight, the running power of the padded waveform)
+    and only forms the cross-spectrum and the inverse transform per pair. FFTtools keeps one FFTW plan per length, so repeated
+    events of the same length reuse the plans, and the scratch and result buffers of the engine keep their memory from event to event.
+
+    The correlation functions are evenly sampled arrays, point k being at lag getCorrFirstLag(pair) + k * getCorrDeltaT(pair);
+    they are the same, to rounding, as the graphs from the single pair functions. makeCorrGraph gives a TGraph where one is needed.
+    \code
+    AraCorrelationEngine engine;
+    engine.setWaveform(0, grInt0);  // interpolated to a common time base
+    engine.setWaveform(1, grInt1);
+    std::vector< std::pair<Int_t, Int_t> > pairs(1, std::make_pair(0, 1));
+    engine.correlate(pairs, AraCorrelationType::kWaveformWeight, kTRUE);
+    Double_t peak = engine.evalCorrelation(0, 12.5); // correlation of pair 0 at a lag of 12.5 ns
+    \endcode
+    An engine is not thread safe, use one per thread.
+    \ingroup rootclasses
+*/
+class AraCorrelationEngine
+{
+    public:
+        AraCorrelationEngine(); ///< Default constructor
+        ~AraCorrelationEngine(); ///< Destructor
+
+        void clearWaveforms(); ///< Forgets the waveforms and their spectra, e.g. before the next event
+        void setWaveform(Int_t ant, TGraph *gr); ///< Copies the waveform of antenna ant, which must be evenly sampled
+        void setWaveform(Int_t ant, Int_t numPoints, const Double_t *times, const Double_t *volts); ///< Copies the waveform of antenna ant, which must be evenly sampled
+        Bool_t hasWaveform(Int_t ant) const; ///< Has a waveform been given for antenna ant
+
+        Bool_t correlate(const std::vector< std::pair<Int_t, Int_t> > &pairs, AraCorrelationType::AraCorrelationType_t corType, Bool_t hilbertEnvelope=kFALSE); ///< Correlates the first antenna of each pair with the second. Returns kFALSE (and correlates nothing) if an antenna has no waveform
+
+        Int_t getNumPairs() const { return fNumPairs; } ///< Number of pairs of the last correlate
+        Int_t getCorrLength(Int_t pair) const { return fCorrLength[pair]; } ///< Number of points in the correlation function of a pair
+        Double_t getCorrLag(Int_t pair, Int_t point) const { return (point - fCorrLength[pair]/2) * fCorrDeltaT[pair] + fCorrOffset[pair]; } ///< Lag (ns) of a point of the correlation function, computed as getCorrelationGraph does
+        Double_t getCorrFirstLag(Int_t pair) const { return getCorrLag(pair, 0); } ///< Lag (ns) of the first point of the correlation function
+        Double_t getCorrDeltaT(Int_t pair) const { return fCorrDeltaT[pair]; } ///< Lag step (ns) of the correlation function
+        const Double_t *getCorrValues(Int_t pair) const { return &fCorrValues[pair][0]; } ///< The correlation function of a pair
+        Double_t evalCorrelation(Int_t pair, Double_t lag) const; ///< Linear interpolation of the correlation function at lag, as RayTraceCorrelator::fastEvalForEvenSampling
+        TGraph *makeCorrGraph(Int_t pair) const; ///< A new TGraph of the correlation function of a pair, owned by the caller
+
+    private:
+        //! The zero padded spectrum of an antenna, as the pair functions place the waveform for a given padded length and first sample
+        struct Spectrum_t {
+            std::vector<FFTWComplex> fft; ///< The transform of the padded waveform
+            std::vector<Double_t> sumSquares; ///< sumSquares[i] is the sum of the squares of the first i padded samples (waveform weight only)
+        };
+        const Spectrum_t &getSpectrum(Int_t ant, Int_t length, Int_t firstRealSamp, Bool_t needSumSquares); ///< The spectrum of an antenna, computed on first use
+
+        std::map<Int_t, std::vector<Double_t> > fTimes; ///< The waveform times of each antenna
+        std::map<Int_t, std::vector<Double_t> > fVolts; ///< The waveform voltages of each antenna
+        std::map< std::pair<Int_t, std::pair<Int_t, Int_t> >, Spectrum_t > fSpectra; ///< The spectra, keyed by (ant, (padded length, first sample))
+        std::vector<Double_t> fPadded; ///< Scratch buffer for a padded waveform
+        std::vector<FFTWComplex> fCrossSpectrum; ///< Scratch buffer for a cross-spectrum
+
+        Int_t fNumPairs; ///< Number of pairs of the last correlate
+        std::vector<Int_t> fCorrLength; ///< Padded length (number of lags) of each pair
+        std::vector<Double_t> fCorrDeltaT; ///< Sample step of each pair
+        std::vector<Double_t> fCorrOffset; ///< Time offset between the first samples of the two waveforms of each pair
+        std::vector< std::vector<Double_t> > fCorrValues; ///< The correlation functions, ordered by lag
+};
+
+#endif //ARACORRELATIONENGINE_H
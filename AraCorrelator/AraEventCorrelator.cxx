@@ -1,5 +1,10 @@
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "AraEventCorrelator.h"
+#include "AraCorrelationEngine.h"
 #include "AraGeomTool.h"
 #include "AraAntennaInfo.h"
 #include "AraStationInfo.h"
@@ -21,11 +26,38 @@ AraEventCorrelator::AraEventCorrelator(Int_t numAnts, Int_t stationId)
   fNumPairs=0;
   fStationId=stationId;
   fDebugMode=0;
+  fNumThreads=1;
+  fVPolDeltaT=0;
+  fHPolDeltaT=0;
+  fGeomYear=0;
+  fGeomStationInfo=0;
+  fEngine=new AraCorrelationEngine();
     
   if(numAnts > MAX_NUM_ANTS){
     fprintf(stderr, "%s -- numAnts %i larger than the maximum %i!\n", __FUNCTION__, numAnts, MAX_NUM_ANTS);
+    fNumAnts=MAX_NUM_ANTS;
   }
+  for(int i=0;i<MAX_NUM_ANTS;i++) {
+    fRfChanVPol[i]=-1;
+    fRfChanHPol[i]=-1;
+  }
+
+  //The delay tables are only computed when a map first needs them
+  fillAntennaPositions(stationId);
+  setupPairs();
+}
 
+void AraEventCorrelator::setupPairs()
+{
+  //Only correlate the antennas the station has in both polarisations, an antenna without an RF channel would leave every map empty
+  Int_t numFilledAnts=0;
+  while(numFilledAnts<fNumAnts && fRfChanVPol[numFilledAnts]>=0 && fRfChanHPol[numFilledAnts]>=0) numFilledAnts++;
+  if(numFilledAnts<fNumAnts){
+    fprintf(stderr, "%s -- station %i only has %i antennas of each polarisation, using %i instead of %i\n", __FUNCTION__, (int)fStationId, numFilledAnts, numFilledAnts, fNumAnts);
+    fNumAnts=numFilledAnts;
+  }
+
+  fNumPairs=0;
   for(int first=0;first<(fNumAnts-1);first++) {
     for(int second=first+1;second<fNumAnts;second++) {      
       fFirstAnt[fNumPairs]=first;
@@ -33,16 +65,42 @@ AraEventCorrelator::AraEventCorrelator(Int_t numAnts, Int_t stationId)
       fNumPairs++;
     }
   }
+}
 
-  //  fillDeltaTArrays();
-  fillAntennaPositions(stationId);
-  setupDeltaTInfinity();
-  setupDeltaT40m();
+/*!
+    AraGeomTool keeps the first geometry loaded for a station whatever year is asked for later,
+    so a correlator with a year of its own loads (and owns) the geometry of that year.
+    The antenna positions are refilled, and the delay tables are looked up under the new year from then on.
+    \param geomYear the year (or unixtime) given to AraStationInfo, 0 for the geometry AraGeomTool has loaded
+*/
+void AraEventCorrelator::setGeomYear(Int_t geomYear)
+{
+  if(geomYear==fGeomYear) return;
+  delete fGeomStationInfo;
+  fGeomStationInfo=0;
+  fGeomYear=geomYear;
+  fVPolDeltaT=0;
+  fHPolDeltaT=0;
+  for(int i=0;i<MAX_NUM_ANTS;i++) {
+    fRfChanVPol[i]=-1;
+    fRfChanHPol[i]=-1;
+  }
+  fillAntennaPositions(fStationId);
+  setupPairs();
+}
+
+AraStationInfo *AraEventCorrelator::getGeomStationInfo()
+{
+  if(fGeomYear==0) return AraGeomTool::Instance()->getStationInfo(fStationId);
+  if(!fGeomStationInfo) fGeomStationInfo=new AraStationInfo(fStationId,fGeomYear);
+  return fGeomStationInfo;
 }
 
 AraEventCorrelator::~AraEventCorrelator()
 {
   //Default destructor
+  delete fEngine;
+  delete fGeomStationInfo;
 }
 
 
@@ -66,26 +124,26 @@ void AraEventCorrelator::fillAntennaPositions(Int_t stationId){
 
 void AraEventCorrelator::fillAntennaPositionsAtri()
 {
-  AraGeomTool *araGeom=AraGeomTool::Instance();  
+  AraStationInfo *stationInfo=getGeomStationInfo();
   for(int ant=0;ant<ANTS_PER_ATRI;ant++){
-    int antPolNum=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->antPolNum; 
-    if(araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->polType==AraAntPol::kVertical) {
-      if(antPolNum<8) {
+    int antPolNum=stationInfo->getAntennaInfo(ant)->antPolNum; 
+    if(stationInfo->getAntennaInfo(ant)->polType==AraAntPol::kVertical) {
+      if(antPolNum<MAX_NUM_ANTS) {
 	fRfChanVPol[antPolNum]=ant;
-	fVPolPos[antPolNum][0]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[0];
-	fVPolPos[antPolNum][1]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[1];
-	fVPolPos[antPolNum][2]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[2];
+	fVPolPos[antPolNum][0]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[0];
+	fVPolPos[antPolNum][1]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[1];
+	fVPolPos[antPolNum][2]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[2];
 	fVPolRho[antPolNum]=TMath::Sqrt(fVPolPos[antPolNum][0]*fVPolPos[antPolNum][0]+
 					fVPolPos[antPolNum][1]*fVPolPos[antPolNum][1]);
 	fVPolPhi[antPolNum]=TMath::ATan2(fVPolPos[antPolNum][1],fVPolPos[antPolNum][0]);
       }
     }
-    if(araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->polType==AraAntPol::kHorizontal) {
-      if(antPolNum<8) {
+    if(stationInfo->getAntennaInfo(ant)->polType==AraAntPol::kHorizontal) {
+      if(antPolNum<MAX_NUM_ANTS) {
 	fRfChanHPol[antPolNum]=ant;
-	fHPolPos[antPolNum][0]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[0];
-	fHPolPos[antPolNum][1]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[1];
-	fHPolPos[antPolNum][2]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[2];
+	fHPolPos[antPolNum][0]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[0];
+	fHPolPos[antPolNum][1]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[1];
+	fHPolPos[antPolNum][2]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[2];
 	fHPolRho[antPolNum]=TMath::Sqrt(fHPolPos[antPolNum][0]*fHPolPos[antPolNum][0]+
 					fHPolPos[antPolNum][1]*fHPolPos[antPolNum][1]);
 	fHPolPhi[antPolNum]=TMath::ATan2(fHPolPos[antPolNum][1],fHPolPos[antPolNum][0]);
@@ -117,28 +175,28 @@ void AraEventCorrelator::fillAntennaPositionsAtri()
 
 void AraEventCorrelator::fillAntennaPositionsIcrr()
 {
-  AraGeomTool *araGeom=AraGeomTool::Instance();
+  AraStationInfo *stationInfo=getGeomStationInfo();
   
   for(int ant=0;ant<ANTS_PER_ICRR;ant++) {   
-    int antPolNum=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->antPolNum; 
-    std::cerr << ant << "\t" << antPolNum << "\t" << araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->polType << "\n";
-    if(araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->polType==AraAntPol::kVertical) {
+    int antPolNum=stationInfo->getAntennaInfo(ant)->antPolNum; 
+    std::cerr << ant << "\t" << antPolNum << "\t" << stationInfo->getAntennaInfo(ant)->polType << "\n";
+    if(stationInfo->getAntennaInfo(ant)->polType==AraAntPol::kVertical) {
       if(antPolNum<MAX_NUM_ANTS) {
 	fRfChanVPol[antPolNum]=ant;
-	fVPolPos[antPolNum][0]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[0];
-	fVPolPos[antPolNum][1]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[1];
-	fVPolPos[antPolNum][2]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[2];
+	fVPolPos[antPolNum][0]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[0];
+	fVPolPos[antPolNum][1]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[1];
+	fVPolPos[antPolNum][2]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[2];
 	fVPolRho[antPolNum]=TMath::Sqrt(fVPolPos[antPolNum][0]*fVPolPos[antPolNum][0]+
 					fVPolPos[antPolNum][1]*fVPolPos[antPolNum][1]);
 	fVPolPhi[antPolNum]=TMath::ATan2(fVPolPos[antPolNum][1],fVPolPos[antPolNum][0]);
       }
     }
-    if(araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->polType==AraAntPol::kHorizontal) {
+    if(stationInfo->getAntennaInfo(ant)->polType==AraAntPol::kHorizontal) {
       if(antPolNum<MAX_NUM_ANTS) {
 	fRfChanHPol[antPolNum]=ant;
-	fHPolPos[antPolNum][0]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[0];
-	fHPolPos[antPolNum][1]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[1];
-	fHPolPos[antPolNum][2]=araGeom->getStationInfo(fStationId)->getAntennaInfo(ant)->getLocationXYZ()[2];
+	fHPolPos[antPolNum][0]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[0];
+	fHPolPos[antPolNum][1]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[1];
+	fHPolPos[antPolNum][2]=stationInfo->getAntennaInfo(ant)->getLocationXYZ()[2];
 	fHPolRho[antPolNum]=TMath::Sqrt(fHPolPos[antPolNum][0]*fHPolPos[antPolNum][0]+
 					fHPolPos[antPolNum][1]*fHPolPos[antPolNum][1]);
 	fHPolPhi[antPolNum]=TMath::ATan2(fHPolPos[antPolNum][1],fHPolPos[antPolNum][0]);
@@ -171,53 +229,13 @@ void AraEventCorrelator::fillAntennaPositionsIcrr()
 
 void AraEventCorrelator::setupDeltaTInfinity() 
 {
-  
- 
-  for(int pair=0;pair<fNumPairs;pair++) {
-    int ind1=0;
-    int ind2=0;
-    getPairIndices(pair,ind1,ind2);
-    for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-      for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	fVPolDeltaTInfinity[pair][phiBin][thetaBin]=
-	  calcDeltaTInfinity(fVPolPos[ind1],fVPolRho[ind1],fVPolPhi[ind1],
-			     fVPolPos[ind2],fVPolRho[ind2],fVPolPhi[ind2],
-			     fPhiWave[phiBin],fThetaWave[thetaBin]);
-	fHPolDeltaTInfinity[pair][phiBin][thetaBin]=
-	  calcDeltaTInfinity(fHPolPos[ind1],fHPolRho[ind1],fHPolPhi[ind1],
-			     fHPolPos[ind2],fHPolRho[ind2],fHPolPhi[ind2],
-			     fPhiWave[phiBin],fThetaWave[thetaBin]);	
-      }
-    }
-  }
-  
+  fillDeltaTArrays(AraCorrelatorType::kPlaneWave);
 }
 
 
 void AraEventCorrelator::setupDeltaT40m() 
 {
-  Double_t R=41.8;
-
- 
-  for(int pair=0;pair<fNumPairs;pair++) {
-    int ind1=0;
-    int ind2=0;
-    getPairIndices(pair,ind1,ind2);
-    //    std::cout << "Starting pair " << pair << "\t" << ind1 << "\t" << ind2 << "\n";
-    for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-      for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	fVPolDeltaT40m[pair][phiBin][thetaBin]=
-	  calcDeltaTR(fVPolPos[ind1],fVPolRho[ind1],fVPolPhi[ind1],
-		      fVPolPos[ind2],fVPolRho[ind2],fVPolPhi[ind2],
-		      fPhiWave[phiBin],fThetaWave[thetaBin],R);
-	fHPolDeltaT40m[pair][phiBin][thetaBin]=
-	  calcDeltaTR(fHPolPos[ind1],fHPolRho[ind1],fHPolPhi[ind1],
-		      fHPolPos[ind2],fHPolRho[ind2],fHPolPhi[ind2],
-		      fPhiWave[phiBin],fThetaWave[thetaBin],R);	
-      }
-    }
-  }
-  
+  fillDeltaTArrays(AraCorrelatorType::kSphericalDist40);
 }
 
 Double_t AraEventCorrelator::calcDeltaTInfinity(Double_t ant1[3],Double_t rho1, Double_t phi1, Double_t ant2[3],Double_t rho2, Double_t phi2, Double_t phiWave, Double_t thetaWave)
@@ -263,36 +281,211 @@ Double_t AraEventCorrelator::calcDeltaTR(Double_t ant1[3],Double_t rho1, Double_
 }
 
 void AraEventCorrelator::fillDeltaTArrays(AraCorrelatorType::AraCorrelatorType_t corType) {
-  static AraCorrelatorType::AraCorrelatorType_t lastCorType=AraCorrelatorType::kNotACorType;
-  if(lastCorType==corType) return;
-  lastCorType=corType;
-
+  Double_t R=0; //Plane wave
   switch (corType) {
   case AraCorrelatorType::kSphericalDist40:    
-      for(int pair=0;pair<fNumPairs;pair++) {	
-	for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	  for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	    fVPolDeltaT[pair][phiBin][thetaBin]=fVPolDeltaT40m[pair][phiBin][thetaBin];
-	    fHPolDeltaT[pair][phiBin][thetaBin]=fHPolDeltaT40m[pair][phiBin][thetaBin];
-	  }
-	}
-      }
+      R=41.8;
       break;
   case AraCorrelatorType::kPlaneWave:
   default:
-      for(int pair=0;pair<fNumPairs;pair++) {	
-	for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	  for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	    fVPolDeltaT[pair][phiBin][thetaBin]=fVPolDeltaTInfinity[pair][phiBin][thetaBin];
-	    fHPolDeltaT[pair][phiBin][thetaBin]=fHPolDeltaTInfinity[pair][phiBin][thetaBin];
-	  }
+      break;
+  }
+  std::vector<Int_t> vPolChans(fRfChanVPol,fRfChanVPol+fNumAnts);
+  std::vector<Int_t> hPolChans(fRfChanHPol,fRfChanHPol+fNumAnts);
+  fVPolDeltaT=getDeltaTTable(vPolChans,R);
+  fHPolDeltaT=getDeltaTTable(hPolChans,R);
+}
+
+namespace {
+  //! Identifies a delay table: the station geometry, the source radius, the binning and the channels of the pairs
+  struct AraDelayTableKey {
+    Int_t stationId;
+    Int_t geomYear;
+    Double_t radius;
+    Int_t numPhiBins;
+    Int_t numThetaBins;
+    std::vector<Int_t> rfChans;
+    bool operator<(const AraDelayTableKey &other) const {
+      if(stationId!=other.stationId) return stationId<other.stationId;
+      if(geomYear!=other.geomYear) return geomYear<other.geomYear;
+      if(radius!=other.radius) return radius<other.radius;
+      if(numPhiBins!=other.numPhiBins) return numPhiBins<other.numPhiBins;
+      if(numThetaBins!=other.numThetaBins) return numThetaBins<other.numThetaBins;
+      return rfChans<other.rfChans;
+    }
+  };
+
+  //! The tables of every correlator in the process. They are only removed by clearDeltaTTables, until then the pointers handed out stay valid
+  std::map<AraDelayTableKey, std::vector<Float_t> > fgDelayTables;
+  std::mutex fgDelayTableMutex;
+}
+
+/*!
+    The table is computed the first time a station geometry, radius, binning and set of channels is asked for, with fNumThreads threads
+    each taking some of the pairs, and is then kept for every correlator in the process.
+    \param rfChans the rf channels, the pairs are (rfChans[first],rfChans[second]) for first<second, first in the outer loop
+    \param radius distance (m) of the source from the station centre, 0 for a plane wave
+    \param numPhiBins number of phi bins from -180 to 180 degrees
+    \param numThetaBins number of theta bins from -90 to 90 degrees
+    \return the delays, indexed by getDeltaTIndex(pair,phiBin,thetaBin,numPhiBins,numThetaBins)
+*/
+const Float_t *AraEventCorrelator::getDeltaTTable(const std::vector<Int_t> &rfChans, Double_t radius, Int_t numPhiBins, Int_t numThetaBins)
+{
+  const Int_t numAnts=rfChans.size();
+  if(numAnts<2 || numAnts>MAX_NUM_ANTS || numPhiBins<=0 || numThetaBins<=0 || radius<0) {
+    fprintf(stderr, "%s -- %i channels, %i x %i bins and radius %f not supported\n", __FUNCTION__, numAnts, numPhiBins, numThetaBins, radius);
+    return NULL;
+  }
+  AraStationInfo *stationInfo=getGeomStationInfo();
+  if(!stationInfo) {
+    fprintf(stderr, "%s -- No geometry for station %i\n", __FUNCTION__, fStationId);
+    return NULL;
+  }
+  for(int ind=0;ind<numAnts;ind++) {
+    if(rfChans[ind]<0 || rfChans[ind]>=stationInfo->getNumRFChans()) {
+      fprintf(stderr, "%s -- rf channel %i not in station %i\n", __FUNCTION__, rfChans[ind], fStationId);
+      return NULL;
+    }
+  }
+
+  AraDelayTableKey key;
+  key.stationId=fStationId;
+  key.geomYear=fGeomYear;
+  key.radius=radius;
+  key.numPhiBins=numPhiBins;
+  key.numThetaBins=numThetaBins;
+  key.rfChans=rfChans;
+  std::lock_guard<std::mutex> lock(fgDelayTableMutex);
+  std::map<AraDelayTableKey, std::vector<Float_t> >::iterator it=fgDelayTables.find(key);
+  if(it!=fgDelayTables.end()) return &(it->second[0]);
+
+  //The antenna positions, and the cylindrical coordinates calcDeltaTInfinity wants
+  std::vector<Double_t> pos(3*numAnts);
+  std::vector<Double_t> rho(numAnts);
+  std::vector<Double_t> phi(numAnts);
+  for(int ind=0;ind<numAnts;ind++) {
+    for(int i=0;i<3;i++)
+      pos[3*ind+i]=stationInfo->getAntennaInfo(rfChans[ind])->getLocationXYZ()[i];
+    rho[ind]=TMath::Sqrt(pos[3*ind]*pos[3*ind]+pos[3*ind+1]*pos[3*ind+1]);
+    phi[ind]=TMath::ATan2(pos[3*ind+1],pos[3*ind]);
+  }
+  Double_t deltaPhi=360./numPhiBins;
+  Double_t deltaTheta=180./numThetaBins;
+  std::vector<Double_t> phiWave(numPhiBins);
+  std::vector<Double_t> thetaWave(numThetaBins);
+  for(int i=0;i<numPhiBins;i++)
+    phiWave[i]=(-180+0.5*deltaPhi+deltaPhi*i)*TMath::DegToRad();
+  for(int i=0;i<numThetaBins;i++)
+    thetaWave[i]=(-90+0.5*deltaTheta+deltaTheta*i)*TMath::DegToRad();
+
+  std::vector<Int_t> firstAnt;
+  std::vector<Int_t> secondAnt;
+  for(int first=0;first<(numAnts-1);first++) {
+    for(int second=first+1;second<numAnts;second++) {
+      firstAnt.push_back(first);
+      secondAnt.push_back(second);
+    }
+  }
+  const Int_t numPairs=firstAnt.size();
+
+  std::vector<Float_t> &table=fgDelayTables[key];
+  table.resize(numPairs*numPhiBins*numThetaBins);
+  auto fillPairs = [&](int firstPair, int lastPair) {
+    for(int pair=firstPair;pair<lastPair;pair++) {
+      int ind1=firstAnt[pair];
+      int ind2=secondAnt[pair];
+      for(int phiBin=0;phiBin<numPhiBins;phiBin++) {
+	for(int thetaBin=0;thetaBin<numThetaBins;thetaBin++) {
+	  table[getDeltaTIndex(pair,phiBin,thetaBin,numPhiBins,numThetaBins)]= radius>0 ?
+	    calcDeltaTR(&pos[3*ind1],rho[ind1],phi[ind1],&pos[3*ind2],rho[ind2],phi[ind2],phiWave[phiBin],thetaWave[thetaBin],radius) :
+	    calcDeltaTInfinity(&pos[3*ind1],rho[ind1],phi[ind1],&pos[3*ind2],rho[ind2],phi[ind2],phiWave[phiBin],thetaWave[thetaBin]);
 	}
       }
-      break;
+    }
+  };
+  Int_t numThreads=std::min(fNumThreads,numPairs);
+  if(numThreads<=1) {
+    fillPairs(0,numPairs);
   }
+  else {
+    std::vector<std::thread> threads;
+    for(int i=0;i<numThreads;i++)
+      threads.push_back(std::thread(fillPairs,(numPairs*i)/numThreads,(numPairs*(i+1))/numThreads));
+    for(size_t i=0;i<threads.size();i++)
+      threads[i].join();
+  }
+  return &table[0];
 }
-    
 
+/*!
+    The tables are otherwise kept for the life of the process, this frees them, e.g. after scanning many radii or binnings.
+    Every pointer returned by getDeltaTTable becomes invalid; the correlators look their tables up again before each map,
+    but none may be making a map while the tables are cleared.
+*/
+void AraEventCorrelator::clearDeltaTTables()
+{
+  std::lock_guard<std::mutex> lock(fgDelayTableMutex);
+  fgDelayTables.clear();
+}
+
+void AraEventCorrelator::correlatePairs(TGraph **grNorm, Int_t numAnts)
+{
+  fEngine->clearWaveforms();
+  for(int ind=0;ind<numAnts;ind++)
+    fEngine->setWaveform(ind,grNorm[ind]);
+  std::vector< std::pair<Int_t, Int_t> > pairs;
+  for(int first=0;first<(numAnts-1);first++) {
+    for(int second=first+1;second<numAnts;second++)
+      pairs.push_back(std::make_pair(first,second));
+  }
+  fEngine->correlate(pairs,AraCorrelationType::kFFTtools);
+}
+
+void AraEventCorrelator::setNumThreads(Int_t numThreads)
+{
+  if(numThreads<=0) numThreads=std::thread::hardware_concurrency();
+  fNumThreads=std::max(numThreads,1);
+}
+
+void AraEventCorrelator::addPairsToMap(TH2D *histMap, const Float_t *deltaT, Double_t scale, Int_t numPairs, Int_t numPhiBins, Int_t numThetaBins)
+{
+  if(!deltaT) return; //No table, getDeltaTTable has said why
+  //Sum in a plain buffer, each thread adding every pair into its own range of phi bins
+  //The pairs are added in the same order whatever the number of threads
+  std::vector<Double_t> mapValues(numPhiBins*numThetaBins,0);
+  auto sumPhiBins = [&](int firstPhiBin, int lastPhiBin) {
+    for(int pair=0;pair<numPairs;pair++) {
+      for(int phiBin=firstPhiBin;phiBin<lastPhiBin;phiBin++) {
+	for(int thetaBin=0;thetaBin<numThetaBins;thetaBin++) {
+	  Double_t dt=deltaT[getDeltaTIndex(pair,phiBin,thetaBin,numPhiBins,numThetaBins)];
+	  Double_t corVal=fEngine->evalCorrelation(pair,dt);
+	  corVal*=scale;
+	  mapValues[phiBin*numThetaBins+thetaBin]+=corVal;
+	}
+      }
+    }
+  };
+  Int_t numTiles=std::min(fNumThreads,numPhiBins);
+  if(numTiles<=1) {
+    sumPhiBins(0,numPhiBins);
+  }
+  else {
+    std::vector<std::thread> threads;
+    for(int tile=0;tile<numTiles;tile++)
+      threads.push_back(std::thread(sumPhiBins,(numPhiBins*tile)/numTiles,(numPhiBins*(tile+1))/numTiles));
+    for(size_t i=0;i<threads.size();i++)
+      threads[i].join();
+  }
+
+  for(int phiBin=0;phiBin<numPhiBins;phiBin++) {
+    for(int thetaBin=0;thetaBin<numThetaBins;thetaBin++) {
+      //I think this is the correct equation to work out the bin number
+      //Could just use TH2::GetBin(binx,biny) but the below should be faster
+      Int_t globalBin=(phiBin+1)+(thetaBin+1)*(numPhiBins+2);
+      histMap->SetBinContent(globalBin,mapValues[phiBin*numThetaBins+thetaBin]);
+    }
+  }
+}
 
 void AraEventCorrelator::getPairIndices(int pair, int &ant1, int &ant2)
 {
@@ -331,27 +524,12 @@ TH2D *AraEventCorrelator::getInterferometricMap(UsefulIcrrStationEvent *evPtr, A
     }
     //    std::cerr << "Got graphs and made int maps\n";
 
-    for(int pair=0;pair<fNumPairs;pair++) {
-      int ind1=0;
-      int ind2=0;
-      getPairIndices(pair,ind1,ind2);
-      //      std::cerr << pair << "\t" << ind1 << "\t" << ind2 << "\n";
-
-      grCor[pair]=FFTtools::getCorrelationGraph(grNorm[ind1],grNorm[ind2]);      
-      for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	  //I think this is the correct equation to work out the bin number
-	  //Could just use TH2::GetBin(binx,biny) but the below should be faster
-	  Int_t globalBin=(phiBin+1)+(thetaBin+1)*(NUM_PHI_BINS+2);
-	  Double_t dt=fVPolDeltaT[pair][phiBin][thetaBin];
-	  //Double_t corVal=grCor[pair]->Eval(dt);
-	  Double_t corVal=fastEvalForEvenSampling(grCor[pair],dt);
-	  corVal*=scale;
-	  Double_t binVal=histMap->GetBinContent(globalBin);
-	  histMap->SetBinContent(globalBin,binVal+corVal);
-	}
-      }      
+    correlatePairs(grNorm,fNumAnts);
+    if(fDebugMode) {
+      for(int pair=0;pair<fNumPairs;pair++)
+	grCor[pair]=fEngine->makeCorrGraph(pair);
     }
+    addPairsToMap(histMap,fVPolDeltaT,scale,fNumPairs);
   }
   else {
     for(int ind=0;ind<fNumAnts;ind++) {
@@ -360,25 +538,12 @@ TH2D *AraEventCorrelator::getInterferometricMap(UsefulIcrrStationEvent *evPtr, A
       grNorm[ind]=getNormalisedGraph(grInt[ind]);
     }
 
-    for(int pair=0;pair<fNumPairs;pair++) {
-      int ind1=0;
-      int ind2=0;
-      getPairIndices(pair,ind1,ind2);
-      grCor[pair]=FFTtools::getCorrelationGraph(grNorm[ind1],grNorm[ind2]);      
-      for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	  //I think this is the correct equation to work out the bin number
-	  //Could just use TH2::GetBin(binx,biny) but the below should be faster
-	  Int_t globalBin=(phiBin+1)+(thetaBin+1)*(NUM_PHI_BINS+2);
-	  Double_t dt=fHPolDeltaT[pair][phiBin][thetaBin];
-	  //	  Double_t corVal=grCor[pair]->Eval(dt);
-	  Double_t corVal=fastEvalForEvenSampling(grCor[pair],dt);
-	  corVal*=scale;
-	  Double_t binVal=histMap->GetBinContent(globalBin);
-	  histMap->SetBinContent(globalBin,binVal+corVal);
-	}
-      }      
+    correlatePairs(grNorm,fNumAnts);
+    if(fDebugMode) {
+      for(int pair=0;pair<fNumPairs;pair++)
+	grCor[pair]=fEngine->makeCorrGraph(pair);
     }
+    addPairsToMap(histMap,fHPolDeltaT,scale,fNumPairs);
  }
   if(fDebugMode) {
     char histName[180];
@@ -449,27 +614,12 @@ TH2D *AraEventCorrelator::getInterferometricMap(UsefulAtriStationEvent *evPtr, A
     }
     std::cerr << "Got graphs and made int maps\n";
 
-    for(int pair=0;pair<fNumPairs;pair++) {
-      int ind1=0;
-      int ind2=0;
-      getPairIndices(pair,ind1,ind2);
-      std::cerr << pair << "\t" << ind1 << "\t" << ind2 << "\n";
-
-      grCor[pair]=FFTtools::getCorrelationGraph(grNorm[ind1],grNorm[ind2]);      
-      for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	  //I think this is the correct equation to work out the bin number
-	  //Could just use TH2::GetBin(binx,biny) but the below should be faster
-	  Int_t globalBin=(phiBin+1)+(thetaBin+1)*(NUM_PHI_BINS+2);
-	  Double_t dt=fVPolDeltaT[pair][phiBin][thetaBin];
-	  //Double_t corVal=grCor[pair]->Eval(dt);
-	  Double_t corVal=fastEvalForEvenSampling(grCor[pair],dt);
-	  corVal*=scale;
-	  Double_t binVal=histMap->GetBinContent(globalBin);
-	  histMap->SetBinContent(globalBin,binVal+corVal);
-	}
-      }      
+    correlatePairs(grNorm,fNumAnts);
+    if(fDebugMode) {
+      for(int pair=0;pair<fNumPairs;pair++)
+	grCor[pair]=fEngine->makeCorrGraph(pair);
     }
+    addPairsToMap(histMap,fVPolDeltaT,scale,fNumPairs);
   }
   else {
     for(int ind=0;ind<fNumAnts;ind++) {
@@ -478,25 +628,12 @@ TH2D *AraEventCorrelator::getInterferometricMap(UsefulAtriStationEvent *evPtr, A
       grNorm[ind]=getNormalisedGraph(grInt[ind]);
     }
 
-    for(int pair=0;pair<fNumPairs;pair++) {
-      int ind1=0;
-      int ind2=0;
-      getPairIndices(pair,ind1,ind2);
-      grCor[pair]=FFTtools::getCorrelationGraph(grNorm[ind1],grNorm[ind2]);      
-      for(int phiBin=0;phiBin<NUM_PHI_BINS;phiBin++) {
-	for(int thetaBin=0;thetaBin<NUM_THETA_BINS;thetaBin++) {
-	  //I think this is the correct equation to work out the bin number
-	  //Could just use TH2::GetBin(binx,biny) but the below should be faster
-	  Int_t globalBin=(phiBin+1)+(thetaBin+1)*(NUM_PHI_BINS+2);
-	  Double_t dt=fHPolDeltaT[pair][phiBin][thetaBin];
-	  //	  Double_t corVal=grCor[pair]->Eval(dt);
-	  Double_t corVal=fastEvalForEvenSampling(grCor[pair],dt);
-	  corVal*=scale;
-	  Double_t binVal=histMap->GetBinContent(globalBin);
-	  histMap->SetBinContent(globalBin,binVal+corVal);
-	}
-      }      
+    correlatePairs(grNorm,fNumAnts);
+    if(fDebugMode) {
+      for(int pair=0;pair<fNumPairs;pair++)
+	grCor[pair]=fEngine->makeCorrGraph(pair);
     }
+    addPairsToMap(histMap,fHPolDeltaT,scale,fNumPairs);
  }
   if(fDebugMode) {
     char histName[180];
@@ -535,6 +672,38 @@ TH2D *AraEventCorrelator::getInterferometricMap(UsefulAtriStationEvent *evPtr, A
   return histMap;
 }
 
+/*!
+    Works for any ATRI station whose geometry AraGeomTool knows, the delays come from getDeltaTTable.
+    \param evPtr the event
+    \param rfChans the rf channels to correlate, 2 to MAX_NUM_ANTS of them
+    \param radius distance (m) of the source from the station centre, 0 for a plane wave
+    \param numPhiBins number of phi bins from -180 to 180 degrees
+    \param numThetaBins number of theta bins from -90 to 90 degrees
+    \return the map, owned by the caller, or NULL if the channels or binning are not supported
+*/
+TH2D *AraEventCorrelator::getInterferometricMap(UsefulAtriStationEvent *evPtr, const std::vector<Int_t> &rfChans, Double_t radius, Int_t numPhiBins, Int_t numThetaBins)
+{
+  const Float_t *deltaT=getDeltaTTable(rfChans,radius,numPhiBins,numThetaBins);
+  if(!deltaT) return NULL;
+  const Int_t numAnts=rfChans.size();
+  const Int_t numPairs=numAnts*(numAnts-1)/2;
+  Double_t scale=1./numPairs;
+  TH2D *histMap = new TH2D("histMap","histMap",numPhiBins,-180,180,numThetaBins,-90,90);
+  std::vector<TGraph*> grNorm(numAnts);
+  for(int ind=0;ind<numAnts;ind++) {
+    TGraph *grRaw=evPtr->getGraphFromRFChan(rfChans[ind]);
+    TGraph *grInt=FFTtools::getInterpolatedGraph(grRaw,0.5);
+    grNorm[ind]=getNormalisedGraph(grInt);
+    delete grRaw;
+    delete grInt;
+  }
+  correlatePairs(&grNorm[0],numAnts);
+  addPairsToMap(histMap,deltaT,scale,numPairs,numPhiBins,numThetaBins);
+  for(int ind=0;ind<numAnts;ind++)
+    delete grNorm[ind];
+  return histMap;
+}
+
 TGraph* AraEventCorrelator::getNormalisedGraph(TGraph *grIn)
 {
   Double_t rms=grIn->GetRMS(2);
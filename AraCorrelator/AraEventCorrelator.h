@@ -11,6 +11,7 @@
 
 //Includes
 #include <TObject.h>
+#include <vector>
 #include "AraStationInfo.h"
 #include "AraAntennaInfo.h"
 
@@ -18,14 +19,15 @@
 #define NUM_PHI_BINS 360
 #define NUM_THETA_BINS 180
 
-#define MAX_NUM_ANTS 8
-#define MAX_NUM_PAIRS 28
-//28 = 7+1 + 6+2 + 5+3 + 4 = max num pairs for 8 antennas 
+#define MAX_NUM_ANTS 16
+#define MAX_NUM_PAIRS 120
+//120 = 16*15/2 = max num pairs for 16 antennas, e.g. all the deep antennas of an ATRI station
 
 
 class UsefulIcrrStationEvent;
 class TH2D;
 class TGraph;
+class AraCorrelationEngine;
 
 //!  AraCorrelatorType -- The Calibration Type
 /*!
@@ -50,18 +52,28 @@ namespace AraCorrelatorType {
 class AraEventCorrelator : public TObject
 {
  public:
-  AraEventCorrelator(Int_t numAnts=4, Int_t stationId=0); ///< Default constructor
+  AraEventCorrelator(Int_t numAnts=4, Int_t stationId=0); ///< Default constructor, numAnts is reduced to the number of antennas the station has in both polarisations
    ~AraEventCorrelator(); ///< Destructor
    
    TH2D *getInterferometricMap(UsefulIcrrStationEvent *evPtr, AraAntPol::AraAntPol_t polType, AraCorrelatorType::AraCorrelatorType_t corType=AraCorrelatorType::kPlaneWave);
    TH2D *getInterferometricMap(UsefulAtriStationEvent *evPtr, AraAntPol::AraAntPol_t polType, AraCorrelatorType::AraCorrelatorType_t corType=AraCorrelatorType::kPlaneWave);
+   TH2D *getInterferometricMap(UsefulAtriStationEvent *evPtr, const std::vector<Int_t> &rfChans, Double_t radius, Int_t numPhiBins=NUM_PHI_BINS, Int_t numThetaBins=NUM_THETA_BINS); ///< Map of every pair of up to MAX_NUM_ANTS rf channels (of either polarisation) for a source at radius metres (0 = plane wave), with any binning
    void fillAntennaPositions(Int_t stationId);
    void fillAntennaPositionsAtri();
    void fillAntennaPositionsIcrr();
-   void fillDeltaTArrays(AraCorrelatorType::AraCorrelatorType_t corType);
-   void setupDeltaTInfinity();
-   void setupDeltaT40m();
+   void fillDeltaTArrays(AraCorrelatorType::AraCorrelatorType_t corType); ///< Points fVPolDeltaT and fHPolDeltaT at the tables of corType, computing them on first use
+   void setupDeltaTInfinity(); ///< Computes the plane wave tables now rather than on first use
+   void setupDeltaT40m(); ///< Computes the 40 m tables now rather than on first use
+   const Float_t *getDeltaTTable(const std::vector<Int_t> &rfChans, Double_t radius, Int_t numPhiBins=NUM_PHI_BINS, Int_t numThetaBins=NUM_THETA_BINS); ///< The delays of every pair of rfChans for a source at radius metres (0 = plane wave), computed on first use. NULL if the channels or binning are not supported
+   void setGeomYear(Int_t geomYear); ///< The year (or unixtime) of the station geometry used for the antenna positions and the delay tables
+   AraStationInfo *getGeomStationInfo(); ///< The station geometry of fGeomYear, the AraGeomTool one for year 0
+   static void clearDeltaTTables(); ///< Frees the delay tables of every correlator, no correlator may be making a map at the time
    void getPairIndices(int pair, int &ant1, int &ant2);
+   static Int_t getDeltaTIndex(Int_t pair, Int_t phiBin, Int_t thetaBin, Int_t numPhiBins=NUM_PHI_BINS, Int_t numThetaBins=NUM_THETA_BINS) { return (pair*numPhiBins+phiBin)*numThetaBins+thetaBin; } ///< Index of a pair and sky bin in the delay tables
+   void correlatePairs(TGraph **grNorm, Int_t numAnts); ///< Correlates every pair (first<second) of numAnts normalised graphs in fEngine, as FFTtools::getCorrelationGraph
+   void addPairsToMap(TH2D *histMap, const Float_t *deltaT, Double_t scale, Int_t numPairs, Int_t numPhiBins=NUM_PHI_BINS, Int_t numThetaBins=NUM_THETA_BINS); ///< Sums the correlations of the pairs at their deltaT into histMap, using fNumThreads threads
+   void setNumThreads(Int_t numThreads); ///< Number of threads the maps are summed with, each taking a range of phi bins. 0 = one per core, default = 1
+   void setupPairs(); ///< Limits fNumAnts to the antennas filled in both polarisations and makes the pairs
    Double_t calcDeltaTInfinity(Double_t ant1[3],Double_t rho1, Double_t phi1, Double_t ant2[3],Double_t rho2, Double_t phi2, Double_t phiWave, Double_t thetaWave);
    Double_t calcDeltaTR(Double_t ant1[3],Double_t rho1, Double_t phi1, Double_t ant2[3],Double_t rho2, Double_t phi2, Double_t phiWave, Double_t thetaWave,Double_t R);
 
@@ -90,12 +102,12 @@ class AraEventCorrelator : public TObject
    Int_t fNumPairs;
    Int_t fFirstAnt[MAX_NUM_PAIRS];
    Int_t fSecondAnt[MAX_NUM_PAIRS];
-   Double_t fVPolDeltaT[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
-   Double_t fHPolDeltaT[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
-   Double_t fVPolDeltaTInfinity[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
-   Double_t fHPolDeltaTInfinity[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
-   Double_t fVPolDeltaT40m[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
-   Double_t fHPolDeltaT40m[MAX_NUM_PAIRS][NUM_PHI_BINS][NUM_THETA_BINS];
+   //The delay tables hold fNumPairs x NUM_PHI_BINS x NUM_THETA_BINS floats, indexed by getDeltaTIndex
+   //They are shared by every correlator in the process (see getDeltaTTable)
+   const Float_t *fVPolDeltaT; //! The VPol table of the current AraCorrelatorType
+   const Float_t *fHPolDeltaT; //! The HPol table of the current AraCorrelatorType
+   Int_t fGeomYear; //! The year (or unixtime) of the station geometry, 0 for the one AraGeomTool has loaded
+   AraStationInfo *fGeomStationInfo; //! The geometry of fGeomYear when it is not 0, owned by the correlator
    Int_t fRfChanVPol[MAX_NUM_ANTS];
    Int_t fRfChanHPol[MAX_NUM_ANTS];
    Double_t fVPolPos[MAX_NUM_ANTS][3];
@@ -104,10 +116,13 @@ class AraEventCorrelator : public TObject
    Double_t fHPolRho[MAX_NUM_ANTS];
    Double_t fVPolPhi[MAX_NUM_ANTS];
    Double_t fHPolPhi[MAX_NUM_ANTS];
+
+   AraCorrelationEngine *fEngine; //! The correlations of the current event, each antenna transformed once
+   Int_t fNumThreads; //! Number of threads getInterferometricMap sums the map with
    
 
 
-   ClassDef(AraEventCorrelator,1);
+   ClassDef(AraEventCorrelator,2);
 
 };
 
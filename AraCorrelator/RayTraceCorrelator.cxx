@@ -2,8 +2,15 @@
 #include <iostream>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdexcept>
 #include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <thread>
 
 //ROOT includes
 #include "TFile.h"
@@ -14,6 +21,8 @@
 #include "AraGeomTool.h"
 #include "RayTraceCorrelator.h"
 #include "RayTraceCorrelator_detail.h"
+#include "AraCorrelationEngine.h"
+#include "RayTraceWorkspace.h"
 
 void RayTraceCorrelator::SetupStationInfo(int stationID, int numAntennas) { 
     char errorMessage[400];
@@ -109,30 +118,174 @@ void RayTraceCorrelator::SetTablePaths(const std::string &dirPath, const std::st
 
 
 void RayTraceCorrelator::ConfigureArrivalVectors(){
-    arrivalTimes_.resize(2);
-    arrivalThetas_.resize(2);
-    arrivalPhis_.resize(2);
-    for(int sol=0; sol<2; sol++){
-        arrivalTimes_[sol].resize(numThetaBins_);
-        arrivalThetas_[sol].resize(numThetaBins_);
-        arrivalPhis_[sol].resize(numThetaBins_);
-        for(int thetaBin=0; thetaBin<numThetaBins_; thetaBin++){
-            arrivalTimes_[sol][thetaBin].resize(numPhiBins_);
-            arrivalThetas_[sol][thetaBin].resize(numPhiBins_);
-            arrivalPhis_[sol][thetaBin].resize(numPhiBins_);
-        }
-        for(int thetaBin=0; thetaBin<numThetaBins_; thetaBin++){
-            for(int phiBin=0; phiBin<numPhiBins_; phiBin++){
-                arrivalTimes_[sol][thetaBin][phiBin].resize(numAntennas_);
-                arrivalThetas_[sol][thetaBin][phiBin].resize(numAntennas_);
-                arrivalPhis_[sol][thetaBin][phiBin].resize(numAntennas_);
-            }
-        }
+    int numEntries = 2 * numThetaBins_ * numPhiBins_ * numAntennas_;
+    arrivalTimes_.assign(numEntries, 0.);
+    arrivalThetas_.assign(numEntries, 0.);
+    arrivalPhis_.assign(numEntries, 0.);
+
+    // any pair delays were made from the old tables
+    std::lock_guard<std::mutex> lock(pairDelaysMutex_);
+    pairDelays_.clear();
+}
+
+#define RT_TABLE_CACHE_MAGIC "ARARTTBL"
+#define RT_TABLE_CACHE_VERSION 1
+
+// Header of the binary table cache
+// It is followed by the arrival times, thetas and phis of the solution,
+// each as doubles indexed [thetaBin][phiBin][ant]
+typedef struct {
+    char magic[8];          ///< RT_TABLE_CACHE_MAGIC
+    int version;            ///< RT_TABLE_CACHE_VERSION
+    int headerBytes;        ///< sizeof(RTTableCacheHeader_t)
+    int stationID;          ///< Station of the tables
+    int numAntennas;        ///< Number of antennas in the tables
+    int numThetaBins;       ///< Number of theta bins in the tables
+    int numPhiBins;         ///< Number of phi bins in the tables
+    int solNum;             ///< Solution number of the tables
+    int reserved;           ///< Padding, zero
+    double radius;          ///< Radius of the tables
+    double angularSize;     ///< Angular binning of the tables
+    long long tableBytes;   ///< Size of the ROOT file the tables came from
+    long long tableMTime;   ///< Modification time of the ROOT file the tables came from
+} RTTableCacheHeader_t;
+
+std::string RayTraceCorrelator::GetTableCachePath(const std::string &tablePath){
+    if(getenv("ARA_RT_TABLE_NO_CACHE")){
+        return "";
+    }
+
+    std::string cachePath = tablePath;
+    size_t suffix = cachePath.rfind(".root");
+    if(suffix != std::string::npos && suffix + 5 == cachePath.size()){
+        cachePath.erase(suffix);
+    }
+    cachePath += ".bin";
+
+    const char *cacheDir = getenv("ARA_RT_TABLE_CACHE_DIR");
+    if(cacheDir){
+        size_t slash = cachePath.rfind('/');
+        std::string baseName = (slash == std::string::npos) ? cachePath : cachePath.substr(slash + 1);
+        cachePath = std::string(cacheDir) + "/" + baseName;
+    }
+    return cachePath;
+}
+
+bool RayTraceCorrelator::LoadTableCache(const std::string &cachePath, const std::string &tablePath, int solNum){
+
+    struct stat tableStat;
+    if(cachePath.empty() || stat(tablePath.c_str(), &tableStat) != 0){
+        return false;
+    }
+
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if(fd < 0){
+        return false; // no cache yet, the normal case the first time a table is used
+    }
+
+    size_t numEntries = size_t(numThetaBins_) * numPhiBins_ * numAntennas_;
+    size_t fileBytes = sizeof(RTTableCacheHeader_t) + 3 * numEntries * sizeof(double);
+    struct stat cacheStat;
+    if(fstat(fd, &cacheStat) != 0 || size_t(cacheStat.st_size) != fileBytes){
+        fprintf(stderr, "RayTraceCorrelator -- WARNING %s has the wrong size, reading %s\n", cachePath.c_str(), tablePath.c_str());
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        fprintf(stderr, "RayTraceCorrelator -- WARNING can not map %s, reading %s\n", cachePath.c_str(), tablePath.c_str());
+        return false;
     }
+
+    const RTTableCacheHeader_t *header = (const RTTableCacheHeader_t*) mapping;
+    if(memcmp(header->magic, RT_TABLE_CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != RT_TABLE_CACHE_VERSION
+        || header->headerBytes != sizeof(RTTableCacheHeader_t)
+        || header->stationID != stationID_
+        || header->numAntennas != numAntennas_
+        || header->numThetaBins != numThetaBins_
+        || header->numPhiBins != numPhiBins_
+        || header->solNum != solNum
+        || header->radius != radius_
+        || header->angularSize != angularSize_
+        || header->tableBytes != (long long) tableStat.st_size
+        || header->tableMTime != (long long) tableStat.st_mtime){
+        // e.g. the table was regenerated; it is read again and the cache replaced
+        munmap(mapping, fileBytes);
+        return false;
+    }
+
+    // the three arrays are laid out like one solution of the tables
+    const double *values = (const double*)((const char*) mapping + sizeof(RTTableCacheHeader_t));
+    int offset = GetTableIndex(solNum, 0, 0, 0);
+    memcpy(&arrivalTimes_[offset], values, numEntries * sizeof(double));
+    memcpy(&arrivalThetas_[offset], values + numEntries, numEntries * sizeof(double));
+    memcpy(&arrivalPhis_[offset], values + 2 * numEntries, numEntries * sizeof(double));
+    munmap(mapping, fileBytes);
+    return true;
+}
+
+bool RayTraceCorrelator::WriteTableCache(int solNum, const std::string &tablePath, std::string cachePath){
+
+    if(cachePath.empty()){
+        cachePath = GetTableCachePath(tablePath);
+    }
+    struct stat tableStat;
+    if(cachePath.empty() || stat(tablePath.c_str(), &tableStat) != 0){
+        return false;
+    }
+    if(arrivalTimes_.size() != size_t(2 * numThetaBins_ * numPhiBins_ * numAntennas_)){
+        fprintf(stderr, "RayTraceCorrelator::WriteTableCache -- ERROR the tables are not loaded\n");
+        return false;
+    }
+
+    RTTableCacheHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RT_TABLE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = RT_TABLE_CACHE_VERSION;
+    header.headerBytes = sizeof(RTTableCacheHeader_t);
+    header.stationID = stationID_;
+    header.numAntennas = numAntennas_;
+    header.numThetaBins = numThetaBins_;
+    header.numPhiBins = numPhiBins_;
+    header.solNum = solNum;
+    header.radius = radius_;
+    header.angularSize = angularSize_;
+    header.tableBytes = tableStat.st_size;
+    header.tableMTime = tableStat.st_mtime;
+
+    // write to a temporary file and rename it, so that other jobs never see half a cache
+    size_t numEntries = size_t(numThetaBins_) * numPhiBins_ * numAntennas_;
+    int offset = GetTableIndex(solNum, 0, 0, 0);
+    char tempPath[FILENAME_MAX];
+    snprintf(tempPath, FILENAME_MAX, "%s.tmp%d", cachePath.c_str(), int(getpid()));
+    FILE *outFile = fopen(tempPath, "wb");
+    if(!outFile){
+        fprintf(stderr, "RayTraceCorrelator::WriteTableCache -- WARNING can not open %s\n", tempPath);
+        return false;
+    }
+    bool isOk = (fwrite(&header, sizeof(header), 1, outFile) == 1
+        && fwrite(&arrivalTimes_[offset], sizeof(double), numEntries, outFile) == numEntries
+        && fwrite(&arrivalThetas_[offset], sizeof(double), numEntries, outFile) == numEntries
+        && fwrite(&arrivalPhis_[offset], sizeof(double), numEntries, outFile) == numEntries);
+    if(fclose(outFile) != 0) isOk = false;
+    if(!isOk || rename(tempPath, cachePath.c_str()) != 0){
+        fprintf(stderr, "RayTraceCorrelator::WriteTableCache -- WARNING writing %s failed\n", cachePath.c_str());
+        remove(tempPath);
+        return false;
+    }
+    return true;
 }
 
 void RayTraceCorrelator::LoadArrivalTimeTables(const std::string &filename, int solNum){
     char errorMessage[400];
+
+    // the binary cache holds exactly what the tree below would give
+    std::string cachePath = GetTableCachePath(filename);
+    if(this->LoadTableCache(cachePath, filename, solNum)){
+        return;
+    }
     
     // try to open the file
     TFile * infile = TFile::Open(filename.c_str(), "READ");
@@ -166,13 +319,51 @@ void RayTraceCorrelator::LoadArrivalTimeTables(const std::string &filename, int
     int nEntries = tTree -> GetEntries();
     for (int i = 0; i < nEntries; i++) {
         tTree -> GetEntry(i);
-        arrivalTimes_[solNum][thetaBin][phiBin][ant] = arrivalTime;
-        arrivalThetas_[solNum][thetaBin][phiBin][ant] = arrivalTheta;
-        arrivalPhis_[solNum][thetaBin][phiBin][ant] = arrivalPhi;
+        int index = GetTableIndex(solNum, thetaBin, phiBin, ant);
+        arrivalTimes_[index] = arrivalTime;
+        arrivalThetas_[index] = arrivalTheta;
+        arrivalPhis_[index] = arrivalPhi;
     }
 
     // close up
     infile->Close();
+
+    // and save the tables for next time; the cache is only an optimisation, so failing to write it is not an error
+    if(!cachePath.empty()){
+        this->WriteTableCache(solNum, filename, cachePath);
+    }
+}
+
+void RayTraceCorrelator::SetArrivalTimeTable(int solNum,
+    const std::vector<double> &arrivalTimes,
+    const std::vector<double> &arrivalThetas,
+    const std::vector<double> &arrivalPhis
+    ){
+
+    char errorMessage[400];
+
+    if(solNum < 0 || solNum > 1){
+        sprintf(errorMessage,"Requested solution number (%d) is not supported\n",solNum);
+        throw std::invalid_argument(errorMessage);
+    }
+    size_t numEntries = size_t(numThetaBins_) * numPhiBins_ * numAntennas_;
+    if(arrivalTimes.size() != numEntries || arrivalThetas.size() != numEntries || arrivalPhis.size() != numEntries){
+        sprintf(errorMessage,"Mismatch in size of provided tables (%d, %d, %d) and the binning (%d)\n",
+            (int)arrivalTimes.size(), (int)arrivalThetas.size(), (int)arrivalPhis.size(), (int)numEntries);
+        throw std::invalid_argument(errorMessage);
+    }
+    if(arrivalTimes_.size() != 2 * numEntries){
+        this->ConfigureArrivalVectors();
+    }
+
+    int offset = GetTableIndex(solNum, 0, 0, 0);
+    std::copy(arrivalTimes.begin(), arrivalTimes.end(), arrivalTimes_.begin() + offset);
+    std::copy(arrivalThetas.begin(), arrivalThetas.end(), arrivalThetas_.begin() + offset);
+    std::copy(arrivalPhis.begin(), arrivalPhis.end(), arrivalPhis_.begin() + offset);
+
+    // any pair delays were made from the old tables
+    std::lock_guard<std::mutex> lock(pairDelaysMutex_);
+    pairDelays_.clear();
 }
 
 RayTraceCorrelator::~RayTraceCorrelator()
@@ -197,6 +388,11 @@ RayTraceCorrelator::RayTraceCorrelator(int stationID,
 
 }
 
+void RayTraceCorrelator::SetNumThreads(int numThreads){
+    if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+    numThreads_ = std::max(numThreads, 1);
+}
+
 void RayTraceCorrelator::LoadTables(){
     char errorMessage[400];
     
@@ -253,55 +449,69 @@ std::map< int, std::vector<int> > RayTraceCorrelator::SetupPairs(
 }
 
 std::vector<TGraph*> RayTraceCorrelator::GetCorrFunctions(
-    std::map<int, std::vector<int> > pairs,
-    std::map<int, TGraph*> interpolatedWaveforms,
+    const std::map<int, std::vector<int> > &pairs,
+    const std::map<int, TGraph*> &interpolatedWaveforms,
     bool applyHilbertEnvelope
     ){
 
-    char errorMessage[400];
+    // the correlation functions are computed in an engine
+    // and only turned into graphs for the caller
+    AraCorrelationEngine engine;
+    this->ComputeCorrelations(pairs, interpolatedWaveforms, engine, applyHilbertEnvelope);
 
-    // first, calculate all of the correlation functions
-    // for performance reasons, it's actually better to store
-    // the correlation functions as a vector
     std::vector<TGraph*> corrFunctions;
+    for(int pair = 0; pair < engine.getNumPairs(); pair++){
+        corrFunctions.push_back(engine.makeCorrGraph(pair));
+    }
+    return corrFunctions;
+}
+
+void RayTraceCorrelator::ComputeCorrelations(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::map<int, TGraph*> &interpolatedWaveforms,
+    AraCorrelationEngine &engine,
+    bool applyHilbertEnvelope
+    ){
+
+    char errorMessage[400];
+
+    // give the engine each antenna once, however many pairs it is in
+    engine.clearWaveforms();
+    std::vector<std::pair<Int_t, Int_t> > enginePairs;
     for(auto iter = pairs.begin(); iter != pairs.end(); ++iter){
         int pairNum = iter->first;
-        int ant1 = iter->second[0];
-        int ant2 = iter->second[1];
+        int ants[2] = {iter->second[0], iter->second[1]};
 
         // make sure these antennas are in the waveforms map
-        auto gr1_iter = interpolatedWaveforms.find(ant1);
-        auto gr2_iter = interpolatedWaveforms.find(ant2);
-        if(gr1_iter==interpolatedWaveforms.end()){
-            sprintf(errorMessage,
-                    "Antenna %d in pair %d is not in the supplied waveforms\n",
-                    ant1, pairNum);
-            throw std::invalid_argument(errorMessage);
-        }
-        if(gr2_iter==interpolatedWaveforms.end()){
-            sprintf(errorMessage,
-                    "Antenna %d in pair %d is not in the supplied waveforms\n",
-                    ant2, pairNum);
-            throw std::invalid_argument(errorMessage);
+        for(int i = 0; i < 2; i++){
+            if(engine.hasWaveform(ants[i])) continue;
+            auto gr_iter = interpolatedWaveforms.find(ants[i]);
+            if(gr_iter==interpolatedWaveforms.end()){
+                sprintf(errorMessage,
+                        "Antenna %d in pair %d is not in the supplied waveforms\n",
+                        ants[i], pairNum);
+                throw std::invalid_argument(errorMessage);
+            }
+            engine.setWaveform(ants[i], gr_iter->second);
         }
+        enginePairs.push_back(std::make_pair(ants[0], ants[1]));
+    }
 
-        // get the correlation function
-        TGraph *grCorr = getCorrelationGraph_WFweight(
-            gr1_iter->second, 
-            gr2_iter->second
-            );
-
-        // store the correlation function, with a hilbert envelope applied (if requested)
-        if(applyHilbertEnvelope){
-            TGraph *grCorrHil = FFTtools::getHilbertEnvelope(grCorr);
-            corrFunctions.push_back(grCorrHil);
-            delete grCorr;
-        }
-        else{
-            corrFunctions.push_back(grCorr);
-        }
+    // get the correlation functions, normalised as getCorrelationGraph_WFweight
+    // with a hilbert envelope applied (if requested)
+    if(!engine.correlate(enginePairs, AraCorrelationType::kWaveformWeight, applyHilbertEnvelope)){
+        throw std::runtime_error("Could not compute the correlation functions\n");
     }
-    return corrFunctions;
+}
+
+void RayTraceCorrelator::ComputeCorrelations(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::map<int, TGraph*> &interpolatedWaveforms,
+    RayTraceWorkspace &workspace,
+    bool applyHilbertEnvelope
+    ){
+
+    this->ComputeCorrelations(pairs, interpolatedWaveforms, workspace.engine_, applyHilbertEnvelope);
 }
 
 void RayTraceCorrelator::LookupArrivalAngles(
@@ -309,35 +519,87 @@ void RayTraceCorrelator::LookupArrivalAngles(
     int thetaBin, int phiBin,
     double &arrivalTheta, double &arrivalPhi
 ){
-    arrivalTheta = this->arrivalThetas_[solNum][thetaBin][phiBin][ant];
-    arrivalPhi = this->arrivalPhis_[solNum][thetaBin][phiBin][ant];
+    int index = GetTableIndex(solNum, thetaBin, phiBin, ant);
+    arrivalTheta = this->arrivalThetas_[index];
+    arrivalPhi = this->arrivalPhis_[index];
 }
 
+const float* RayTraceCorrelator::GetPairDelays(int solNum, int ant1, int ant2){
 
-TH2D* RayTraceCorrelator::GetInterferometricMap(
-    std::map<int, std::vector<int> > pairs,
-    std::vector<TGraph*> corrFunctions,
-    int solNum,
-    std::map<int, double> weights
-    ){
+    int key = (solNum * numAntennas_ + ant1) * numAntennas_ + ant2;
+    std::lock_guard<std::mutex> lock(pairDelaysMutex_);
+    auto delays_iter = pairDelays_.find(key);
+    if(delays_iter != pairDelays_.end()){
+        return delays_iter->second.data();
+    }
 
-    char errorMessage[400];
+    // walk the table in its own order, so both antennas are read from the same cache line
+    std::vector<float> &delays = pairDelays_[key];
+    delays.resize(numThetaBins_ * numPhiBins_);
+    for(int thetaBin=0; thetaBin < numThetaBins_; thetaBin++){
+        for(int phiBin=0; phiBin < numPhiBins_; phiBin++){
+            int index = GetTableIndex(solNum, thetaBin, phiBin, 0);
+            double arrival_time1 = arrivalTimes_[index + ant1];
+            double arrival_time2 = arrivalTimes_[index + ant2];
+
+            // no solution for one of the antennas
+            if (arrival_time1 < -100 || arrival_time2 < -100) {
+                delays[thetaBin * numPhiBins_ + phiBin] = NAN;
+            }
+            else{
+                delays[thetaBin * numPhiBins_ + phiBin] = arrival_time1 - arrival_time2;
+            }
+        }
+    }
+    return delays.data();
+}
 
-    // first, sort out the weights to apply to each pair
-    if(weights.size()>0){
-        // if the user provided weights, make sure they provided the right number
-        if(weights.size()!=pairs.size()){
-            sprintf(errorMessage,"Mismatch in size of provided weights (%d) and provided pairs (%d)\n",weights.size(), pairs.size());
-            throw std::invalid_argument(errorMessage);
+// Linear interpolation of an evenly sampled correlation function (point p at x0 + p * dx, with numPoints >= 2 and dx > 0) at dt,
+// as fastEvalForEvenSampling
+static inline double InterpolateCorr(int numPoints, double x0, double dx, const double *yVals, double dt){
+    int p0 = int((dt - x0) / dx);
+    p0 = p0 < 0 ? 0 : p0;
+    p0 = p0 > numPoints - 2 ? numPoints - 2 : p0;
+    return yVals[p0] + (yVals[p0 + 1] - yVals[p0]) * (dt - (x0 + p0 * dx)) / dx;
+}
+
+// Adds scale times the correlation function (sampled evenly, point p at x0 + p * dx, as fastEvalForEvenSampling)
+// at each delay into mapValues, and flags the bins without a delay in noSolution.
+static void AccumulatePairMap(int numBins, const float *delays,
+    int numPoints, double x0, double dx, const double *yVals, double scale,
+    float *mapValues, unsigned char *noSolution
+    ){
+
+    if (numPoints < 2 || dx <= 0) {
+        // fastEvalForEvenSampling gives 0 for such a graph
+        for(int bin=0; bin < numBins; bin++){
+            noSolution[bin] |= (delays[bin] != delays[bin]);
         }
+        return;
     }
-    else{
-        // otherwise, assume the user wanted equal weighting; which means 1/num_pairs
-        for(auto iter = pairs.begin(); iter != pairs.end(); ++iter){
-            int pairNum = iter->first;
-            weights[pairNum] = 1./double(pairs.size());
+
+    for(int bin=0; bin < numBins; bin++){
+        double dt = delays[bin];
+        bool hasSolution = (dt == dt);
+        noSolution[bin] |= !hasSolution;
+        if(!hasSolution) dt = x0;
+
+        double corrVal = InterpolateCorr(numPoints, x0, dx, yVals, dt) * scale;
+        if (hasSolution && corrVal == corrVal){ // not a nan
+            mapValues[bin] += corrVal;
         }
     }
+}
+
+
+TH2D* RayTraceCorrelator::GetInterferometricMap(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::vector<TGraph*> &corrFunctions,
+    int solNum,
+    std::map<int, double> weights
+    ){
+
+    char errorMessage[400];
 
     // make sure number of pairs agrees with size of corrFunctions
     if(pairs.size()!=corrFunctions.size()){
@@ -345,59 +607,337 @@ TH2D* RayTraceCorrelator::GetInterferometricMap(
         throw std::invalid_argument(errorMessage);
     }
 
-    // create output histogram
-    TH2D *histMap = new TH2D("", "", 
-        this->numPhiBins_, -180, 180, 
-        this->numThetaBins_, -90, 90
-    );
+    // the graphs are evenly sampled, so only their first two points are needed
+    std::vector<CorrSamples> corrSamples(corrFunctions.size());
+    for(size_t pair = 0; pair < corrFunctions.size(); pair++){
+        TGraph *corrFunction = corrFunctions[pair];
+        CorrSamples &samples = corrSamples[pair];
+        samples.numPoints = corrFunction->GetN();
+        samples.firstLag = samples.numPoints > 0 ? corrFunction->GetX()[0] : 0;
+        samples.deltaLag = samples.numPoints > 1 ? corrFunction->GetX()[1] - corrFunction->GetX()[0] : 0;
+        samples.values = corrFunction->GetY();
+    }
+    return this->MakeInterferometricMap(pairs, corrSamples, solNum, weights);
+}
 
-    // now, make the map
+TH2D* RayTraceCorrelator::GetInterferometricMap(
+    const std::map<int, std::vector<int> > &pairs,
+    const AraCorrelationEngine &engine,
+    int solNum,
+    std::map<int, double> weights
+    ){
+
+    char errorMessage[400];
+
+    // make sure number of pairs agrees with the pairs in the engine
+    if((int)pairs.size()!=engine.getNumPairs()){
+        sprintf(errorMessage,"Mismatch in number of engine corr functions (%d) and provided pairs (%d)\n",engine.getNumPairs(), (int)pairs.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    std::vector<CorrSamples> corrSamples(engine.getNumPairs());
+    for(int pair = 0; pair < engine.getNumPairs(); pair++){
+        CorrSamples &samples = corrSamples[pair];
+        samples.numPoints = engine.getCorrLength(pair);
+        samples.firstLag = engine.getCorrFirstLag(pair);
+        samples.deltaLag = engine.getCorrDeltaT(pair);
+        samples.values = engine.getCorrValues(pair);
+    }
+    return this->MakeInterferometricMap(pairs, corrSamples, solNum, weights);
+}
+
+void RayTraceCorrelator::SetupPairTerms(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::vector<CorrSamples> &corrSamples,
+    int solNum,
+    const std::map<int, double> &weights,
+    std::vector<PairTerm> &pairTerms
+    ){
+
+    char errorMessage[400];
+
+    // first, sort out the weights to apply to each pair
+    // if the user provided weights, make sure they provided the right number
+    if(weights.size()>0 && weights.size()!=pairs.size()){
+        sprintf(errorMessage,"Mismatch in size of provided weights (%d) and provided pairs (%d)\n",(int)weights.size(), (int)pairs.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    pairTerms.clear();
     for(auto iter = pairs.begin(); iter != pairs.end(); ++iter){
         int pairNum = iter->first;
         int ant1 = iter->second[0];
         int ant2 = iter->second[1];
 
-        // get the weight for this pair
-        auto weight_iter = weights.find(pairNum);
-        if(weight_iter==weights.end()){
-            sprintf(errorMessage,"Weights for pair %d not found\n",pairNum);
-            throw std::invalid_argument(errorMessage);
+        PairTerm term;
+        if(weights.empty()){
+            // otherwise, assume the user wanted equal weighting; which means 1/num_pairs
+            term.scale = 1./double(pairs.size());
         }
-        double scale = weight_iter->second;
-
-        for(int phiBin=0; phiBin < this->numPhiBins_; phiBin++){
-            for(int thetaBin=0; thetaBin < this->numThetaBins_; thetaBin++){
-                
-                int globalBin = (phiBin + 1) + (thetaBin + 1) * (this->numPhiBins_ + 2);
-                double arrival_time1 = this->arrivalTimes_[solNum][thetaBin][phiBin][ant1];
-                double arrival_time2 = this->arrivalTimes_[solNum][thetaBin][phiBin][ant2];
-                double dt = arrival_time1 - arrival_time2;
-
-                // sanity check
-                if (arrival_time1 < -100 || arrival_time2 < -100 || histMap -> GetBinContent(globalBin) == -1000) {
-                    histMap -> SetBinContent(globalBin, -1000);
-                }
-                else{
-                    double corrVal = fastEvalForEvenSampling(corrFunctions[pairNum], dt);
-                    corrVal *= scale;
-                    double binVal = histMap -> GetBinContent(globalBin);
-                    if (corrVal == corrVal){ // not a nan
-                        histMap -> SetBinContent(globalBin, binVal + corrVal);
-                    }
-                }
+        else{
+            // get the weight for this pair
+            auto weight_iter = weights.find(pairNum);
+            if(weight_iter==weights.end()){
+                sprintf(errorMessage,"Weights for pair %d not found\n",pairNum);
+                throw std::invalid_argument(errorMessage);
             }
+            term.scale = weight_iter->second;
         }
+        term.delays = this->GetPairDelays(solNum, ant1, ant2);
+        term.samples = &corrSamples[pairNum];
+        pairTerms.push_back(term);
     }
+}
+
+TH2D* RayTraceCorrelator::MakeInterferometricMap(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::vector<CorrSamples> &corrSamples,
+    int solNum,
+    const std::map<int, double> &weights
+    ){
 
-    // bit of sanity checking
-    for (int phiBin = 0; phiBin < this->numPhiBins_; phiBin++) {
-        for (int thetaBin = 0; thetaBin < this->numThetaBins_; thetaBin++) {
+    // now, make the map
+    // it is summed in a plain buffer laid out like the pair delays (theta bins outer, phi bins inner)
+    // and only copied into a histogram at the end
+    int numBins = this->numThetaBins_ * this->numPhiBins_;
+    std::vector<float> mapValues(numBins, 0.);
+    std::vector<unsigned char> noSolution(numBins, 0);
+
+    // look up everything each pair needs before any tile is summed,
+    // so the threads only read the delays and correlation functions
+    std::vector<PairTerm> pairTerms;
+    this->SetupPairTerms(pairs, corrSamples, solNum, weights, pairTerms);
+    this->SumInterferometricMap(pairTerms, mapValues.data(), noSolution.data());
+
+    // create output histogram
+    // bins without a solution for one of the antennas in any pair are left at zero
+    TH2D *histMap = new TH2D("", "", 
+        this->numPhiBins_, -180, 180, 
+        this->numThetaBins_, -90, 90
+    );
+    for (int thetaBin = 0; thetaBin < this->numThetaBins_; thetaBin++) {
+        for (int phiBin = 0; phiBin < this->numPhiBins_; phiBin++) {
+            int bin = thetaBin * this->numPhiBins_ + phiBin;
+            if (noSolution[bin]) continue;
             Int_t globalBin = (phiBin + 1) + (thetaBin + 1) * (this->numPhiBins_ + 2);
-            if (histMap -> GetBinContent(globalBin) == -1000) {
-                histMap -> SetBinContent(globalBin, 0);
-            }
+            histMap -> SetBinContent(globalBin, mapValues[bin]);
         }
     }
 
     return histMap;
-}
\ No newline at end of file
+}
+
+void RayTraceCorrelator::SumInterferometricMap(
+    const std::vector<PairTerm> &pairTerms,
+    float *mapValues,
+    unsigned char *noSolution
+    ){
+
+    // each tile adds the pairs in the same order, so the sums do not depend on the number of tiles
+    int numBins = this->numThetaBins_ * this->numPhiBins_;
+    auto sumTile = [&](int firstBin, int lastBin){
+        for(size_t pair = 0; pair < pairTerms.size(); pair++){
+            const CorrSamples &samples = *pairTerms[pair].samples;
+            AccumulatePairMap(lastBin - firstBin, pairTerms[pair].delays + firstBin,
+                samples.numPoints, samples.firstLag, samples.deltaLag, samples.values, pairTerms[pair].scale,
+                mapValues + firstBin, noSolution + firstBin
+            );
+        }
+    };
+    int numTiles = std::min(this->numThreads_, numBins);
+    if(numTiles <= 1){
+        sumTile(0, numBins);
+    }
+    else{
+        std::vector<std::thread> threads;
+        for(int tile = 0; tile < numTiles; tile++){
+            threads.push_back(std::thread(sumTile,
+                int((long long)numBins * tile / numTiles),
+                int((long long)numBins * (tile + 1) / numTiles)
+            ));
+        }
+        for(size_t i = 0; i < threads.size(); i++){
+            threads[i].join();
+        }
+    }
+}
+
+void RayTraceCorrelator::FillInterferometricMap(
+    const std::map<int, std::vector<int> > &pairs,
+    RayTraceWorkspace &workspace,
+    int solNum,
+    const std::map<int, double> &weights
+    ){
+
+    char errorMessage[400];
+
+    const AraCorrelationEngine &engine = workspace.engine_;
+    if((int)pairs.size()!=engine.getNumPairs()){
+        sprintf(errorMessage,"Mismatch in number of engine corr functions (%d) and provided pairs (%d)\n",engine.getNumPairs(), (int)pairs.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    // the buffers of the workspace keep their memory, so only the first event allocates
+    workspace.corrSamples_.resize(engine.getNumPairs());
+    for(int pair = 0; pair < engine.getNumPairs(); pair++){
+        CorrSamples &samples = workspace.corrSamples_[pair];
+        samples.numPoints = engine.getCorrLength(pair);
+        samples.firstLag = engine.getCorrFirstLag(pair);
+        samples.deltaLag = engine.getCorrDeltaT(pair);
+        samples.values = engine.getCorrValues(pair);
+    }
+    this->SetupPairTerms(pairs, workspace.corrSamples_, solNum, weights, workspace.pairTerms_);
+
+    workspace.ResizeMap(this->numPhiBins_, this->numThetaBins_);
+    workspace.solNum_ = solNum;
+    this->SumInterferometricMap(workspace.pairTerms_, workspace.mapValues_.data(), workspace.noSolution_.data());
+}
+
+// The map value of one bin, summed as AccumulatePairMap sums it; false if one of the pairs has no solution there
+bool RayTraceCorrelator::EvaluateBin(const std::vector<PairTerm> &pairTerms, int bin, float &value){
+    value = 0;
+    for(size_t pair = 0; pair < pairTerms.size(); pair++){
+        double dt = pairTerms[pair].delays[bin];
+        if(dt != dt) return false;
+        const CorrSamples &samples = *pairTerms[pair].samples;
+        if(samples.numPoints < 2 || samples.deltaLag <= 0) continue;
+        double corrVal = InterpolateCorr(samples.numPoints, samples.firstLag, samples.deltaLag, samples.values, dt) * pairTerms[pair].scale;
+        if(corrVal == corrVal){ // not a nan
+            value += corrVal;
+        }
+    }
+    return true;
+}
+
+double RayTraceCorrelator::FindPeak(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::vector<TGraph*> &corrFunctions,
+    double &peakTheta, double &peakPhi, int &peakSolNum,
+    std::vector<int> solNums,
+    std::map<int, double> weights,
+    int coarseStep, int numCandidates
+    ){
+
+    char errorMessage[400];
+
+    if(pairs.size()!=corrFunctions.size()){
+        sprintf(errorMessage,"Mismatch in size of provided corr functions (%d) and provided pairs (%d)\n",(int)corrFunctions.size(), (int)pairs.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    std::vector<CorrSamples> corrSamples(corrFunctions.size());
+    for(size_t pair = 0; pair < corrFunctions.size(); pair++){
+        TGraph *corrFunction = corrFunctions[pair];
+        CorrSamples &samples = corrSamples[pair];
+        samples.numPoints = corrFunction->GetN();
+        samples.firstLag = samples.numPoints > 0 ? corrFunction->GetX()[0] : 0;
+        samples.deltaLag = samples.numPoints > 1 ? corrFunction->GetX()[1] - corrFunction->GetX()[0] : 0;
+        samples.values = corrFunction->GetY();
+    }
+    return this->FindPeakOfSamples(pairs, corrSamples, peakTheta, peakPhi, peakSolNum, solNums, weights, coarseStep, numCandidates);
+}
+
+double RayTraceCorrelator::FindPeak(
+    const std::map<int, std::vector<int> > &pairs,
+    const AraCorrelationEngine &engine,
+    double &peakTheta, double &peakPhi, int &peakSolNum,
+    std::vector<int> solNums,
+    std::map<int, double> weights,
+    int coarseStep, int numCandidates
+    ){
+
+    char errorMessage[400];
+
+    if((int)pairs.size()!=engine.getNumPairs()){
+        sprintf(errorMessage,"Mismatch in number of engine corr functions (%d) and provided pairs (%d)\n",engine.getNumPairs(), (int)pairs.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    std::vector<CorrSamples> corrSamples(engine.getNumPairs());
+    for(int pair = 0; pair < engine.getNumPairs(); pair++){
+        CorrSamples &samples = corrSamples[pair];
+        samples.numPoints = engine.getCorrLength(pair);
+        samples.firstLag = engine.getCorrFirstLag(pair);
+        samples.deltaLag = engine.getCorrDeltaT(pair);
+        samples.values = engine.getCorrValues(pair);
+    }
+    return this->FindPeakOfSamples(pairs, corrSamples, peakTheta, peakPhi, peakSolNum, solNums, weights, coarseStep, numCandidates);
+}
+
+double RayTraceCorrelator::FindPeakOfSamples(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::vector<CorrSamples> &corrSamples,
+    double &peakTheta, double &peakPhi, int &peakSolNum,
+    const std::vector<int> &solNums,
+    const std::map<int, double> &weights,
+    int coarseStep, int numCandidates
+    ){
+
+    char errorMessage[400];
+
+    if(coarseStep < 1) coarseStep = 1;
+    if(numCandidates < 1) numCandidates = 1;
+
+    // a candidate (or the peak) is a bin of one solution and its value
+    struct Candidate {
+        float value;
+        int solNum;
+        int thetaBin;
+        int phiBin;
+        bool operator<(const Candidate &other) const { return value > other.value; } // best first
+    };
+
+    // first pass: every coarseStep'th bin in theta and phi, of every solution
+    std::vector< std::vector<PairTerm> > solPairTerms(solNums.size());
+    std::vector<Candidate> candidates;
+    for(size_t sol = 0; sol < solNums.size(); sol++){
+        if(solNums[sol] < 0 || solNums[sol] > 1){
+            sprintf(errorMessage,"Requested solution number (%d) is not supported\n",solNums[sol]);
+            throw std::invalid_argument(errorMessage);
+        }
+        this->SetupPairTerms(pairs, corrSamples, solNums[sol], weights, solPairTerms[sol]);
+        for(int thetaBin = coarseStep / 2; thetaBin < this->numThetaBins_; thetaBin += coarseStep){
+            for(int phiBin = coarseStep / 2; phiBin < this->numPhiBins_; phiBin += coarseStep){
+                Candidate candidate;
+                if(!EvaluateBin(solPairTerms[sol], thetaBin * this->numPhiBins_ + phiBin, candidate.value)) continue;
+                candidate.solNum = int(sol);
+                candidate.thetaBin = thetaBin;
+                candidate.phiBin = phiBin;
+                candidates.push_back(candidate);
+            }
+        }
+    }
+    if(candidates.empty()){
+        throw std::runtime_error("No bin of the coarse grid has a solution for every pair\n");
+    }
+    int numRefined = std::min(numCandidates, int(candidates.size()));
+    std::partial_sort(candidates.begin(), candidates.begin() + numRefined, candidates.end());
+
+    // second pass: every bin within coarseStep of the best candidates, at full resolution
+    // (phi wraps around, theta does not)
+    Candidate peak = candidates[0];
+    for(int i = 0; i < numRefined; i++){
+        const Candidate &candidate = candidates[i];
+        int firstTheta = std::max(candidate.thetaBin - coarseStep, 0);
+        int lastTheta = std::min(candidate.thetaBin + coarseStep, this->numThetaBins_ - 1);
+        int numPhi = std::min(2 * coarseStep + 1, this->numPhiBins_);
+        for(int thetaBin = firstTheta; thetaBin <= lastTheta; thetaBin++){
+            for(int j = 0; j < numPhi; j++){
+                int phiBin = ((candidate.phiBin - coarseStep + j) % this->numPhiBins_ + this->numPhiBins_) % this->numPhiBins_;
+                float value;
+                if(!EvaluateBin(solPairTerms[candidate.solNum], thetaBin * this->numPhiBins_ + phiBin, value)) continue;
+                if(value > peak.value){
+                    peak.value = value;
+                    peak.solNum = candidate.solNum;
+                    peak.thetaBin = thetaBin;
+                    peak.phiBin = phiBin;
+                }
+            }
+        }
+    }
+
+    peakTheta = this->thetaAngles_[peak.thetaBin] * TMath::RadToDeg();
+    peakPhi = this->phiAngles_[peak.phiBin] * TMath::RadToDeg();
+    peakSolNum = solNums[peak.solNum];
+    return peak.value;
+}
@@ -2,13 +2,20 @@
 #define RAYTRACECORRELATOR_H
 
 #include <map>
+#include <mutex>
+#include <vector>
+#include "AraAntennaInfo.h"
 class TGraph;
 class TH2D;
 class AraGeomTool;
+class AraCorrelationEngine;
+class RayTraceWorkspace;
 
 class RayTraceCorrelator : public TObject
 {
 
+    friend class RayTraceWorkspace; ///< keeps buffers of the pair types below between events
+
     private:
         int stationID_;                  ///< Station ID for this correlator instance
         double radius_;                  ///< Radial distance from the center of gravity
@@ -30,19 +37,74 @@ class RayTraceCorrelator : public TObject
         void SetAngularConfig(double angularSize);
         void SetTablePaths(const std::string &dirPath, const std::string &refPath);
 
-        // a high-dimensional vector to store the arrival times at antennas
+        // the arrival times at the antennas, stored flat
         // first index is direct/reflected
         // second index is theta bins
         // third index is phi bins
         // fourth index is number of antennas
-        std::vector < std::vector < std::vector < std::vector < double > > > > arrivalTimes_;
+        // (see GetTableIndex)
+        std::vector<double> arrivalTimes_;
 
         // same dimensions and explanations, just for theta and phi
-        std::vector < std::vector < std::vector < std::vector < double > > > > arrivalThetas_;
-        std::vector < std::vector < std::vector < std::vector < double > > > > arrivalPhis_;
+        std::vector<double> arrivalThetas_;
+        std::vector<double> arrivalPhis_;
+
+        //! index of [solNum][thetaBin][phiBin][ant] in arrivalTimes_, arrivalThetas_ and arrivalPhis_
+        int GetTableIndex(int solNum, int thetaBin, int phiBin, int ant) const {
+            return ((solNum * numThetaBins_ + thetaBin) * numPhiBins_ + phiBin) * numAntennas_ + ant;
+        }
+
+        // the arrival time differences of each pair that has been asked for, built on first use
+        // keyed by (solNum * numAntennas_ + ant1) * numAntennas_ + ant2 (see GetPairDelays)
+        std::map<int, std::vector<float> > pairDelays_; //!
+        std::mutex pairDelaysMutex_; //! guards pairDelays_
+
+        int numThreads_ = 1;             ///< Number of threads GetInterferometricMap sums the sky tiles in
 
-        
         void ConfigureArrivalVectors(); ///< Function to set the dimensions of arrivalTimes_, arrivalThetas_, etc. correctly
+        bool LoadTableCache(const std::string &cachePath, const std::string &tablePath, int solNum); ///< Function to fill one solution of the tables from a binary cache, returns false if there is no usable cache
+
+        // an evenly sampled correlation function, point p being at lag firstLag + p * deltaLag
+        struct CorrSamples {
+            int numPoints;
+            double firstLag;
+            double deltaLag;
+            const double *values;
+        };
+
+        // what a pair adds to the map: its delays, correlation function and weight
+        struct PairTerm {
+            const float *delays;
+            const CorrSamples *samples;
+            double scale;
+        };
+        void SetupPairTerms(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::vector<CorrSamples> &corrSamples,
+            int solNum,
+            const std::map<int, double> &weights,
+            std::vector<PairTerm> &pairTerms
+        ); ///< Function to check the weights (default 1/pairs.size()) and look up the delays of each pair
+        static bool EvaluateBin(const std::vector<PairTerm> &pairTerms, int bin, float &value); ///< Function to sum one bin of a map, returns false if a pair has no solution in it
+        void SumInterferometricMap(
+            const std::vector<PairTerm> &pairTerms,
+            float *mapValues,
+            unsigned char *noSolution
+        ); ///< Function to add every pair into a zeroed map buffer, in numThreads_ tiles
+        TH2D* MakeInterferometricMap(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::vector<CorrSamples> &corrSamples,
+            int solNum,
+            const std::map<int, double> &weights
+        ); ///< Function to sum the map of either GetInterferometricMap
+        double FindPeakOfSamples(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::vector<CorrSamples> &corrSamples,
+            double &peakTheta, double &peakPhi, int &peakSolNum,
+            const std::vector<int> &solNums,
+            const std::map<int, double> &weights,
+            int coarseStep, int numCandidates
+        ); ///< Function to search the peak for either FindPeak
 
     public:
 
@@ -57,10 +119,64 @@ class RayTraceCorrelator : public TObject
         std::vector<double> GetThetaAngles(){ return thetaAngles_; }
 
 
+        //! function to set the number of threads the maps are made with
+        /*!
+            The sky is split into one tile of bins per thread, and each thread adds every pair into its own tile,
+            reading the pair delays and correlation functions shared by all of them. The map is the same whatever the number of threads
+            \param numThreads number of threads; 0 = one per core, default = 1
+            \return void
+        */
+        void SetNumThreads(int numThreads);
+        int GetNumThreads(){ return numThreads_; }
+
+
         //! function to load the arrival time tables
+        /*!
+            The tables are read from the binary cache (see GetTableCachePath) if there is an up-to-date one,
+            otherwise from the tArrivalTimes tree in filename, after which the cache is written for next time
+            \param filename path to the ROOT file holding the tables
+            \param solNum which solution number (0 = direct, 1 = reflected/refracted) the file holds
+            \return void
+        */
         void LoadArrivalTimeTables(const std::string &filename, int solNum);
 
 
+        //! function to set the arrival information of one solution, e.g. from a table generator
+        /*!
+            The tables of the other solution are kept; both are zero until loaded or set
+            \param solNum which solution number (0 = direct, 1 = reflected/refracted)
+            \param arrivalTimes the arrival times, indexed [thetaBin][phiBin][ant] (GetNumThetaBins() * GetNumPhiBins() * GetNumAntennas() values)
+            \param arrivalThetas the arrival thetas, indexed the same way
+            \param arrivalPhis the arrival phis, indexed the same way
+            \return void
+        */
+        void SetArrivalTimeTable(int solNum,
+            const std::vector<double> &arrivalTimes,
+            const std::vector<double> &arrivalThetas,
+            const std::vector<double> &arrivalPhis
+        );
+
+
+        //! function to get the path of the binary cache of a table file
+        /*!
+            The cache is the table file with .root replaced by .bin, or a file of that name in $ARA_RT_TABLE_CACHE_DIR if it is set.
+            Setting ARA_RT_TABLE_NO_CACHE turns the cache off
+            \param tablePath path to the ROOT file holding the tables
+            \return path to the cache file, or an empty string if the cache is turned off
+        */
+        static std::string GetTableCachePath(const std::string &tablePath);
+
+
+        //! function to write the loaded tables of one solution to a binary cache
+        /*!
+            \param solNum which solution number (0 = direct, 1 = reflected/refracted)
+            \param tablePath path to the ROOT file the tables were loaded from, the cache is only used while that file is unchanged
+            \param cachePath where to write the cache (default: GetTableCachePath(tablePath))
+            \return true if the cache was written
+        */
+        bool WriteTableCache(int solNum, const std::string &tablePath, std::string cachePath = "");
+
+
         //! constructor for the RayTraceCorrelator
         /*!
             \param stationID ID of the station
@@ -95,8 +211,42 @@ class RayTraceCorrelator : public TObject
             \return a std::vector of the correlation functions (one for each pair)
         */
         std::vector<TGraph*> GetCorrFunctions(
-            std::map<int, std::vector<int> > pairs,
-            std::map<int, TGraph*> interpolatedWaveforms,
+            const std::map<int, std::vector<int> > &pairs,
+            const std::map<int, TGraph*> &interpolatedWaveforms,
+            bool applyHilbertEnvelope = true
+        );
+
+
+        //! function to compute the correlation functions in an AraCorrelationEngine, without making graphs
+        /*!
+            Each waveform is transformed once however many pairs it is in, and the engine keeps its buffers for the next event
+            \param pairs a std::map of pair indices to antenna indices
+            \param interpolatedWaveforms a std::map of antenna indices to interpolated waveforms
+            \param engine the engine to correlate in, its pairs are in the order of pairs
+            \param applyHilbertEnvelope whether or not to apply hilbert enveloping to the correlation functions
+            \return void
+        */
+        void ComputeCorrelations(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::map<int, TGraph*> &interpolatedWaveforms,
+            AraCorrelationEngine &engine,
+            bool applyHilbertEnvelope = true
+        );
+
+
+        //! function to compute the correlation functions into a workspace
+        /*!
+            As ComputeCorrelations with an engine, using the engine of the workspace
+            \param pairs a std::map of pair indices to antenna indices
+            \param interpolatedWaveforms a std::map of antenna indices to interpolated waveforms
+            \param workspace the workspace to correlate in
+            \param applyHilbertEnvelope whether or not to apply hilbert enveloping to the correlation functions
+            \return void
+        */
+        void ComputeCorrelations(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::map<int, TGraph*> &interpolatedWaveforms,
+            RayTraceWorkspace &workspace,
             bool applyHilbertEnvelope = true
         );
 
@@ -131,6 +281,17 @@ class RayTraceCorrelator : public TObject
         );
 
 
+        //! function to get the arrival time differences of a pair over the whole sky
+        /*!
+            The delays are computed from the arrival time tables the first time a pair is asked for, and kept until the tables are reloaded
+            \param solNum which solution number (0 = direct, 1 = reflected/refracted)
+            \param ant1 first antenna of the pair
+            \param ant2 second antenna of the pair
+            \return arrival time at ant1 minus arrival time at ant2 (ns) for every sky bin, indexed thetaBin * GetNumPhiBins() + phiBin; NaN where either antenna has no solution
+        */
+        const float* GetPairDelays(int solNum, int ant1, int ant2);
+
+
         //! function to get an interferometric map
         /*!
             \param pairs a std::map of antenna pairs
@@ -140,13 +301,98 @@ class RayTraceCorrelator : public TObject
             \return a 2D histogram with the values filled with the interferometric sums
         */
         TH2D* GetInterferometricMap(
-            std::map<int, std::vector<int> > pairs,
-            std::vector<TGraph*> corrFunctions,
+            const std::map<int, std::vector<int> > &pairs,
+            const std::vector<TGraph*> &corrFunctions,
             int solNum,
             std::map<int, double> weights = {}
         );
 
 
+        //! function to get an interferometric map from the correlation functions in an engine
+        /*!
+            \param pairs a std::map of antenna pairs
+            \param engine an engine filled by ComputeCorrelations with the same pairs
+            \param solNum whether to have the first or second (0 or 1) solution hypothesis
+            \param weights weights to apply to each map; default = equal weights, or 1/pairs.size()
+            \return a 2D histogram with the values filled with the interferometric sums
+        */
+        TH2D* GetInterferometricMap(
+            const std::map<int, std::vector<int> > &pairs,
+            const AraCorrelationEngine &engine,
+            int solNum,
+            std::map<int, double> weights = {}
+        );
+
+
+        //! function to fill the interferometric map of a workspace in place
+        /*!
+            The map has the same values as GetInterferometricMap, but is summed into the map buffer of the workspace
+            instead of a new histogram (see RayTraceWorkspace::FillHistogram to get one)
+            \param pairs a std::map of antenna pairs
+            \param workspace a workspace filled by ComputeCorrelations with the same pairs
+            \param solNum whether to have the first or second (0 or 1) solution hypothesis
+            \param weights weights to apply to each map; default = equal weights, or 1/pairs.size()
+            \return void
+        */
+        void FillInterferometricMap(
+            const std::map<int, std::vector<int> > &pairs,
+            RayTraceWorkspace &workspace,
+            int solNum,
+            const std::map<int, double> &weights = {}
+        );
+
+
+        //! function to find the peak of an interferometric map without making the map
+        /*!
+            The map of each solution is first evaluated on a coarse grid (every coarseStep'th bin in theta and phi).
+            Every bin within coarseStep bins of the numCandidates best coarse bins is then evaluated at the full angular resolution.
+            The value of a bin is the same as in GetInterferometricMap; bins where a pair has no solution are never the peak.
+            A peak narrower than about coarseStep bins can be missed if it falls between the coarse bins of the best candidates
+            \param pairs a std::map of antenna pairs
+            \param corrFunctions a std::vector of correlation functions, one for each pair in pairs (in that order!)
+            \param peakTheta passed by reference, replaced by the theta angle (degrees) of the peak bin center
+            \param peakPhi passed by reference, replaced by the phi angle (degrees) of the peak bin center
+            \param peakSolNum passed by reference, replaced by the solution number of the peak
+            \param solNums the solutions to search; default = both
+            \param weights weights to apply to each map; default = equal weights, or 1/pairs.size()
+            \param coarseStep the coarse grid spacing in bins; 1 = search every bin
+            \param numCandidates number of coarse bins refined at full resolution
+            \return the map value at the peak
+        */
+        double FindPeak(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::vector<TGraph*> &corrFunctions,
+            double &peakTheta, double &peakPhi, int &peakSolNum,
+            std::vector<int> solNums = {0, 1},
+            std::map<int, double> weights = {},
+            int coarseStep = 4, int numCandidates = 5
+        );
+
+
+        //! function to find the peak of an interferometric map from the correlation functions in an engine, without making the map
+        /*!
+            As FindPeak with correlation functions
+            \param pairs a std::map of antenna pairs
+            \param engine an engine filled by ComputeCorrelations with the same pairs
+            \param peakTheta passed by reference, replaced by the theta angle (degrees) of the peak bin center
+            \param peakPhi passed by reference, replaced by the phi angle (degrees) of the peak bin center
+            \param peakSolNum passed by reference, replaced by the solution number of the peak
+            \param solNums the solutions to search; default = both
+            \param weights weights to apply to each map; default = equal weights, or 1/pairs.size()
+            \param coarseStep the coarse grid spacing in bins; 1 = search every bin
+            \param numCandidates number of coarse bins refined at full resolution
+            \return the map value at the peak
+        */
+        double FindPeak(
+            const std::map<int, std::vector<int> > &pairs,
+            const AraCorrelationEngine &engine,
+            double &peakTheta, double &peakPhi, int &peakSolNum,
+            std::vector<int> solNums = {0, 1},
+            std::map<int, double> weights = {},
+            int coarseStep = 4, int numCandidates = 5
+        );
+
+
         //! a function to return the pairs to be used in the interferometery
         /*!
             \param stationID an ARA station ID
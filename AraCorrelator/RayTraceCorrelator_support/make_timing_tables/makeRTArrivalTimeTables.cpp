@@ -1,5 +1,11 @@
 #include <iostream>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 // ROOT Includes
 #include "TFile.h"
@@ -20,8 +26,39 @@
 #include "RaySolver.h"
 #include "Settings.h"
 
+#define RT_PARTIAL_MAGIC "ARARTPRT"
+
+// Header of a partial table file
+// It is followed by one record per finished theta strip: the theta bin (an int), then the arrival times, thetas and phis
+// of the strip, each as numPhiBins * numAntennas doubles indexed [phiBin][ant]
+typedef struct {
+    char magic[8];          ///< RT_PARTIAL_MAGIC
+    int stationID;          ///< Station of the tables
+    int numAntennas;        ///< Number of antennas in the tables
+    int numThetaBins;       ///< Number of theta bins in the tables
+    int numPhiBins;         ///< Number of phi bins in the tables
+    int solNum;             ///< Solution number of the tables
+    int reserved;           ///< Padding, zero
+    double radius;          ///< Radius of the tables
+    double angularSize;     ///< Angular binning of the tables
+} RTPartialHeader_t;
+
+// The tables of one solution, laid out as RayTraceCorrelator holds them, [thetaBin][phiBin][ant]
+struct ArrivalTables {
+    std::vector<double> arrivalTimes;
+    std::vector<double> arrivalThetas;
+    std::vector<double> arrivalPhis;
+    std::vector<char> stripDone; ///< whether each theta strip has been solved
+};
+
 std::map<int, Position> GetAntLocationsInEarthCoords(int station, IceModel *iceModel);
-void CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir);
+std::string GetTablePath(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir);
+std::vector<std::string> FindPartialFiles(const std::string &tablePath);
+void MakePartialHeader(RayTraceCorrelator *theCorrelator, int solNum, RTPartialHeader_t &header);
+int LoadPartialTables(RayTraceCorrelator *theCorrelator, int solNum, const std::string &tablePath, ArrivalTables &tables);
+bool CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir,
+    int numThreads, int firstThetaBin, int lastThetaBin);
+void WriteTables(RayTraceCorrelator *theCorrelator, int solNum, const std::string &tablePath, const ArrivalTables &tables);
 Position CalculateStationCOG(std::map<int, Position> antennaLocations);
 void CalculateArrivalInformation(
     RaySolver *raySolver,
@@ -36,8 +73,10 @@ int main(int argc, char **argv)
 {
     
     if(argc<4) {
-        std::cout << "Usage\n" << argv[0] << " <station> <radius> <output location>\n";
+        std::cout << "Usage\n" << argv[0] << " <station> <radius> <output location> [threads] [first theta bin] [last theta bin]\n";
         std::cout << "e.g.\n" << argv[0] << " 2 300 /path/to/my/home/dir \n";
+        std::cout << "threads: number of threads, 0 = one per core (default 1)\n";
+        std::cout << "first/last theta bin: only solve theta bins first to last-1 (default all)\n";
         return 0;
     }
 
@@ -55,24 +94,283 @@ int main(int argc, char **argv)
         radius, angular_size, tempFileName, tempFileName
     );
 
-    CalculateTables(theCorrelator, 0, iceModelidx, argv[3]);
-    CalculateTables(theCorrelator, 1, iceModelidx, argv[3]);
+    int numThreads = argc > 4 ? atoi(argv[4]) : 1;
+    if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+    numThreads = std::max(numThreads, 1);
+    int firstThetaBin = argc > 6 ? atoi(argv[5]) : 0;
+    int lastThetaBin = argc > 6 ? atoi(argv[6]) : theCorrelator->GetNumThetaBins();
+    firstThetaBin = std::max(firstThetaBin, 0);
+    lastThetaBin = std::min(lastThetaBin, theCorrelator->GetNumThetaBins());
+
+    bool dirDone = CalculateTables(theCorrelator, 0, iceModelidx, argv[3], numThreads, firstThetaBin, lastThetaBin);
+    bool refDone = CalculateTables(theCorrelator, 1, iceModelidx, argv[3], numThreads, firstThetaBin, lastThetaBin);
+    if(!dirDone || !refDone){
+        printf("Theta bins %d to %d are done; run again (e.g. without a theta range) once every range has been solved to write the tables\n",
+            firstThetaBin, lastThetaBin - 1);
+    }
+    delete theCorrelator;
 
 }
 
-void CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir){
+std::string GetTablePath(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir){
 
     char fileName[500];
     sprintf(fileName, "%s/arrivaltimes_station_%d_icemodel_%d_radius_%.2f_angle_%.2f_solution_%d.root",
         tableDir.c_str(), theCorrelator->GetStationID(), iceModelidx,
         theCorrelator->GetRadius(), theCorrelator->GetAngularSize(), solNum
     );
+    return fileName;
+}
+
+void MakePartialHeader(RayTraceCorrelator *theCorrelator, int solNum, RTPartialHeader_t &header){
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RT_PARTIAL_MAGIC, sizeof(header.magic));
+    header.stationID = theCorrelator->GetStationID();
+    header.numAntennas = int(theCorrelator->GetNumAntennas());
+    header.numThetaBins = theCorrelator->GetNumThetaBins();
+    header.numPhiBins = theCorrelator->GetNumPhiBins();
+    header.solNum = solNum;
+    header.radius = theCorrelator->GetRadius();
+    header.angularSize = theCorrelator->GetAngularSize();
+}
+
+// The partial files of a table: <table>_thetabins_<first>_<last>.partial, one per theta range that has been started
+std::vector<std::string> FindPartialFiles(const std::string &tablePath){
+
+    size_t slash = tablePath.rfind('/');
+    std::string dirName = (slash == std::string::npos) ? "." : tablePath.substr(0, slash);
+    std::string prefix = tablePath.substr(slash == std::string::npos ? 0 : slash + 1);
+    prefix = prefix.substr(0, prefix.size() - 5) + "_thetabins_"; // without the .root
+    std::string suffix = ".partial";
+
+    std::vector<std::string> partialFiles;
+    DIR *dir = opendir(dirName.c_str());
+    if(!dir) return partialFiles;
+    for(struct dirent *entry = readdir(dir); entry; entry = readdir(dir)){
+        std::string name = entry->d_name;
+        if(name.compare(0, prefix.size(), prefix) != 0) continue;
+        if(name.size() < suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+        partialFiles.push_back(dirName + "/" + name);
+    }
+    closedir(dir);
+    return partialFiles;
+}
+
+/*
+Read the strips already solved for a table from every partial file of the table.
+A strip that was being written when a job stopped is ignored, and solved again.
+Returns the number of strips read.
+*/
+int LoadPartialTables(RayTraceCorrelator *theCorrelator, int solNum, const std::string &tablePath, ArrivalTables &tables){
+
+    RTPartialHeader_t expected;
+    MakePartialHeader(theCorrelator, solNum, expected);
+    int stripSize = expected.numPhiBins * expected.numAntennas;
+    std::vector<double> strip(3 * stripSize);
+
+    int numRead = 0;
+    std::vector<std::string> partialFiles = FindPartialFiles(tablePath);
+    for(size_t file = 0; file < partialFiles.size(); file++){
+        const std::string &path = partialFiles[file];
+        FILE *inFile = fopen(path.c_str(), "rb");
+        if(!inFile) continue;
+        RTPartialHeader_t header;
+        if(fread(&header, sizeof(header), 1, inFile) != 1 || memcmp(&header, &expected, sizeof(header)) != 0){
+            fprintf(stderr, "makeRTArrivalTimeTables -- WARNING %s is not a partial table of this station and binning, ignoring it\n", path.c_str());
+            fclose(inFile);
+            continue;
+        }
+        int thetaBin;
+        while(fread(&thetaBin, sizeof(thetaBin), 1, inFile) == 1
+            && fread(&strip[0], sizeof(double), strip.size(), inFile) == strip.size()){
+            if(thetaBin < 0 || thetaBin >= expected.numThetaBins) break;
+            int offset = thetaBin * stripSize;
+            std::copy(strip.begin(), strip.begin() + stripSize, tables.arrivalTimes.begin() + offset);
+            std::copy(strip.begin() + stripSize, strip.begin() + 2 * stripSize, tables.arrivalThetas.begin() + offset);
+            std::copy(strip.begin() + 2 * stripSize, strip.end(), tables.arrivalPhis.begin() + offset);
+            if(!tables.stripDone[thetaBin]) numRead++;
+            tables.stripDone[thetaBin] = 1;
+        }
+        fclose(inFile);
+    }
+    return numRead;
+}
+
+/*
+Solve theta bins firstThetaBin to lastThetaBin-1 of one solution, skipping the strips already in the partial files.
+Each thread has its own ice model, ray solver and settings, and takes the next unsolved theta strip until there are none left.
+Every finished strip is appended to the partial file of this range, so a stopped job resumes where it was.
+Once every strip of the table is solved, the table and its binary cache are written and the partial files removed.
+Returns true if the table is complete.
+*/
+bool CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModelidx, const std::string &tableDir,
+    int numThreads, int firstThetaBin, int lastThetaBin){
+
+    std::string tablePath = GetTablePath(theCorrelator, solNum, iceModelidx, tableDir);
 
-    TFile *outfile = 0;
-    TTree *tArrivalTimes = 0;
+    int numThetaBins = theCorrelator->GetNumThetaBins();
+    int numPhiBins = theCorrelator->GetNumPhiBins();
+    int numAnts = theCorrelator->GetNumAntennas();
+    double radius = theCorrelator->GetRadius();
+    std::vector<double> phiAngles = theCorrelator->GetPhiAngles();
+    std::vector<double> thetaAngles = theCorrelator->GetThetaAngles();
 
-    outfile = new TFile(fileName, "RECREATE");
-    tArrivalTimes = new TTree("tArrivalTimes", "tArrivalTimes");
+    int stripSize = numPhiBins * numAnts;
+    ArrivalTables tables;
+    tables.arrivalTimes.assign(numThetaBins * stripSize, 0.);
+    tables.arrivalThetas.assign(numThetaBins * stripSize, 0.);
+    tables.arrivalPhis.assign(numThetaBins * stripSize, 0.);
+    tables.stripDone.assign(numThetaBins, 0);
+    int numResumed = LoadPartialTables(theCorrelator, solNum, tablePath, tables);
+    if(numResumed > 0){
+        printf("Solution %d: %d theta strips were already solved\n", solNum, numResumed);
+    }
+
+    std::vector<int> todo;
+    for(int thetaBin = firstThetaBin; thetaBin < lastThetaBin; thetaBin++){
+        if(!tables.stripDone[thetaBin]) todo.push_back(thetaBin);
+    }
+
+    if(!todo.empty()){
+        /*
+        Set up ice model
+        To load the AraSim ice model, it has to read some bedmap/depth files 
+        located in the AraSim "data" directory
+        If those files are missing, it errors out *very* unhelpfully.
+        So we implement a check here, waiting for the day when AraSim handles
+        this more intelligently.
+        */
+        struct stat buffer;
+        bool dirExists = (stat("data", &buffer) == 0);
+        if(!dirExists){
+            throw std::runtime_error("The AraSim data directory is missing! Please make it, e.g. ln -s /path/to/AraSim/data data");
+        }
+
+        // one ice model, ray solver and settings per thread, as AraSim keeps state in them
+        // they are all made here, before any thread starts
+        numThreads = std::min(numThreads, int(todo.size()));
+        std::vector<IceModel*> iceModels;
+        std::vector<RaySolver*> raySolvers;
+        std::vector<Settings*> settings;
+        for(int i = 0; i < numThreads; i++){
+            iceModels.push_back(new IceModel(0 + 1*10, 0, 0));
+            raySolvers.push_back(new RaySolver);
+            Settings *threadSettings = new Settings();
+
+            // turn up the accuracy on the ray solving
+            threadSettings->Z_THIS_TOLERANCE = 1;
+            threadSettings->Z_TOLERANCE = 0.05;
+
+            threadSettings->NOFZ=1; // make sure n(z) is turned on
+            threadSettings->RAY_TRACE_ICE_MODEL_PARAMS = iceModelidx; // set the ice model as user requested
+            settings.push_back(threadSettings);
+        }
+
+        // get the antenna locations in a way that AraSim likes
+        std::map<int, Position> antennaLocations = GetAntLocationsInEarthCoords(theCorrelator->GetStationID(), iceModels[0]);
+        Position stationCOG = CalculateStationCOG(antennaLocations);
+
+        // the strips of this range are appended to its own partial file, so jobs of different ranges never share one
+        char partialPath[600];
+        sprintf(partialPath, "%s_thetabins_%d_%d.partial", tablePath.substr(0, tablePath.size() - 5).c_str(), firstThetaBin, lastThetaBin);
+        // drop a strip that was being written when the last job of this range stopped, so new strips follow whole ones
+        long long headerBytes = sizeof(RTPartialHeader_t);
+        long long recordBytes = sizeof(int) + 3 * sizeof(double) * (long long) stripSize;
+        long long partialBytes = 0;
+        struct stat partialStat;
+        if(stat(partialPath, &partialStat) == 0){
+            partialBytes = partialStat.st_size < headerBytes ? 0 : headerBytes + (partialStat.st_size - headerBytes) / recordBytes * recordBytes;
+            if(partialBytes != partialStat.st_size && truncate(partialPath, partialBytes) != 0){
+                throw std::runtime_error(std::string("Can not truncate the partial table file ") + partialPath);
+            }
+        }
+        FILE *partialFile = fopen(partialPath, "ab");
+        if(!partialFile){
+            throw std::runtime_error(std::string("Can not open the partial table file ") + partialPath);
+        }
+        if(partialBytes == 0){
+            RTPartialHeader_t header;
+            MakePartialHeader(theCorrelator, solNum, header);
+            fwrite(&header, sizeof(header), 1, partialFile);
+            fflush(partialFile);
+        }
+
+        std::atomic<int> nextStrip(0);
+        std::mutex partialMutex;
+        auto solveStrips = [&](int thread){
+            for(int i = nextStrip++; i < int(todo.size()); i = nextStrip++){
+                int thetaBin = todo[i];
+                {
+                    std::lock_guard<std::mutex> lock(partialMutex);
+                    printf("Solving theta strip at %.2f deg \n",thetaAngles[thetaBin]*TMath::RadToDeg());
+                }
+
+                for (int phiBin = 0; phiBin < numPhiBins; phiBin++) {
+                    for (int ant = 0; ant < numAnts; ant++) {
+                        Position antPosition = antennaLocations.find(ant)->second;
+                        int index = (thetaBin * numPhiBins + phiBin) * numAnts + ant;
+                        CalculateArrivalInformation(
+                            raySolvers[thread], iceModels[thread], settings[thread],
+                            antPosition, stationCOG,
+                            phiAngles[phiBin], thetaAngles[thetaBin], radius, solNum,
+                            tables.arrivalTimes[index], tables.arrivalThetas[index], tables.arrivalPhis[index]
+                        );
+                    }
+                }
+
+                // the strip is only marked done once it is safely in the partial file
+                std::lock_guard<std::mutex> lock(partialMutex);
+                int offset = thetaBin * stripSize;
+                fwrite(&thetaBin, sizeof(thetaBin), 1, partialFile);
+                fwrite(&tables.arrivalTimes[offset], sizeof(double), stripSize, partialFile);
+                fwrite(&tables.arrivalThetas[offset], sizeof(double), stripSize, partialFile);
+                fwrite(&tables.arrivalPhis[offset], sizeof(double), stripSize, partialFile);
+                fflush(partialFile);
+                tables.stripDone[thetaBin] = 1;
+            }
+        };
+        if(numThreads <= 1){
+            solveStrips(0);
+        }
+        else{
+            std::vector<std::thread> threads;
+            for(int i = 0; i < numThreads; i++){
+                threads.push_back(std::thread(solveStrips, i));
+            }
+            for(size_t i = 0; i < threads.size(); i++){
+                threads[i].join();
+            }
+        }
+        fclose(partialFile);
+
+        for(int i = 0; i < numThreads; i++){
+            delete iceModels[i];
+            delete raySolvers[i];
+            delete settings[i];
+        }
+    }
+
+    for(int thetaBin = 0; thetaBin < numThetaBins; thetaBin++){
+        if(!tables.stripDone[thetaBin]) return false;
+    }
+    WriteTables(theCorrelator, solNum, tablePath, tables);
+
+    // the partial files are no longer needed once the table is written
+    std::vector<std::string> partialFiles = FindPartialFiles(tablePath);
+    for(size_t i = 0; i < partialFiles.size(); i++){
+        remove(partialFiles[i].c_str());
+    }
+    return true;
+}
+
+/*
+Write the ROOT table (the tArrivalTimes tree) and its binary cache (see RayTraceCorrelator::GetTableCachePath)
+straight from the solved tables, so the first analysis job to use them does not have to read the tree
+*/
+void WriteTables(RayTraceCorrelator *theCorrelator, int solNum, const std::string &tablePath, const ArrivalTables &tables){
+
+    TFile *outfile = new TFile(tablePath.c_str(), "RECREATE");
+    TTree *tArrivalTimes = new TTree("tArrivalTimes", "tArrivalTimes");
 
     int ant, phiBin, thetaBin;
     double phi, theta;
@@ -89,74 +387,15 @@ void CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModel
     int numThetaBins = theCorrelator->GetNumThetaBins();
     int numPhiBins = theCorrelator->GetNumPhiBins();
     int numAnts = theCorrelator->GetNumAntennas();
-    double radius = theCorrelator->GetRadius();
     std::vector<double> phiAngles = theCorrelator->GetPhiAngles();
     std::vector<double> thetaAngles = theCorrelator->GetThetaAngles();
-
-    /*
-    Set up ice model
-    To load the AraSim ice model, it has to read some bedmap/depth files 
-    located in the AraSim "data" directory
-    If those files are missing, it errors out *very* unhelpfully.
-    So we implement a check here, waiting for the day when AraSim handles
-    this more intelligently.
-    */
-    struct stat buffer;
-    bool dirExists = (stat("data", &buffer) == 0);
-    if(!dirExists){
-        throw std::runtime_error("The AraSim data directory is missing! Please make it, e.g. ln -s /path/to/AraSim/data data");
-    }
-    // need ice model
-    IceModel *iceModel = new IceModel(0 + 1*10, 0, 0);
-
-    // get the antenna locations in a way that AraSim likes
-    std::map<int, Position> antennaLocations = GetAntLocationsInEarthCoords(theCorrelator->GetStationID(), iceModel);
-    Position stationCOG = CalculateStationCOG(antennaLocations);
-
-    // setup a ray solver
-    RaySolver *raySolver = new RaySolver;
-
-    // and settings
-    Settings *settings = new Settings();
-    
-    // turn up the accuracy on the ray solving
-    settings->Z_THIS_TOLERANCE = 1;
-    settings->Z_TOLERANCE = 0.05;
-    
-    settings->NOFZ=1; // make sure n(z) is turned on
-    settings->RAY_TRACE_ICE_MODEL_PARAMS = iceModelidx; // set the ice model as user requested
-
-    for (int thetaBin_temp = 0; thetaBin_temp < numThetaBins; thetaBin_temp++) {
-
-        printf("Solving theta strip at %.2f deg \n",thetaAngles[thetaBin_temp]*TMath::RadToDeg());
-
-        for (int phiBin_temp = 0; phiBin_temp < numPhiBins; phiBin_temp++) {
-
-            for (int ant_temp = 0; ant_temp < numAnts; ant_temp++) {
-
-                Position antPosition = antennaLocations.find(ant_temp)->second;
-
-                double arrivalTime_temp;
-                double arrivalTheta_temp;
-                double arrivalPhi_temp;
-                CalculateArrivalInformation(
-                    raySolver, iceModel, settings,
-                    antPosition, stationCOG,
-                    phiAngles[phiBin_temp], thetaAngles[thetaBin_temp], radius, solNum,
-                    arrivalTime_temp, arrivalTheta_temp, arrivalPhi_temp
-
-                );
-                
-                arrivalTime = arrivalTime_temp;
-                arrivalTheta = arrivalTheta_temp;
-                arrivalPhi = arrivalPhi_temp;
-                // printf("  Phi %d, Ant %d, Arrival Time %.2f, Arrival Theta %.2f, Arrival Phi %.2f \n",
-                //     phiBin_temp, ant_temp, arrivalTime_temp, 
-                //     TMath::RadToDeg()*arrivalTheta_temp, TMath::RadToDeg()*arrivalPhi_temp
-                // );
-                ant = ant_temp;
-                phiBin = phiBin_temp;
-                thetaBin = thetaBin_temp;
+    for (thetaBin = 0; thetaBin < numThetaBins; thetaBin++) {
+        for (phiBin = 0; phiBin < numPhiBins; phiBin++) {
+            for (ant = 0; ant < numAnts; ant++) {
+                int index = (thetaBin * numPhiBins + phiBin) * numAnts + ant;
+                arrivalTime = tables.arrivalTimes[index];
+                arrivalTheta = tables.arrivalThetas[index];
+                arrivalPhi = tables.arrivalPhis[index];
                 phi = phiAngles[phiBin];
                 theta = thetaAngles[thetaBin];
                 tArrivalTimes -> Fill();
@@ -165,6 +404,10 @@ void CalculateTables(RayTraceCorrelator *theCorrelator, int solNum, int iceModel
     }
     outfile->Write();
     outfile->Close();
+
+    // the cache is stamped with the size and time of the ROOT file, so it is written after it
+    theCorrelator->SetArrivalTimeTable(solNum, tables.arrivalTimes, tables.arrivalThetas, tables.arrivalPhis);
+    theCorrelator->WriteTableCache(solNum, tablePath);
 }
 
 void CalculateArrivalInformation(
@@ -0,0 +1,132 @@
+//C/C++ includes
+#include <stdio.h>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <exception>
+
+// AraRoot includes
+#include "AraGeomTool.h"
+#include "RayTraceVertexScanner.h"
+#include "RayTraceCorrelator.h"
+#include "AraCorrelationEngine.h"
+
+RayTraceVertexScanner::RayTraceVertexScanner(int stationID,
+    int numAntennas,
+    double angularSize,
+    const std::vector<double> &radii,
+    const std::vector<std::string> &dirSolTablePaths,
+    const std::vector<std::string> &refSolTablePaths
+    ) : numThreads_(1) {
+
+    char errorMessage[400];
+
+    if(radii.empty()){
+        throw std::invalid_argument("No radii given to scan\n");
+    }
+    if(dirSolTablePaths.size()!=radii.size() || refSolTablePaths.size()!=radii.size()){
+        sprintf(errorMessage,"Mismatch in number of radii (%d) and provided direct (%d) and reflected (%d) tables\n",
+            (int)radii.size(), (int)dirSolTablePaths.size(), (int)refSolTablePaths.size());
+        throw std::invalid_argument(errorMessage);
+    }
+
+    // the correlators check their own arguments
+    try{
+        for(size_t i = 0; i < radii.size(); i++){
+            correlators_.push_back(new RayTraceCorrelator(stationID, numAntennas, radii[i], angularSize,
+                dirSolTablePaths[i], refSolTablePaths[i]));
+        }
+    }
+    catch(...){
+        for(size_t i = 0; i < correlators_.size(); i++) delete correlators_[i];
+        throw;
+    }
+}
+
+RayTraceVertexScanner::~RayTraceVertexScanner(){
+    for(size_t i = 0; i < correlators_.size(); i++){
+        delete correlators_[i];
+    }
+}
+
+void RayTraceVertexScanner::LoadTables(){
+    for(size_t i = 0; i < correlators_.size(); i++){
+        correlators_[i]->LoadTables();
+    }
+}
+
+double RayTraceVertexScanner::GetRadius(int radiusIndex){
+    return correlators_.at(radiusIndex)->GetRadius();
+}
+
+void RayTraceVertexScanner::SetNumThreads(int numThreads){
+    if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+    numThreads_ = std::max(numThreads, 1);
+}
+
+void RayTraceVertexScanner::ComputeCorrelations(
+    const std::map<int, std::vector<int> > &pairs,
+    const std::map<int, TGraph*> &interpolatedWaveforms,
+    AraCorrelationEngine &engine,
+    bool applyHilbertEnvelope
+    ){
+
+    // the correlation functions do not depend on the radius
+    correlators_[0]->ComputeCorrelations(pairs, interpolatedWaveforms, engine, applyHilbertEnvelope);
+}
+
+double RayTraceVertexScanner::ScanVertex(
+    const std::map<int, std::vector<int> > &pairs,
+    const AraCorrelationEngine &engine,
+    double &peakRadius, double &peakTheta, double &peakPhi, int &peakSolNum,
+    std::vector<double> &radiusPeaks,
+    std::vector<int> solNums,
+    std::map<int, double> weights,
+    int coarseStep, int numCandidates
+    ){
+
+    int numRadii = int(correlators_.size());
+    std::vector<double> thetas(numRadii), phis(numRadii);
+    std::vector<int> sols(numRadii);
+    radiusPeaks.assign(numRadii, 0.);
+
+    // the correlators only share the (read-only) engine, so the radii can be searched side by side
+    std::atomic<int> nextRadius(0);
+    std::vector<std::exception_ptr> errors(numRadii);
+    auto searchRadii = [&](){
+        for(int radius = nextRadius++; radius < numRadii; radius = nextRadius++){
+            try{
+                radiusPeaks[radius] = correlators_[radius]->FindPeak(pairs, engine,
+                    thetas[radius], phis[radius], sols[radius],
+                    solNums, weights, coarseStep, numCandidates);
+            }
+            catch(...){
+                errors[radius] = std::current_exception();
+            }
+        }
+    };
+    int numThreads = std::min(numThreads_, numRadii);
+    if(numThreads <= 1){
+        searchRadii();
+    }
+    else{
+        std::vector<std::thread> threads;
+        for(int i = 0; i < numThreads; i++){
+            threads.push_back(std::thread(searchRadii));
+        }
+        for(size_t i = 0; i < threads.size(); i++){
+            threads[i].join();
+        }
+    }
+    for(int radius = 0; radius < numRadii; radius++){
+        if(errors[radius]) std::rethrow_exception(errors[radius]);
+    }
+
+    int best = int(std::max_element(radiusPeaks.begin(), radiusPeaks.end()) - radiusPeaks.begin());
+    peakRadius = correlators_[best]->GetRadius();
+    peakTheta = thetas[best];
+    peakPhi = phis[best];
+    peakSolNum = sols[best];
+    return radiusPeaks[best];
+}
@@ -0,0 +1,120 @@
+#ifndef RAYTRACEVERTEXSCANNER_H
+#define RAYTRACEVERTEXSCANNER_H
+
+#include <map>
+#include <string>
+#include <vector>
+class TGraph;
+class AraCorrelationEngine;
+class RayTraceCorrelator;
+
+//! Part of AraCorrelator library. Scans source distance as well as direction with one RayTraceCorrelator per radius
+/*!
+    The correlation functions of an event do not depend on the source hypothesis, so they are computed once
+    and searched with the tables of every radius:
+    \code
+    RayTraceVertexScanner scanner(2, 16, 1., radii, dirTablePaths, refTablePaths);
+    scanner.LoadTables();
+    AraCorrelationEngine engine;
+    scanner.ComputeCorrelations(pairs, interpolatedWaveforms, engine);
+    double radius, theta, phi;
+    int solNum;
+    std::vector<double> radiusPeaks;
+    double peak = scanner.ScanVertex(pairs, engine, radius, theta, phi, solNum, radiusPeaks);
+    \endcode
+*/
+class RayTraceVertexScanner
+{
+
+    private:
+        std::vector<RayTraceCorrelator*> correlators_; ///< One correlator per radius, in the order of the radii
+        int numThreads_;                               ///< Number of radii searched at once
+
+    public:
+
+        //! constructor for the RayTraceVertexScanner
+        /*!
+            \param stationID ID of the station
+            \param numAntennas number of antennas in the timing tables
+            \param angularSize The angular binning, the same for every radius
+            \param radii The radii to scan
+            \param dirSolTablePaths Complete paths to the direct RT solution tables, one per radius
+            \param refSolTablePaths Complete paths to the reflected/refracted RT solution tables, one per radius
+            \return an instance of the vertex scanner
+        */
+        RayTraceVertexScanner(int stationID, int numAntennas, double angularSize,
+            const std::vector<double> &radii,
+            const std::vector<std::string> &dirSolTablePaths,
+            const std::vector<std::string> &refSolTablePaths
+        );
+
+
+        ~RayTraceVertexScanner(); ///< Destructor
+
+
+        //! function to load the arrival time tables of every radius
+        /*!
+            \return void
+        */
+        void LoadTables();
+
+
+        // these are getter functions to provide an interface
+        int GetNumRadii(){ return int(correlators_.size()); }
+        double GetRadius(int radiusIndex);
+        RayTraceCorrelator* GetCorrelator(int radiusIndex){ return correlators_.at(radiusIndex); } ///< The correlator of one radius, e.g. to make its full map
+
+
+        //! function to set the number of radii searched at once
+        /*!
+            \param numThreads number of threads; 0 = one per core, default = 1
+            \return void
+        */
+        void SetNumThreads(int numThreads);
+
+
+        //! function to compute the correlation functions of an event once for every radius
+        /*!
+            \param pairs a std::map of pair indices to antenna indices
+            \param interpolatedWaveforms a std::map of antenna indices to interpolated waveforms
+            \param engine the engine to correlate in
+            \param applyHilbertEnvelope whether or not to apply hilbert enveloping to the correlation functions
+            \return void
+        */
+        void ComputeCorrelations(
+            const std::map<int, std::vector<int> > &pairs,
+            const std::map<int, TGraph*> &interpolatedWaveforms,
+            AraCorrelationEngine &engine,
+            bool applyHilbertEnvelope = true
+        );
+
+
+        //! function to find the best source radius, direction and solution
+        /*!
+            Runs RayTraceCorrelator::FindPeak for every radius on the same correlation functions
+            \param pairs a std::map of antenna pairs
+            \param engine an engine filled by ComputeCorrelations with the same pairs
+            \param peakRadius passed by reference, replaced by the radius of the peak
+            \param peakTheta passed by reference, replaced by the theta angle (degrees) of the peak
+            \param peakPhi passed by reference, replaced by the phi angle (degrees) of the peak
+            \param peakSolNum passed by reference, replaced by the solution number of the peak
+            \param radiusPeaks passed by reference, replaced by the peak value of each radius
+            \param solNums the solutions to search; default = both
+            \param weights weights to apply to each map; default = equal weights, or 1/pairs.size()
+            \param coarseStep the coarse grid spacing in bins of FindPeak
+            \param numCandidates number of coarse bins FindPeak refines
+            \return the peak value over all radii
+        */
+        double ScanVertex(
+            const std::map<int, std::vector<int> > &pairs,
+            const AraCorrelationEngine &engine,
+            double &peakRadius, double &peakTheta, double &peakPhi, int &peakSolNum,
+            std::vector<double> &radiusPeaks,
+            std::vector<int> solNums = {0, 1},
+            std::map<int, double> weights = {},
+            int coarseStep = 4, int numCandidates = 5
+        );
+
+};
+
+#endif //RAYTRACEVERTEXSCANNER_H
@@ -0,0 +1,67 @@
+//C/C++ includes
+#include <stdio.h>
+#include <stdexcept>
+
+//ROOT includes
+#include "TH2D.h"
+
+// AraRoot includes
+#include "RayTraceWorkspace.h"
+
+RayTraceWorkspace::RayTraceWorkspace()
+    : numPhiBins_(0), numThetaBins_(0), solNum_(0) {
+}
+
+RayTraceWorkspace::~RayTraceWorkspace(){
+}
+
+void RayTraceWorkspace::ResizeMap(int numPhiBins, int numThetaBins){
+    numPhiBins_ = numPhiBins;
+    numThetaBins_ = numThetaBins;
+    mapValues_.assign(numPhiBins * numThetaBins, 0.);
+    noSolution_.assign(numPhiBins * numThetaBins, 0);
+}
+
+double RayTraceWorkspace::GetMapMaximum(int &peakThetaBin, int &peakPhiBin){
+    int peakBin = -1;
+    for(size_t bin = 0; bin < mapValues_.size(); bin++){
+        if(noSolution_[bin]) continue;
+        if(peakBin < 0 || mapValues_[bin] > mapValues_[peakBin]) peakBin = int(bin);
+    }
+    if(peakBin < 0){
+        throw std::runtime_error("No bin of the map has a solution for every pair\n");
+    }
+    peakThetaBin = peakBin / numPhiBins_;
+    peakPhiBin = peakBin % numPhiBins_;
+    return mapValues_[peakBin];
+}
+
+void RayTraceWorkspace::FillHistogram(TH2D *histMap){
+    char errorMessage[400];
+
+    if(histMap->GetNbinsX()!=numPhiBins_ || histMap->GetNbinsY()!=numThetaBins_){
+        sprintf(errorMessage,"Histogram has %d x %d bins, the map has %d x %d\n",
+            histMap->GetNbinsX(), histMap->GetNbinsY(), numPhiBins_, numThetaBins_);
+        throw std::invalid_argument(errorMessage);
+    }
+
+    histMap->Reset();
+    for (int thetaBin = 0; thetaBin < numThetaBins_; thetaBin++) {
+        for (int phiBin = 0; phiBin < numPhiBins_; phiBin++) {
+            int bin = thetaBin * numPhiBins_ + phiBin;
+            if (noSolution_[bin]) continue;
+            Int_t globalBin = (phiBin + 1) + (thetaBin + 1) * (numPhiBins_ + 2);
+            histMap -> SetBinContent(globalBin, mapValues_[bin]);
+        }
+    }
+}
+
+TH2D* RayTraceWorkspace::MakeHistogram(const char *name, const char *title){
+    TH2D *histMap = new TH2D(name, title,
+        numPhiBins_, -180, 180,
+        numThetaBins_, -90, 90
+    );
+    histMap->SetDirectory(0);
+    this->FillHistogram(histMap);
+    return histMap;
+}
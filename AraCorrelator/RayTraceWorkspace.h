@@ -0,0 +1,90 @@
+#ifndef RAYTRACEWORKSPACE_H
+#define RAYTRACEWORKSPACE_H
+
+#include <vector>
+#include "AraCorrelationEngine.h"
+#include "RayTraceCorrelator.h"
+class TH2D;
+
+//! Part of AraCorrelator library. Holds the correlation functions and the map of one event for a RayTraceCorrelator
+/*!
+    GetCorrFunctions and GetInterferometricMap make new graphs and a new histogram for every event.
+    A workspace keeps its correlation engine, pair lookups and map buffer from one event to the next,
+    so these are not made again for every event:
+    \code
+    RayTraceWorkspace workspace;
+    TH2D *histMap = 0;
+    for(...){
+        theCorrelator->ComputeCorrelations(pairs, interpolatedWaveforms, workspace);
+        theCorrelator->FillInterferometricMap(pairs, workspace, 0);
+        int peakThetaBin, peakPhiBin;
+        double peak = workspace.GetMapMaximum(peakThetaBin, peakPhiBin);
+        if(!histMap) histMap = workspace.MakeHistogram("histMap", "histMap");
+        else workspace.FillHistogram(histMap);
+    }
+    \endcode
+    A workspace is not thread safe, use one per thread.
+*/
+class RayTraceWorkspace
+{
+
+    friend class RayTraceCorrelator;
+
+    private:
+        AraCorrelationEngine engine_;                      ///< The correlation functions of the last ComputeCorrelations
+        std::vector<RayTraceCorrelator::CorrSamples> corrSamples_; ///< The correlation functions as the correlator reads them
+        std::vector<RayTraceCorrelator::PairTerm> pairTerms_;      ///< The delays, correlation function and weight of each pair
+        std::vector<float> mapValues_;                     ///< The map, indexed thetaBin * numPhiBins_ + phiBin
+        std::vector<unsigned char> noSolution_;            ///< Whether a pair has no solution in each bin of the map
+        int numPhiBins_;                                   ///< Number of phi bins of the map
+        int numThetaBins_;                                 ///< Number of theta bins of the map
+        int solNum_;                                       ///< Solution number of the map
+
+        void ResizeMap(int numPhiBins, int numThetaBins); ///< Function to size and zero the map buffers, keeping their memory
+
+    public:
+
+        RayTraceWorkspace(); ///< Default constructor, the buffers are sized by the first event
+        ~RayTraceWorkspace(); ///< Destructor
+
+
+        // these are getter functions to provide an interface
+        AraCorrelationEngine& GetEngine(){ return engine_; } ///< The correlation functions, e.g. for RayTraceCorrelator::FindPeak
+        int GetNumPhiBins(){ return numPhiBins_; }
+        int GetNumThetaBins(){ return numThetaBins_; }
+        int GetSolNum(){ return solNum_; }
+        const float* GetMapValues(){ return mapValues_.data(); } ///< The map, indexed thetaBin * GetNumPhiBins() + phiBin; 0 where HasSolution is false
+        bool HasSolution(int thetaBin, int phiBin){ return !noSolution_[thetaBin * numPhiBins_ + phiBin]; }
+        double GetMapValue(int thetaBin, int phiBin){ return mapValues_[thetaBin * numPhiBins_ + phiBin]; }
+
+
+        //! function to find the largest bin of the map
+        /*!
+            \param peakThetaBin passed by reference, replaced by the theta bin of the peak
+            \param peakPhiBin passed by reference, replaced by the phi bin of the peak
+            \return the map value at the peak
+        */
+        double GetMapMaximum(int &peakThetaBin, int &peakPhiBin);
+
+
+        //! function to copy the map into an existing histogram
+        /*!
+            Bins without a solution are set to zero, as in RayTraceCorrelator::GetInterferometricMap
+            \param histMap a histogram with GetNumPhiBins() x GetNumThetaBins() bins, e.g. from MakeHistogram
+            \return void
+        */
+        void FillHistogram(TH2D *histMap);
+
+
+        //! function to make a histogram of the map
+        /*!
+            The histogram is not added to the current directory
+            \param name name of the histogram
+            \param title title of the histogram
+            \return a new histogram, owned by the caller
+        */
+        TH2D* MakeHistogram(const char *name = "", const char *title = "");
+
+};
+
+#endif //RAYTRACEWORKSPACE_H
@@ -11,6 +11,7 @@
 // ARA Includes
 #include "AraGeomTool.h"
 #include "RayTraceCorrelator.h"
+#include "AraCorrelationEngine.h"
 #include "RawAtriStationEvent.h"
 #include "UsefulAtriStationEvent.h"
 #include "FFTtools.h"
@@ -87,6 +88,7 @@ int main(int argc, char **argv)
     Long64_t numEntries=eventTree->GetEntries();
 
     numEntries=10;
+    AraCorrelationEngine engine; // keeps its buffers from event to event
     for(Long64_t event=0;event<numEntries;event++) {
         eventTree->GetEntry(event);
 
@@ -104,10 +106,17 @@ int main(int argc, char **argv)
             interpolatedWaveforms[i] = grInt;
             delete gr;
         }
-        std::vector<TGraph*> corrFunctions = theCorrelator->GetCorrFunctions(pairs, interpolatedWaveforms); // apply Hilbert envelope is default
+        theCorrelator->ComputeCorrelations(pairs, interpolatedWaveforms, engine); // apply Hilbert envelope is default
+        // (GetCorrFunctions gives the same correlation functions as TGraphs)
 
         // get the map
-        TH2D *dirMap = theCorrelator->GetInterferometricMap(pairs, corrFunctions, 0); // direct solution
+        TH2D *dirMap = theCorrelator->GetInterferometricMap(pairs, engine, 0); // direct solution
+
+        // or, when only the peak is needed, search for it without making the maps
+        double peakTheta, peakPhi;
+        int peakSolNum;
+        double peakCorr = theCorrelator->FindPeak(pairs, engine, peakTheta, peakPhi, peakSolNum);
+        printf("Peak %.3f at theta %.2f, phi %.2f (solution %d)\n", peakCorr, peakTheta, peakPhi, peakSolNum);
 
         // draw and save the map
         gStyle->SetOptStat(0);
@@ -137,9 +146,6 @@ int main(int argc, char **argv)
         for(int i=0; i<16; i++){
             delete interpolatedWaveforms[i];
         }
-        for(int i=0; i<corrFunctions.size(); i++){
-            delete corrFunctions[i];
-        }
         delete realAtriEvPtr;
 
     }
@@ -1159,6 +1159,7 @@ TPad *AraAtriCanvasMaker::getIntMapCanvas(UsefulAtriStationEvent *evPtr,
   plotPad->cd();
   plotPad->Clear();
   AraEventCorrelator *araCorPtr = AraEventCorrelator::Instance(fNumAntsInMap, evPtr->stationId);
+  araCorPtr->setNumThreads(0); //Interactive, so sum the maps on every core
 
 
   static TH2D* histMapH=0;  
@@ -1180,6 +1180,7 @@ TPad *AraIcrrCanvasMaker::getIntMapCanvas(UsefulIcrrStationEvent *evPtr,
   plotPad->cd();
   plotPad->Clear();
   AraEventCorrelator *araCorPtr = AraEventCorrelator::Instance(fNumAntsInMap, evPtr->stationId);
+  araCorPtr->setNumThreads(0); //Interactive, so sum the maps on every core
   static TH2D* histMapH=0;  
   static TH2D* histMapV=0;  
   plotPad->Divide(1,2);
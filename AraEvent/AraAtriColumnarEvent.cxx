@@ -0,0 +1,213 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraAtriColumnarEvent.cxx        Columnar ATRI event layout        /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Writes and reads RawAtriStationEvent contents as plain leaf   /////
+/////     branches, without the ROOT object streamers                    /////
+//////////////////////////////////////////////////////////////////////////////
+
+#include "AraAtriColumnarEvent.h"
+#include "RawAtriStationEvent.h"
+#include "TTree.h"
+#include <cstdio>
+#include <cstring>
+
+AraAtriColumnarEvent::AraAtriColumnarEvent()
+    : fSamples(ATRI_COLUMNAR_MAX_SAMPLES,0)
+{
+    //Default constructor
+    memset(triggerInfo,0,sizeof(triggerInfo));
+    memset(triggerBlock,0,sizeof(triggerBlock));
+    numBlocks=0;
+    numSamples=0;
+}
+
+AraAtriColumnarEvent::~AraAtriColumnarEvent()
+{
+    //Default destructor
+}
+
+Bool_t AraAtriColumnarEvent::isColumnarTree(TTree *tree)
+{
+    return tree && tree->GetBranch("samples") && tree->GetBranch("sampleOffset");
+}
+
+void AraAtriColumnarEvent::makeBranches(TTree *tree)
+{
+    tree->Branch("softVerMajor",&softVerMajor,"softVerMajor/b");
+    tree->Branch("softVerMinor",&softVerMinor,"softVerMinor/b");
+    tree->Branch("typeId",&typeId,"typeId/b");
+    tree->Branch("verId",&verId,"verId/b");
+    tree->Branch("subVerId",&subVerId,"subVerId/b");
+    tree->Branch("stationId",&stationId,"stationId/b");
+    tree->Branch("reserved",&reserved,"reserved/s");
+    tree->Branch("numBytes",&numBytes,"numBytes/i");
+    tree->Branch("checksum",&checksum,"checksum/s");
+
+    tree->Branch("unixTime",&unixTime,"unixTime/l");
+    tree->Branch("unixTimeUs",&unixTimeUs,"unixTimeUs/i");
+    tree->Branch("eventNumber",&eventNumber,"eventNumber/i");
+    tree->Branch("ppsNumber",&ppsNumber,"ppsNumber/i");
+    tree->Branch("numStationBytes",&numStationBytes,"numStationBytes/i");
+    tree->Branch("timeStamp",&timeStamp,"timeStamp/i");
+    tree->Branch("eventId",&eventId,"eventId/i");
+    tree->Branch("versionId",&versionId,"versionId/s");
+    tree->Branch("numReadoutBlocks",&numReadoutBlocks,"numReadoutBlocks/s");
+    char leafList[80];
+    sprintf(leafList,"triggerInfo[%d]/i",MAX_TRIG_BLOCKS);
+    tree->Branch("triggerInfo",triggerInfo,leafList);
+    sprintf(leafList,"triggerBlock[%d]/b",MAX_TRIG_BLOCKS);
+    tree->Branch("triggerBlock",triggerBlock,leafList);
+    tree->Branch("filterInfo",&filterInfo,"filterInfo/b");
+
+    tree->Branch("numBlocks",&numBlocks,"numBlocks/I");
+    tree->Branch("irsBlockNumber",irsBlockNumber,"irsBlockNumber[numBlocks]/s");
+    tree->Branch("channelMask",channelMask,"channelMask[numBlocks]/s");
+    tree->Branch("numChannels",numChannels,"numChannels[numBlocks]/b");
+    tree->Branch("sampleOffset",sampleOffset,"sampleOffset[numBlocks]/I");
+    tree->Branch("numSamples",&numSamples,"numSamples/I");
+    tree->Branch("samples",fSamples.data(),"samples[numSamples]/s");
+}
+
+void AraAtriColumnarEvent::setBranchAddresses(TTree *tree)
+{
+    tree->SetBranchAddress("softVerMajor",&softVerMajor);
+    tree->SetBranchAddress("softVerMinor",&softVerMinor);
+    tree->SetBranchAddress("typeId",&typeId);
+    tree->SetBranchAddress("verId",&verId);
+    tree->SetBranchAddress("subVerId",&subVerId);
+    tree->SetBranchAddress("stationId",&stationId);
+    tree->SetBranchAddress("reserved",&reserved);
+    tree->SetBranchAddress("numBytes",&numBytes);
+    tree->SetBranchAddress("checksum",&checksum);
+
+    tree->SetBranchAddress("unixTime",&unixTime);
+    tree->SetBranchAddress("unixTimeUs",&unixTimeUs);
+    tree->SetBranchAddress("eventNumber",&eventNumber);
+    tree->SetBranchAddress("ppsNumber",&ppsNumber);
+    tree->SetBranchAddress("numStationBytes",&numStationBytes);
+    tree->SetBranchAddress("timeStamp",&timeStamp);
+    tree->SetBranchAddress("eventId",&eventId);
+    tree->SetBranchAddress("versionId",&versionId);
+    tree->SetBranchAddress("numReadoutBlocks",&numReadoutBlocks);
+    tree->SetBranchAddress("triggerInfo",triggerInfo);
+    tree->SetBranchAddress("triggerBlock",triggerBlock);
+    tree->SetBranchAddress("filterInfo",&filterInfo);
+
+    tree->SetBranchAddress("numBlocks",&numBlocks);
+    tree->SetBranchAddress("irsBlockNumber",irsBlockNumber);
+    tree->SetBranchAddress("channelMask",channelMask);
+    tree->SetBranchAddress("numChannels",numChannels);
+    tree->SetBranchAddress("sampleOffset",sampleOffset);
+    tree->SetBranchAddress("numSamples",&numSamples);
+    tree->SetBranchAddress("samples",fSamples.data());
+}
+
+/*!
+    \param rawEvent the event to copy
+    \return kFALSE if the event has more than ATRI_COLUMNAR_MAX_BLOCKS blocks, only the first ones are kept
+*/
+Bool_t AraAtriColumnarEvent::setFromRawEvent(const RawAtriStationEvent *rawEvent)
+{
+    softVerMajor=rawEvent->softVerMajor;
+    softVerMinor=rawEvent->softVerMinor;
+    typeId=rawEvent->typeId;
+    verId=rawEvent->verId;
+    subVerId=rawEvent->subVerId;
+    stationId=rawEvent->stationId;
+    reserved=rawEvent->reserved;
+    numBytes=rawEvent->numBytes;
+    checksum=rawEvent->checksum;
+
+    unixTime=rawEvent->unixTime;
+    unixTimeUs=rawEvent->unixTimeUs;
+    eventNumber=rawEvent->eventNumber;
+    ppsNumber=rawEvent->ppsNumber;
+    numStationBytes=rawEvent->numStationBytes;
+    timeStamp=rawEvent->timeStamp;
+    eventId=rawEvent->eventId;
+    versionId=rawEvent->versionId;
+    numReadoutBlocks=rawEvent->numReadoutBlocks;
+    for(int trig=0;trig<MAX_TRIG_BLOCKS;trig++) {
+        triggerInfo[trig]=rawEvent->triggerInfo[trig];
+        triggerBlock[trig]=rawEvent->triggerBlock[trig];
+    }
+    filterInfo=rawEvent->filterInfo;
+
+    Bool_t isComplete=kTRUE;
+    numBlocks=rawEvent->blockVec.size();
+    if(numBlocks>ATRI_COLUMNAR_MAX_BLOCKS) {
+        fprintf(stderr, "AraAtriColumnarEvent::setFromRawEvent -- ERROR event %u has %d blocks, only %d are kept\n", eventNumber, numBlocks, ATRI_COLUMNAR_MAX_BLOCKS);
+        numBlocks=ATRI_COLUMNAR_MAX_BLOCKS;
+        isComplete=kFALSE;
+    }
+    numSamples=0;
+    for(int block=0;block<numBlocks;block++) {
+        const RawAtriStationBlock &rawBlock = rawEvent->blockVec[block];
+        irsBlockNumber[block]=rawBlock.irsBlockNumber;
+        channelMask[block]=rawBlock.channelMask;
+        //A block reads out at most RFCHAN_PER_DDA channels, so a corrupt block can not run past ATRI_COLUMNAR_MAX_SAMPLES
+        size_t numBlockChans=rawBlock.data.size();
+        if(numBlockChans>RFCHAN_PER_DDA) {
+            fprintf(stderr, "AraAtriColumnarEvent::setFromRawEvent -- ERROR event %u block %d has %d channels, only %d are kept\n", eventNumber, block, (int)numBlockChans, RFCHAN_PER_DDA);
+            numBlockChans=RFCHAN_PER_DDA;
+            isComplete=kFALSE;
+        }
+        numChannels[block]=numBlockChans;
+        sampleOffset[block]=numSamples;
+        for(size_t chan=0;chan<numBlockChans;chan++) {
+            //Blocks always hold SAMPLES_PER_BLOCK samples per channel, pad just in case so the offsets stay valid
+            size_t numChanSamples=rawBlock.data[chan].size();
+            if(numChanSamples>SAMPLES_PER_BLOCK) numChanSamples=SAMPLES_PER_BLOCK;
+            memcpy(&fSamples[numSamples],rawBlock.data[chan].data(),numChanSamples*sizeof(UShort_t));
+            if(numChanSamples<SAMPLES_PER_BLOCK)
+                memset(&fSamples[numSamples+numChanSamples],0,(SAMPLES_PER_BLOCK-numChanSamples)*sizeof(UShort_t));
+            numSamples+=SAMPLES_PER_BLOCK;
+        }
+    }
+    return isComplete;
+}
+
+/*!
+    \param rawEvent the event to fill, its blocks and sample vectors are reused
+*/
+void AraAtriColumnarEvent::fillRawEvent(RawAtriStationEvent *rawEvent) const
+{
+    rawEvent->softVerMajor=softVerMajor;
+    rawEvent->softVerMinor=softVerMinor;
+    rawEvent->typeId=typeId;
+    rawEvent->verId=verId;
+    rawEvent->subVerId=subVerId;
+    rawEvent->stationId=stationId;
+    rawEvent->reserved=reserved;
+    rawEvent->numBytes=numBytes;
+    rawEvent->checksum=checksum;
+
+    rawEvent->unixTime=unixTime;
+    rawEvent->unixTimeUs=unixTimeUs;
+    rawEvent->eventNumber=eventNumber;
+    rawEvent->ppsNumber=ppsNumber;
+    rawEvent->numStationBytes=numStationBytes;
+    rawEvent->timeStamp=timeStamp;
+    rawEvent->eventId=eventId;
+    rawEvent->versionId=versionId;
+    rawEvent->numReadoutBlocks=numReadoutBlocks;
+    for(int trig=0;trig<MAX_TRIG_BLOCKS;trig++) {
+        rawEvent->triggerInfo[trig]=triggerInfo[trig];
+        rawEvent->triggerBlock[trig]=triggerBlock[trig];
+    }
+    rawEvent->filterInfo=filterInfo;
+
+    rawEvent->blockVec.resize(numBlocks);
+    for(int block=0;block<numBlocks;block++) {
+        RawAtriStationBlock &rawBlock = rawEvent->blockVec[block];
+        rawBlock.irsBlockNumber=irsBlockNumber[block];
+        rawBlock.channelMask=channelMask[block];
+        rawBlock.numChannels=numChannels[block];
+        rawBlock.data.resize(numChannels[block]);
+        const UShort_t *blockSamples=getBlockSamples(block);
+        for(int chan=0;chan<numChannels[block];chan++) {
+            rawBlock.data[chan].assign(blockSamples+chan*SAMPLES_PER_BLOCK,blockSamples+(chan+1)*SAMPLES_PER_BLOCK);
+        }
+    }
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraAtriColumnarEvent.h        Columnar ATRI event layout          /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Writes and reads RawAtriStationEvent contents as plain leaf   /////
+/////     branches, without the ROOT object streamers                    /////
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARAATRICOLUMNAREVENT_H
+#define ARAATRICOLUMNAREVENT_H
+
+//Includes
+#include <vector>
+#include <TObject.h>
+#include "araSoft.h"
+#include "araAtriStructures.h"
+
+class TTree;
+class RawAtriStationEvent;
+
+#define ATRI_COLUMNAR_MAX_BLOCKS 1024 ///< Most readout blocks one event can hold in the columnar layout
+#define ATRI_COLUMNAR_MAX_SAMPLES (ATRI_COLUMNAR_MAX_BLOCKS*RFCHAN_PER_DDA*SAMPLES_PER_BLOCK) ///< Most samples one event can hold in the columnar layout
+
+//! Part of AraEvent library. A RawAtriStationEvent stored as columns of plain leaf branches
+/*!
+    Instead of a single "event" branch holding a streamed RawAtriStationEvent, the columnar eventTree has
+    one leaf branch per header variable, the block numbers, channel masks and channel counts of the readout blocks as arrays,
+    and every ADC sample of the event in the one UShort_t array "samples" (block after block, channel after channel, SAMPLES_PER_BLOCK each).
+    Reading this needs no object streaming, so full-run passes are limited by decompression rather than deserialisation.
+
+    makeAtriEventTree -c writes this layout. To read it:
+    \code
+    AraAtriColumnarEvent colEvent;
+    colEvent.setBranchAddresses(eventTree);
+    eventTree->GetEntry(entry);
+    for(int block=0;block<colEvent.numBlocks;block++) {
+        const UShort_t *samples = colEvent.getBlockSamples(block); // numChannels[block]*SAMPLES_PER_BLOCK samples
+    }
+    colEvent.fillRawEvent(rawEvent); // or rebuild the RawAtriStationEvent, e.g. for the calibrator
+    \endcode
+    \ingroup rootclasses
+*/
+class AraAtriColumnarEvent
+{
+    public:
+        AraAtriColumnarEvent(); ///< Default constructor
+        ~AraAtriColumnarEvent(); ///< Destructor
+
+        static Bool_t isColumnarTree(TTree *tree); ///< Does the tree have the columnar layout (rather than an "event" branch)
+        void makeBranches(TTree *tree); ///< Creates the columnar branches in a tree that is being written
+        void setBranchAddresses(TTree *tree); ///< Points the columnar branches of a tree that is being read at this object
+        Bool_t setFromRawEvent(const RawAtriStationEvent *rawEvent); ///< Copies a raw event into the columns, before TTree::Fill. Returns kFALSE if the event had to be truncated
+        void fillRawEvent(RawAtriStationEvent *rawEvent) const; ///< Rebuilds the raw event from the columns, reusing the memory of its blocks
+
+        const UShort_t *getBlockSamples(Int_t block) const { return &fSamples[sampleOffset[block]]; } ///< The samples of a readout block, numChannels[block] channels of SAMPLES_PER_BLOCK samples
+        Int_t getBlockDda(Int_t block) const { return (channelMask[block]&0x300)>>8; } ///< As RawAtriStationBlock::getDda
+        Int_t getBlock(Int_t block) const { return irsBlockNumber[block]&0x1ff; } ///< As RawAtriStationBlock::getBlock
+
+        //Generic header
+        UChar_t softVerMajor; ///< Version of AraRoot used to build this ROOT file
+        UChar_t softVerMinor; ///< Version of AraRoot used to build this ROOT file
+        UChar_t typeId; ///< The AraDataStructureType_t
+        UChar_t verId; ///< Software version running on the DAQ SBC
+        UChar_t subVerId; ///< Software version running on the DAQ SBC
+        UChar_t stationId; ///< The station id
+        UShort_t reserved; ///< The filterFlag
+        UInt_t numBytes; ///< Bytes in the generic header record
+        UShort_t checksum; ///< Checksum
+
+        //Event header
+        ULong64_t unixTime; ///< Software event time in seconds
+        UInt_t unixTimeUs; ///< Software event time in microseconds
+        UInt_t eventNumber; ///< Software event number
+        UInt_t ppsNumber; ///< For matching up with thresholds etc.
+        UInt_t numStationBytes; ///< Bytes in station readout
+        UInt_t timeStamp; ///< Timestamp
+        UInt_t eventId; ///< Event Id
+        UShort_t versionId; ///< Version Id for event header
+        UShort_t numReadoutBlocks; ///< Number of readout blocks which follow header
+        UInt_t triggerInfo[MAX_TRIG_BLOCKS]; ///< The trigger pattern
+        UChar_t triggerBlock[MAX_TRIG_BLOCKS]; ///< Which block the triggers occured in
+        UChar_t filterInfo; ///< The filter information
+
+        //Readout blocks
+        Int_t numBlocks; ///< Number of blocks in the arrays below
+        UShort_t irsBlockNumber[ATRI_COLUMNAR_MAX_BLOCKS]; ///< As RawAtriStationBlock::irsBlockNumber
+        UShort_t channelMask[ATRI_COLUMNAR_MAX_BLOCKS]; ///< As RawAtriStationBlock::channelMask
+        UChar_t numChannels[ATRI_COLUMNAR_MAX_BLOCKS]; ///< As RawAtriStationBlock::numChannels
+        Int_t sampleOffset[ATRI_COLUMNAR_MAX_BLOCKS]; ///< Index of the first sample of each block in the samples array
+        Int_t numSamples; ///< Number of samples in fSamples
+
+    private:
+        std::vector<UShort_t> fSamples; ///< All the samples of the event (the "samples" branch), sized to ATRI_COLUMNAR_MAX_SAMPLES so ROOT can read into it
+};
+
+#endif //ARAATRICOLUMNAREVENT_H
@@ -9,6 +9,7 @@
 #include "AraEventCalibrator.h"
 #include "UsefulIcrrStationEvent.h"
 #include "UsefulAtriStationEvent.h"
+#include "RawAtriEventView.h"
 #include "AraGeomTool.h"
 #include "araSoft.h"
 #include "TMath.h"
@@ -21,6 +22,11 @@
 #include <cstdlib>
 #include <sstream>
 #include <numeric>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /*!
     Returns if a calibration type should or should not trim the first block of a waveform., 27-09-2021 -MK-
@@ -201,6 +207,9 @@ ClassImp(AraEventCalibrator);
 
 AraEventCalibrator * AraEventCalibrator::fgInstance=0;
 
+//! Guards the creation of the instance and the loading of the ATRI tables, the tables themselves are read without it
+static std::mutex atriTableMutex;
+
 
 AraEventCalibrator::AraEventCalibrator() 
 {
@@ -208,16 +217,22 @@ AraEventCalibrator::AraEventCalibrator()
     // Loop through and set the got ped / calib flags to zero. This assumes stationId's first n elements
     // are for ICRR stations and the remaining N-n are ATRI
     memset(fGotAtriPedFile,0,sizeof(Int_t)*ATRI_NO_STATIONS);
-    memset(fGotAtriCalibFile,0,sizeof(Int_t)*ATRI_NO_STATIONS);
     memset(gotIcrrPedFile,0,sizeof(Int_t)*ICRR_NO_STATIONS);
     memset(gotIcrrCalibFile,0,sizeof(Int_t)*ICRR_NO_STATIONS);
-    fAtriPeds=0;
 
 
 }
 
 AraEventCalibrator::~AraEventCalibrator() {
     // Default Destructor
+    std::map< Int_t, AraAtriCalibTables* >::iterator tableIt;
+    for(tableIt=fAtriCalibTables.begin();tableIt!=fAtriCalibTables.end();tableIt++) {
+        std::map< AraAtriCalibTables*, size_t >::iterator mapIt = fAtriCalibMappedBytes.find(tableIt->second);
+        if(mapIt!=fAtriCalibMappedBytes.end())
+            munmap((char*)tableIt->second - sizeof(AraAtriCalibCacheHeader_t), mapIt->second);
+        else
+            delete tableIt->second;
+    }
 }
 
 AraEventCalibrator*  AraEventCalibrator::Instance()
@@ -225,6 +240,7 @@ AraEventCalibrator*  AraEventCalibrator::Instance()
     
     // printf("AraEventCalibrator::Instance() creating an instance of the calibrator\n");
     // static function
+    std::lock_guard<std::mutex> lock(atriTableMutex);
     if(fgInstance)
         return fgInstance;
 
@@ -262,18 +278,7 @@ void AraEventCalibrator::loadIcrrPedestals(AraStationId_t stationId)
         char *pedFileEnv = getenv( "ARA_PEDESTAL_FILE" );
         if ( pedFileEnv == NULL ) {
             char calibDir[FILENAME_MAX];
-            char *calibEnv=getenv("ARA_CALIB_DIR");
-            if(!calibEnv) {
-                char *utilEnv=getenv("ARA_UTIL_INSTALL_DIR");
-                if(!utilEnv) {
-                    sprintf(calibDir,"calib");
-                } else {
-                    sprintf(calibDir,"%s/share/araCalib",utilEnv);
-                }
-            }
-            else {
-                strncpy(calibDir,calibEnv,FILENAME_MAX);
-            }
+            getCalibDir(calibDir);
             sprintf(IcrrPedFile[0],"%s/ICRR/TestBed/peds_1294924296.869787.run001202.dat",calibDir);
         } // end of IF-block for pedestal file not specified by environment variable
         else {
@@ -285,18 +290,7 @@ void AraEventCalibrator::loadIcrrPedestals(AraStationId_t stationId)
         char *pedFileEnv = getenv( "ARA_PEDESTAL_FILE" );
         if ( pedFileEnv == NULL ) {
             char calibDir[FILENAME_MAX];
-            char *calibEnv=getenv("ARA_CALIB_DIR");
-            if(!calibEnv) {
-                char *utilEnv=getenv("ARA_UTIL_INSTALL_DIR");
-                if(!utilEnv) {
-                    sprintf(calibDir,"calib");
-                } else {
-                    sprintf(calibDir,"%s/share/araCalib",utilEnv);
-                }
-            }
-            else {
-                strncpy(calibDir,calibEnv,FILENAME_MAX);
-            }
+            getCalibDir(calibDir);
             sprintf(IcrrPedFile[1],"%s/ICRR/Station1/peds_1326108401.602169.run003747.dat",calibDir);
         } // end of IF-block for pedestal file not specified by environment variable
         else {
@@ -708,17 +702,7 @@ void AraEventCalibrator::loadIcrrCalib(AraStationId_t stationId)
     char binWidthFileName[FILENAME_MAX];
     char epsilonFileName[FILENAME_MAX];
     char interleaveFileName[FILENAME_MAX];
-    char *calibEnv=getenv("ARA_CALIB_DIR");
-    if(!calibEnv) {
-        char *utilEnv=getenv("ARA_UTIL_INSTALL_DIR");
-        if(!utilEnv)
-            sprintf(calibDir,"calib");
-        else
-            sprintf(calibDir,"%s/share/araCalib",utilEnv);
-    }
-    else {
-        strncpy(calibDir,calibEnv,FILENAME_MAX);
-    }  
+    getCalibDir(calibDir);
     // Populate the binWidthFileName, epsilonFileName and interleaveFileName variables
     if(stationId==ARA_TESTBED&&gotIcrrCalibFile[0]==0){
         sprintf(binWidthFileName,"%s/ICRR/TestBed/binWidths.txt",calibDir);
@@ -941,35 +925,48 @@ Double_t AraEventCalibrator::estimateClockPeriod(Int_t numPoints, Double_t &rms)
     return meanPeriod;
 }
 
-void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType) 
+void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType, const char *pedFile) 
+{
+    calibrateAtriEvent(theEvent, calType, pedFile, 0);
+}
+
+/*!
+    The calibration steps of calibrateEvent
+    \param theEvent the useful atri event, its header is already filled
+    \param calType the calibration type
+    \param pedFile the pedestal file to use, or 0 for the pedestal file of the station
+    \param view if not 0 the samples are unpacked from the view rather than from the blockVec of theEvent
+    \return void
+*/
+void AraEventCalibrator::calibrateAtriEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType, const char *pedFile, const RawAtriEventView *view)
 {
     // fprintf(stderr, "begin calibrating event\n");//FIXME
 
     //! Modulates calibration step. MK added 27-09-2021
     //! 1st step. Configures basic information (station id, unixtime) and arrays (time,volt, sample index, etc.)
+    //! The samples, their sample numbers and the 'block number' modulo 2 of each block are held in the flat arrays of theEvent
     AraStationId_t thisStationId = theEvent->stationId;
     Double_t unixtime = theEvent->unixTime; ///< The unixtime line was added by UAL 01/26/2019.
-    std::map< Int_t, std::vector <Double_t> >::iterator timeMapIt;
-    std::map< Int_t, std::vector <Double_t> >::iterator voltMapIt;
-    std::vector<std::vector<int> > *sampleList = new std::vector<std::vector<int> >(CHANNELS_PER_ATRI, std::vector<int>(0)); ///< pointer for WF sample numbers
-    std::vector<std::vector<int> > *capArrayList = new std::vector<std::vector<int> >(DDA_PER_ATRI, std::vector<int>(0)); ///< pointer for 'block number' modulo 2
     Bool_t hasTrimFirstBlk = false;
     Bool_t hasTimingCalib = false; 
 
-    //! 2nd step. Loads Tables (Pedestal, Conversion factor, Sample timing) 
-    Int_t calibIndex = AraGeomTool::getStationCalibIndex(thisStationId);
-    //! RJN debug
-    // std::cout << "Station Id fun: " << (int)thisStationId << "\t" << calibIndex << "\n";
-    //! Only load the pedestals / calib if they are not already loaded
-    if(fGotAtriCalibFile[calibIndex]==0){
-        loadAtriCalib(thisStationId, unixtime); ///< Adds unix time to select the new timing table for A3 2019 data. MK added 08-02-2022
-    }
-    if(fGotAtriPedFile[calibIndex]==0){
-        loadAtriPedestals(thisStationId);
+    //! 2nd step. Gets Tables (Pedestal, Conversion factor, Sample timing) 
+    //! They are only loaded the first time a station / pedestal file is seen and are not modified afterwards
+    const AraAtriCalibTables *tables = getAtriCalib(thisStationId, unixtime); ///< Adds unix time to select the new timing table for A3 2019 data. MK added 08-02-2022
+    const UShort_t *peds = getAtriPedestals(thisStationId, pedFile);
+    if(!tables || !peds) {
+        fprintf(stderr, "AraEventCalibrator::calibrateEvent -- ERROR No calibration tables for stationId %i\n", thisStationId);
+        //! A reused event would otherwise still hold the samples of the previous event, so leave it with no channels
+        theEvent->resetFlatStorage();
+        theEvent->fNumChannels=0;
+        theEvent->fTimes.clear();
+        theEvent->fVolts.clear();
+        return;
     }
 
     //! 3rd step. Converts DAQ data format to Electronic channel format
-    UnpackDAQFormatToElecChanFormat(theEvent, voltMapIt, timeMapIt, sampleList, capArrayList);
+    if(view) UnpackDAQFormatToElecChanFormat(theEvent, *view);
+    else UnpackDAQFormatToElecChanFormat(theEvent);
 
     /*! 
 	4th step. Common mode
@@ -979,7 +976,7 @@ void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCal
 	It is placed before TrimFirstBlock() and TimingCalibrationAndBadSampleReomval()
     */
     if(hasCommonMode(calType)) {
-        CommonMode(theEvent, voltMapIt);
+        CommonMode(theEvent);
     }
 
     /*!
@@ -990,18 +987,18 @@ void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCal
     //! 5th step. Erase first block that currupted by trigger
     //! Apply conditioner function here
     if(hasTrimFirstBlock(calType)) {
-        hasTrimFirstBlk = TrimFirstBlock(theEvent, voltMapIt, timeMapIt, sampleList, capArrayList, hasTimingCalib);
+        hasTrimFirstBlk = TrimFirstBlock(theEvent, tables, hasTimingCalib);
     }
 
     //! 6th step. Timing calibration and bad sample removal
     //! This step calibrates the time of each sample and only selecting the samples that have good performance
     if(hasBinWidthCalib(calType)){ 
-        hasTimingCalib = TimingCalibrationAndBadSampleReomval(theEvent, voltMapIt, timeMapIt, sampleList, capArrayList, hasTrimFirstBlk);    
+        hasTimingCalib = TimingCalibrationAndBadSampleReomval(theEvent, tables, hasTrimFirstBlk);    
     }
     
     //! 7th step. Pedestal subtraction
     if(hasPedestalSubtraction(calType)) {
-        PedestalSubtraction(theEvent, voltMapIt, sampleList, calType);
+        PedestalSubtraction(theEvent, peds, calType);
     }
     
     /*!
@@ -1035,12 +1032,12 @@ void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCal
         latest update : 29th Nov2022, PDG is debugging ! 
     */ //do not zero mean if station==4, station==5 
     if(hasADCZeroMean(calType) && thisStationId != 5 && thisStationId != 4) {
-        ApplyZeroMean(theEvent, voltMapIt, capArrayList, hasTrimFirstBlk, hasTimingCalib);
+        ApplyZeroMean(theEvent, tables, hasTrimFirstBlk, hasTimingCalib);
     }
 
     //! 9th step. Voltage calibration
     if(hasVoltCal(calType)) {
-        VoltageCalibration(theEvent, voltMapIt, sampleList, thisStationId);
+        VoltageCalibration(theEvent, tables);
     }
    
     /*! 
@@ -1053,122 +1050,230 @@ void AraEventCalibrator::calibrateEvent(UsefulAtriStationEvent *theEvent, AraCal
         In the future, we might need to re-perform calibration to get a better conversion factor
     */
     if(hasVoltZeroMean(calType)) {
-        ApplyZeroMean(theEvent, voltMapIt, capArrayList, hasTrimFirstBlk, hasTimingCalib);
+        ApplyZeroMean(theEvent, tables, hasTrimFirstBlk, hasTimingCalib);
     }
 
     //! 11th step. Inverts only RF channels = 0,4,8 in A3
     //! Apply conditioner function here
     if (hasInvertA3Chans(calType) && thisStationId ==3) {
-        InvertA3Chans(theEvent, voltMapIt, thisStationId);
+        InvertA3Chans(theEvent, thisStationId);
     }
 
     //! 12th step. Remove knwon cable delay
     //! jpd change 25-03-13
     //! now subtract off the cable delays
     if(hasCableDelays(calType)){
-        ApplyCableDelay(theEvent, timeMapIt, unixtime, thisStationId);
+        ApplyCableDelay(theEvent, unixtime, thisStationId);
     }
 
     //! extra step. return sample index
     if(hasSampleIndex(calType)){
-        ReturnSampleIndex(theEvent, voltMapIt, sampleList);
+        ReturnSampleIndex(theEvent);
     }
  
-    delete sampleList, capArrayList; ///< delete the pointer
+    //! Unless the caller asked for flat storage only, copy the calibrated samples into the fTimes / fVolts maps
+    if(!theEvent->fUseFlatStorage) {
+        theEvent->fillTimeVoltMaps();
+    }
 
     // fprintf(stderr, "AraEventCalibrator::CalibrateEvent() -- finished calibrating event\n");//DEBUG                        
 }
 
-//! Converts DAQ data format to Electronic channel format
 /*!
-    \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param timeMapIt the iterator referring to the time elements in the 2d map container
-    \param sampleList the pointer of WF sample numbers
-    \param capArrayList the pointer of 'block number' modulo 2
+    Calibrate a raw event into an existing UsefulAtriStationEvent, e.g. one event object kept for a whole event loop.
+    The raw part is copy-assigned, so the block vectors, the flat arrays and the fTimes / fVolts vectors keep their storage
+    and nothing is allocated as long as the events do not grow (the number of readout blocks is fixed within a run).
+    The storage mode (see UsefulAtriStationEvent::setFlatStorage) is taken from theEvent.
+*/
+/*!
+    \param rawEvent the raw atri event to be calibrated
+    \param theEvent the useful atri event that is overwritten with the calibrated event
+    \param calType the calibration type
+    \param pedFile the pedestal file to use, or 0 for the pedestal file of the station
     \return void
 */
-void AraEventCalibrator::UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList)
+void AraEventCalibrator::calibrateInto(const RawAtriStationEvent &rawEvent, UsefulAtriStationEvent &theEvent, AraCalType::AraCalType_t calType, const char *pedFile)
 {
+    static_cast<RawAtriStationEvent&>(theEvent) = rawEvent;
+    theEvent.fNumChannels=0;
+    theEvent.fIsConditioned=0;
+    theEvent.fConditioningList.clear();
+    if(theEvent.fUseFlatStorage) {
+        theEvent.fTimes.clear();
+        theEvent.fVolts.clear();
+    }
+    calibrateEvent(&theEvent, calType, pedFile);
+}
+
+/*!
+    Calibrate an event straight from the DAQ buffer. Only the header and the block headers are copied into theEvent
+    (its blocks are left without samples), the samples are unpacked from the view into the flat arrays
+    \param view the raw atri event, read in place
+    \param theEvent the useful atri event that is overwritten with the calibrated event
+    \param calType the calibration type
+    \param pedFile the pedestal file to use, or 0 for the pedestal file of the station
+    \return void
+*/
+void AraEventCalibrator::calibrateInto(const RawAtriEventView &view, UsefulAtriStationEvent &theEvent, AraCalType::AraCalType_t calType, const char *pedFile)
+{
+    view.fillEventHeader(&theEvent);
+    theEvent.fNumChannels=0;
+    theEvent.fIsConditioned=0;
+    theEvent.fConditioningList.clear();
+    if(theEvent.fUseFlatStorage) {
+        theEvent.fTimes.clear();
+        theEvent.fVolts.clear();
+    }
+    calibrateAtriEvent(&theEvent, calType, pedFile, &view);
+}
 
-    int samples_per_block = SAMPLES_PER_BLOCK;
 
-    std::vector<RawAtriStationBlock>::iterator blockIt;
-    std::vector< std::vector<UShort_t> >::iterator vecVecIt;
-    std::vector< UShort_t >::iterator shortIt;
-
-    //! Step one is loop over the blocks 
-    for(blockIt = theEvent->blockVec.begin();
-            blockIt!=theEvent->blockVec.end();
-            blockIt++) {
-        //! Step two is determine the channel Ids
-        Int_t irsChan[8];
-        Int_t numChans=0;
-        for(Int_t bit=0;bit<8;bit++) {
-            Int_t mask=(1<<bit);
-            if((blockIt->channelMask)&mask) {
-                irsChan[numChans]=bit;
-                numChans++;
+namespace {
+
+    //! The blocks of a RawAtriStationEvent, as seen by unpackAtriBlocks
+    struct AtriBlockVecSource {
+        const std::vector<RawAtriStationBlock> &blocks;
+        Int_t getNumBlocks() const { return blocks.size(); }
+        UShort_t getChannelMask(Int_t block) const { return blocks[block].channelMask; }
+        UShort_t getIrsBlockNumber(Int_t block) const { return blocks[block].irsBlockNumber; }
+        Int_t getNumChannels(Int_t block) const { return blocks[block].data.size(); }
+        Int_t getNumSamples(Int_t block, Int_t chan) const { return blocks[block].data[chan].size(); }
+        const UShort_t *getSamples(Int_t block, Int_t chan) const { return blocks[block].data[chan].data(); }
+    };
+
+    //! The blocks of a RawAtriEventView, read in place from the DAQ buffer
+    struct AtriEventViewSource {
+        const RawAtriEventView &view;
+        Int_t getNumBlocks() const { return view.getNumBlocks(); }
+        UShort_t getChannelMask(Int_t block) const { return view.getBlockHeader(block)->channelMask; }
+        UShort_t getIrsBlockNumber(Int_t block) const { return view.getBlockHeader(block)->irsBlockNumber; }
+        Int_t getNumChannels(Int_t block) const { return view.getNumChannels(block); }
+        Int_t getNumSamples(Int_t, Int_t) const { return SAMPLES_PER_BLOCK; }
+        const UShort_t *getSamples(Int_t block, Int_t chan) const { return view.getSamples(block, chan); }
+    };
+
+    //! Unpacks the blocks of source into the flat arrays of theEvent, see AraEventCalibrator::UnpackDAQFormatToElecChanFormat
+    template<class BlockSource> void unpackAtriBlocks(UsefulAtriStationEvent *theEvent, const BlockSource &source)
+    {
+        int samples_per_block = SAMPLES_PER_BLOCK;
+        const Int_t numReadBlocks = source.getNumBlocks();
+
+        //! Step one is to count the samples of each channel and the blocks of each dda
+        Bool_t gotChan[CHANNELS_PER_ATRI] = {false};
+        Int_t chanSamples[CHANNELS_PER_ATRI] = {0};
+        Int_t ddaBlocks[DDA_PER_ATRI] = {0};
+        for(Int_t readBlock=0;readBlock<numReadBlocks;readBlock++) {
+            UShort_t channelMask=source.getChannelMask(readBlock);
+            ddaBlocks[(channelMask&0x300)>>8]++;
+            Int_t uptoChan=0;
+            for(Int_t bit=0;bit<8 && uptoChan<source.getNumChannels(readBlock);bit++) {
+                Int_t mask=(1<<bit);
+                if(channelMask&mask) {
+                    Int_t chanId=bit | ((channelMask&0x300)>>5);
+                    gotChan[chanId]=true;
+                    chanSamples[chanId]+=source.getNumSamples(readBlock, uptoChan);
+                    uptoChan++;
+                }
             }
         }
-        // std::cout << "Got numChans " << numChans << "\n";
-        Int_t dda=blockIt->getDda();
-        Int_t block=blockIt->getBlock();  ///< This is a number between 0 and 511 and is the storage block
-        Int_t capArray=blockIt->getCapArray();
-        capArrayList->at(dda).push_back(capArray);
-
-        //! Step three is loop over the channels within a block
-        Int_t uptoChan=0;
-        for(vecVecIt=blockIt->data.begin();
-            vecVecIt!=blockIt->data.end();
-            vecVecIt++) {
-            Int_t chanId=irsChan[uptoChan] | ((blockIt->channelMask&0x300)>>5);
-            Int_t chan=irsChan[uptoChan];
-
-            // std::cout << "Got chanId " << chanId << "\t" << irsChan[uptoChan] << "\t";
-            // << dda << "\t" << block << "\t" << RawAtriStationEvent::getPedIndex(dda,block,chan,0) << "\n";
-            uptoChan++;
-
-            //! Step four is to check if we have already got this chanId
-            timeMapIt=theEvent->fTimes.find(chanId);
-            Double_t time=0;
-            Int_t firstTime=1;
-            if(timeMapIt==theEvent->fTimes.end()) {
-                //! First time round for this channel
-                std::vector <Double_t> tempTimes;
-                std::vector <Double_t> tempVolts;
-                //! Now need to insert empty vector into map
-                theEvent->fTimes.insert( std::pair< Int_t, std::vector <Double_t> >(chanId,tempTimes));
-                theEvent->fVolts.insert( std::pair< Int_t, std::vector <Double_t> >(chanId,tempVolts));
-                theEvent->fNumChannels++;
-            }
-            else {
-                //! Just get the last time
-                time=timeMapIt->second.back();
-                // if(dda==1 &&chan==1)
-                // std::cout << "Last time " << time << "\t" << timeMapIt->second.size() << "\n";
-                firstTime=0;
-            }
-   
-            //! Set the iterators to point to the correct channel in the map
-            timeMapIt=theEvent->fTimes.find(chanId);
-            voltMapIt=theEvent->fVolts.find(chanId);
-
-            int samp=0;
-            //! Now loop over the 64 samples
-            for(shortIt=vecVecIt->begin();
-                shortIt!=vecVecIt->end();
-                shortIt++){
-
-                time+=NSPERSAMP_ATRI;
-                timeMapIt->second.push_back(time); ///< Filling with time
-                voltMapIt->second.push_back((*shortIt)); ///< Filling with volts
-                sampleList->at(chanId).push_back(block * samples_per_block + samp); ///< Filling with sample number. It is needed for pedestal subtraction and voltage calibration
-                samp++;
 
+        //! Step two is to lay the channels out back to back in the flat arrays
+        theEvent->resetFlatStorage();
+        Int_t numSamples=0;
+        for(Int_t chanId=0;chanId<CHANNELS_PER_ATRI;chanId++) {
+            if(!gotChan[chanId]) continue;
+            theEvent->fFlatOffset[chanId]=numSamples;
+            numSamples+=chanSamples[chanId];
+            theEvent->fNumChannels++;
+        }
+        if((Int_t)theEvent->fFlatTimes.size()<numSamples) {
+            theEvent->fFlatTimes.resize(numSamples);
+            theEvent->fFlatVolts.resize(numSamples);
+            theEvent->fFlatSampleIndex.resize(numSamples);
+        }
+        Int_t numBlocks=0;
+        for(Int_t dda=0;dda<DDA_PER_ATRI;dda++) {
+            theEvent->fFlatCapArrayOffset[dda]=numBlocks;
+            numBlocks+=ddaBlocks[dda];
+        }
+        if((Int_t)theEvent->fFlatCapArray.size()<numBlocks) {
+            theEvent->fFlatCapArray.resize(numBlocks);
+        }
+
+        //! Step three is loop over the blocks 
+        for(Int_t readBlock=0;readBlock<numReadBlocks;readBlock++) {
+            UShort_t channelMask=source.getChannelMask(readBlock);
+            UShort_t irsBlockNumber=source.getIrsBlockNumber(readBlock);
+            //! Step four is determine the channel Ids
+            Int_t irsChan[8];
+            Int_t numChans=0;
+            for(Int_t bit=0;bit<8;bit++) {
+                Int_t mask=(1<<bit);
+                if(channelMask&mask) {
+                    irsChan[numChans]=bit;
+                    numChans++;
+                }
+            }
+            // std::cout << "Got numChans " << numChans << "\n";
+            Int_t dda=(channelMask&0x300)>>8; ///< As RawAtriStationBlock::getDda
+            Int_t block=irsBlockNumber&0x1ff;  ///< This is a number between 0 and 511 and is the storage block
+            Int_t capArray=irsBlockNumber&0x1; ///< As RawAtriStationBlock::getCapArray
+            theEvent->fFlatCapArray[theEvent->fFlatCapArrayOffset[dda]+theEvent->fFlatNumBlocks[dda]]=capArray;
+            theEvent->fFlatNumBlocks[dda]++;
+
+            //! Step five is loop over the channels within a block
+            for(Int_t uptoChan=0;uptoChan<numChans && uptoChan<source.getNumChannels(readBlock);uptoChan++) {
+                Int_t chanId=irsChan[uptoChan] | ((channelMask&0x300)>>5);
+                const UShort_t *samples = source.getSamples(readBlock, uptoChan);
+
+                //! Carry on from the last time of this channel, if we have already got some of its samples
+                Int_t upto=theEvent->fFlatOffset[chanId]+theEvent->fFlatNumSamples[chanId];
+                Double_t time=0;
+                if(theEvent->fFlatNumSamples[chanId]>0) {
+                    time=theEvent->fFlatTimes[upto-1];
+                }
+                Double_t *times=theEvent->fFlatTimes.data()+upto;
+                Double_t *volts=theEvent->fFlatVolts.data()+upto;
+                Int_t *samps=theEvent->fFlatSampleIndex.data()+upto;
+
+                //! Now loop over the 64 samples
+                Int_t numInBlock=source.getNumSamples(readBlock, uptoChan);
+                for(int samp=0;samp<numInBlock;samp++) {
+                    time+=NSPERSAMP_ATRI;
+                    times[samp]=time; ///< Filling with time
+                    volts[samp]=samples[samp]; ///< Filling with volts
+                    samps[samp]=block * samples_per_block + samp; ///< Filling with sample number. It is needed for pedestal subtraction and voltage calibration
+                }
+                theEvent->fFlatNumSamples[chanId]+=numInBlock;
             }
         }
     }
+
+}
+
+//! Converts DAQ data format to Electronic channel format
+/*!
+    The samples are unpacked into the flat arrays of theEvent. A first pass over the blocks counts the samples of each channel,
+    so every channel gets one contiguous range and the arrays are only grown when an event is bigger than any seen before
+    \param theEvent the useful atri event pointer
+    \return void
+*/
+void AraEventCalibrator::UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent)
+{
+    AtriBlockVecSource source = {theEvent->blockVec};
+    unpackAtriBlocks(theEvent, source);
+}
+
+//! Converts DAQ data format to Electronic channel format, reading the samples in place from the DAQ buffer
+/*!
+    \param theEvent the useful atri event pointer
+    \param view the raw event, only its samples are read
+    \return void
+*/
+void AraEventCalibrator::UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent, const RawAtriEventView &view)
+{
+    AtriEventViewSource source = {view};
+    unpackAtriBlocks(theEvent, source);
 }
 
 /*! 
@@ -1176,104 +1281,278 @@ void AraEventCalibrator::UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent
     This step calibrates the time of each sample and only selecting the samples that have good performance
     fAtriSampleIndex and fAtriSampleTimes stores the sample numbers and times that have good performance
     Based on the sample numbers in the tables, this step will remove bad samples from WF
-    The sampleList that contains the sample number of WF will be updated by the good performance sample numbers 
-    This sampleList will be used for calling the right pedestal subtraction samples and the conversion factor samples 
+    The sample numbers of WF will be updated by the good performance sample numbers 
+    These sample numbers will be used for calling the right pedestal subtraction samples and the conversion factor samples 
+    The good samples of a block never land after the block itself, so the flat arrays are compacted in place
 */
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param timeMapIt the iterator referring to the time elements in the 2d map container
-    \param sampleList the pointer of WF sample numbers
-    \param capArrayList the pointer of 'block number' modulo 2
+    \param tables the calibration tables of the station
     \param hasTrimFirstBlk boolean statement that whether first block trimming is already performed or not
     \return boolean true or false
 */
-Bool_t AraEventCalibrator::TimingCalibrationAndBadSampleReomval(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList, Bool_t hasTrimFirstBlk)
+Bool_t AraEventCalibrator::TimingCalibrationAndBadSampleReomval(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTrimFirstBlk)
 {
  
     int capArrayNumber = 0;
     int samples_per_block = SAMPLES_PER_BLOCK;
 
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
+        const Int_t *capArrays = theEvent->fFlatCapArray.data()+theEvent->fFlatCapArrayOffset[dda];
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda; ///< make electronic channel number
-            voltMapIt=theEvent->fVolts.find(chanId);
-            timeMapIt=theEvent->fTimes.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-               
-                //! copy the voltage and sample index in temperary array and clear them before filling with calibrated values
-                std::vector<double> tempVolts;
-                tempVolts = voltMapIt->second;
-                voltMapIt->second.clear();
-                timeMapIt->second.clear();
-                std::vector<int> tempSamps;
-                tempSamps = sampleList->at(chanId);
-                sampleList->at(chanId).clear();
-           
-                int numBlock = int(numPoints/samples_per_block); 
-                for(int blk=0; blk<numBlock; blk++){
-                    capArrayNumber = capArrayList->at(dda)[blk];
- 
-                    //! array that stores trimmed values based on the sample indexes in the fAtriSampleIndex table
-                    int voltIndex[samples_per_block];
-                    Double_t tempTimes[samples_per_block];
-
-                    for (int samp=0; samp<samples_per_block; samp++){
-                        //! Select index and time of well calibrated samples from the tables
-                        voltIndex[samp] = fAtriSampleIndex[dda][chan][capArrayNumber][samp] + blk * samples_per_block;
-                        tempTimes[samp] = (blk + hasTrimFirstBlk) * 20.0 + fAtriSampleTimes[dda][chan][capArrayNumber][samp] - 20.0*capArrayNumber; ///< hasTrimFirstBlk will take into account whether first block is trimmed or not
-                    }   
-         
-                    Int_t numSamples=fAtriNumSamples[dda][chan][capArrayNumber]; ///< number of samples in each block after timing calibration
-                    for (int trim=0; trim<numSamples; trim++){
-                        timeMapIt->second.push_back(tempTimes[trim]); ///< Filling with time
-                        voltMapIt->second.push_back(tempVolts[voltIndex[trim]]); ///< Filling with volt
-                        sampleList->at(chanId).push_back(tempSamps[voltIndex[trim]]); ///< Filling with sample index
-                    }
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            Double_t *times=theEvent->fFlatTimes.data()+theEvent->fFlatOffset[chanId];
+            Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
+            Int_t *samps=theEvent->fFlatSampleIndex.data()+theEvent->fFlatOffset[chanId];
+
+            Int_t numTrimmed=0;
+            int numBlock = int(numPoints/samples_per_block); 
+            for(int blk=0; blk<numBlock; blk++){
+                capArrayNumber = capArrays[blk];
+
+                //! copy the voltage and sample index of the block before overwriting them with calibrated values
+                Double_t blockVolts[SAMPLES_PER_BLOCK];
+                Int_t blockSamps[SAMPLES_PER_BLOCK];
+                for (int samp=0; samp<samples_per_block; samp++){
+                    blockVolts[samp] = volts[blk * samples_per_block + samp];
+                    blockSamps[samp] = samps[blk * samples_per_block + samp];
                 }
-            } 
+     
+                Int_t numSamples=tables->fAtriNumSamples[dda][chan][capArrayNumber]; ///< number of samples in each block after timing calibration
+                for (int trim=0; trim<numSamples; trim++){
+                    //! Select index and time of well calibrated samples from the tables
+                    Int_t voltIndex = tables->fAtriSampleIndex[dda][chan][capArrayNumber][trim];
+                    times[numTrimmed] = (blk + hasTrimFirstBlk) * 20.0 + tables->fAtriSampleTimes[dda][chan][capArrayNumber][trim] - 20.0*capArrayNumber; ///< hasTrimFirstBlk will take into account whether first block is trimmed or not
+                    volts[numTrimmed] = blockVolts[voltIndex]; ///< Filling with volt
+                    samps[numTrimmed] = blockSamps[voltIndex]; ///< Filling with sample index
+                    numTrimmed++;
+                }
+            }
+            theEvent->fFlatNumSamples[chanId]=numTrimmed;
         }
     }
     return true;
 }
 
+/*!
+    The per-sample loops of the calibration steps below run through these kernels.
+    Each kernel is compiled once for AVX2 and once for the baseline instruction set and the
+    version is picked at run time from the CPU (ARA_CALIB_NO_SIMD=1 forces the baseline one).
+    Both versions do the same operations in the same order, so they give identical results.
+    The samples stay in double precision as the calibrated waveforms are stored as Double_t.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ATRI_HAVE_AVX2_KERNELS
+#define ATRI_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define ATRI_KERNEL_INLINE inline
+#endif
+
+//! Is the channel one of the RF channels that have voltage calibration factors
+static inline Bool_t isAtriVoltsCalibChan(int dda, int chan)
+{
+    return (dda==0 && chan<6)||(dda==1 && chan<4)||(dda==2 && chan<4)||(dda==3 && chan<6);
+}
+
+//! The station dependent settings of the ADC to mV conversion
+/*!
+    There is an offset induced in the pedestal numbers, due to asymmetry of the chip. 
+    From calibration files this offset with the given noise will be around 11 ADC counts.
+    If it's not station 5, subtract an offset of 11. (THM)
+    \param stationId id of the station
+    \param isA4A5 filled with whether the A4/A5 style conversion (fits around the zero value, no high ADC calibration) is used
+    \param adc_offset filled with the ADC offset
+    \param high_adc_limit filled with the ADC count above which the polynomial fit is not used (MK)
+*/
+static void getAtriVoltsCalibSettings(AraStationId_t stationId, Bool_t &isA4A5, double &adc_offset, int &high_adc_limit)
+{
+    isA4A5 = (stationId == 5 || stationId == 4);
+    if (stationId == 4) {
+        high_adc_limit = 600; // only for ARA 4
+        adc_offset = 0.0; // only for ARA 4 
+    } else if (stationId == 5) {
+        high_adc_limit = 500;
+        adc_offset = 0.0;
+    } else {
+        high_adc_limit = 400;
+        adc_offset = -11.0;
+    }
+}
+
+//! Converts one ADC count to mV with the conversion factors of one capacitor
+/*!
+    Each conversion parameter in conv: pos_fit_x, pos_fit_x^2, pos_fit_x^3, neg_fit_x, neg_fit_x^2, neg_fit_x^3, fit_const, zeroval, chi2
+    Each conversion parameter in highConv: pos_fit_const, pos_fit_x, neg_fit_const, neg_fit_x
+*/
+static inline Double_t atriAdcToMilliVolts(Double_t adcCountsIn, const Double_t *conv, const Double_t *highConv, Bool_t isA4A5, double adc_offset, int high_adc_limit)
+{
+    Double_t volts;
+
+    //! Offset needs to be subtracted
+    double adcCounts = adcCountsIn + adc_offset;
+
+    //! Start ADC to voltage conversion
+    if(TMath::Abs(adcCounts)<high_adc_limit){
+        //! conversion factors for higher ADC values have strong errors, therefore we need the alternative calibration (see below)
+        //! RJN chnaged the below to remove calls to pow for code optimisation
+        double modAdcCounts=adcCounts-conv[7];
+
+        Double_t fit_const; ///< Define the fit_const here (MK)
+        double adc_zero_def; ///< Define which value will be used to choose a positive or negative conversion
+        //! new  29th Nov2022
+        if (isA4A5) {
+            fit_const = 0.0; // fit const for A5 and A4
+            adc_zero_def = modAdcCounts;
+        } else {
+            fit_const = conv[6];
+            adc_zero_def = adcCounts;
+        }
+
+        //! positive and negative values need different calibration constants
+        const Double_t *fit = (adc_zero_def>0) ? conv : conv+3;
+        volts = fit_const
+            +modAdcCounts*fit[0]
+            +modAdcCounts*modAdcCounts*fit[1]
+            +modAdcCounts*modAdcCounts*modAdcCounts*fit[2];
+
+        /*!
+            For A5, since there is no high ADC calibration data, use ADC count
+            If ADC count between -500 ~ 500 is converted to over 800 mV, this condition decides to use just ADC value instead of the conversion result
+            It seems ADC values between -400 ~ 400 are not converted to over 800 millivolts on A2/3
+            Related talk: https://aradocs.wipac.wisc.edu/cgi-bin/DocDB/ShowDocument?docid=2464 (slide 16 ~17)
+            I leave this condition just for A5 -MK-
+        */
+        if (isA4A5 && volts > 800) volts=modAdcCounts;
+    }
+    else if (isA4A5) {
+        /*!
+            For A5, since there is no high ADC calibration data, use ADC count for conervison result in case A5 encount high ADC count
+            Similarly for A4, since no high ADC calib data is available, we use ADC count for the corresponding voltage result for high ADC count
+        */
+        volts = adcCounts;
+    }
+    else {
+        //! here is the alternative calibration (used only for A2 and A3) if the ADC count exceeds 400
+        if(adcCounts>0) volts = highConv[0] + adcCounts*highConv[1];
+        else volts = highConv[2] + adcCounts*highConv[3];
+    }
+    return volts;
+}
+
+//! Subtracts (or with onlyPed, fills in) the pedestals of one channel, one block of samples at a time
+static ATRI_KERNEL_INLINE void atriPedestalKernel(Double_t * __restrict volts, const Int_t * __restrict samps, int numPoints, const UShort_t * __restrict chanPeds, Bool_t onlyPed)
+{
+    const int pedsPerBlock = RFCHAN_PER_DDA*SAMPLES_PER_BLOCK; ///< distance between the pedestals of consecutive blocks of one channel
+    int samp=0;
+    while(samp<numPoints) {
+        //! the samples of one block are consecutive, find where the block ends
+        int block = samps[samp]/SAMPLES_PER_BLOCK;
+        int blockEnd = samp+1;
+        while(blockEnd<numPoints && samps[blockEnd]/SAMPLES_PER_BLOCK==block) blockEnd++;
+        const UShort_t *blockPeds = chanPeds + block*pedsPerBlock - block*SAMPLES_PER_BLOCK; ///< indexed by the capacitor sample index
+        if(onlyPed) {
+            for(int i=samp;i<blockEnd;i++) volts[i] = blockPeds[samps[i]];
+        }
+        else {
+            for(int i=samp;i<blockEnd;i++) volts[i] -= blockPeds[samps[i]];
+        }
+        samp=blockEnd;
+    }
+}
+
+//! Multiplies the samples by factor
+static ATRI_KERNEL_INLINE void atriScaleKernel(Double_t * __restrict volts, int numPoints, Double_t factor)
+{
+    for(int samp=0;samp<numPoints;samp++) volts[samp]*=factor;
+}
+
+//! Subtracts the mean of the samples from first on from all samples
+static ATRI_KERNEL_INLINE void atriZeroMeanKernel(Double_t * __restrict volts, int first, int numPoints)
+{
+    //! summed in order, as std::accumulate did, so the means are bit-identical to the map based calibration
+    Double_t mean = 0;
+    for(int samp=first;samp<numPoints;samp++) mean+=volts[samp];
+    mean /= (numPoints-first);
+    for(int samp=0;samp<numPoints;samp++) volts[samp]-=mean;
+}
+
+//! Converts the ADC counts of one calibrated channel to mV
+static ATRI_KERNEL_INLINE void atriVoltsKernel(Double_t * __restrict volts, const Int_t * __restrict samps, int numPoints,
+    const UShort_t (*calibIndex)[SAMPLES_PER_BLOCK], const Double_t (*conv)[SAMPLES_PER_BLOCK][9], const Double_t (*highConv)[SAMPLES_PER_BLOCK][5],
+    Bool_t isA4A5, double adc_offset, int high_adc_limit)
+{
+    for(int samp=0;samp<numPoints;samp++) {
+        int sampleIndex = samps[samp]; ///< capacitor sample index
+        int index = calibIndex[sampleIndex/SAMPLES_PER_BLOCK][sampleIndex%SAMPLES_PER_BLOCK];
+        volts[samp] = atriAdcToMilliVolts(volts[samp], conv[index/SAMPLES_PER_BLOCK][index%SAMPLES_PER_BLOCK], highConv[index/SAMPLES_PER_BLOCK][index%SAMPLES_PER_BLOCK],
+            isA4A5, adc_offset, high_adc_limit);
+    }
+}
+
+//! The kernels of one instruction set
+typedef struct {
+    void (*pedestal)(Double_t*, const Int_t*, int, const UShort_t*, Bool_t);
+    void (*scale)(Double_t*, int, Double_t);
+    void (*zeroMean)(Double_t*, int, int);
+    void (*volts)(Double_t*, const Int_t*, int, const UShort_t (*)[SAMPLES_PER_BLOCK], const Double_t (*)[SAMPLES_PER_BLOCK][9], const Double_t (*)[SAMPLES_PER_BLOCK][5], Bool_t, double, int);
+} AtriCalibKernels_t;
+
+static void atriPedestalScalar(Double_t *volts, const Int_t *samps, int numPoints, const UShort_t *chanPeds, Bool_t onlyPed) { atriPedestalKernel(volts, samps, numPoints, chanPeds, onlyPed); }
+static void atriScaleScalar(Double_t *volts, int numPoints, Double_t factor) { atriScaleKernel(volts, numPoints, factor); }
+static void atriZeroMeanScalar(Double_t *volts, int first, int numPoints) { atriZeroMeanKernel(volts, first, numPoints); }
+static void atriVoltsScalar(Double_t *volts, const Int_t *samps, int numPoints, const UShort_t (*calibIndex)[SAMPLES_PER_BLOCK], const Double_t (*conv)[SAMPLES_PER_BLOCK][9], const Double_t (*highConv)[SAMPLES_PER_BLOCK][5], Bool_t isA4A5, double adc_offset, int high_adc_limit)
+{ atriVoltsKernel(volts, samps, numPoints, calibIndex, conv, highConv, isA4A5, adc_offset, high_adc_limit); }
+
+#ifdef ATRI_HAVE_AVX2_KERNELS
+__attribute__((target("avx2"))) static void atriPedestalAvx2(Double_t *volts, const Int_t *samps, int numPoints, const UShort_t *chanPeds, Bool_t onlyPed) { atriPedestalKernel(volts, samps, numPoints, chanPeds, onlyPed); }
+__attribute__((target("avx2"))) static void atriScaleAvx2(Double_t *volts, int numPoints, Double_t factor) { atriScaleKernel(volts, numPoints, factor); }
+__attribute__((target("avx2"))) static void atriZeroMeanAvx2(Double_t *volts, int first, int numPoints) { atriZeroMeanKernel(volts, first, numPoints); }
+__attribute__((target("avx2"))) static void atriVoltsAvx2(Double_t *volts, const Int_t *samps, int numPoints, const UShort_t (*calibIndex)[SAMPLES_PER_BLOCK], const Double_t (*conv)[SAMPLES_PER_BLOCK][9], const Double_t (*highConv)[SAMPLES_PER_BLOCK][5], Bool_t isA4A5, double adc_offset, int high_adc_limit)
+{ atriVoltsKernel(volts, samps, numPoints, calibIndex, conv, highConv, isA4A5, adc_offset, high_adc_limit); }
+#endif
+
+//! Returns the kernels for this CPU, chosen on the first call
+static const AtriCalibKernels_t &getAtriCalibKernels()
+{
+    static const AtriCalibKernels_t kernels = []() {
+        AtriCalibKernels_t chosen = { atriPedestalScalar, atriScaleScalar, atriZeroMeanScalar, atriVoltsScalar };
+#ifdef ATRI_HAVE_AVX2_KERNELS
+        const char *noSimdEnv = getenv("ARA_CALIB_NO_SIMD");
+        if((!noSimdEnv || atoi(noSimdEnv)==0) && __builtin_cpu_supports("avx2")) {
+            AtriCalibKernels_t avx2 = { atriPedestalAvx2, atriScaleAvx2, atriZeroMeanAvx2, atriVoltsAvx2 };
+            chosen = avx2;
+        }
+#endif
+        return chosen;
+    }();
+    return kernels;
+}
+
 //! Pedestal subtraction
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param sampleList the pointer of WF sample numbers
+    \param peds the pedestals, indexed by RawAtriStationEvent::getPedIndex
+    \param calType the calibration type, kOnlyPed~ replaces the samples with the pedestal values
 */
-void AraEventCalibrator::PedestalSubtraction(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList, AraCalType::AraCalType_t calType)
+void AraEventCalibrator::PedestalSubtraction(UsefulAtriStationEvent *theEvent, const UShort_t *peds, AraCalType::AraCalType_t calType)
 {
-
-    int sampleIndex, sampleNumber, blockIndex = 0; ///< capacitor sample index, block sample index, capacitor block index
-    int samples_per_block = SAMPLES_PER_BLOCK;
+    //! Filling with the pedestal values for the corresponding raw WF, 19-12-2021 -MK-
+    //! Otherwise filling with ADC-Pedestal. Iunputted pedestal will be stored in fAtriPedTables 
+    Bool_t onlyPed = (calType==AraCalType::kOnlyPed
+                    || calType==AraCalType::kOnlyPedWithOut1stBlock
+                    || calType==AraCalType::kOnlyPedWithOut1stBlockAndBadSamples);
+    const AtriCalibKernels_t &kernels = getAtriCalibKernels();
 
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda; ///< make electronic channel number
-            voltMapIt=theEvent->fVolts.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-                if(calType==AraCalType::kOnlyPed
-                    || calType==AraCalType::kOnlyPedWithOut1stBlock
-                    || calType==AraCalType::kOnlyPedWithOut1stBlockAndBadSamples)
-                { voltMapIt->second.clear(); } ///< clear voltMapIt iterator before filling with pedestal values
-
-                for(int samp=0;samp<numPoints;samp++) {
-                    sampleIndex = sampleList->at(chanId)[samp];
-                    sampleNumber = sampleIndex%samples_per_block;
-                    blockIndex = int(sampleIndex/samples_per_block);
-                    //! Filling with the pedestal values for the corresponding raw WF, 19-12-2021 -MK-
-                    if(calType==AraCalType::kOnlyPed 
-                        || calType==AraCalType::kOnlyPedWithOut1stBlock 
-                        || calType==AraCalType::kOnlyPedWithOut1stBlockAndBadSamples) 
-                    { voltMapIt->second.push_back((Int_t)fAtriPeds[RawAtriStationEvent::getPedIndex(dda,blockIndex,chan,sampleNumber)]);
-                    //! Filling with ADC-Pedestal. Iunputted pedestal will be stored in fAtriPeds table 
-                    } else { voltMapIt->second[samp] -= (Int_t)fAtriPeds[RawAtriStationEvent::getPedIndex(dda,blockIndex,chan,sampleNumber)]; }
-                }
-            }
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
+            const Int_t *samps=theEvent->fFlatSampleIndex.data()+theEvent->fFlatOffset[chanId];
+            kernels.pedestal(volts, samps, numPoints, peds+RawAtriStationEvent::getPedIndex(dda,0,chan,0), onlyPed);
         }
     }
 }
@@ -1281,25 +1560,16 @@ void AraEventCalibrator::PedestalSubtraction(UsefulAtriStationEvent *theEvent, s
 //! Return sample index. If user use below options, user can check which analog buffer regions were used to record the event. 26-11-2022 -MK-
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param sampleList the pointer of WF sample numbers
 */
-void AraEventCalibrator::ReturnSampleIndex(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList)
+void AraEventCalibrator::ReturnSampleIndex(UsefulAtriStationEvent *theEvent)
 {
-    int sampleIndex = 0; ///< capacitor sample index
-
-    for(int dda=0;dda<DDA_PER_ATRI;dda++) {
-        for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
-            Int_t chanId=chan+RFCHAN_PER_DDA*dda; ///< make electronic channel number
-            voltMapIt=theEvent->fVolts.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-                voltMapIt->second.clear(); ///< clear voltMapIt iterator before filling with sample index values
-                for(int samp=0;samp<numPoints;samp++) {
-                    sampleIndex = sampleList->at(chanId)[samp];
-                    voltMapIt->second.push_back(sampleIndex);
-                }
-            }
+    for(int chanId=0;chanId<CHANNELS_PER_ATRI;chanId++) {
+        if(theEvent->fFlatOffset[chanId]<0) continue;
+        Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+        Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
+        const Int_t *samps=theEvent->fFlatSampleIndex.data()+theEvent->fFlatOffset[chanId];
+        for(int samp=0;samp<numPoints;samp++) {
+            volts[samp] = samps[samp]; ///< replace the volts with the capacitor sample index
         }
     }
 }
@@ -1307,31 +1577,33 @@ void AraEventCalibrator::ReturnSampleIndex(UsefulAtriStationEvent *theEvent, std
 //! Voltage calibration. Converts ADC to voltage sample by sample
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param stationId id of the station
+    \param tables the calibration tables of the station
     \return void
 */
-void AraEventCalibrator::VoltageCalibration(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList, AraStationId_t thisStationId)
+void AraEventCalibrator::VoltageCalibration(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables)
 {
-    int blockIndex = 0;///< This is now filled in the code below- KAH
-    int sampleIndex, sampleNumber = 0; ///< removed this and instead use "samp" variable below. re-use this for the trimmed sample index -MK-
-    int samples_per_block = SAMPLES_PER_BLOCK;
+    //! The station settings and the neighbour substitution are resolved once, so the sample loop is just a lookup and a polynomial
+    Bool_t isA4A5;
+    double adc_offset;
+    int high_adc_limit;
+    getAtriVoltsCalibSettings(tables->fStationId, isA4A5, adc_offset, high_adc_limit);
+    const AtriCalibKernels_t &kernels = getAtriCalibKernels();
 
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda;
-            voltMapIt=theEvent->fVolts.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-                for(int samp=0;samp<numPoints;samp++) {
-                    sampleIndex = sampleList->at(chanId)[samp]; ///< capacitor sample index
-                    sampleNumber = sampleIndex%samples_per_block; ///< block sample index
-                    blockIndex = int(sampleIndex/samples_per_block); ///< capacitor block index
-                    //! Move to conversion function
-                    //! Apply conversion parameter on each sample
-                    voltMapIt->second[samp] = convertADCtoMilliVolts( voltMapIt->second[samp], dda, blockIndex, chan, sampleNumber, thisStationId);
-                }
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
+            const Int_t *samps=theEvent->fFlatSampleIndex.data()+theEvent->fFlatOffset[chanId];
+            if(!isAtriVoltsCalibChan(dda, chan)) {
+                for(int samp=0;samp<numPoints;samp++) volts[samp] += adc_offset;
+                continue;
             }
+            //! Apply the conversion parameter of the resolved capacitor on each sample
+            kernels.volts(volts, samps, numPoints, tables->fAtriVoltsCalibIndex[dda][chan],
+                tables->fAtriSampleADCVoltsConversion[dda][chan], tables->fAtriSampleHighADCVoltsConversion[dda][chan],
+                isA4A5, adc_offset, high_adc_limit);
         }
     }
 }
@@ -1340,44 +1612,37 @@ void AraEventCalibrator::VoltageCalibration(UsefulAtriStationEvent *theEvent, st
 //! Apply Brian's conditioner inside of calibration
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
     \param stationId id of the station
     \return void
 */
-void AraEventCalibrator::InvertA3Chans(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, AraStationId_t thisStationId)
+void AraEventCalibrator::InvertA3Chans(UsefulAtriStationEvent *theEvent, AraStationId_t thisStationId)
 {
     
-    std::vector<Int_t> list_to_invert;
-    list_to_invert.push_back(0);
-    list_to_invert.push_back(4);
-    list_to_invert.push_back(8);
+    const Int_t list_to_invert[3] = {0, 4, 8};
 
     //! loop over that list and invert them (multiply by -1)
-    for(int i=0; i<list_to_invert.size(); i++){
+    for(int i=0; i<3; i++){
         //! get the elec chan
         Int_t rf_chan = list_to_invert[i];
         Int_t elec_chan = AraGeomTool::Instance()->getElecChanFromRFChan(rf_chan, thisStationId);
- 
-        voltMapIt=theEvent->fVolts.find(elec_chan);
-        if(voltMapIt!=theEvent->fVolts.end()) {
-            Int_t numPoints=(voltMapIt->second).size();
-           
-            //! perform inversion on every sample
-            for(int samp=0;samp<numPoints;samp++) {
-                voltMapIt->second[samp]*=-1.;
-            }
-        }
+        if(elec_chan<0 || elec_chan>=CHANNELS_PER_ATRI || theEvent->fFlatOffset[elec_chan]<0) continue;
+
+        Int_t numPoints=theEvent->fFlatNumSamples[elec_chan];
+        Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[elec_chan];
+       
+        //! perform inversion on every sample
+        getAtriCalibKernels().scale(volts, numPoints, -1.);
     }
 }
 
 //! Remove knwon cable delay
 /*!
     \param theEvent the useful atri event pointer
-    \param timeMapIt the iterator referring to the time elements in the 2d map container
+    \param unixtime the event time, used to pick the geometry
     \param stationId id of the station
     \return void
 */
-void AraEventCalibrator::ApplyCableDelay(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, Double_t unixtime, AraStationId_t thisStationId)
+void AraEventCalibrator::ApplyCableDelay(UsefulAtriStationEvent *theEvent, Double_t unixtime, AraStationId_t thisStationId)
 {
     
     for(int rfChan=0;rfChan<ANTS_PER_ATRI;rfChan++){
@@ -1385,27 +1650,24 @@ void AraEventCalibrator::ApplyCableDelay(UsefulAtriStationEvent *theEvent, std::
         tempGeom->LoadSQLDbAtri(unixtime,thisStationId); ///< LoadSQLDbAtri() added by UAL 01/25/2019
         Double_t delay=tempGeom->getStationInfo(thisStationId)->getCableDelay(rfChan);
         int chanId = tempGeom->getElecChanFromRFChan(rfChan, thisStationId);
-        timeMapIt=theEvent->fTimes.find(chanId);
-        if(timeMapIt!=theEvent->fTimes.end()) {
-            Int_t numPoints = (timeMapIt->second).size();
-            for(int samp=0;samp<numPoints;samp++){
-                timeMapIt->second[samp]-=delay;
-            }
+        if(chanId<0 || chanId>=CHANNELS_PER_ATRI || theEvent->fFlatOffset[chanId]<0) continue;
+        Int_t numPoints = theEvent->fFlatNumSamples[chanId];
+        Double_t *times=theEvent->fFlatTimes.data()+theEvent->fFlatOffset[chanId];
+        for(int samp=0;samp<numPoints;samp++){
+            times[samp]-=delay;
         }
     }
 }
 
 //! Erase first block that currupted by trigger
 /*!
+    In the flat arrays this only moves the start of each channel (and of each dda's block list) past the first block
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
-    \param timeMapIt the iterator referring to the time elements in the 2d map container
-    \param sampleList the pointer of WF sample number
-    \param capArrayList the pointer of  'block number' modulo 2
+    \param tables the calibration tables of the station
     \param hasTimingCalib boolean statement that whether TimingCalibrationAndBadSampleReomval is already performed or not
     \return boolean true or false
 */
-Bool_t AraEventCalibrator::TrimFirstBlock(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList, Bool_t hasTimingCalib)
+Bool_t AraEventCalibrator::TrimFirstBlock(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTimingCalib)
 {
 
     int first_block_len = 0;
@@ -1414,21 +1676,20 @@ Bool_t AraEventCalibrator::TrimFirstBlock(UsefulAtriStationEvent *theEvent, std:
     //! check if number of total samples are smaller than number of samples in the first block
     bool hasTooFewBlocks=false;
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
-        first_capNumber = capArrayList->at(dda)[0];
+        if(theEvent->fFlatNumBlocks[dda]==0) continue;
+        first_capNumber = theEvent->fFlatCapArray[theEvent->fFlatCapArrayOffset[dda]];
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda;
-            voltMapIt=theEvent->fVolts.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-                if (hasTimingCalib){
-                    first_block_len = fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
-                } else {
-                    first_block_len = SAMPLES_PER_BLOCK;
-                }
-                if (numPoints < first_block_len){
-                    hasTooFewBlocks=true;
-                    break;
-                }
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            if (hasTimingCalib){
+                first_block_len = tables->fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
+            } else {
+                first_block_len = SAMPLES_PER_BLOCK;
+            }
+            if (numPoints < first_block_len){
+                hasTooFewBlocks=true;
+                break;
             }
         }
     }
@@ -1440,32 +1701,29 @@ Bool_t AraEventCalibrator::TrimFirstBlock(UsefulAtriStationEvent *theEvent, std:
 
     //! if number of samples in the WF is bigger than first block, perform first block trimming
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
-        first_capNumber = capArrayList->at(dda)[0];
-        capArrayList->at(dda).erase(capArrayList->at(dda).begin(),capArrayList->at(dda).begin()+1); ///< delete the first block number. This trimming is needed for TimingCalibrationAndBadSampleReomval()
+        if(theEvent->fFlatNumBlocks[dda]==0) continue;
+        first_capNumber = theEvent->fFlatCapArray[theEvent->fFlatCapArrayOffset[dda]];
+        theEvent->fFlatCapArrayOffset[dda]++; ///< drop the first block number. This trimming is needed for TimingCalibrationAndBadSampleReomval()
+        theEvent->fFlatNumBlocks[dda]--;
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda;
-            voltMapIt=theEvent->fVolts.find(chanId);
-            timeMapIt=theEvent->fTimes.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                if (hasTimingCalib){
-                    first_block_len = fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
-                } else {
-                    first_block_len = SAMPLES_PER_BLOCK;
-                }
-                voltMapIt->second.erase(voltMapIt->second.begin(),voltMapIt->second.begin()+first_block_len); ///< delete the times in the first block
-                timeMapIt->second.erase(timeMapIt->second.begin(),timeMapIt->second.begin()+first_block_len); ///< delete the ADC (or volt) in the first block
-                sampleList->at(chanId).erase(sampleList->at(chanId).begin(),sampleList->at(chanId).begin()+first_block_len); ///< delete the samples in the first block
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            if (hasTimingCalib){
+                first_block_len = tables->fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
+            } else {
+                first_block_len = SAMPLES_PER_BLOCK;
             }
+            theEvent->fFlatOffset[chanId]+=first_block_len; ///< drop the times, ADC (or volt) and samples in the first block
+            theEvent->fFlatNumSamples[chanId]-=first_block_len;
         }
     } return !hasTooFewBlocks;
 }
 
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
     \return void
 */
-void AraEventCalibrator::CommonMode(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt)
+void AraEventCalibrator::CommonMode(UsefulAtriStationEvent *theEvent)
 {
     /*!
         Then we need to do a common mode correction
@@ -1473,17 +1731,17 @@ void AraEventCalibrator::CommonMode(UsefulAtriStationEvent *theEvent, std::map<
         loop over chan
         loop over times and subtract one
     */
-    std::map< Int_t, std::vector <Double_t> >::iterator voltMapIt2;
-
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
+        Int_t chanId2=5+RFCHAN_PER_DDA*dda;
+        if(theEvent->fFlatOffset[chanId2]<0) continue;
+        const Double_t *volts2=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId2];
         for(Int_t chan=0;chan<5;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda;
-            voltMapIt= theEvent->fVolts.find(chanId);
-            Int_t chanId2=5+RFCHAN_PER_DDA*dda;
-            voltMapIt2= theEvent->fVolts.find(chanId2);
-            Int_t numPoints=(voltMapIt->second).size();
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
             for(int samp=0;samp<numPoints;samp++) {
-                voltMapIt->second[samp]-= voltMapIt2->second[samp];
+                volts[samp]-= volts2[samp];
             }
         }
     }
@@ -1496,42 +1754,38 @@ void AraEventCalibrator::CommonMode(UsefulAtriStationEvent *theEvent, std::map<
 */
 /*!
     \param theEvent the useful atri event pointer
-    \param voltMapIt the iterator referring to the voltage elements in the 2d map container
+    \param tables the calibration tables of the station
+    \param hasTrimFirstBlk boolean statement that whether first block trimming is already performed or not
+    \param hasTimingCalib boolean statement that whether TimingCalibrationAndBadSampleReomval is already performed or not
     \return void
 */
-void AraEventCalibrator::ApplyZeroMean(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *capArrayList, Bool_t hasTrimFirstBlk, Bool_t hasTimingCalib)
+void AraEventCalibrator::ApplyZeroMean(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTrimFirstBlk, Bool_t hasTimingCalib)
 {
     int first_block_len = 0;
-    int numPoints_for_mean = 0;
     int first_capNumber = 0;
     int samples_per_block = SAMPLES_PER_BLOCK;
+    const AtriCalibKernels_t &kernels = getAtriCalibKernels();
 
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
-        first_capNumber = capArrayList->at(dda)[0];
+        if(theEvent->fFlatNumBlocks[dda]==0) continue;
+        first_capNumber = theEvent->fFlatCapArray[theEvent->fFlatCapArrayOffset[dda]];
         for(Int_t chan=0;chan<RFCHAN_PER_DDA;chan++) {
             Int_t chanId=chan+RFCHAN_PER_DDA*dda;
-            voltMapIt=theEvent->fVolts.find(chanId);
-            if(voltMapIt!=theEvent->fVolts.end()) {
-                Int_t numPoints=(voltMapIt->second).size();
-                if (!hasTrimFirstBlk) {
-                    if (hasTimingCalib) {
-                        first_block_len = fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
-                    } else { 
-                        first_block_len = samples_per_block;
-                    }
-                    numPoints_for_mean = numPoints - first_block_len;
-                } else {
-                    numPoints_for_mean = numPoints;
-                    first_block_len = 0;
-                }
-                //! compute the mean, and let C++ help by doing the addition for us
-                //! If 1st block is still in the WF, exclude the samples in the 1st block from mean calculation
-                Double_t mean = std::accumulate((voltMapIt->second).begin() + first_block_len, (voltMapIt->second).end(), 0.0);
-                mean /= numPoints_for_mean;
-                for(int samp=0;samp<numPoints;samp++) {
-                    voltMapIt->second[samp]-=mean;
+            if(theEvent->fFlatOffset[chanId]<0) continue;
+            Int_t numPoints=theEvent->fFlatNumSamples[chanId];
+            Double_t *volts=theEvent->fFlatVolts.data()+theEvent->fFlatOffset[chanId];
+            if (!hasTrimFirstBlk) {
+                if (hasTimingCalib) {
+                    first_block_len = tables->fAtriNumSamples[dda][chan][first_capNumber]; ///< use the exact number of samples in the first if timing calibration has already happened
+                } else { 
+                    first_block_len = samples_per_block;
                 }
+            } else {
+                first_block_len = 0;
             }
+            //! compute the mean, and let C++ help by doing the addition for us
+            //! If 1st block is still in the WF, exclude the samples in the 1st block from mean calculation
+            kernels.zeroMean(volts, first_block_len, numPoints);
         }
     }
 }
@@ -1539,142 +1793,487 @@ void AraEventCalibrator::ApplyZeroMean(UsefulAtriStationEvent *theEvent, std::ma
 void AraEventCalibrator::setAtriPedFile(char *filename, AraStationId_t stationId)
 {
     Int_t calibIndex = AraGeomTool::getStationCalibIndex(stationId);
+    if(calibIndex==-1){
+        fprintf(stderr, "AraEventCalibrator::setAtriPedFile -- ERROR Unknown stationId %i\n", stationId);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(atriTableMutex);
     strncpy(fAtriPedFile[calibIndex],filename,FILENAME_MAX);
     fGotAtriPedFile[calibIndex]=1; //Protects us from loading the default pedfile
-    loadAtriPedestals(stationId);
+    if(!fileExists(fAtriPedFile[calibIndex])){
+        fprintf(stderr, "%s -- pedFile does not exist!\n", __FUNCTION__);
+        chooseAtriPedFile(stationId);
+    }
+    else if(fAtriPedTables.find(fAtriPedFile[calibIndex])==fAtriPedTables.end()) {
+        //! Validate and keep the pedestals with a single read of the file
+        std::vector<UShort_t> peds;
+        if(readAtriPedestalFile(fAtriPedFile[calibIndex], peds) != RFCHAN_PER_DDA*DDA_PER_ATRI*BLOCKS_PER_DDA*SAMPLES_PER_BLOCK){
+            fprintf(stderr, "%s -- pedFile has too few values!\n", __FUNCTION__);
+            chooseAtriPedFile(stationId);
+        }
+        else {
+            fprintf(stdout, "%s : Loading fAtriPedFile - %s\n", __FUNCTION__, fAtriPedFile[calibIndex]);
+            fAtriPedTables[fAtriPedFile[calibIndex]].swap(peds);
+        }
+    }
+    loadAtriPedestalFile(fAtriPedFile[calibIndex]);
 }
 
 void AraEventCalibrator::loadAtriPedestals(AraStationId_t stationId)
-{  
+{
+    getAtriPedestals(stationId);
+}
+
+/*!
+    Returns the pedestals, loading them the first time a pedestal file is asked for.
+    Pedestals from several files (stations or pedestal epochs) stay in memory side by side.
+*/
+/*!
+    \param stationId id of the station
+    \param pedFile the pedestal file, or 0 for the file set with setAtriPedFile (or the default file of the station)
+    \return the pedestals indexed by RawAtriStationEvent::getPedIndex, or NULL if they could not be loaded
+*/
+const UShort_t *AraEventCalibrator::getAtriPedestals(AraStationId_t stationId, const char *pedFile)
+{
     Int_t calibIndex = AraGeomTool::getStationCalibIndex(stationId);
-    Int_t stationNumber = AraGeomTool::getStationNumber(stationId);
     if(calibIndex==-1){
-        fprintf(stderr, "AraEventCalibrator::loadAtriPedestals -- ERROR Unknown stationId %i\n", stationId);
+        fprintf(stderr, "AraEventCalibrator::getAtriPedestals -- ERROR Unknown stationId %i\n", stationId);
         exit(0);
     }
-    if(fGotAtriPedFile[calibIndex]==1){
-        if(!fileExists(fAtriPedFile[calibIndex])){
-            fGotAtriPedFile[calibIndex]=0;
-            fprintf(stderr, "%s -- pedFile does not exist!\n", __FUNCTION__);
-        }
-        else if(numberOfPedestalValsInFile(fAtriPedFile[calibIndex]) != RFCHAN_PER_DDA*DDA_PER_ATRI*BLOCKS_PER_DDA*SAMPLES_PER_BLOCK){
-            fGotAtriPedFile[calibIndex]=0;
-            fprintf(stderr, "%s -- pedFile has too few values!\n", __FUNCTION__);
+    std::lock_guard<std::mutex> lock(atriTableMutex);
+    if(!pedFile) {
+        if(fGotAtriPedFile[calibIndex]==0){
+            chooseAtriPedFile(stationId);
+            fGotAtriPedFile[calibIndex]=1;
         }
+        pedFile = fAtriPedFile[calibIndex];
     }
+    return loadAtriPedestalFile(pedFile);
+}
+
+//! Sets the pedestal file of the station to the ARA_ATRI_PEDESTAL_FILE environment variable, or the default file in the calib directory
+/*!
+    \param stationId id of the station
+    \return void
+*/
+void AraEventCalibrator::chooseAtriPedFile(AraStationId_t stationId)
+{  
+    Int_t calibIndex = AraGeomTool::getStationCalibIndex(stationId);
+    char *pedFileEnv = getenv( "ARA_ATRI_PEDESTAL_FILE" );
+    if ( pedFileEnv == NULL ) {
+        char calibDir[FILENAME_MAX];
+        getCalibDir(calibDir);
+        sprintf(fAtriPedFile[calibIndex],"%s/ATRI/araAtriStation%iPedestals.txt",calibDir, stationId);
+        // fprintf(stdout," = %s\n",fAtriPedFile[calibIndex]);
+    } // end of IF-block for pedestal file not specified by environment variable
+    else {
+        strncpy(fAtriPedFile[calibIndex],pedFileEnv,FILENAME_MAX);
+        // fprintf(stdout,"AraEventCalibrator::loadAtriPedestals(): INFO - Pedestal file [from ARA_ONE_PEDESTAL_FILE] = %s\n",fAtriPedFile[calibIndex]);
+    } // end of IF-block for pedestal file specified by environment variable
+}
+
+//! Reads a pedestal file into fAtriPedTables. Has to be called with atriTableMutex held
+/*!
+    \param pedFile the pedestal file
+    \return the pedestals indexed by RawAtriStationEvent::getPedIndex, or NULL if the file can not be opened
+*/
+const UShort_t *AraEventCalibrator::loadAtriPedestalFile(const char *pedFile)
+{
+    std::map< std::string, std::vector<UShort_t> >::iterator pedIt = fAtriPedTables.find(pedFile);
+    if(pedIt!=fAtriPedTables.end()) return pedIt->second.data();
 
-    if(fGotAtriPedFile[calibIndex]==0){
-        char *pedFileEnv = getenv( "ARA_ATRI_PEDESTAL_FILE" );
-        if ( pedFileEnv == NULL ) {
-            char calibDir[FILENAME_MAX];
-            char *calibEnv=getenv("ARA_CALIB_DIR");
-            if(!calibEnv) {
-                char *utilEnv=getenv("ARA_UTIL_INSTALL_DIR");
-                if(!utilEnv) {
-                    sprintf(calibDir,"calib");
-                    // fprintf(stdout,"AraEventCalibrator::loadAtriPedestals(): INFO - Pedestal file [from ./calib]");
-                } else {
-                    sprintf(calibDir,"%s/share/araCalib",utilEnv);
-                    // fprintf(stdout,"AraEventCalibrator::loadAtriPedestals(): INFO - Pedestal file [from ARA_UTIL_INSTALL_DIR/share/calib]");
-                }
-            }
-            else {
-                strncpy(calibDir,calibEnv,FILENAME_MAX);
-                // fprintf(stdout,"AraEventCalibrator::loadAtriPedestals(): INFO - Pedestal file [from ARA_CALIB_DIR]");
-            }
-            sprintf(fAtriPedFile[calibIndex],"%s/ATRI/araAtriStation%iPedestals.txt",calibDir, stationId);
-            // fprintf(stdout," = %s\n",fAtriPedFile[calibIndex]);
-        } // end of IF-block for pedestal file not specified by environment variable
-        else {
-            strncpy(fAtriPedFile[calibIndex],pedFileEnv,FILENAME_MAX);
-            // fprintf(stdout,"AraEventCalibrator::loadAtriPedestals(): INFO - Pedestal file [from ARA_ONE_PEDESTAL_FILE] = %s\n",fAtriPedFile[calibIndex]);
-        } // end of IF-block for pedestal file specified by environment variable
-    }
-    
     // Pedestal file
     
-    fprintf(stdout, "%s : Loading fAtriPedFile - %s\n", __FUNCTION__, fAtriPedFile[calibIndex]);
-    
-    // If there are pedestals in memory already then we need to delete them and replace with this station's
-    if(fAtriPeds)
-        delete fAtriPeds;
+    fprintf(stdout, "%s : Loading fAtriPedFile - %s\n", __FUNCTION__, pedFile);
 
-    fAtriPeds = new UShort_t [DDA_PER_ATRI*BLOCKS_PER_DDA*RFCHAN_PER_DDA*SAMPLES_PER_BLOCK];
-    if(!fAtriPeds) {
-        std::cerr << "Can not allocate memory for pedestal file\n";
-        exit(0);
+    // now, we open and load the pedestal files
+    std::vector<UShort_t> &peds = fAtriPedTables[pedFile];
+    Int_t numPeds = readAtriPedestalFile(pedFile, peds);
+    if(numPeds<0) {
+        fprintf(stderr, "%s -- Can not read pedestal file %s\n", __FUNCTION__, pedFile);
+        fAtriPedTables.erase(pedFile);
+        return NULL;
+    }
+    if(numPeds!=DDA_PER_ATRI*BLOCKS_PER_DDA*RFCHAN_PER_DDA*SAMPLES_PER_BLOCK)
+        fprintf(stderr, "%s -- WARNING pedestal file %s has %i values instead of %i\n", __FUNCTION__, pedFile, numPeds, DDA_PER_ATRI*BLOCKS_PER_DDA*RFCHAN_PER_DDA*SAMPLES_PER_BLOCK);
+    return peds.data();
+}
+
+//! Reads the next (possibly negative) integer from a null terminated buffer
+/*!
+    \param pos the read position, moved past the integer
+    \param value filled with the integer
+    \return false at the end of the buffer or if the next token is not an integer
+*/
+static inline bool readPedToken(const char *&pos, int &value)
+{
+    while(*pos==' ' || *pos=='\n' || *pos=='\t' || *pos=='\r') pos++;
+    bool negative = (*pos=='-');
+    if(negative || *pos=='+') pos++;
+    if(*pos<'0' || *pos>'9') return false;
+    int number = 0;
+    while(*pos>='0' && *pos<='9') number = 10*number + (*pos++ - '0');
+    value = negative ? -number : number;
+    return true;
+}
+
+/*!
+    Reads the whole file (gzipped or not) in one go. Text files hold lines of "dda block chan" followed by
+    SAMPLES_PER_BLOCK pedestals, binary files start with an AraAtriPedBinaryHeader_t
+*/
+/*!
+    \param pedFile the pedestal file
+    \param peds resized to the full pedestal table and filled, values missing from the file are left 0
+    \return the number of pedestal values read, or -1 if the file can not be read or is malformed
+*/
+Int_t AraEventCalibrator::readAtriPedestalFile(const char *pedFile, std::vector<UShort_t> &peds)
+{
+    const Int_t numPedsAtri = DDA_PER_ATRI*BLOCKS_PER_DDA*RFCHAN_PER_DDA*SAMPLES_PER_BLOCK;
+    gzFile inPed = gzopen(pedFile, "r");
+    if(!inPed) return -1;
+    gzbuffer(inPed, 1<<20);
+
+    std::vector<char> buffer;
+    const size_t chunkSize = 1<<22;
+    size_t numBytes = 0;
+    int nRead;
+    do {
+        buffer.resize(numBytes+chunkSize+1);
+        nRead = gzread(inPed, &buffer[numBytes], chunkSize);
+        if(nRead>0) numBytes += nRead;
+    } while(nRead==(int)chunkSize);
+    gzclose(inPed);
+    if(nRead<0) {
+        fprintf(stderr, "%s -- Error reading %s\n", __FUNCTION__, pedFile);
+        return -1;
     }
+    buffer[numBytes] = '\0';
 
-    // now, we open and load the pedestal files
-    gzFile inPed = gzopen(fAtriPedFile[calibIndex], "r");
-    std::vector<char> buffer(6000000);
-    int nRead = gzread(inPed, &buffer[0], sizeof(char)*6000000);
-
-    // we then put the buffer (which are characters at this point)
-    // into a string object that we can manipulate
-    std::string string_buffer(buffer.begin(), buffer.end()); // convert the vector of chars to a string    
-    std::stringstream ss(string_buffer);
-
-    // to do this, we need "buffer" variables
-    std::string dda_buf;
-    std::string block_buf;
-    std::string chan_buf;
-    std::string ped_buf;
-   
-    while ( ss >> dda_buf >> block_buf >> chan_buf){
-        // we cast the dda, block, and channels into integers
-        int dda = std::stoi(dda_buf);
-        int block = std::stoi(block_buf);
-        int chan = std::stoi(chan_buf);
+    peds.assign(numPedsAtri, 0);
 
-        // the pedestal values are cast as shorts
+    //! Binary pedestals are copied straight into the table
+    const AraAtriPedBinaryHeader_t *header = (const AraAtriPedBinaryHeader_t*)buffer.data();
+    if(numBytes>=sizeof(AraAtriPedBinaryHeader_t) && memcmp(header->magic, ATRI_PED_BINARY_MAGIC, sizeof(header->magic))==0) {
+        if(header->version!=ATRI_PED_BINARY_VERSION || header->numPeds>(UInt_t)numPedsAtri
+            || numBytes!=sizeof(AraAtriPedBinaryHeader_t)+header->numPeds*sizeof(UShort_t)) {
+            fprintf(stderr, "%s -- Binary pedestal file %s is malformed\n", __FUNCTION__, pedFile);
+            return -1;
+        }
+        memcpy(peds.data(), buffer.data()+sizeof(AraAtriPedBinaryHeader_t), header->numPeds*sizeof(UShort_t));
+        return header->numPeds;
+    }
+
+    //! Text pedestals
+    Int_t numPeds = 0;
+    const char *pos = buffer.data();
+    int dda, block, chan, pedVal;
+    while(readPedToken(pos, dda) && readPedToken(pos, block) && readPedToken(pos, chan)) {
+        if(dda<0 || dda>=DDA_PER_ATRI || block<0 || block>=BLOCKS_PER_DDA || chan<0 || chan>=RFCHAN_PER_DDA) {
+            fprintf(stderr, "%s -- Bad dda %i block %i chan %i in pedestal file %s\n", __FUNCTION__, dda, block, chan, pedFile);
+            return -1;
+        }
+        UShort_t *blockPeds = &peds[RawAtriStationEvent::getPedIndex(dda,block,chan,0)];
         for(int samp=0; samp < SAMPLES_PER_BLOCK; samp++){
-            ss >> ped_buf;
-            short pedVal = short(std::stoi(ped_buf));
-            fAtriPeds[RawAtriStationEvent::getPedIndex(dda,block,chan,samp)]=pedVal;
+            if(!readPedToken(pos, pedVal)) {
+                fprintf(stderr, "%s -- Pedestal file %s ends in the middle of dda %i block %i chan %i\n", __FUNCTION__, pedFile, dda, block, chan);
+                return numPeds;
+            }
+            // the pedestal values are cast as shorts
+            blockPeds[samp] = short(pedVal);
+            numPeds++;
         }
     }
-    gzclose(inPed);
-    
-    // Now we set the gotPedFile flags to indicate which station we have in memory
-    
-    // for(AraStationId_t station=0;station<ICRR_NO_STATIONS+ATRI_NO_STATIONS;station++){
-    //   if(AraGeomTool::isAtriStation(station)){
-    //     calibIndex=AraGeomTool::getStationCalibIndex(station);
-    //     if(station==stationId) fGotAtriPedFile[calibIndex]=1;
-    //     else fGotAtriPedFile[calibIndex]=0;
-    //   }
-    // }
+    while(*pos==' ' || *pos=='\n' || *pos=='\t' || *pos=='\r') pos++;
+    if(*pos!='\0') {
+        fprintf(stderr, "%s -- Unexpected text in pedestal file %s\n", __FUNCTION__, pedFile);
+        return -1;
+    }
+    return numPeds;
+}
 
-    // RJN change 13-Feb-2013
-    memset(fGotAtriPedFile,ATRI_NO_STATIONS*sizeof(Int_t),0);
-    calibIndex = AraGeomTool::getStationCalibIndex(stationId);
-    fGotAtriPedFile[calibIndex]=1;
+/*!
+    \param pedFile the file to write
+    \param peds the pedestals, indexed by RawAtriStationEvent::getPedIndex
+    \return kTRUE if the file was written
+*/
+Bool_t AraEventCalibrator::writeAtriBinaryPedestalFile(const char *pedFile, const std::vector<UShort_t> &peds)
+{
+    AraAtriPedBinaryHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ATRI_PED_BINARY_MAGIC, sizeof(header.magic));
+    header.version = ATRI_PED_BINARY_VERSION;
+    header.numPeds = peds.size();
+
+    // Write to a temporary file in the same directory and rename it, so a calibrator loading the file never sees half of it
+    char tempFile[FILENAME_MAX];
+    snprintf(tempFile, FILENAME_MAX, "%s.tmp%i", pedFile, (int)getpid());
+    FILE *outFile = fopen(tempFile, "wb");
+    if(!outFile) {
+        fprintf(stderr, "%s -- Can not open %s\n", __FUNCTION__, tempFile);
+        return kFALSE;
+    }
+    Bool_t isOk = (fwrite(&header, sizeof(header), 1, outFile)==1
+                    && fwrite(peds.data(), sizeof(UShort_t), peds.size(), outFile)==peds.size());
+    if(fflush(outFile)!=0) isOk = kFALSE;
+    if(fclose(outFile)!=0) isOk = kFALSE;
+    if(!isOk || rename(tempFile, pedFile)!=0) {
+        fprintf(stderr, "%s -- Error writing %s\n", __FUNCTION__, pedFile);
+        remove(tempFile);
+        return kFALSE;
+    }
+    return kTRUE;
 }
 
+//! Returns which sample timing table applies to an event
+/*!
+    \param stationId id of the station
+    \param unixtime time of the event
+    \return 1 for the A3 2019 data set timing table, 0 for the default table
+*/
+Int_t AraEventCalibrator::getAtriTimingEpoch(AraStationId_t stationId, Double_t unixtime)
+{
+    if (stationId==3 && unixtime > 1544125405 && unixtime < 1576210568) return 1; ///< A3 Run12866 (2018/12/21) until Run16481 (2019/12/13), see loadAtriCalib
+    return 0;
+}
 
-void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixtime)
+/*!
+    Returns the calibration tables, loading them the first time a station (and timing epoch) is asked for.
+    The station geometry is loaded at the same time, so that the calibration steps only read it
+*/
+/*!
+    \param stationId id of the station
+    \param unixtime time of the event
+    \return the calibration tables, or NULL for an unknown station
+*/
+const AraAtriCalibTables *AraEventCalibrator::getAtriCalib(AraStationId_t stationId, Double_t unixtime)
 {
     Int_t calibIndex = AraGeomTool::getStationCalibIndex(stationId);
-    // std::cout << "Loading calibration info for station: " << (int)stationId << "\t" << calibIndex << "\n";
     if(calibIndex==-1){
-        fprintf(stderr, "AraEventCalibrator::loadAtriCalib -- ERROR Unknown stationId %i\n", stationId);
-        return;
-    }
+        fprintf(stderr, "AraEventCalibrator::getAtriCalib -- ERROR Unknown stationId %i\n", stationId);
+        return NULL;
+    }
+    Int_t key = 2*calibIndex + getAtriTimingEpoch(stationId, unixtime);
+    std::lock_guard<std::mutex> lock(atriTableMutex);
+    std::map< Int_t, AraAtriCalibTables* >::iterator tableIt = fAtriCalibTables.find(key);
+    if(tableIt!=fAtriCalibTables.end()) return tableIt->second;
+
+    AraGeomTool::Instance()->LoadSQLDbAtri(unixtime, stationId);
+    // The binary cache saves parsing ~120 MB of text, fall back to the text files if it is missing or stale
+    AraAtriCalibTables *tables = mapAtriCalibCache(stationId, getAtriTimingEpoch(stationId, unixtime));
+    if(!tables) tables = loadAtriCalib(stationId, unixtime);
+    if(tables) fAtriCalibTables[key] = tables;
+    return tables;
+}
 
-    char calibFile[FILENAME_MAX];
-    char calibDir[FILENAME_MAX];
+
+//! Finds the directory of the calibration and pedestal files
+/*!
+    Every calibration and pedestal file lookup goes through here, so the cache signature and the files loaded always agree
+    \param calibDir filled with the directory, FILENAME_MAX long
+*/
+void AraEventCalibrator::getCalibDir(char *calibDir)
+{
     char *calibEnv=getenv("ARA_CALIB_DIR");
     if(!calibEnv) {
         char *utilEnv=getenv("ARA_UTIL_INSTALL_DIR");
         if(!utilEnv)
             sprintf(calibDir,"calib");
         else
-            sprintf(calibDir,"%s/share/araCalib",utilEnv);
+            snprintf(calibDir,FILENAME_MAX,"%s/share/araCalib",utilEnv);
     }
     else {
-        strncpy(calibDir,calibEnv,FILENAME_MAX);
-    }  
+        strncpy(calibDir,calibEnv,FILENAME_MAX-1);
+        calibDir[FILENAME_MAX-1]='\0';
+    }
+}
+
+
+//! Fills in the size, latest modification time and hash of the text calibration files that loadAtriCalib reads for a station and epoch
+/*!
+    A missing file still changes the hash, so a cache made while a file was missing does not match once it is there
+*/
+static void getAtriCalibSourceSignature(AraStationId_t stationId, Int_t timingEpoch, ULong64_t &sourceBytes, Long64_t &sourceMTime, ULong64_t &sourceSignature)
+{
+    // the calibration directory of loadAtriCalib
+    char calibDir[FILENAME_MAX];
+    AraEventCalibrator::getCalibDir(calibDir);
+
+    const int maxFiles=5;
+    char sourceFiles[maxFiles][FILENAME_MAX];
+    int numFiles=0;
+    if(timingEpoch==1)
+        snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%iSampleTimingNew_2019DataSet.txt",calibDir,stationId);
+    else
+        snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%iSampleTimingNew.txt",calibDir,stationId);
+    snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%iadcToVoltsConv.txt",calibDir,stationId);
+    snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%ihighAdcToVoltsConv.txt",calibDir,stationId);
+    snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%iEpsilon.txt",calibDir,stationId);
+    if(stationId==2)
+        snprintf(sourceFiles[numFiles++],FILENAME_MAX,"%s/ATRI/araAtriStation%iVadjRef.txt",calibDir,stationId);
+
+    // FNV-1a over the name, size and modification time of every file
+    sourceBytes=0;
+    sourceMTime=0;
+    sourceSignature=14695981039346656037ULL;
+    for(int file=0;file<numFiles;file++) {
+        struct stat fileStat;
+        Long64_t values[2]={-1,-1};
+        if(stat(sourceFiles[file], &fileStat)==0) {
+            values[0]=fileStat.st_size;
+            values[1]=fileStat.st_mtime;
+            sourceBytes+=fileStat.st_size;
+            if(values[1]>sourceMTime) sourceMTime=values[1];
+        }
+        const unsigned char *bytes=(const unsigned char*)sourceFiles[file];
+        for(size_t i=0;i<strlen(sourceFiles[file]);i++) sourceSignature=(sourceSignature^bytes[i])*1099511628211ULL;
+        bytes=(const unsigned char*)values;
+        for(size_t i=0;i<sizeof(values);i++) sourceSignature=(sourceSignature^bytes[i])*1099511628211ULL;
+    }
+}
+
+
+void AraEventCalibrator::getAtriCalibCacheFile(char *cacheFile, AraStationId_t stationId, Int_t timingEpoch)
+{
+    char calibDir[FILENAME_MAX];
+    char *cacheEnv=getenv("ARA_CALIB_CACHE_DIR");
+    if(cacheEnv) {
+        strncpy(calibDir,cacheEnv,FILENAME_MAX-1);
+        calibDir[FILENAME_MAX-1]='\0';
+    }
+    else {
+        char baseDir[FILENAME_MAX];
+        getCalibDir(baseDir);
+        snprintf(calibDir,FILENAME_MAX,"%s/ATRI",baseDir);
+    }
+    snprintf(cacheFile,FILENAME_MAX,"%s/araAtriStation%iCalibTables_epoch%i.bin",calibDir,stationId,timingEpoch);
+}
+
+
+AraAtriCalibTables *AraEventCalibrator::mapAtriCalibCache(AraStationId_t stationId, Int_t timingEpoch)
+{
+    char cacheFile[FILENAME_MAX];
+    getAtriCalibCacheFile(cacheFile, stationId, timingEpoch);
+
+    int fd = open(cacheFile, O_RDONLY);
+    if(fd<0) return NULL; // No cache, the normal case if none was generated
+
+    const size_t fileBytes = sizeof(AraAtriCalibCacheHeader_t) + sizeof(AraAtriCalibTables);
+    struct stat fileStat;
+    if(fstat(fd, &fileStat)!=0 || (size_t)fileStat.st_size!=fileBytes) {
+        fprintf(stderr, "AraEventCalibrator::mapAtriCalibCache -- WARNING %s has the wrong size, using the text calib files\n", cacheFile);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping==MAP_FAILED) {
+        fprintf(stderr, "AraEventCalibrator::mapAtriCalibCache -- WARNING can not map %s, using the text calib files\n", cacheFile);
+        return NULL;
+    }
+
+    const AraAtriCalibCacheHeader_t *header = (const AraAtriCalibCacheHeader_t*)mapping;
+    AraAtriCalibTables *tables = (AraAtriCalibTables*)((char*)mapping + sizeof(AraAtriCalibCacheHeader_t));
+    if(memcmp(header->magic, ATRI_CALIB_CACHE_MAGIC, sizeof(header->magic))!=0
+        || header->version!=ATRI_CALIB_CACHE_VERSION
+        || header->headerBytes!=sizeof(AraAtriCalibCacheHeader_t)
+        || header->tableBytes!=sizeof(AraAtriCalibTables)
+        || header->stationId!=stationId
+        || header->timingEpoch!=timingEpoch
+        || tables->fStationId!=stationId
+        || tables->fTimingEpoch!=timingEpoch) {
+        fprintf(stderr, "AraEventCalibrator::mapAtriCalibCache -- WARNING %s does not match station %i epoch %i or this version of AraRoot, using the text calib files\n", cacheFile, stationId, timingEpoch);
+        munmap(mapping, fileBytes);
+        return NULL;
+    }
+
+    // a cache made from older text calibration files would silently calibrate with the old tables
+    ULong64_t sourceBytes, sourceSignature;
+    Long64_t sourceMTime;
+    getAtriCalibSourceSignature(stationId, timingEpoch, sourceBytes, sourceMTime, sourceSignature);
+    if(header->sourceBytes!=sourceBytes
+        || header->sourceMTime!=sourceMTime
+        || header->sourceSignature!=sourceSignature) {
+        fprintf(stderr, "AraEventCalibrator::mapAtriCalibCache -- WARNING %s was made from different calib files, using the text calib files (regenerate it with makeAtriCalibCache)\n", cacheFile);
+        munmap(mapping, fileBytes);
+        return NULL;
+    }
+
+    fAtriCalibMappedBytes[tables] = fileBytes;
+    return tables;
+}
+
+
+Bool_t AraEventCalibrator::writeAtriCalibCache(AraStationId_t stationId, Double_t unixtime, const char *cacheFile)
+{
+    char defaultFile[FILENAME_MAX];
+    if(!cacheFile) {
+        getAtriCalibCacheFile(defaultFile, stationId, getAtriTimingEpoch(stationId, unixtime));
+        cacheFile = defaultFile;
+    }
+
+    // The source files are looked at before they are read, so a file changed while the tables are made leaves the cache stale rather than wrongly current
+    ULong64_t sourceBytes, sourceSignature;
+    Long64_t sourceMTime;
+    getAtriCalibSourceSignature(stationId, getAtriTimingEpoch(stationId, unixtime), sourceBytes, sourceMTime, sourceSignature);
+
+    // Always regenerate from the text files, an existing cache may be the stale one being replaced
+    AraAtriCalibTables *tables;
+    {
+        std::lock_guard<std::mutex> lock(atriTableMutex);
+        AraGeomTool::Instance()->LoadSQLDbAtri(unixtime, stationId);
+        tables = loadAtriCalib(stationId, unixtime);
+    }
+    if(!tables) return kFALSE;
+
+    AraAtriCalibCacheHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ATRI_CALIB_CACHE_MAGIC, sizeof(header.magic));
+    header.version = ATRI_CALIB_CACHE_VERSION;
+    header.headerBytes = sizeof(AraAtriCalibCacheHeader_t);
+    header.tableBytes = sizeof(AraAtriCalibTables);
+    header.stationId = stationId;
+    header.timingEpoch = tables->fTimingEpoch;
+    header.sourceBytes = sourceBytes;
+    header.sourceMTime = sourceMTime;
+    header.sourceSignature = sourceSignature;
+
+    // Write to a temporary file and rename it, so that jobs mapping the cache never see half a file
+    char tempFile[FILENAME_MAX];
+    snprintf(tempFile, FILENAME_MAX, "%s.tmp%i", cacheFile, (int)getpid());
+    FILE *outFile = fopen(tempFile, "wb");
+    if(!outFile) {
+        fprintf(stderr, "AraEventCalibrator::writeAtriCalibCache -- ERROR can not open %s\n", tempFile);
+        delete tables;
+        return kFALSE;
+    }
+    Bool_t isOk = (fwrite(&header, sizeof(header), 1, outFile)==1 && fwrite(tables, sizeof(AraAtriCalibTables), 1, outFile)==1);
+    if(fclose(outFile)!=0) isOk = kFALSE;
+    delete tables;
+    if(!isOk || rename(tempFile, cacheFile)!=0) {
+        fprintf(stderr, "AraEventCalibrator::writeAtriCalibCache -- ERROR writing %s\n", cacheFile);
+        remove(tempFile);
+        return kFALSE;
+    }
+    return kTRUE;
+}
+
+
+AraAtriCalibTables *AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixtime)
+{
+    Int_t calibIndex = AraGeomTool::getStationCalibIndex(stationId);
+    // std::cout << "Loading calibration info for station: " << (int)stationId << "\t" << calibIndex << "\n";
+    if(calibIndex==-1){
+        fprintf(stderr, "AraEventCalibrator::loadAtriCalib -- ERROR Unknown stationId %i\n", stationId);
+        return NULL;
+    }
+
+    AraAtriCalibTables *tables = new AraAtriCalibTables;
+    tables->fStationId = stationId;
+    tables->fTimingEpoch = getAtriTimingEpoch(stationId, unixtime);
+
+    char calibFile[FILENAME_MAX];
+    char calibDir[FILENAME_MAX];
+    getCalibDir(calibDir);
 
     int dda,chan,sample,capArray;
 
@@ -1712,7 +2311,7 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
         It looks like duplication is disappeared from 2019-2020 pole season
         The new timing table will be only used between Run12866 and Run16481
     */
-    if (stationId==3 && unixtime > 1544125405 && unixtime < 1576210568){ ///< use new timing table from A3 Run12866 (2018/12/21) until Run16481 (2019/12/13)
+    if (tables->fTimingEpoch==1){ ///< use new timing table from A3 Run12866 (2018/12/21) until Run16481 (2019/12/13)
         sprintf(calibFile,"%s/ATRI/araAtriStation%iSampleTimingNew_2019DataSet.txt",calibDir, stationId);
     }
     else {
@@ -1730,10 +2329,10 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
         for(chan=0;chan<RFCHAN_PER_DDA;chan++) {
             for(capArray=0;capArray<2;capArray++) {
                 for(sample=0;sample<SAMPLES_PER_BLOCK;sample++) {
-                    fAtriSampleTimes[dda][chan][capArray][sample]=sample/3.2;
-                    fAtriSampleIndex[dda][chan][capArray][sample]=-1;
+                    tables->fAtriSampleTimes[dda][chan][capArray][sample]=sample/3.2;
+                    tables->fAtriSampleIndex[dda][chan][capArray][sample]=-1;
                 }
-                fAtriEpsilonTimes[dda][chan][capArray]=1/3.2;
+                tables->fAtriEpsilonTimes[dda][chan][capArray]=1/3.2;
             }
         }
     }
@@ -1741,35 +2340,35 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
     Double_t value;
     Int_t index;
     while(SampleFile >> dda >> chan >> capArray){
-        SampleFile >> fAtriNumSamples[dda][chan][capArray];
-        // std::cerr <<  dda << "\t" << chan << "\t" << capArray << "\t" << fAtriNumSamples[dda][chan][capArray] << "\t";
-        for(sample=0;sample<fAtriNumSamples[dda][chan][capArray];sample++) {
+        SampleFile >> tables->fAtriNumSamples[dda][chan][capArray];
+        // std::cerr <<  dda << "\t" << chan << "\t" << capArray << "\t" << tables->fAtriNumSamples[dda][chan][capArray] << "\t";
+        for(sample=0;sample<tables->fAtriNumSamples[dda][chan][capArray];sample++) {
             SampleFile >> index;
-            fAtriSampleIndex[dda][chan][capArray][sample]=index;
-            // std::cerr << fAtriSampleIndex[dda][chan][capArray][sample] << " ";    
+            tables->fAtriSampleIndex[dda][chan][capArray][sample]=index;
+            // std::cerr << tables->fAtriSampleIndex[dda][chan][capArray][sample] << " ";    
         }
         // std::cerr << "\n";
-        SampleFile >> dda >> chan >> capArray >> fAtriNumSamples[dda][chan][capArray];
-        // std::cerr <<  dda << "\t" << chan << "\t" << capArray << "\t" << fAtriNumSamples[dda][chan][capArray] << "\t";
-        for(sample=0;sample<fAtriNumSamples[dda][chan][capArray];sample++) {
+        SampleFile >> dda >> chan >> capArray >> tables->fAtriNumSamples[dda][chan][capArray];
+        // std::cerr <<  dda << "\t" << chan << "\t" << capArray << "\t" << tables->fAtriNumSamples[dda][chan][capArray] << "\t";
+        for(sample=0;sample<tables->fAtriNumSamples[dda][chan][capArray];sample++) {
             SampleFile >> value;
             // Now the sample times are read and corrected compared to the TSA reference for a change of Vadj. Note that this should be only done for ARA02 so far. 
             // Only for ARA02 we have data about the dependency of the sampling speed on Vadj which look reliable. Maybe we can fix this with future measurements.
             // Current Vadj somehow needs to get here from the eventHk-file. Not sure what the best way is. -THM- 
             if(stationId==2){
-                fAtriSampleTimes[dda][chan][capArray][sample]=value * 1.0/(0.9978 - 0.0002*(VadjRef[dda] - currentVadj[dda]));
+                tables->fAtriSampleTimes[dda][chan][capArray][sample]=value * 1.0/(0.9978 - 0.0002*(VadjRef[dda] - currentVadj[dda]));
             }
             else{
-                fAtriSampleTimes[dda][chan][capArray][sample]=value;
+                tables->fAtriSampleTimes[dda][chan][capArray][sample]=value;
             } //end modification -THM-
-            // std::cerr << fAtriSampleTimes[dda][chan][capArray][sample] << " ";    
+            // std::cerr << tables->fAtriSampleTimes[dda][chan][capArray][sample] << " ";    
         }
         // std::cerr << "\n";
     }
     SampleFile.close();
 
     // RJN -- Add call to check sample timing
-    checkAtriSampleTiming();
+    checkAtriSampleTiming(tables);
 
     // Read the ADC to volts conversion factors for the range between -400 and 400 ADC counts. -THM-
     int blockNumber;
@@ -1783,7 +2382,7 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
             for(sample=0;sample<64;sample++){
                 for(int cv=0;cv<9;cv++){
                     ADCConvFile >> conv;
-                    fAtriSampleADCVoltsConversion[dda][chan][blockNumber][sample][cv] = conv;
+                    tables->fAtriSampleADCVoltsConversion[dda][chan][blockNumber][sample][cv] = conv;
                 }
             }
         }
@@ -1805,7 +2404,7 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
             for(sample=0;sample<64;sample++){
                 for(int cv=0;cv<5;cv++){
                     highADCConvFile >> conv;
-                    fAtriSampleHighADCVoltsConversion[dda][chan][blockNumber][sample][cv] = conv;
+                    tables->fAtriSampleHighADCVoltsConversion[dda][chan][blockNumber][sample][cv] = conv;
                 }
             }
         }
@@ -1817,6 +2416,8 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
     }
     // end modification -THM-
 
+    resolveAtriVoltsCalib(tables);
+
     char epsilonFileName[100];
     sprintf(epsilonFileName,"%s/ATRI/araAtriStation%iEpsilon.txt",calibDir, stationId);
     // fprintf(stdout, "AraEventCalibrator::loadAtriCalib(): INFO - Epsilon file = %s\n", epsilonFileName);//DEBUG
@@ -1824,7 +2425,7 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
     if(epsilonFile.is_open()) {
          while(epsilonFile >> dda >> chan >> capArray){
             epsilonFile >> value;
-            fAtriEpsilonTimes[dda][chan][capArray]=value;
+            tables->fAtriEpsilonTimes[dda][chan][capArray]=value;
             // printf("%s : dda %i channel %i capArray %f\n", __FUNCTION__, dda, chan, value);
          }
         epsilonFile.close();
@@ -1842,9 +2443,9 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
 //  int thisDda=0;
 //  int thisChan=6;
 //  int thisCapArray=block%2;
-//  if(block!=0) time+=fAtriEpsilonTimes[thisDda][thisChan][thisCapArray];
-//  for (int samp=0;samp<fAtriNumSamples[thisDda][thisChan][thisCapArray];samp++) {
-//     Double_t sampTime=time+fAtriSampleTimes[thisDda][thisChan][thisCapArray][samp];
+//  if(block!=0) time+=tables->fAtriEpsilonTimes[thisDda][thisChan][thisCapArray];
+//  for (int samp=0;samp<tables->fAtriNumSamples[thisDda][thisChan][thisCapArray];samp++) {
+//     Double_t sampTime=time+tables->fAtriSampleTimes[thisDda][thisChan][thisCapArray][samp];
 //     std::cout << index << "\t" << sampTime << "\t" << sampTime-lastTime << "\n";
 //     index++;
 //     lastTime=sampTime;
@@ -1867,33 +2468,30 @@ void AraEventCalibrator::loadAtriCalib(AraStationId_t stationId, Double_t unixti
 
 
 
-    // RJN change 13-Feb-2013
-    memset(fGotAtriCalibFile,ATRI_NO_STATIONS*sizeof(Int_t),0);
-    calibIndex = AraGeomTool::getStationCalibIndex(stationId);
-    fGotAtriCalibFile[calibIndex]=1;
+    return tables;
 }
 
-void AraEventCalibrator::checkAtriSampleTiming() {
+void AraEventCalibrator::checkAtriSampleTiming(AraAtriCalibTables *tables) {
     for(int dda=0;dda<DDA_PER_ATRI;dda++) {
         for(int chan=0;chan<RFCHAN_PER_DDA;chan++) {
             int madeChange=0;
             do {
                 madeChange=0;
                 // Need to check if times follow each other or not
-                if(fAtriSampleTimes[dda][chan][0][fAtriNumSamples[dda][chan][0]-1]>
-                    fAtriSampleTimes[dda][chan][1][0]) {
+                if(tables->fAtriSampleTimes[dda][chan][0][tables->fAtriNumSamples[dda][chan][0]-1]>
+                    tables->fAtriSampleTimes[dda][chan][1][0]) {
                     // Need to trim one sample off cap array 0
-                    // std::cerr << "Oops calibration issue: dda: " << dda << ", chan: " << chan << ", capArray: " << 0 << ", sample " << fAtriNumSamples[dda][chan][0]-1 << ":" << fAtriSampleTimes[dda][chan][0][fAtriNumSamples[dda][chan][0]-1] << " is after capArray: 1 sample 0: " <<  fAtriSampleTimes[dda][chan][1][0] << "\n";
+                    // std::cerr << "Oops calibration issue: dda: " << dda << ", chan: " << chan << ", capArray: " << 0 << ", sample " << tables->fAtriNumSamples[dda][chan][0]-1 << ":" << tables->fAtriSampleTimes[dda][chan][0][tables->fAtriNumSamples[dda][chan][0]-1] << " is after capArray: 1 sample 0: " <<  tables->fAtriSampleTimes[dda][chan][1][0] << "\n";
                     // std::cerr << "Removing one sample from cap array 0\n";
-                    fAtriNumSamples[dda][chan][0]--;
+                    tables->fAtriNumSamples[dda][chan][0]--;
                     madeChange=1;
                 }
-                if(fAtriSampleTimes[dda][chan][1][fAtriNumSamples[dda][chan][1]-1]>
-                    (40+fAtriSampleTimes[dda][chan][0][0])) {
+                if(tables->fAtriSampleTimes[dda][chan][1][tables->fAtriNumSamples[dda][chan][1]-1]>
+                    (40+tables->fAtriSampleTimes[dda][chan][0][0])) {
                     // Need to trim one sample off cap array 1
-                    // std::cerr << "Oops calibration issue: dda: " << dda << ", chan: " << chan << ", capArray: " << 1 << ", sample " << fAtriNumSamples[dda][chan][1]-1 << ": " << fAtriSampleTimes[dda][chan][1][fAtriNumSamples[dda][chan][1]-1] << " is after capArray: 0 sample 0: " <<  40+fAtriSampleTimes[dda][chan][0][0] << "\n";
+                    // std::cerr << "Oops calibration issue: dda: " << dda << ", chan: " << chan << ", capArray: " << 1 << ", sample " << tables->fAtriNumSamples[dda][chan][1]-1 << ": " << tables->fAtriSampleTimes[dda][chan][1][tables->fAtriNumSamples[dda][chan][1]-1] << " is after capArray: 0 sample 0: " <<  40+tables->fAtriSampleTimes[dda][chan][0][0] << "\n";
                     // std::cerr << "Removing one sample from cap array 1\n";
-                    fAtriNumSamples[dda][chan][1]--;
+                    tables->fAtriNumSamples[dda][chan][1]--;
                     madeChange=1;
                 }
             } while(madeChange);
@@ -1916,24 +2514,9 @@ Bool_t AraEventCalibrator::fileExists(char *fileName){
 
 
 Int_t AraEventCalibrator::numberOfPedestalValsInFile(char *fileName){
-    Int_t numPedVals=0;
-    gzFile inPed = gzopen(fileName, "r");
-    if(inPed){
-        std::vector<char> buffer(6000000);
-        int nRead = gzread(inPed, &buffer[0], sizeof(char)*6000000);
-        std::string string_buffer(buffer.begin(), buffer.end()); // convert the vector of chars to a string
-        std::stringstream ss(string_buffer); // and then convert the string to a stringstream
-
-        std::string dummy;
-        while( ss >> dummy >> dummy >> dummy){
-            for(int samp=0; samp < SAMPLES_PER_BLOCK; samp++){
-                ss >> dummy;
-                numPedVals++;
-            }
-        }
-    }
-    gzclose(inPed);
-    return numPedVals;
+    std::vector<UShort_t> peds;
+    Int_t numPedVals = readAtriPedestalFile(fileName, peds);
+    return numPedVals<0 ? 0 : numPedVals;
 }
 
 /*! 
@@ -1950,127 +2533,79 @@ Int_t AraEventCalibrator::numberOfPedestalValsInFile(char *fileName){
     \param block corresponding black number of adcCountsIn
     \param chan corresponding dda channel number of adcCountsIn
     \param sample corresponding sample number of adcCountsIn
-    \param stationId id of the station
-    \return void
+    \param tables the calibration tables of the station
+    \return the voltage in mV
 */
-Double_t AraEventCalibrator::convertADCtoMilliVolts(Double_t adcCountsIn, int dda, int block, int chan, int sample, AraStationId_t stationId) ///< -THM-, -MK- imports the station id to optimize conversion for each station
+Double_t AraEventCalibrator::convertADCtoMilliVolts(Double_t adcCountsIn, int dda, int block, int chan, int sample, const AraAtriCalibTables *tables) ///< -THM-, -MK- imports the station id to optimize conversion for each station
 {
-    
-    Double_t volts = 0.0;
-    int samples_per_block = SAMPLES_PER_BLOCK;
-    int blocks_per_dda = BLOCKS_PER_DDA;
-    int samples_per_dda = SAMPLES_PER_DDA;
+    Bool_t isA4A5;
+    double adc_offset;
+    int high_adc_limit;
+    getAtriVoltsCalibSettings(tables->fStationId, isA4A5, adc_offset, high_adc_limit);
 
-    /*!
-       There is an offset induced in the pedestal numbers, due to asymmetry of the chip. 
-       From calibration files this offset with the given noise will be around 11 ADC counts.
-       If it's not station 5, subtract an offset of 11. (THM)
-    */
-    double adc_offset; 
-    int high_adc_limit; ///< Define the high ADC limit here (MK)
-    if (stationId == 4) {
-        high_adc_limit = 600; // only for ARA 4
-        adc_offset = 0.0; // only for ARA 4 
-    } else if (stationId == 5) {
-        high_adc_limit = 500;
-        adc_offset = 0.0;
-    } else {
-        high_adc_limit = 400;
-        adc_offset = -11.0;
-    }
-
-    //! Define neighboring sample or block offset. Based on Thomas's thesis p.69
-    int neighboring_index = 2;
-
-    /*! 
-        Each conversion parameter in fAtriSampleADCVoltsConversion: pos_fit_x, pos_fit_x^2, pos_fit_x^3, neg_fit_x, neg_fit_x^2, neg_fit_x^3, fit_const, zeroval, chi2
-        Each conversion parameter in fAtriSampleHighADCVoltsConversion: pos_fit_const, pos_fit_x, neg_fit_const, neg_fit_x
-    */
     //! Only apply calibration on calibrated channels (RF channels)!
-    if( (dda==0 && chan<6)||(dda==1 && chan<4)||(dda==2 && chan<4)||(dda==3 && chan<6) ){
+    if(!isAtriVoltsCalibChan(dda, chan)) return adcCountsIn + adc_offset;
+
+    //! The neighbouring block or sample that replaces a bad fit was chosen by resolveAtriVoltsCalib
+    int calibIndex = tables->fAtriVoltsCalibIndex[dda][chan][block][sample];
+    return atriAdcToMilliVolts(adcCountsIn,
+        tables->fAtriSampleADCVoltsConversion[dda][chan][calibIndex/SAMPLES_PER_BLOCK][calibIndex%SAMPLES_PER_BLOCK],
+        tables->fAtriSampleHighADCVoltsConversion[dda][chan][calibIndex/SAMPLES_PER_BLOCK][calibIndex%SAMPLES_PER_BLOCK],
+        isA4A5, adc_offset, high_adc_limit);
+}
 
-        /*!
-            Check if the fit worked out well parameter[8] is the Chi^2/NDF of the fit. Normally it is very good if <1.0.
-            For A2/3, If Chi^2/NDF is > 1.0, the conversion factor of the same sample number in a neighboring block, provided it has a better Chi^2/NDF value, will be used. -- Thomas's thesis p.69
-            For A5 and A4, the conversion factor of the neighboring sample, provided it has a better Chi^2/NDF value, will be used.
-            update by PDG 6th Nov 2022, adding A4 condition here for sample to be considered
-        */ 
-        if (stationId == 5 || stationId == 4) {
-            if (sample%2==0 && chan>0) sample=(sample+1)%samples_per_block; ///< Dumping even samples
-            while(fAtriSampleADCVoltsConversion[dda][chan][block][sample][8]>1.0) sample = (sample - neighboring_index + samples_per_block)%samples_per_block;
-        } 
-        else {
-            while(fAtriSampleADCVoltsConversion[dda][chan][block][sample][8]>1.0) block = (block - neighboring_index + blocks_per_dda)%blocks_per_dda;
-        }
 
-        //! Offset needs to be subtracted
-        double adcCounts = adcCountsIn + adc_offset;
-
-        //! Start ADC to voltage conversion
-        if(TMath::Abs(adcCounts)<high_adc_limit){
-            //! conversion factors for higher ADC values have strong errors, therefore we need the alternative calibration (see below)
-            //! RJN chnaged the below to remove calls to pow for code optimisation
-            double modAdcCounts=adcCounts-fAtriSampleADCVoltsConversion[dda][chan][block][sample][7];
-            //double modAdcCounts=adcCounts;//-fAtriSampleADCVoltsConversion[dda][chan][block][sample][7];
-
-            Double_t fit_const; ///< Define the fit_const here (MK)
-            double adc_zero_def; ///< Define which value will be used to choose a positive or negative conversion
-            //! new  29th Nov2022
-            if (stationId == 5 || stationId == 4) {
-                fit_const = 0.0; // fit const for A5 and A4
-                adc_zero_def = modAdcCounts;
-            } else {
-                fit_const = fAtriSampleADCVoltsConversion[dda][chan][block][sample][6];
-                adc_zero_def = adcCounts;
-            }
-            
-            if(adc_zero_def>0){
-                //! positive and negative values need different calibration constants
-                volts = fit_const
-                    +modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][0] 
-                    +modAdcCounts*modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][1] 
-                    +modAdcCounts*modAdcCounts*modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][2]; 
-            }
-            else{
-                volts = fit_const      
-                    +modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][3] 
-                    +modAdcCounts*modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][4]
-                    +modAdcCounts*modAdcCounts*modAdcCounts*fAtriSampleADCVoltsConversion[dda][chan][block][sample][5];
-            }
+//! Chooses the conversion factors of every capacitor once the tables are read
+/*!
+    Check if the fit worked out well parameter[8] is the Chi^2/NDF of the fit. Normally it is very good if <1.0.
+    For A2/3, If Chi^2/NDF is > 1.0, the conversion factor of the same sample number in a neighboring block, provided it has a better Chi^2/NDF value, will be used. -- Thomas's thesis p.69
+    For A5 and A4, the conversion factor of the neighboring sample, provided it has a better Chi^2/NDF value, will be used.
+    update by PDG 6th Nov 2022, adding A4 condition here for sample to be considered
+    This used to be searched for on every sample in convertADCtoMilliVolts. If no neighbour has a good fit the capacitor keeps its own factors (the old search never ended)
+    \param tables the calibration tables of the station, with the conversion factors already read
+    \return void
+*/
+void AraEventCalibrator::resolveAtriVoltsCalib(AraAtriCalibTables *tables)
+{
+    Bool_t isA4A5;
+    double adc_offset;
+    int high_adc_limit;
+    getAtriVoltsCalibSettings(tables->fStationId, isA4A5, adc_offset, high_adc_limit);
 
-            /*!
-                For A5, since there is no high ADC calibration data, use ADC count
-                If ADC count between -500 ~ 500 is converted to over 800 mV, this condition decides to use just ADC value instead of the conversion result
-                It seems ADC values between -400 ~ 400 are not converted to over 800 millivolts on A2/3
-                Related talk: https://aradocs.wipac.wisc.edu/cgi-bin/DocDB/ShowDocument?docid=2464 (slide 16 ~17)
-                I leave this condition just for A5 -MK-
-            */
-            if ((stationId == 4 || stationId == 5) && volts > 800) volts=modAdcCounts;
-      
-        } // below for higher ADC count 
-        else { ///< for higher ADC count
-            if (stationId == 5 || stationId == 4){
-                /*!
-                    For A5, since there is no high ADC calibration data, use ADC count for conervison result in case A5 encount high ADC count
-                    Similarly for A4, since no high ADC calib data is available, we use ADC count for the corresponding voltage result for high ADC count
-                */
-                volts = adcCountsIn + adc_offset;
-            }
-            else {
-                //! here is the alternative calibration (used only for A2 and A3) if the ADC count exceeds 400
-                if(adcCounts>0) {
-                    volts = fAtriSampleHighADCVoltsConversion[dda][chan][block][sample][0] 
-                    + adcCounts*fAtriSampleHighADCVoltsConversion[dda][chan][block][sample][1];
-                } 
-                else {
-                    volts = fAtriSampleHighADCVoltsConversion[dda][chan][block][sample][2]
-                    + adcCounts*fAtriSampleHighADCVoltsConversion[dda][chan][block][sample][3];
+    //! Define neighboring sample or block offset. Based on Thomas's thesis p.69
+    int neighboring_index = 2;
+    int samples_per_block = SAMPLES_PER_BLOCK;
+    int blocks_per_dda = BLOCKS_PER_DDA;
+    int numUnresolved = 0;
+
+    for(int dda=0;dda<DDA_PER_ATRI;dda++) {
+        for(int chan=0;chan<RFCHAN_PER_DDA;chan++) {
+            for(int block=0;block<blocks_per_dda;block++) {
+                for(int sample=0;sample<samples_per_block;sample++) {
+                    int calBlock = block;
+                    int calSample = sample;
+                    if(isAtriVoltsCalibChan(dda, chan)) {
+                        if(isA4A5) {
+                            if (calSample%2==0 && chan>0) calSample=(calSample+1)%samples_per_block; ///< Dumping even samples
+                            for(int step=0;step<samples_per_block && tables->fAtriSampleADCVoltsConversion[dda][chan][calBlock][calSample][8]>1.0;step++)
+                                calSample = (calSample - neighboring_index + samples_per_block)%samples_per_block;
+                        }
+                        else {
+                            for(int step=0;step<blocks_per_dda && tables->fAtriSampleADCVoltsConversion[dda][chan][calBlock][calSample][8]>1.0;step++)
+                                calBlock = (calBlock - neighboring_index + blocks_per_dda)%blocks_per_dda;
+                        }
+                        if(tables->fAtriSampleADCVoltsConversion[dda][chan][calBlock][calSample][8]>1.0) {
+                            numUnresolved++;
+                            calBlock = block;
+                            if(!isA4A5 || sample%2!=0 || chan==0) calSample = sample;
+                            else calSample = (sample+1)%samples_per_block;
+                        }
+                    }
+                    tables->fAtriVoltsCalibIndex[dda][chan][block][sample] = calBlock*samples_per_block + calSample;
                 }
-            }    
+            }
         }
-    }    
-    else{
-        volts = adcCountsIn + adc_offset;
     }
-    return volts;
+    if(numUnresolved>0)
+        fprintf(stderr, "AraEventCalibrator::resolveAtriVoltsCalib -- WARNING %i capacitors of station %i have no neighbour with a good voltage calibration fit\n", numUnresolved, tables->fStationId);
 }
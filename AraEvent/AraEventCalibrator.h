@@ -16,6 +16,8 @@
 #include "araIcrrStructures.h"
 #include "araIcrrDefines.h"
 #include <map>
+#include <vector>
+#include <string>
 
 #define ADCMV 0.939   /* mV/adc, per Gary's email of 05/04/2006 */
 #define SATURATION 1300 
@@ -95,10 +97,69 @@ namespace AraCalType {
     Bool_t hasSampleIndex(AraCalType::AraCalType_t calType); ///< Does return sample index -MK-
 } 
 
+class RawAtriStationEvent;
+class RawAtriEventView;
 class UsefulAtriStationEvent;
 class UsefulIcrrStationEvent;
 class TGraph; 
 
+//!  Part of AraEvent library. The calibration tables of one ATRI station, as read by AraEventCalibrator::loadAtriCalib
+/*!
+    The tables are filled once when loaded and only read afterwards. They hold about 120 MB, mostly the ADC to mV conversion factors
+    \ingroup rootclasses
+*/
+class AraAtriCalibTables
+{
+    public:
+        AraStationId_t fStationId; ///< The station the tables belong to
+        Int_t fTimingEpoch; ///< Which sample timing table was loaded, see AraEventCalibrator::getAtriTimingEpoch
+        Int_t fAtriSampleIndex[DDA_PER_ATRI][RFCHAN_PER_DDA][2][SAMPLES_PER_BLOCK]; ///<The sample order
+        Double_t fAtriSampleADCVoltsConversion[DDA_PER_ATRI][RFCHAN_PER_DDA][512][64][9];//added for voltage conversion -THM-
+        Double_t fAtriSampleHighADCVoltsConversion[DDA_PER_ATRI][RFCHAN_PER_DDA][512][64][5];//added for high voltages -THM-
+        Double_t fAtriSampleTimes[DDA_PER_ATRI][RFCHAN_PER_DDA][2][SAMPLES_PER_BLOCK]; ///<The sample timings
+        Double_t fAtriEpsilonTimes[DDA_PER_ATRI][RFCHAN_PER_DDA][2]; ///< The timing between blocks the capArray number is the number of the second block
+        Int_t fAtriNumSamples[DDA_PER_ATRI][RFCHAN_PER_DDA][2]; ///< The number of samples per block in a particular dda, chan, capArray
+        UShort_t fAtriVoltsCalibIndex[DDA_PER_ATRI][RFCHAN_PER_DDA][BLOCKS_PER_DDA][SAMPLES_PER_BLOCK]; ///< block*SAMPLES_PER_BLOCK+sample of the conversion factors used for each capacitor, with the bad fits already replaced by a neighbour. Filled by AraEventCalibrator::resolveAtriVoltsCalib
+};
+
+#define ATRI_CALIB_CACHE_MAGIC "ARACALTB"
+#define ATRI_CALIB_CACHE_VERSION 3
+
+//! The header of a binary ATRI calibration cache file, written by AraEventCalibrator::writeAtriCalibCache
+/*!
+    The header is 64 bytes long and is directly followed by the raw bytes of one AraAtriCalibTables.
+    A cache is only used if the magic, version, table size, station and timing epoch all match
+    and the text calibration files it was made from (sample timing, ADC conversion, high ADC conversion, epsilon and,
+    for A2, Vadj reference) still have the size and modification time they had when it was written,
+    otherwise the calibrator falls back to the text calibration files.
+*/
+typedef struct {
+    char magic[8]; ///< ATRI_CALIB_CACHE_MAGIC, not null terminated
+    UInt_t version; ///< ATRI_CALIB_CACHE_VERSION
+    UInt_t headerBytes; ///< sizeof(AraAtriCalibCacheHeader_t)
+    ULong64_t tableBytes; ///< sizeof(AraAtriCalibTables) of the writer
+    UInt_t stationId; ///< The station the tables belong to
+    Int_t timingEpoch; ///< The timing epoch of the tables
+    ULong64_t sourceBytes; ///< Total size of the text calibration files the tables were made from
+    Long64_t sourceMTime; ///< Latest modification time of the text calibration files the tables were made from
+    ULong64_t sourceSignature; ///< Hash of the name, size and modification time of each text calibration file
+    char reserved[8]; ///< Pads the header to 64 bytes so the tables stay aligned
+} AraAtriCalibCacheHeader_t;
+
+#define ATRI_PED_BINARY_MAGIC "ARAPEDBN"
+#define ATRI_PED_BINARY_VERSION 1
+
+//! The header of a binary ATRI pedestal file, as written by repeder -B
+/*!
+    The header is followed by numPeds UShort_t pedestals in RawAtriStationEvent::getPedIndex order.
+    The file may be gzipped, like the text pedestal files.
+*/
+typedef struct {
+    char magic[8]; ///< ATRI_PED_BINARY_MAGIC, not null terminated
+    UInt_t version; ///< ATRI_PED_BINARY_VERSION
+    UInt_t numPeds; ///< Number of pedestal values that follow
+} AraAtriPedBinaryHeader_t;
+
 //!  Part of AraEvent library. The calibrator takes Raw ATRI / ICRR events and applies Voltage, timing and bandpass filter calibrations to produce Useful ATRI / ICRR events.
 /*!
     The Ara Event Calibrator
@@ -148,41 +209,54 @@ class AraEventCalibrator : public TObject
     int indexNums[MAX_NUMBER_SAMPLES_LAB3]; /// for time sorting
 
     //Atri Calibrations
-    UShort_t *fAtriPeds; ///< Storage array to hold the ATRI pedestal data
-    Int_t fGotAtriPedFile[ATRI_NO_STATIONS]; ///< Flag to indicate whether the ATRI pedestals have been loaded and for which station
-    Int_t fGotAtriCalibFile[ATRI_NO_STATIONS]; ///< Flag to indicate whether the ATRI calib have been loaded and for which station
+    //! The ATRI tables are held per station (and per pedestal file) and are read-only once loaded, so ATRI events can be calibrated from several threads at once
+    Int_t fGotAtriPedFile[ATRI_NO_STATIONS]; ///< Flag to indicate whether the ATRI pedestal file for a station has been chosen
     char fAtriPedFile[ATRI_NO_STATIONS][FILENAME_MAX]; ///< Filename of the ATRI pedestal file
-    Int_t fAtriSampleIndex[DDA_PER_ATRI][RFCHAN_PER_DDA][2][SAMPLES_PER_BLOCK]; ///<The sample order
-    Double_t fAtriSampleADCVoltsConversion[DDA_PER_ATRI][RFCHAN_PER_DDA][512][64][9];//added for voltage conversion -THM-
-    Double_t fAtriSampleHighADCVoltsConversion[DDA_PER_ATRI][RFCHAN_PER_DDA][512][64][5];//added for high voltages -THM-
-    Double_t fAtriSampleTimes[DDA_PER_ATRI][RFCHAN_PER_DDA][2][SAMPLES_PER_BLOCK]; ///<The sample timings
-    Double_t fAtriEpsilonTimes[DDA_PER_ATRI][RFCHAN_PER_DDA][2]; ///< The timing between blocks the capArray number is the number of the second block
-    Int_t fAtriNumSamples[DDA_PER_ATRI][RFCHAN_PER_DDA][2]; ///< The number of samples per block in a particular dda, chan, capArray
-
-    void checkAtriSampleTiming();
-    void calibrateEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType=AraCalType::kVoltageTime); ///< Apply the calibration to a UsefulAtriStationEvent, called from UsefulAtriStationEvent constructor
-    Double_t convertADCtoMilliVolts(Double_t adcCountsIn, int dda, int inBlock, int chan, int sample, AraStationId_t stationId); //A conversion module from ADC counts to millivolts  -THM-
+    std::map< Int_t, AraAtriCalibTables* > fAtriCalibTables; //! The ATRI calibration tables, keyed by 2*(station calib index) + timing epoch
+    std::map< std::string, std::vector<UShort_t> > fAtriPedTables; //! The ATRI pedestals, keyed by pedestal file name
+    std::map< AraAtriCalibTables*, size_t > fAtriCalibMappedBytes; //! Length of the mapping of every table that was mmapped from a cache file
+
+    static Int_t getAtriTimingEpoch(AraStationId_t stationId, Double_t unixtime); ///< Returns which sample timing table (0 default, 1 A3 2019 data set) applies to an event
+    const AraAtriCalibTables *getAtriCalib(AraStationId_t stationId, Double_t unixtime); ///< Returns the calibration tables for a station at unixtime, loading them on first use. Thread safe
+    const UShort_t *getAtriPedestals(AraStationId_t stationId, const char *pedFile=0); ///< Returns the pedestals from pedFile (by default the pedestal file of the station), loading them on first use. Thread safe
+    void checkAtriSampleTiming(AraAtriCalibTables *tables);
+    void calibrateEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType=AraCalType::kVoltageTime, const char *pedFile=0); ///< Apply the calibration to a UsefulAtriStationEvent, called from UsefulAtriStationEvent constructor. A pedFile other than the station default can be given
+    void calibrateInto(const RawAtriStationEvent &rawEvent, UsefulAtriStationEvent &theEvent, AraCalType::AraCalType_t calType=AraCalType::kVoltageTime, const char *pedFile=0); ///< Calibrate rawEvent into a caller-owned UsefulAtriStationEvent, reusing its buffers so that an event loop does not allocate once the buffers have grown to the event size
+    void calibrateInto(const RawAtriEventView &view, UsefulAtriStationEvent &theEvent, AraCalType::AraCalType_t calType=AraCalType::kVoltageTime, const char *pedFile=0); ///< As above, but reading the samples in place from the DAQ buffer of a RawAtriEventView
+    Double_t convertADCtoMilliVolts(Double_t adcCountsIn, int dda, int inBlock, int chan, int sample, const AraAtriCalibTables *tables); //A conversion module from ADC counts to millivolts  -THM-
     void setAtriPedFile(char *filename, AraStationId_t stationId); ///< Allows the user to force a specific pedestal file into the calibrator instead of the default. The pedestals may vary as a function of time so using a pedestal file from a time close the the event / run is a good idea
-    void loadAtriPedestals(AraStationId_t stationId); ///< Internally used function that loads the pedestals into memory.
-    void loadAtriCalib(AraStationId_t stationId, Double_t unixtime); ///< Internally used fuction that loads the calibration values into memory. ///< Adds unix time to select the new timing table for A3 2019 data. MK added 08-02-2022
+    void loadAtriPedestals(AraStationId_t stationId); ///< Loads the pedestals of the station into memory, if they are not already there
+    AraAtriCalibTables *loadAtriCalib(AraStationId_t stationId, Double_t unixtime); ///< Internally used fuction that reads the calibration values into a new set of tables. ///< Adds unix time to select the new timing table for A3 2019 data. MK added 08-02-2022
+    static void getCalibDir(char *calibDir); ///< Fills calibDir (FILENAME_MAX long) with the calibration directory: ARA_CALIB_DIR, else ARA_UTIL_INSTALL_DIR/share/araCalib, else calib
+    static void getAtriCalibCacheFile(char *cacheFile, AraStationId_t stationId, Int_t timingEpoch); ///< Fills cacheFile (FILENAME_MAX long) with the binary calibration cache name, in ARA_CALIB_CACHE_DIR if set and next to the text calib files otherwise
+    Bool_t writeAtriCalibCache(AraStationId_t stationId, Double_t unixtime, const char *cacheFile=0); ///< Writes the tables of the station at unixtime into a binary cache file (by default getAtriCalibCacheFile). Returns kTRUE on success
      
     Bool_t fileExists(char *fileName); ///< Helper function to check whether a file exists
     Int_t numberOfPedestalValsInFile(char *fileName); ///< Helper function to check number of pedestal values in a pedestal file. This is to identify corrupted pedestal files
+    static Int_t readAtriPedestalFile(const char *pedFile, std::vector<UShort_t> &peds); ///< Reads a text or binary (possibly gzipped) pedestal file into peds, indexed by RawAtriStationEvent::getPedIndex. Returns the number of values read or -1 if the file is unreadable or malformed
+    static Bool_t writeAtriBinaryPedestalFile(const char *pedFile, const std::vector<UShort_t> &peds); ///< Writes pedestals (indexed by RawAtriStationEvent::getPedIndex) in the binary format. Returns kTRUE on success
 
     //! Modulates calibration step -MK-
-    void UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList); ///< Converts DAQ data format to Electronic channel format
-    Bool_t TrimFirstBlock(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList, Bool_t hasTimingCalib); ///< Erase first block that currupted by trigger
-    Bool_t TimingCalibrationAndBadSampleReomval(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, std::vector<std::vector<int> > *sampleList, std::vector<std::vector<int> > *capArrayList, Bool_t hasTrimFirstBlk); ///< Trims samples using fAtriSampleTimes table
-    void PedestalSubtraction(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList, AraCalType::AraCalType_t calType); ///< Subtracts pedestal from raw data
-    void CommonMode(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt);
-    void InvertA3Chans(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, AraStationId_t thisStationId); ///< Inverts only RF channels = 0,4,8 in A3
-    void ApplyZeroMean(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *capArrayList, Bool_t hasTrimFirstBlk, Bool_t hasTimingCalib); ///< Zeroing WF by subtracting mean. ADC or Voltage. If 1st block is still in the WF, exclude the samplesin the 1st block from mean calculation
-    void VoltageCalibration(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList, AraStationId_t thisStationId); ///< Converts ADC to Voltage using conversion table
-    void ApplyCableDelay(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &timeMapIt, Double_t unixtime, AraStationId_t thisStationId); ///< Remove knwon cable delay
-    void ReturnSampleIndex(UsefulAtriStationEvent *theEvent, std::map< Int_t, std::vector <Double_t> >::iterator &voltMapIt, std::vector<std::vector<int> > *sampleList); ///< Return sample index.
+    //! Each step works in place on the flat sample arrays of the UsefulAtriStationEvent and only reads the tables
+    void UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent); ///< Converts DAQ data format to Electronic channel format
+    void UnpackDAQFormatToElecChanFormat(UsefulAtriStationEvent *theEvent, const RawAtriEventView &view); ///< Converts DAQ data format to Electronic channel format, reading the samples from the view
+    Bool_t TrimFirstBlock(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTimingCalib); ///< Erase first block that currupted by trigger
+    Bool_t TimingCalibrationAndBadSampleReomval(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTrimFirstBlk); ///< Trims samples using fAtriSampleTimes table
+    void PedestalSubtraction(UsefulAtriStationEvent *theEvent, const UShort_t *peds, AraCalType::AraCalType_t calType); ///< Subtracts pedestal from raw data
+    void CommonMode(UsefulAtriStationEvent *theEvent);
+    void InvertA3Chans(UsefulAtriStationEvent *theEvent, AraStationId_t thisStationId); ///< Inverts only RF channels = 0,4,8 in A3
+    void ApplyZeroMean(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables, Bool_t hasTrimFirstBlk, Bool_t hasTimingCalib); ///< Zeroing WF by subtracting mean. ADC or Voltage. If 1st block is still in the WF, exclude the samplesin the 1st block from mean calculation
+    void VoltageCalibration(UsefulAtriStationEvent *theEvent, const AraAtriCalibTables *tables); ///< Converts ADC to Voltage using conversion table
+    void ApplyCableDelay(UsefulAtriStationEvent *theEvent, Double_t unixtime, AraStationId_t thisStationId); ///< Remove knwon cable delay
+    void ReturnSampleIndex(UsefulAtriStationEvent *theEvent); ///< Return sample index.
 
     protected:
         static AraEventCalibrator *fgInstance;  ///< protect against multiple instances
+        void chooseAtriPedFile(AraStationId_t stationId); ///< Sets fAtriPedFile to the default (or environment) pedestal file of the station
+        const UShort_t *loadAtriPedestalFile(const char *pedFile); ///< Reads a pedestal file into fAtriPedTables, unless it is already there
+        void resolveAtriVoltsCalib(AraAtriCalibTables *tables); ///< Picks, once at load time, the neighbouring conversion factors that replace each badly fitted capacitor
+        AraAtriCalibTables *mapAtriCalibCache(AraStationId_t stationId, Int_t timingEpoch); ///< Maps the binary calibration cache read-only, returns NULL if there is no usable cache
+        void calibrateAtriEvent(UsefulAtriStationEvent *theEvent, AraCalType::AraCalType_t calType, const char *pedFile, const RawAtriEventView *view); ///< The calibration steps behind calibrateEvent and calibrateInto, unpacking from view if it is not 0
 
     ClassDef(AraEventCalibrator,1);
 };
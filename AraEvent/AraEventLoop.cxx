@@ -0,0 +1,290 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraEventLoop.cxx        Parallel ATRI event loop                  /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Reads, calibrates and hands out the events of an ATRI run     /////
+/////     using several threads                                          /////
+//////////////////////////////////////////////////////////////////////////////
+
+#include "AraEventLoop.h"
+#include "AraGeomTool.h"
+#include "RawAtriStationEvent.h"
+#include "UsefulAtriStationEvent.h"
+
+#include "TChain.h"
+#include "TROOT.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+//! Number of consecutive entries an IO thread reads in one go, so the threads mostly decompress different baskets
+static const Long64_t ENTRIES_PER_CHUNK = 64;
+//! Raw events in flight per worker thread
+static const Int_t RAW_EVENTS_PER_WORKER = 4;
+
+namespace {
+
+    //! A blocking queue that can be closed, used to pass raw events between the threads
+    template<class T> class AraEventLoopQueue
+    {
+        public:
+            AraEventLoopQueue() : fClosed(false) {}
+            void push(const T &item) {
+                {
+                    std::lock_guard<std::mutex> lock(fMutex);
+                    fItems.push_back(item);
+                }
+                fCond.notify_one();
+            }
+            //! Waits for an item, returns false once the queue is closed and empty
+            bool pop(T &item) {
+                std::unique_lock<std::mutex> lock(fMutex);
+                fCond.wait(lock, [this]{ return !fItems.empty() || fClosed; });
+                if(fItems.empty()) return false;
+                item = fItems.front();
+                fItems.pop_front();
+                return true;
+            }
+            void close() {
+                {
+                    std::lock_guard<std::mutex> lock(fMutex);
+                    fClosed = true;
+                }
+                fCond.notify_all();
+            }
+        private:
+            std::deque<T> fItems;
+            std::mutex fMutex;
+            std::condition_variable fCond;
+            bool fClosed;
+    };
+
+    //! A raw event on its way from an IO thread to a worker
+    struct AraEventLoopItem {
+        Long64_t entry;
+        RawAtriStationEvent *rawEvent; ///< NULL if the entry could not be read
+    };
+
+}
+
+AraEventLoop::AraEventLoop(const char *fileName, AraCalType::AraCalType_t calType, Int_t numThreads)
+    : fCalType(calType), fNumIoThreads(0), fFirstEntry(0), fLastEntry(-1), fCalibrate(kTRUE), fNumEntries(-1)
+{
+    fFileNames.push_back(fileName);
+    setNumThreads(numThreads);
+}
+
+AraEventLoop::AraEventLoop(const std::vector<std::string> &fileNames, AraCalType::AraCalType_t calType, Int_t numThreads)
+    : fFileNames(fileNames), fCalType(calType), fNumIoThreads(0), fFirstEntry(0), fLastEntry(-1), fCalibrate(kTRUE), fNumEntries(-1)
+{
+    setNumThreads(numThreads);
+}
+
+AraEventLoop::~AraEventLoop()
+{
+    //Default destructor
+}
+
+void AraEventLoop::setNumThreads(Int_t numThreads)
+{
+    if(numThreads<=0) numThreads = std::thread::hardware_concurrency();
+    fNumThreads = std::max(numThreads, 1);
+}
+
+void AraEventLoop::setNumIoThreads(Int_t numIoThreads)
+{
+    fNumIoThreads = std::max(numIoThreads, 0);
+}
+
+void AraEventLoop::setEntryRange(Long64_t firstEntry, Long64_t lastEntry)
+{
+    fFirstEntry = std::max(firstEntry, (Long64_t)0);
+    fLastEntry = lastEntry;
+}
+
+void AraEventLoop::setPedestalFile(const char *pedFile)
+{
+    fPedFile = pedFile ? pedFile : "";
+}
+
+void AraEventLoop::setCalibrate(Bool_t calibrate)
+{
+    fCalibrate = calibrate;
+}
+
+Int_t AraEventLoop::getNumThreads() const
+{
+    return fNumThreads;
+}
+
+Long64_t AraEventLoop::getNumEntries()
+{
+    if(fNumEntries<0) {
+        TChain chain("eventTree");
+        for(size_t i=0;i<fFileNames.size();i++) chain.Add(fFileNames[i].c_str());
+        fNumEntries = chain.GetEntries();
+    }
+    return fNumEntries;
+}
+
+/*!
+    \param func called on a worker thread for every event
+    \return the number of events that were read and processed
+*/
+Long64_t AraEventLoop::process(EventFunc_t func)
+{
+    return run(&func, 0);
+}
+
+/*!
+    \param func called on a worker thread for every event, the function it returns is called in entry order on this thread
+    \return the number of events that were read and processed
+*/
+Long64_t AraEventLoop::processOrdered(OrderedEventFunc_t func)
+{
+    return run(0, &func);
+}
+
+Long64_t AraEventLoop::run(EventFunc_t *func, OrderedEventFunc_t *orderedFunc)
+{
+    Long64_t numEntries = getNumEntries();
+    Long64_t lastEntry = (fLastEntry<0 || fLastEntry>=numEntries) ? numEntries-1 : fLastEntry;
+    if(fFirstEntry>lastEntry) return 0;
+
+    //! ROOT has to know about the threads before any of them opens a file
+    ROOT::EnableThreadSafety();
+    AraGeomTool::Instance();
+    AraEventCalibrator *calibrator = AraEventCalibrator::Instance();
+    const char *pedFile = fPedFile.empty() ? 0 : fPedFile.c_str();
+
+    const Int_t numWorkers = fNumThreads;
+    const Int_t numIo = fNumIoThreads>0 ? fNumIoThreads : std::max(1, numWorkers/8);
+    const Int_t numRaw = RAW_EVENTS_PER_WORKER*numWorkers;
+
+    //! The raw events are recycled between the free queue and the work queue, so their buffers are reused too
+    std::vector<RawAtriStationEvent*> rawEvents(numRaw);
+    AraEventLoopQueue<RawAtriStationEvent*> freeQueue;
+    AraEventLoopQueue<AraEventLoopItem> workQueue;
+    for(Int_t i=0;i<numRaw;i++) {
+        rawEvents[i] = new RawAtriStationEvent();
+        freeQueue.push(rawEvents[i]);
+    }
+
+    //! For the ordered merge, the IO threads do not read further than maxAhead entries past the next entry to merge
+    std::mutex mergeMutex;
+    std::condition_variable mergeCond;
+    std::map<Long64_t, MergeFunc_t> pendingMerges;
+    Long64_t nextMerge = fFirstEntry;
+    const Long64_t maxAhead = 2*ENTRIES_PER_CHUNK*(numIo+numWorkers);
+
+    std::atomic<Long64_t> nextChunk(fFirstEntry);
+    std::atomic<Long64_t> numProcessed(0);
+    const std::vector<std::string> &fileNames = fFileNames;
+
+    auto ioThread = [&]() {
+        TChain chain("eventTree");
+        for(size_t i=0;i<fileNames.size();i++) chain.Add(fileNames[i].c_str());
+        RawAtriStationEvent *rawEvent = 0;
+        RawAtriStationEvent *boundEvent = 0; // the event the branch address was last set to
+        bool isClosed = false;
+        while(!isClosed) {
+            Long64_t chunkStart = nextChunk.fetch_add(ENTRIES_PER_CHUNK);
+            if(chunkStart>lastEntry) break;
+            Long64_t chunkEnd = std::min(chunkStart+ENTRIES_PER_CHUNK-1, lastEntry);
+            if(orderedFunc) {
+                std::unique_lock<std::mutex> lock(mergeMutex);
+                mergeCond.wait(lock, [&]{ return chunkStart<nextMerge+maxAhead; });
+            }
+            for(Long64_t entry=chunkStart;entry<=chunkEnd;entry++) {
+                if(!freeQueue.pop(rawEvent)) {
+                    isClosed = true; // the loop is shutting down, nothing left to read into
+                    break;
+                }
+                //! The pool holds only a few events, so the address only changes when a different one comes back
+                if(rawEvent!=boundEvent) {
+                    chain.SetBranchAddress("event", &rawEvent);
+                    boundEvent = rawEvent;
+                }
+                AraEventLoopItem item;
+                item.entry = entry;
+                item.rawEvent = rawEvent;
+                if(chain.GetEntry(entry)<=0) {
+                    fprintf(stderr, "AraEventLoop -- ERROR Can not read entry %lld\n", entry);
+                    freeQueue.push(rawEvent);
+                    item.rawEvent = 0;
+                }
+                workQueue.push(item);
+            }
+        }
+        chain.ResetBranchAddresses();
+    };
+
+    auto workerThread = [&](Int_t thread) {
+        //! Per thread calibration state, the tables inside the calibrator are shared and read-only
+        UsefulAtriStationEvent usefulEvent;
+        usefulEvent.setFlatStorage(kTRUE);
+        AraEventLoopItem item;
+        while(workQueue.pop(item)) {
+            MergeFunc_t merge;
+            if(item.rawEvent) {
+                if(fCalibrate) calibrator->calibrateInto(*item.rawEvent, usefulEvent, fCalType, pedFile);
+                else {
+                    //! Only the raw part is copied, so drop the samples of the last event calibrated into this one
+                    static_cast<RawAtriStationEvent&>(usefulEvent) = *item.rawEvent;
+                    usefulEvent.resetFlatStorage();
+                    usefulEvent.fNumChannels = 0;
+                    usefulEvent.fTimes.clear();
+                    usefulEvent.fVolts.clear();
+                }
+                freeQueue.push(item.rawEvent);
+                if(orderedFunc) merge = (*orderedFunc)(item.entry, &usefulEvent, thread);
+                else (*func)(item.entry, &usefulEvent, thread);
+                numProcessed++;
+            }
+            if(orderedFunc) {
+                {
+                    std::lock_guard<std::mutex> lock(mergeMutex);
+                    pendingMerges[item.entry] = merge;
+                }
+                mergeCond.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> ioThreads;
+    std::vector<std::thread> workerThreads;
+    for(Int_t i=0;i<numIo;i++) ioThreads.push_back(std::thread(ioThread));
+    for(Int_t i=0;i<numWorkers;i++) workerThreads.push_back(std::thread(workerThread, i));
+
+    //! The ordered merge runs here, on the calling thread
+    if(orderedFunc) {
+        while(nextMerge<=lastEntry) {
+            MergeFunc_t merge;
+            {
+                std::unique_lock<std::mutex> lock(mergeMutex);
+                mergeCond.wait(lock, [&]{ return pendingMerges.count(nextMerge)>0; });
+                merge = pendingMerges[nextMerge];
+                pendingMerges.erase(nextMerge);
+            }
+            if(merge) merge();
+            {
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                nextMerge++;
+            }
+            mergeCond.notify_all();
+        }
+    }
+
+    for(size_t i=0;i<ioThreads.size();i++) ioThreads[i].join();
+    workQueue.close();
+    for(size_t i=0;i<workerThreads.size();i++) workerThreads[i].join();
+
+    for(Int_t i=0;i<numRaw;i++) delete rawEvents[i];
+    return numProcessed;
+}
@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  AraEventLoop.h        Parallel ATRI event loop                    /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Reads, calibrates and hands out the events of an ATRI run     /////
+/////     using several threads                                          /////
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARAEVENTLOOP_H
+#define ARAEVENTLOOP_H
+
+//Includes
+#include "AraEventCalibrator.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class UsefulAtriStationEvent;
+
+//! Part of AraEvent library. Loops over the events of ATRI eventTree files on several threads
+/*!
+    IO threads read (decompress and deserialise) the RawAtriStationEvent objects, each from its own TChain,
+    and a pool of worker threads calibrates them and calls the user function.
+    Each worker calibrates into its own UsefulAtriStationEvent with AraEventCalibrator::calibrateInto,
+    so after the first few events the loop does not allocate, and the shared calibration tables are only read.
+
+    Events reach the user function in no particular order and from several threads at once.
+    Anything that needs the events in order (e.g. filling an output TTree) can be returned as a function
+    from processOrdered, which calls those functions one at a time, in entry order, on the thread that runs the loop.
+
+    \code
+    AraEventLoop loop("event3000.root", AraCalType::kLatestCalib, 32);
+    std::vector<double> rms(loop.getNumThreads());  // per thread state, no locking needed
+    loop.process([&](Long64_t entry, UsefulAtriStationEvent *event, Int_t thread) {
+        TGraph *gr = event->getGraphFromRFChan(0);
+        rms[thread] += gr->GetRMS(2);
+        delete gr;
+    });
+    \endcode
+    \ingroup rootclasses
+*/
+class AraEventLoop
+{
+    public:
+        typedef std::function<void(Long64_t entry, UsefulAtriStationEvent *event, Int_t thread)> EventFunc_t; ///< Called on a worker thread for each calibrated event. thread runs from 0 to getNumThreads()-1
+        typedef std::function<void()> MergeFunc_t; ///< Returned by an OrderedEventFunc_t, called in entry order on the thread running the loop
+        typedef std::function<MergeFunc_t(Long64_t entry, UsefulAtriStationEvent *event, Int_t thread)> OrderedEventFunc_t; ///< Called on a worker thread, may return an empty function if there is nothing to merge
+
+        AraEventLoop(const char *fileName, AraCalType::AraCalType_t calType=AraCalType::kLatestCalib, Int_t numThreads=0); ///< Loop over the eventTree in fileName (may contain wildcards). numThreads 0 uses all cores
+        AraEventLoop(const std::vector<std::string> &fileNames, AraCalType::AraCalType_t calType=AraCalType::kLatestCalib, Int_t numThreads=0); ///< Loop over the eventTree in several files, as one chain
+        ~AraEventLoop(); ///< Destructor
+
+        void setNumThreads(Int_t numThreads); ///< Number of worker threads, 0 uses all cores
+        void setNumIoThreads(Int_t numIoThreads); ///< Number of reading threads, 0 (default) picks one per 8 workers
+        void setEntryRange(Long64_t firstEntry, Long64_t lastEntry=-1); ///< Only process the entries firstEntry to lastEntry (inclusive, -1 for the end of the chain)
+        void setPedestalFile(const char *pedFile); ///< Calibrate with pedFile instead of the default pedestals of the station
+        void setCalibrate(Bool_t calibrate); ///< If false the events are not calibrated, the UsefulAtriStationEvent only holds the raw event (e.g. for header only selections)
+
+        Int_t getNumThreads() const; ///< Number of worker threads that process will use
+        Long64_t getNumEntries(); ///< Number of entries in the chain
+
+        Long64_t process(EventFunc_t func); ///< Runs func on every event, returns the number of events processed
+        Long64_t processOrdered(OrderedEventFunc_t func); ///< Runs func on every event and the functions it returns in entry order, returns the number of events processed
+
+    private:
+        Long64_t run(EventFunc_t *func, OrderedEventFunc_t *orderedFunc);
+
+        std::vector<std::string> fFileNames; ///< The files that make up the chain
+        AraCalType::AraCalType_t fCalType; ///< The calibration applied to the events
+        Int_t fNumThreads; ///< Number of worker threads
+        Int_t fNumIoThreads; ///< Number of reading threads, 0 for automatic
+        Long64_t fFirstEntry; ///< First entry to process
+        Long64_t fLastEntry; ///< Last entry to process, -1 for the end of the chain
+        std::string fPedFile; ///< Pedestal file, empty for the station default
+        Bool_t fCalibrate; ///< Whether the events are calibrated
+        Long64_t fNumEntries; ///< Entries in the chain, -1 until counted
+};
+
+#endif //ARAEVENTLOOP_H
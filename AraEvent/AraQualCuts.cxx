@@ -10,6 +10,7 @@
 #include <fstream>
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 
 //class definition includes
 #include "AraQualCuts.h"
@@ -19,6 +20,7 @@
 #include "FFTtools.h"
 #include "AraAntennaInfo.h"
 #include "AraGeomTool.h"
+#include "AraEventCalibrator.h"
 
 //ROOT includes
 #include "TGraph.h"
@@ -32,6 +34,8 @@ AraQualCuts::AraQualCuts()
     _VOffsetThresh=-20.;
     _HOffsetThresh=-12.;
     _OffsetBlocksTimeWindowCut=10.;
+    _VOffsetThreshADC=-30.;
+    _HOffsetThreshADC=-18.;
     //for the moment, this doesn't do anything intelligent...
 }
 
@@ -80,6 +84,26 @@ bool AraQualCuts::isGoodEvent(UsefulAtriStationEvent *realEvent)
     return isGoodEvent;
 }
 
+//! Returns if a raw atri event passes the quality cuts that can be made before calibration
+/*!
+    A cheap pre-screen for isGoodEvent, made only of the cuts that give the same answer on the raw event:
+    block gaps and first event corruption are read from the headers, and the calibration only ever removes samples,
+    so a channel that is short in the raw readout is short once calibrated.
+    An event which fails it would fail isGoodEvent, so it need not be calibrated;
+    an event which passes it still has to be calibrated and pass isGoodEvent.
+    The raw offset block detector, hasOffsetBlocks(RawAtriStationEvent*, const UShort_t*), is not exact and so is not applied here.
+    \param rawEvent the raw atri event pointer
+    \return if the event passes the raw level cuts
+*/
+bool AraQualCuts::isGoodRawEvent(RawAtriStationEvent *rawEvent)
+{
+    // too few blocks goes first, as hasBlockGap needs a block to look at
+    if(hasTooFewBlocks(rawEvent) || hasBlockGap(rawEvent) || hasFirstEventCorruption(rawEvent)){
+        return false;
+    }
+    return true;
+}
+
 //! Returns if a real atri event has an offset block probelm
 /*!
     \param realEvent the real atri event pointer
@@ -90,24 +114,10 @@ bool AraQualCuts::hasOffsetBlocks(UsefulAtriStationEvent *realEvent)
 
     bool hasOffsetBlocks=false;
 
-    /*
-        This is currently only tuned for A2, and sort of for A3
-        So "bounce out" if someone tries to use it for another station
-    */
-    if(realEvent->stationId!=ARA_STATION2 && realEvent->stationId!=ARA_STATION3){
+    int numStringsToCheck = setupOffsetBlocksCut(realEvent);
+    if(numStringsToCheck==0){
         return hasOffsetBlocks;
     }
-    int numStringsToCheck=4;
-
-    if(realEvent->stationId==ARA_STATION3){
-
-        // if string 4 has gone "bad" in A3 (which we think happened at run 1901)
-        // then reduce the strings we scan over for a mistake
-        if(realEvent->unixTime > 1387451885 ){
-            numStringsToCheck=3;
-        }
-        _OffsetBlocksTimeWindowCut=20.; // bump this for A3 only; actually makes a little more sense. this says "anywhere within a block"
-    }
 
     int nChanBelowThresh_V[4]={0};
     int nChanBelowThresh_H[4]={0};
@@ -121,7 +131,11 @@ bool AraQualCuts::hasOffsetBlocks(UsefulAtriStationEvent *realEvent)
     AraAntPol::AraAntPol_t Hpol = AraAntPol::kHorizontal;
 
     for(int chan=0; chan<16; chan++){
-        TGraph* grRaw = realEvent->getGraphFromRFChan(chan); //get the waveform
+        Int_t elecChan = AraGeomTool::Instance()->getElecChanFromRFChan(chan,realEvent->stationId);
+        int numPoints = realEvent->getNumSamplesInElecChan(elecChan); //get the waveform
+        if(numPoints==0){
+            continue;
+        }
 
         AraAntPol::AraAntPol_t this_pol = AraGeomTool::Instance()->getPolByRFChan(chan,realEvent->stationId);
         double deltaT; //interpolation time step
@@ -139,12 +153,10 @@ bool AraQualCuts::hasOffsetBlocks(UsefulAtriStationEvent *realEvent)
             deltaT=_VdeltaT;
             this_thresh=_VOffsetThresh;
         }
-        //get interpolated waveform
-        TGraph *grInt = FFTtools::getInterpolatedGraph(grRaw, deltaT); 
-        //then, get the rolling mean graph
-        TGraph *grMean = getRollingMean(grInt,SAMPLES_PER_BLOCK); //SAMPLES_PER_BLOCK=64, in araSoft.h
+        //get the max of the rolling mean of the interpolated waveform
         double maxTime;
-        double meanMax = getMax(grMean, &maxTime);
+        double meanMax = getMaxRollingMean(realEvent->getTimesForElecChan(elecChan), realEvent->getVoltsForElecChan(elecChan),
+            numPoints, deltaT, SAMPLES_PER_BLOCK, &maxTime); //SAMPLES_PER_BLOCK=64, in araSoft.h
         // printf("Chan %d: maxTime %.2f and meanMax %.2f \n", chan, maxTime, meanMax);
 
         if(-1.*fabs(meanMax)<this_thresh){
@@ -157,12 +169,152 @@ bool AraQualCuts::hasOffsetBlocks(UsefulAtriStationEvent *realEvent)
                 maxTimeVec[chan%4][1].push_back(maxTime);
             }
         }
+    }
+
+    hasOffsetBlocks = hasOffsetBlockStrings(nChanBelowThresh_V, nChanBelowThresh_H, maxTimeVec, numStringsToCheck);
+    return hasOffsetBlocks;
+}
+
+//! Returns if a raw atri event has an offset block problem, without calibrating it
+/*!
+    The calibrated cut looks for a block long stretch of a waveform whose mean is far from zero.
+    Here the stretches are the readout blocks themselves: the mean of each block of pedestal-subtracted ADC counts
+    is compared to the mean of the whole channel, so nothing is interpolated or allocated.
+    The first block of each channel is skipped, as the calibration trims it.
+    The offsets are in ADC counts and are compared to _VOffsetThreshADC and _HOffsetThreshADC.
+    This only approximates the calibrated cut, in either direction: the ADC to mV conversion is a fit per capacitor,
+    so the ADC thresholds have no exact mV equivalent, and the block times ignore the timing calibration and cable delays,
+    so offsets in the same readout block always coincide. It is therefore not part of isGoodRawEvent;
+    use it only where rejecting a few events that isGoodEvent would keep is acceptable.
+    \param rawEvent the raw atri event pointer
+    \param peds the pedestals of the station, indexed by RawAtriStationEvent::getPedIndex
+    \return does the event have offset blocks?
+*/
+bool AraQualCuts::hasOffsetBlocks(RawAtriStationEvent *rawEvent, const UShort_t *peds)
+{
+
+    bool hasOffsetBlocks=false;
+
+    int numStringsToCheck = setupOffsetBlocksCut(rawEvent);
+    if(numStringsToCheck==0 || !peds){
+        return hasOffsetBlocks;
+    }
+
+    // one pass over the blocks keeps the sum of each electronics channel and its lowest and highest block means
+    int numBlocks[CHANNELS_PER_ATRI]={0};
+    int numSamples[CHANNELS_PER_ATRI]={0};
+    double sum[CHANNELS_PER_ATRI]={0};
+    double minBlockMean[CHANNELS_PER_ATRI], maxBlockMean[CHANNELS_PER_ATRI];
+    double minBlockTime[CHANNELS_PER_ATRI], maxBlockTime[CHANNELS_PER_ATRI];
+    for(size_t readBlock=0; readBlock<rawEvent->blockVec.size(); readBlock++){
+        RawAtriStationBlock &block = rawEvent->blockVec[readBlock];
+        int dda = block.getDda();
+        int irsBlock = block.getBlock();
+        int uptoChan=0;
+        for(int bit=0; bit<RFCHAN_PER_DDA && uptoChan<(int)block.data.size(); bit++){
+            if(!(block.channelMask&(1<<bit))) continue;
+            const std::vector<UShort_t> &samples = block.data[uptoChan++];
+            int chanId = bit + RFCHAN_PER_DDA*dda; // as in AraEventCalibrator::UnpackDAQFormatToElecChanFormat
+            int blockNum = numBlocks[chanId]++;
+            int numInBlock = std::min((int)samples.size(), SAMPLES_PER_BLOCK);
+            if(blockNum==0 || numInBlock==0) continue;
+
+            const UShort_t *blockPeds = peds + RawAtriStationEvent::getPedIndex(dda, irsBlock, bit, 0);
+            double blockSum=0.;
+            for(int samp=0; samp<numInBlock; samp++){
+                blockSum += double(samples[samp]) - double(blockPeds[samp]);
+            }
+            double blockMean = blockSum/numInBlock;
+            double blockTime = blockNum*SAMPLES_PER_BLOCK*NSPERSAMP_ATRI;
+            if(numSamples[chanId]==0 || blockMean<minBlockMean[chanId]){
+                minBlockMean[chanId]=blockMean;
+                minBlockTime[chanId]=blockTime;
+            }
+            if(numSamples[chanId]==0 || blockMean>maxBlockMean[chanId]){
+                maxBlockMean[chanId]=blockMean;
+                maxBlockTime[chanId]=blockTime;
+            }
+            sum[chanId]+=blockSum;
+            numSamples[chanId]+=numInBlock;
+        }
+    }
+
+    int nChanBelowThresh_V[4]={0};
+    int nChanBelowThresh_H[4]={0};
+    std::vector< std::vector< std::vector<double> > > maxTimeVec(4, std::vector< std::vector<double> >(2));
+
+    AraGeomTool *geom = AraGeomTool::Instance();
+    for(int chan=0; chan<16; chan++){
+        int chanId = geom->getElecChanFromRFChan(chan, rawEvent->stationId);
+        if(chanId<0 || chanId>=CHANNELS_PER_ATRI || numSamples[chanId]==0) continue;
+
+        AraAntPol::AraAntPol_t this_pol = geom->getPolByRFChan(chan, rawEvent->stationId);
+        double this_thresh = (this_pol==AraAntPol::kHorizontal) ? _HOffsetThreshADC : _VOffsetThreshADC; //fallback to V (more conservative)
+
+        // the block mean furthest from the (zero meaned) channel
+        double mean = sum[chanId]/numSamples[chanId];
+        double meanMax = maxBlockMean[chanId]-mean;
+        double maxTime = maxBlockTime[chanId];
+        if(fabs(minBlockMean[chanId]-mean)>fabs(meanMax)){
+            meanMax = minBlockMean[chanId]-mean;
+            maxTime = minBlockTime[chanId];
+        }
+
+        if(-1.*fabs(meanMax)<this_thresh){
+            if(this_pol==AraAntPol::kVertical){
+                nChanBelowThresh_V[chan%4]+=1;
+                maxTimeVec[chan%4][0].push_back(maxTime);
+            }
+            else if (this_pol==AraAntPol::kHorizontal){
+                nChanBelowThresh_H[chan%4]+=1;
+                maxTimeVec[chan%4][1].push_back(maxTime);
+            }
+        }
+    }
 
-        delete grMean;
-        delete grInt;
-        delete grRaw;
+    hasOffsetBlocks = hasOffsetBlockStrings(nChanBelowThresh_V, nChanBelowThresh_H, maxTimeVec, numStringsToCheck);
+    return hasOffsetBlocks;
+}
+
+//! Returns the number of strings the offset block cut checks for an event
+/*!
+    \param rawEvent the raw atri event pointer
+    \return the number of strings to check, 0 if the cut is not tuned for the station
+*/
+int AraQualCuts::setupOffsetBlocksCut(RawAtriStationEvent *rawEvent)
+{
+    /*
+        This is currently only tuned for A2, and sort of for A3
+        So "bounce out" if someone tries to use it for another station
+    */
+    if(rawEvent->stationId!=ARA_STATION2 && rawEvent->stationId!=ARA_STATION3){
+        return 0;
     }
+    int numStringsToCheck=4;
 
+    if(rawEvent->stationId==ARA_STATION3){
+
+        // if string 4 has gone "bad" in A3 (which we think happened at run 1901)
+        // then reduce the strings we scan over for a mistake
+        if(rawEvent->unixTime > 1387451885 ){
+            numStringsToCheck=3;
+        }
+        _OffsetBlocksTimeWindowCut=20.; // bump this for A3 only; actually makes a little more sense. this says "anywhere within a block"
+    }
+    return numStringsToCheck;
+}
+
+//! Returns if the offset blocks found in the channels line up into offset block strings
+/*!
+    \param nChanBelowThresh_V the number of vpol channels of each string with an offset block
+    \param nChanBelowThresh_H the number of hpol channels of each string with an offset block
+    \param maxTimeVec the times of the offset blocks, by string and then polarization (0 vpol, 1 hpol)
+    \param numStringsToCheck the number of strings to check
+    \return does the event have offset blocks?
+*/
+bool AraQualCuts::hasOffsetBlockStrings(const int nChanBelowThresh_V[4], const int nChanBelowThresh_H[4],
+    const std::vector< std::vector< std::vector<double> > > &maxTimeVec, int numStringsToCheck)
+{
     /* Check for offset block
         Criteria: at least 2 offset block strings. An offset block string is defined as having offset blocks in both Vpols and at least 1
         Hpol, and their offset time is within timeRangeCut for Vpol & Hpol resoectively.
@@ -196,11 +348,7 @@ bool AraQualCuts::hasOffsetBlocks(UsefulAtriStationEvent *realEvent)
     // currently unused
     int noffsetBlockString_startH=0;
 
-    if(noffsetBlockString_startV>1 || noffsetBlockString_startH>1){
-        // printf("Yes! Has offset blocks!\n");
-        hasOffsetBlocks=true;
-    }
-    return hasOffsetBlocks;
+    return noffsetBlockString_startV>1 || noffsetBlockString_startH>1;
 }
 
 //! Returns the rolling mean graph with a window size samplePerBlock
@@ -226,6 +374,149 @@ TGraph* AraQualCuts::getRollingMean(TGraph *grInt, int samplePerBlock){
      return grMean;
 }
 
+namespace {
+
+//! Evaluates an Akima interpolation of a waveform at increasing times
+/*!
+    This is the Akima spline of ROOT::Math::Interpolator (GSL), which FFTtools::getInterpolatedGraph uses,
+    with the coefficients of each interval worked out when the walker reaches it rather than stored for the whole waveform
+*/
+struct AkimaWalker_t
+{
+    const Double_t *x; ///< the sample times, increasing
+    const Double_t *y; ///< the sample values
+    int n; ///< the number of samples, at least 5
+    int interval; ///< the interval the coefficients are for
+    double b, c, d; ///< the polynomial coefficients of the interval
+
+    //! the slope of interval i, extrapolated beyond the ends as in GSL
+    double slope(int i) const
+    {
+        if(i<0){
+            double m0 = (y[1]-y[0])/(x[1]-x[0]);
+            double m1 = (y[2]-y[1])/(x[2]-x[1]);
+            return i==-1 ? 2.0*m0-m1 : 3.0*m0-2.0*m1;
+        }
+        if(i>n-2){
+            double m2 = (y[n-1]-y[n-2])/(x[n-1]-x[n-2]);
+            double m3 = (y[n-2]-y[n-3])/(x[n-2]-x[n-3]);
+            return i==n-1 ? 2.0*m2-m3 : 3.0*m2-2.0*m3;
+        }
+        return (y[i+1]-y[i])/(x[i+1]-x[i]);
+    }
+
+    void setInterval(int i)
+    {
+        interval = i;
+        double m_m2 = slope(i-2), m_m1 = slope(i-1), m = slope(i), m_p1 = slope(i+1), m_p2 = slope(i+2);
+        const double NE = fabs(m_p1-m) + fabs(m_m1-m_m2);
+        if(NE==0.0){
+            b = m;
+            c = 0.0;
+            d = 0.0;
+            return;
+        }
+        const double h = x[i+1]-x[i];
+        const double NE_next = fabs(m_p2-m_p1) + fabs(m-m_m1);
+        const double alpha = fabs(m_m1-m_m2)/NE;
+        double tL_next = m;
+        if(NE_next!=0.0){
+            const double alpha_next = fabs(m-m_m1)/NE_next;
+            tL_next = (1.0-alpha_next)*m + alpha_next*m_p1;
+        }
+        b = (1.0-alpha)*m_m1 + alpha*m;
+        c = (3.0*m - 2.0*b - tL_next)/h;
+        d = (b + tL_next - 2.0*m)/(h*h);
+    }
+
+    void start(const Double_t *times, const Double_t *volts, int numPoints)
+    {
+        x = times;
+        y = volts;
+        n = numPoints;
+        setInterval(0);
+    }
+
+    //! the interpolated value at t, which must not be before the previous t
+    double eval(double t)
+    {
+        int i = interval;
+        while(i+1<n-1 && x[i+1]<=t) i++;
+        if(i!=interval) setInterval(i);
+        const double delx = t-x[i];
+        return y[i] + delx*(b + delx*(c + d*delx));
+    }
+};
+
+}
+
+//! Returns the max value (pos or neg) of the rolling mean of an interpolated waveform
+/*!
+    Gives the same result as getMax(getRollingMean(FFTtools::getInterpolatedGraph(gr, deltaT), samplePerBlock), maxTime)
+    but works on the sample arrays in O(N) and without allocating:
+    the interpolated points are generated at the same times as the interpolated graph, one walker adds them as they enter
+    the window and a second one regenerates and removes them as they leave it.
+    The windows are the same inclusive time ranges that getRollingMean crops.
+    \param times the sample times, increasing
+    \param volts the sample values
+    \param numPoints the number of samples
+    \param deltaT the interpolation time step
+    \param samplePerBlock the window size, in interpolated samples
+    \param maxTime a pointer to the max time, measured from the first sample as in getRollingMean
+    \return the max value (pos or neg) of the rolling mean, 0 if the waveform is too short
+*/
+double AraQualCuts::getMaxRollingMean(const Double_t *times, const Double_t *volts, int numPoints, double deltaT, int samplePerBlock, double *maxTime)
+{
+    double max=0.;
+    double _maxTime=0.;
+    if(maxTime) *maxTime = _maxTime;
+    if(!times || !volts || numPoints<5 || deltaT<=0.){ // the Akima interpolation needs 5 points
+        return max;
+    }
+
+    // the interpolated points are at the times of the loop in FFTtools::getInterpolatedGraph
+    const double startTime = times[0];
+    const double lastTime = times[numPoints-1];
+    int nSamp=0;
+    for(double time=startTime; time<=lastTime; time+=deltaT) nSamp++;
+    if(nSamp<2){
+        return max;
+    }
+    const double t0 = startTime;
+    const double wInt = (startTime+deltaT) - t0;
+
+    AkimaWalker_t lead, trail;
+    lead.start(times, volts, numPoints);
+    trail.start(times, volts, numPoints);
+    int leadIndex=0, trailIndex=0; // the window holds the interpolated points [trailIndex, leadIndex)
+    double leadTime=startTime, trailTime=startTime;
+    double sum=0.;
+
+    for(int i=0; i<nSamp-samplePerBlock; i++){
+        const double minTime = t0+i*wInt;
+        const double maxWindowTime = t0+(i+samplePerBlock)*wInt;
+        while(leadIndex<nSamp && leadTime<=maxWindowTime){
+            sum += lead.eval(leadTime);
+            leadIndex++;
+            leadTime+=deltaT;
+        }
+        while(trailIndex<leadIndex && trailTime<minTime){
+            sum -= trail.eval(trailTime);
+            trailIndex++;
+            trailTime+=deltaT;
+        }
+        const int count = leadIndex-trailIndex;
+        if(count==0) continue;
+        const double mean = sum/double(count);
+        if(fabs(mean)>fabs(max)){
+            max = mean;
+            _maxTime = wInt*i;
+        }
+    }
+    if(maxTime) *maxTime = _maxTime;
+    return max;
+}
+
 //! Returns the max value (pos or neg) of a waveform
 /*!
     \param gr the tgraph
@@ -348,6 +639,38 @@ bool AraQualCuts::hasTooFewBlocks(UsefulAtriStationEvent *realEvent)
     return hasTooFewBlocks;
 }
 
+//! Returns if a raw atri event has two few blocks
+/*!
+    The calibration only ever removes samples, so a channel with fewer than SAMPLES_PER_BLOCK raw samples
+    will also have too few once it is calibrated
+    \param rawEvent the raw atri event pointer
+    \return if the event has two few blocks/samples to be analyzed
+*/
+bool AraQualCuts::hasTooFewBlocks(RawAtriStationEvent *rawEvent)
+{
+
+    int numSamples[CHANNELS_PER_ATRI]={0};
+    for(size_t readBlock=0; readBlock<rawEvent->blockVec.size(); readBlock++){
+        RawAtriStationBlock &block = rawEvent->blockVec[readBlock];
+        int uptoChan=0;
+        for(int bit=0; bit<RFCHAN_PER_DDA && uptoChan<(int)block.data.size(); bit++){
+            if(!(block.channelMask&(1<<bit))) continue;
+            numSamples[bit + RFCHAN_PER_DDA*block.getDda()] += block.data[uptoChan++].size();
+        }
+    }
+
+    bool hasTooFewBlocks=false;
+    AraStationInfo *stationInfo = AraGeomTool::Instance()->getStationInfo(rawEvent->stationId);
+    for(int chan=0; chan<stationInfo->getNumRFChans(); chan++){
+        int chanId = stationInfo->getElecChanFromRFChan(chan);
+        if(chanId<0 || chanId>=CHANNELS_PER_ATRI || numSamples[chanId]<SAMPLES_PER_BLOCK){
+            hasTooFewBlocks=true;
+            break;
+        }
+    }
+    return hasTooFewBlocks;
+}
+
 //! Returns if a real atri event contains a waveform whose number of samples is less than 500.
 /*!
     \param realEvent the useful atri event pointer
@@ -9,6 +9,7 @@
 #define ARAQUALCUTS_H
 
 //Includes
+#include <vector>
 #include "RawAtriStationEvent.h"
 #include "UsefulAtriStationEvent.h"
 
@@ -27,10 +28,12 @@ class AraQualCuts
         static AraQualCuts*  Instance();
 
         bool isGoodEvent(UsefulAtriStationEvent *realEvent);
+        bool isGoodRawEvent(RawAtriStationEvent *rawEvent); ///< Pre-screen before calibration with the cuts that need no calibration, false if the event is sure to fail isGoodEvent
 
         bool hasBlockGap(RawAtriStationEvent *rawEvent); ///< Detects block gaps
         bool hasTimingError(UsefulAtriStationEvent *realEvent); ///< Detects timing errors
         bool hasTooFewBlocks(UsefulAtriStationEvent *realEvent); ///< Detects too few block cases
+        bool hasTooFewBlocks(RawAtriStationEvent *rawEvent); ///< Detects too few block cases from the raw readout
         bool hasTooFewSamples(UsefulAtriStationEvent *realEvent); ///< Detects too few waveform samples
         bool hasFirstEventCorruption(RawAtriStationEvent *rawEvent); ///<Checks for event corruption in A2 and A3
 
@@ -48,11 +51,15 @@ class AraQualCuts
         double _HOffsetThresh; ///< the offset which will trigger a "bad block" in hpol
         int _NumOffsetBlocksCut; ///< numer of channels which must have an offset block to qualify the event as bad
         int _OffsetBlocksTimeWindowCut; ///< the coincidence window for offset blocks
+        double _VOffsetThreshADC; ///< the offset in pedestal-subtracted ADC counts which will trigger a "bad block" in vpol, for the raw offset block detector
+        double _HOffsetThreshADC; ///< the offset in pedestal-subtracted ADC counts which will trigger a "bad block" in hpol, for the raw offset block detector
         bool hasOffsetBlocks(UsefulAtriStationEvent *realEvent); ///< Detects offset blocks
+        bool hasOffsetBlocks(RawAtriStationEvent *rawEvent, const UShort_t *peds); ///< Opt-in approximation of the offset block cut from the block means of the pedestal-subtracted raw samples, not part of isGoodRawEvent
 
         double getMax(TGraph *gr, double *maxTime); ///< gets the max of waveform
         double getMean(TGraph *gr); ///< gets the mean of a waveform
         TGraph* getRollingMean(TGraph *grInt, int samplePerBlock); ///< gets the rolling average of a waveform
+        double getMaxRollingMean(const Double_t *times, const Double_t *volts, int numPoints, double deltaT, int samplePerBlock, double *maxTime); ///< gets the max of the rolling average of the interpolated waveform, without making any graphs
 
         int getLivetimeConfiguration(const int runNumber, int stationId);
         int getLivetimeConfiguration(const int runNumber, RawAtriStationEvent *realEvent)
@@ -62,7 +69,9 @@ class AraQualCuts
         static AraQualCuts *fgInstance; // protect against multiple instances
         
     private:
-
+        int setupOffsetBlocksCut(RawAtriStationEvent *rawEvent); ///< Returns the number of strings the offset block cut checks for this event, 0 if the cut does not apply
+        bool hasOffsetBlockStrings(const int nChanBelowThresh_V[4], const int nChanBelowThresh_H[4],
+            const std::vector< std::vector< std::vector<double> > > &maxTimeVec, int numStringsToCheck); ///< Applies the string coincidence of the offset block cut
 
 };
 
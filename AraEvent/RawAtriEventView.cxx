@@ -0,0 +1,152 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  RawAtriEventView.cxx        Zero-copy view of a raw ATRI event    /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Reads the header, blocks and samples of an ATRI event in place /////
+/////     from the DAQ buffer, without copying them                      /////
+//////////////////////////////////////////////////////////////////////////////
+
+#include "RawAtriEventView.h"
+#include "RawAtriStationEvent.h"
+#include "AraRootVersion.h"
+#include <cstdio>
+
+RawAtriEventView::RawAtriEventView()
+    : fHeader(0), fDataBuffer(0), fValid(kFALSE)
+{
+    //Default Constructor
+}
+
+RawAtriEventView::RawAtriEventView(const AraStationEventHeader_t *hdPtr, const char *dataBuffer)
+    : fHeader(0), fDataBuffer(0), fValid(kFALSE)
+{
+    setBuffer(hdPtr, dataBuffer);
+}
+
+RawAtriEventView::~RawAtriEventView()
+{
+    //Default Destructor
+}
+
+/*!
+    Walks the block headers once to find where each block starts, the samples are not touched
+    \param hdPtr the event header
+    \param dataBuffer the data following the event header, hdPtr->numBytes long
+    \return kTRUE if the blocks added up to the numBytes of the header
+*/
+Bool_t RawAtriEventView::setBuffer(const AraStationEventHeader_t *hdPtr, const char *dataBuffer)
+{
+    fHeader=hdPtr;
+    fDataBuffer=dataBuffer;
+    fBlockOffset.clear();
+    fNumChannels.clear();
+
+    const Int_t numDataBytes=hdPtr->numBytes;
+    Int_t uptoByte=0;
+    for(int block=0;block<hdPtr->numReadoutBlocks;block++) {
+        if(uptoByte+(Int_t)sizeof(AraStationEventBlockHeader_t)>numDataBytes) break;
+        const AraStationEventBlockHeader_t *blkPtr=(const AraStationEventBlockHeader_t*)&dataBuffer[uptoByte];
+        Int_t numChan=0;
+        for(int bit=0;bit<8;bit++) {
+            if(blkPtr->channelMask&(1<<bit)) numChan++;
+        }
+        Int_t blockBytes=sizeof(AraStationEventBlockHeader_t)+sizeof(AraStationEventBlockChannel_t)*numChan;
+        if(uptoByte+blockBytes>numDataBytes) break;
+        fBlockOffset.push_back(uptoByte);
+        fNumChannels.push_back(numChan);
+        uptoByte+=blockBytes;
+    }
+
+    fValid=(getNumBlocks()==hdPtr->numReadoutBlocks && uptoByte==numDataBytes);
+    if(!fValid) {
+        fprintf(stderr, "RawAtriEventView::setBuffer -- ERROR Event %u has %i of %i blocks in %i of %i bytes\n",
+                hdPtr->eventNumber, getNumBlocks(), hdPtr->numReadoutBlocks, uptoByte, numDataBytes);
+    }
+    return fValid;
+}
+
+UInt_t RawAtriEventView::getTimeStamp() const
+{
+    UInt_t timeStamp=fHeader->timeStamp;
+    timeStamp ^= (timeStamp >> 1);
+    timeStamp ^= (timeStamp >> 2);
+    timeStamp ^= (timeStamp >> 4);
+    timeStamp ^= (timeStamp >> 8);
+    timeStamp ^= (timeStamp >> 16);
+    return timeStamp;
+}
+
+bool RawAtriEventView::isCalpulserEvent() const
+{
+    return RawAtriStationEvent::isCalpulserTimeStamp(getStationId(), getTimeStamp());
+}
+
+Bool_t RawAtriEventView::isTrigType(Int_t bit) const
+{
+    if(bit >= MAX_TRIG_BLOCKS) {
+        fprintf(stderr, "%s -- bit %i too high!\n", __FUNCTION__, bit);
+        return kFALSE;
+    }
+    return fHeader->triggerInfo[bit] ? kTRUE : kFALSE;
+}
+
+/*!
+    Fills everything that RawAtriStationEvent(AraStationEventHeader_t*, char*) fills except the samples.
+    This is what AraEventCalibrator::calibrateInto uses, the samples themselves are unpacked from the view.
+    \param rawEvent the event to fill
+*/
+void RawAtriEventView::fillEventHeader(RawAtriStationEvent *rawEvent) const
+{
+    rawEvent->softVerMajor=ARA_ROOT_MAJOR;
+    rawEvent->softVerMinor=ARA_ROOT_MINOR;
+    rawEvent->typeId=fHeader->gHdr.typeId;
+    rawEvent->verId=fHeader->gHdr.verId;
+    rawEvent->subVerId=fHeader->gHdr.subVerId;
+    rawEvent->stationId=fHeader->gHdr.stationId;
+    rawEvent->reserved=fHeader->gHdr.reserved;
+    rawEvent->numBytes=fHeader->gHdr.numBytes;
+    rawEvent->checksum=fHeader->gHdr.checksum;
+
+    rawEvent->unixTime=fHeader->unixTime;
+    rawEvent->unixTimeUs=fHeader->unixTimeUs;
+    rawEvent->eventNumber=fHeader->eventNumber;
+    rawEvent->ppsNumber=fHeader->ppsNumber;
+    rawEvent->numStationBytes=fHeader->numBytes;
+    rawEvent->timeStamp=getTimeStamp();
+    rawEvent->eventId=fHeader->eventId;
+    rawEvent->versionId=fHeader->versionNumber;
+    rawEvent->numReadoutBlocks=fHeader->numReadoutBlocks;
+    for(int trig=0;trig<MAX_TRIG_BLOCKS;trig++) {
+        rawEvent->triggerInfo[trig]=fHeader->triggerInfo[trig];
+        rawEvent->triggerBlock[trig]=fHeader->triggerBlock[trig];
+    }
+
+    const Int_t numBlocks=getNumBlocks();
+    rawEvent->blockVec.resize(numBlocks);
+    for(int block=0;block<numBlocks;block++) {
+        RawAtriStationBlock &rawBlock = rawEvent->blockVec[block];
+        const AraStationEventBlockHeader_t *blkPtr = getBlockHeader(block);
+        rawBlock.irsBlockNumber=blkPtr->irsBlockNumber;
+        rawBlock.channelMask=blkPtr->channelMask;
+        rawBlock.numChannels=fNumChannels[block];
+        rawBlock.data.clear();
+    }
+}
+
+/*!
+    The same event as RawAtriStationEvent(AraStationEventHeader_t*, char*), but the blocks and sample vectors of rawEvent are reused
+    \param rawEvent the event to fill
+*/
+void RawAtriEventView::fillRawEvent(RawAtriStationEvent *rawEvent) const
+{
+    fillEventHeader(rawEvent);
+    const Int_t numBlocks=getNumBlocks();
+    for(int block=0;block<numBlocks;block++) {
+        RawAtriStationBlock &rawBlock = rawEvent->blockVec[block];
+        rawBlock.data.resize(fNumChannels[block]);
+        for(int chan=0;chan<fNumChannels[block];chan++) {
+            const UShort_t *samples=getSamples(block, chan);
+            rawBlock.data[chan].assign(samples, samples+SAMPLES_PER_BLOCK);
+        }
+    }
+}
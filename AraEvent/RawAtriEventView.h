@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  RawAtriEventView.h        Zero-copy view of a raw ATRI event      /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Reads the header, blocks and samples of an ATRI event in place /////
+/////     from the DAQ buffer, without copying them                      /////
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef RAWATRIEVENTVIEW_H
+#define RAWATRIEVENTVIEW_H
+
+//Includes
+#include <vector>
+#include <TObject.h>
+#include "araSoft.h"
+#include "araAtriStructures.h"
+
+class RawAtriStationEvent;
+
+//! Part of AraEvent library. A raw ATRI event read in place from the DAQ buffer
+/*!
+    RawAtriStationEvent(AraStationEventHeader_t*, char*) copies every sample of every block into its own vector.
+    The view instead only records where each AraStationEventBlockHeader_t sits in the data buffer, so the header,
+    the block headers and the samples (as AraStationEventBlockChannel_t) are read straight from the buffer.
+    Setting a view to a new event does not allocate once it has seen the largest event of the run.
+
+    The view does not own the buffers, they have to stay unchanged for as long as the view is used.
+    The calibrator can unpack the samples directly from the view with AraEventCalibrator::calibrateInto.
+    \code
+    RawAtriEventView view;
+    if(view.setBuffer(&theEventHeader, dataBuffer) && view.isCalpulserEvent()) {
+        for(int block=0;block<view.getNumBlocks();block++) {
+            const UShort_t *samples = view.getSamples(block, 0); // SAMPLES_PER_BLOCK samples of the first channel in the block
+        }
+        calibrator->calibrateInto(view, usefulEvent, AraCalType::kLatestCalib);
+    }
+    \endcode
+    \ingroup rootclasses
+*/
+class RawAtriEventView
+{
+    public:
+        RawAtriEventView(); ///< Default constructor, an empty view
+        RawAtriEventView(const AraStationEventHeader_t *hdPtr, const char *dataBuffer); ///< View of the event in hdPtr and dataBuffer
+        ~RawAtriEventView(); ///< Destructor
+
+        Bool_t setBuffer(const AraStationEventHeader_t *hdPtr, const char *dataBuffer); ///< Points the view at a new event. Returns kFALSE if the blocks do not fit in the numBytes of the header, the view then holds the blocks that do fit
+        Bool_t isValid() const { return fValid; } ///< Did the blocks of the event add up to the numBytes of the header
+
+        const AraStationEventHeader_t *getHeader() const { return fHeader; } ///< The event header
+        const char *getDataBuffer() const { return fDataBuffer; } ///< The data that follows the event header
+        AraStationId_t getStationId() const { return fHeader->gHdr.stationId; } ///< The station id
+        ULong64_t getUnixTime() const { return fHeader->unixTime; } ///< Software event time in seconds
+        UInt_t getEventNumber() const { return fHeader->eventNumber; } ///< Software event number
+        UShort_t getNumReadoutBlocks() const { return fHeader->numReadoutBlocks; } ///< Number of readout blocks given in the header
+        UInt_t getTimeStamp() const; ///< Timestamp, decoded from the Gray code as in RawAtriStationEvent
+        bool isCalpulserEvent() const; ///< As RawAtriStationEvent::isCalpulserEvent
+        Bool_t isTrigType(Int_t bit) const; ///< As RawAtriStationEvent::isTrigType
+        Bool_t isRFTrigger() const { return isTrigType(0); } ///< Is this an RF trigger event?
+        Bool_t isSoftwareTrigger() const { return isTrigType(2); } ///< Is this an Software trigger event?
+
+        Int_t getNumBlocks() const { return (Int_t)fBlockOffset.size(); } ///< Number of readout blocks in the view
+        const AraStationEventBlockHeader_t *getBlockHeader(Int_t block) const { return (const AraStationEventBlockHeader_t*)(fDataBuffer+fBlockOffset[block]); } ///< The header of a readout block
+        const AraStationEventBlockChannel_t *getBlockChannels(Int_t block) const { return (const AraStationEventBlockChannel_t*)(fDataBuffer+fBlockOffset[block]+sizeof(AraStationEventBlockHeader_t)); } ///< The getNumChannels(block) channels of a readout block
+        const UShort_t *getSamples(Int_t block, Int_t chan) const { return getBlockChannels(block)[chan].samples; } ///< The SAMPLES_PER_BLOCK samples of the chan'th channel read out in a block
+        Int_t getNumChannels(Int_t block) const { return fNumChannels[block]; } ///< As RawAtriStationBlock::getNumChannels
+        Int_t getDda(Int_t block) const { return (getBlockHeader(block)->channelMask&0x300)>>8; } ///< As RawAtriStationBlock::getDda
+        Int_t getBlock(Int_t block) const { return getBlockHeader(block)->irsBlockNumber&0x1ff; } ///< As RawAtriStationBlock::getBlock
+        Int_t getCapArray(Int_t block) const { return getBlockHeader(block)->irsBlockNumber&0x1; } ///< As RawAtriStationBlock::getCapArray
+
+        void fillEventHeader(RawAtriStationEvent *rawEvent) const; ///< Copies the header and the block headers into rawEvent, leaving the sample vectors of its blocks empty
+        void fillRawEvent(RawAtriStationEvent *rawEvent) const; ///< Copies the whole event into rawEvent, reusing the memory of its blocks
+
+    private:
+        const AraStationEventHeader_t *fHeader; ///< The event header, not owned
+        const char *fDataBuffer; ///< The block data, not owned
+        std::vector<Int_t> fBlockOffset; ///< Byte offset of each block header in fDataBuffer
+        std::vector<UChar_t> fNumChannels; ///< Number of channels read out in each block
+        Bool_t fValid; ///< Whether the blocks added up to the numBytes of the header
+};
+
+#endif //RAWATRIEVENTVIEW_H
@@ -142,6 +142,10 @@ Int_t RawAtriStationEvent::getFirstCapArray(Int_t dda)
 
 
 bool RawAtriStationEvent::isCalpulserEvent(){
+  return isCalpulserTimeStamp(stationId,timeStamp);
+}
+
+bool RawAtriStationEvent::isCalpulserTimeStamp(AraStationId_t stationId, UInt_t timeStamp){
   Int_t pulserTime=0;
 
   if(stationId==ARA_STATION1B) pulserTime=254;
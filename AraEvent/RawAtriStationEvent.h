@@ -67,6 +67,7 @@ class RawAtriStationEvent: public RawAraStationEvent
 
    Int_t getFirstCapArray(Int_t dda); ///< Function for asking the block vector the capArray
    bool isCalpulserEvent(); ///< Uses the timeStamp (from Rubidium clock) to decide whether an event is from a local in-ice calpulser
+   static bool isCalpulserTimeStamp(AraStationId_t stationId, UInt_t timeStamp); ///< The test behind isCalpulserEvent, for a (decoded) timeStamp of the station
    
    Bool_t isTrigType(Int_t bit); ///< Was this trigger bit set? bit0 - RF0 Trigger (Deep Antennas), bit1 - RF1 Trigger (Surface Antennas), bit2 - Software trigger
 
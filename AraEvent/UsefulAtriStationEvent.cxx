@@ -18,32 +18,30 @@
 #include <cstring>
 ClassImp(UsefulAtriStationEvent);
 
-AraEventCalibrator *fCalibrator;
 AraEventConditioner *fConditioner;
 
 UsefulAtriStationEvent::UsefulAtriStationEvent() 
 {
   //Default Constructor
   fNumChannels=0;
-  fCalibrator=0;
-  fConditioner=0;
   fIsConditioned=0;
+  fUseFlatStorage=0;
+  resetFlatStorage();
 }
 
 UsefulAtriStationEvent::~UsefulAtriStationEvent() {
    //Default Destructor
   fNumChannels=0;
-  fCalibrator=0;
-  fConditioner=0;
   fIsConditioned=0;
 }
 
 UsefulAtriStationEvent::UsefulAtriStationEvent(RawAtriStationEvent *rawEvent, AraCalType::AraCalType_t calType)
  :RawAtriStationEvent(*rawEvent)
 {
-  fCalibrator=AraEventCalibrator::Instance();
   fNumChannels=0;
-  fCalibrator->calibrateEvent(this,calType);
+  fUseFlatStorage=0;
+  resetFlatStorage();
+  AraEventCalibrator::Instance()->calibrateEvent(this,calType);
   fIsConditioned=0;
 
   //! All the functions in the conditioner class are imported and available into the calibrateEvent() function -MK-
@@ -55,9 +53,91 @@ UsefulAtriStationEvent::UsefulAtriStationEvent(RawAtriStationEvent *rawEvent, Ar
   }*/
 }
 
+UsefulAtriStationEvent::UsefulAtriStationEvent(RawAtriStationEvent *rawEvent, AraCalType::AraCalType_t calType, Bool_t useFlatStorage)
+ :RawAtriStationEvent(*rawEvent)
+{
+  fNumChannels=0;
+  fUseFlatStorage=useFlatStorage;
+  resetFlatStorage();
+  AraEventCalibrator::Instance()->calibrateEvent(this,calType);
+  fIsConditioned=0;
+}
+
+void UsefulAtriStationEvent::resetFlatStorage()
+{
+  for(int chanId=0;chanId<CHANNELS_PER_ATRI;chanId++) {
+    fFlatOffset[chanId]=-1;
+    fFlatNumSamples[chanId]=0;
+  }
+  for(int dda=0;dda<DDA_PER_ATRI;dda++) {
+    fFlatCapArrayOffset[dda]=0;
+    fFlatNumBlocks[dda]=0;
+  }
+}
+
+void UsefulAtriStationEvent::fillTimeVoltMaps()
+{
+  // Only drop the channels that are gone, the vectors of the others are reused by assign
+  for(int chanId=0;chanId<CHANNELS_PER_ATRI;chanId++) {
+    if(fFlatOffset[chanId]<0) {
+      fTimes.erase(chanId);
+      fVolts.erase(chanId);
+      continue;
+    }
+    const Double_t *times=fFlatTimes.data()+fFlatOffset[chanId];
+    const Double_t *volts=fFlatVolts.data()+fFlatOffset[chanId];
+    fTimes[chanId].assign(times,times+fFlatNumSamples[chanId]);
+    fVolts[chanId].assign(volts,volts+fFlatNumSamples[chanId]);
+  }
+}
+
+Int_t UsefulAtriStationEvent::getNumSamplesInElecChan(int chanId)
+{
+  if(fUseFlatStorage) {
+    if(chanId<0 || chanId>=CHANNELS_PER_ATRI || fFlatOffset[chanId]<0) return 0;
+    return fFlatNumSamples[chanId];
+  }
+  std::map< Int_t, std::vector <Double_t> >::iterator timeMapIt=fTimes.find(chanId);
+  if(timeMapIt==fTimes.end()) return 0;
+  return timeMapIt->second.size();
+}
+
+Double_t *UsefulAtriStationEvent::getTimesForElecChan(int chanId)
+{
+  if(fUseFlatStorage) {
+    if(chanId<0 || chanId>=CHANNELS_PER_ATRI || fFlatOffset[chanId]<0) return NULL;
+    return fFlatTimes.data()+fFlatOffset[chanId];
+  }
+  std::map< Int_t, std::vector <Double_t> >::iterator timeMapIt=fTimes.find(chanId);
+  if(timeMapIt==fTimes.end()) return NULL;
+  return timeMapIt->second.data();
+}
+
+Double_t *UsefulAtriStationEvent::getVoltsForElecChan(int chanId)
+{
+  if(fUseFlatStorage) {
+    if(chanId<0 || chanId>=CHANNELS_PER_ATRI || fFlatOffset[chanId]<0) return NULL;
+    return fFlatVolts.data()+fFlatOffset[chanId];
+  }
+  std::map< Int_t, std::vector <Double_t> >::iterator voltMapIt=fVolts.find(chanId);
+  if(voltMapIt==fVolts.end()) return NULL;
+  return voltMapIt->second.data();
+}
+
 
 TGraph *UsefulAtriStationEvent::getGraphFromElecChan(int chanId)
 {
+  if(fUseFlatStorage) {
+    // Same behaviour as the map version below, an empty graph for a missing channel
+    if(chanId<0 || chanId>=CHANNELS_PER_ATRI || fFlatOffset[chanId]<0)
+      return new TGraph;
+    if(fFlatNumSamples[chanId]==0) {
+      std::cerr << "Oh no there aren't any points\n";
+      return new TGraph;
+    }
+    return new TGraph(fFlatNumSamples[chanId],getTimesForElecChan(chanId),getVoltsForElecChan(chanId));
+  }
+
   std::map< Int_t, std::vector <Double_t> >::iterator timeMapIt;
   timeMapIt=fTimes.find(chanId);
   if(timeMapIt==fTimes.end()) {
@@ -35,6 +35,7 @@ class UsefulAtriStationEvent: public RawAtriStationEvent, public UsefulAraStatio
   public:
     UsefulAtriStationEvent(); ///< Default constructor
     UsefulAtriStationEvent(RawAtriStationEvent *rawEvent, AraCalType::AraCalType_t calType=AraCalType::kVoltageTime); ///< Constructor from RawAtriStationEvent object. This uses AraEventCalibrator to apply calibrations to the event.
+    UsefulAtriStationEvent(RawAtriStationEvent *rawEvent, AraCalType::AraCalType_t calType, Bool_t useFlatStorage); ///< As above, but if useFlatStorage is true the calibrated samples are only kept in the flat arrays (fTimes / fVolts are left empty)
     ~UsefulAtriStationEvent(); ///< Destructor
 
     Int_t getNumElecChannels() {return fNumChannels;} ///< Returns the number of electronics channels
@@ -45,11 +46,30 @@ class UsefulAtriStationEvent: public RawAtriStationEvent, public UsefulAraStatio
     TH1D *getFFTHistForRFChan(int chan); ///< Utility function for webplotter -- produces a TH1D form of getFFTForRFChan(int chan)
     int fillFFTHistoForRFChan(int chan, TH1D *histFFT); ///< Utility function for webplotter
 
+    Bool_t hasFlatStorage() {return fUseFlatStorage;} ///< Are the calibrated samples only stored in the flat arrays?
+    void setFlatStorage(Bool_t useFlatStorage) {fUseFlatStorage=useFlatStorage;} ///< Selects the storage mode used by the next AraEventCalibrator::calibrateInto
+    Int_t getNumSamplesInElecChan(int chanId); ///< Returns the number of calibrated samples in an electronics channel (0 if the channel was not read out)
+    Double_t *getTimesForElecChan(int chanId); ///< Returns a pointer to the sample times of an electronics channel, in either storage mode (NULL if the channel was not read out)
+    Double_t *getVoltsForElecChan(int chanId); ///< Returns a pointer to the sample voltages of an electronics channel, in either storage mode (NULL if the channel was not read out)
+    void fillTimeVoltMaps(); ///< Copies the flat arrays into fTimes / fVolts, for map based code working on a flat storage event
+    void resetFlatStorage(); ///< Marks every channel as not read out, keeping the allocated flat arrays for reuse
+
     //Calibrated data
     Int_t fNumChannels; ///< The number of channels
     std::map< Int_t, std::vector <Double_t> > fTimes; ///< The times of samples
     std::map< Int_t, std::vector <Double_t> > fVolts; ///< The voltages of samples
 
+    //Flat sample storage -- filled by AraEventCalibrator, channel chanId occupies [fFlatOffset[chanId], fFlatOffset[chanId]+fFlatNumSamples[chanId])
+    Bool_t fUseFlatStorage; //! If true fTimes / fVolts are not filled and the samples only live in the arrays below
+    Int_t fFlatOffset[CHANNELS_PER_ATRI]; //! Index of the first sample of each electronics channel in the flat arrays (-1 if not read out)
+    Int_t fFlatNumSamples[CHANNELS_PER_ATRI]; //! Number of samples of each electronics channel in the flat arrays
+    std::vector<Double_t> fFlatTimes; //! The times of samples, all channels back to back
+    std::vector<Double_t> fFlatVolts; //! The voltages of samples, same layout as fFlatTimes
+    std::vector<Int_t> fFlatSampleIndex; //! The capacitor sample index (block*SAMPLES_PER_BLOCK+sample) of each sample, same layout as fFlatTimes
+    Int_t fFlatCapArrayOffset[DDA_PER_ATRI]; //! Index of the first remaining readout block of each dda in fFlatCapArray
+    Int_t fFlatNumBlocks[DDA_PER_ATRI]; //! Number of remaining readout blocks of each dda
+    std::vector<Int_t> fFlatCapArray; //! The capArray of each readout block, grouped by dda
+
     //to track conditioning
     bool fIsConditioned;
     std::vector<std::string> fConditioningList;
@@ -95,6 +95,12 @@ int main(int argc, char **argv)
    //jpd print to screen some info
    std::cerr << "isAtri " << isAtriEvent << " isIcrr " << isIcrrEvent << " number of entries is " <<  numEntries << std::endl;
 
+   //For Atri events one UsefulAtriStationEvent is made up front and every event is calibrated into it,
+   //this reuses its memory rather than making (and deleting) a new object per event
+   if(isAtriEvent){
+     realAtriEvPtr = new UsefulAtriStationEvent();
+   }
+
 
    for(Long64_t event=0;event<numEntries;event++) {
      if(event%starEvery==0) {
@@ -110,7 +116,7 @@ int main(int argc, char **argv)
        realIcrrEvPtr = new UsefulIcrrStationEvent(rawIcrrEvPtr, AraCalType::kLatestCalib);
      }
      else if(isAtriEvent){
-       realAtriEvPtr = new UsefulAtriStationEvent(rawAtriEvPtr, AraCalType::kLatestCalib);
+       AraEventCalibrator::Instance()->calibrateInto(*rawAtriEvPtr, *realAtriEvPtr, AraCalType::kLatestCalib);
      }
      
      //Now you can do whatever analysis you want
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////  exampleParallelLoop.cxx 
+////      The ATRI part of exampleLoop, using AraEventLoop to read and
+////      calibrate the events on several threads
+////
+////////////////////////////////////////////////////////////////////////////////
+
+//Includes
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+//AraRoot Includes
+#include "AraEventLoop.h"
+#include "UsefulAtriStationEvent.h"
+
+//ROOT Includes
+#include "TFile.h"
+#include "TTree.h"
+#include "TGraph.h"
+
+
+int main(int argc, char **argv)
+{
+
+  if(argc<2) {
+    std::cout << "Usage\n" << argv[0] << " <input file> [num threads]\n";
+    std::cout << "e.g.\n" << argv[0] << " event3000.root 16\n";
+    return 0;
+  }
+  int numThreads=0;
+  if(argc>2) numThreads=atoi(argv[2]);
+
+  AraEventLoop loop(argv[1], AraCalType::kLatestCalib, numThreads);
+  std::cerr << "Looping over " << loop.getNumEntries() << " entries with " << loop.getNumThreads() << " threads\n";
+
+  //Anything filled from the event function should be kept per thread
+  std::vector<double> sumRms(loop.getNumThreads(),0);
+  std::vector<Long64_t> numEvents(loop.getNumThreads(),0);
+
+  loop.process([&](Long64_t entry, UsefulAtriStationEvent *realAtriEvPtr, Int_t thread) {
+      //Now you can do whatever analysis you want
+      TGraph *chan1 = realAtriEvPtr->getGraphFromRFChan(0);
+      sumRms[thread]+=chan1->GetRMS(2);
+      numEvents[thread]++;
+      delete chan1;
+    });
+
+  //An output tree has to be filled in entry order, so it is filled from the functions returned to processOrdered
+  TFile *fpOut = new TFile("exampleParallelLoop.root","RECREATE");
+  TTree *rmsTree = new TTree("rmsTree","RMS of RF channel 0");
+  Double_t rms;
+  Int_t eventNumber;
+  rmsTree->Branch("rms",&rms,"rms/D");
+  rmsTree->Branch("eventNumber",&eventNumber,"eventNumber/I");
+
+  loop.processOrdered([&](Long64_t entry, UsefulAtriStationEvent *realAtriEvPtr, Int_t thread) -> AraEventLoop::MergeFunc_t {
+      TGraph *chan1 = realAtriEvPtr->getGraphFromRFChan(0);
+      Double_t thisRms=chan1->GetRMS(2);
+      Int_t thisEventNumber=realAtriEvPtr->eventNumber;
+      delete chan1;
+      return [&,thisRms,thisEventNumber]() {
+        rms=thisRms;
+        eventNumber=thisEventNumber;
+        rmsTree->Fill();
+      };
+    });
+
+  fpOut->cd();
+  rmsTree->Write();
+  fpOut->Close();
+
+  double totalRms=0;
+  Long64_t totalEvents=0;
+  for(int thread=0;thread<loop.getNumThreads();thread++) {
+    totalRms+=sumRms[thread];
+    totalEvents+=numEvents[thread];
+  }
+  if(totalEvents>0) std::cerr << "Mean RMS of RF channel 0 " << totalRms/totalEvents << " over " << totalEvents << " events\n";
+
+}
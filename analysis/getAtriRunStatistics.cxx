@@ -16,6 +16,7 @@ using namespace std;
 #include "AraGeomTool.h"
 #include "araAtriStructures.h"
 #include "RawAtriStationEvent.h"  
+#include "RawAtriEventView.h"
 
 void process(int run);
 void processFileList(char *inputName, char *outDir, int run);
@@ -25,7 +26,7 @@ AraStationEventHeader_t theEventHeader;
 char *dataBuffer;
 TFile *outFile;
 TTree *outTree;
-RawAtriStationEvent *theEvent=0;
+RawAtriEventView theEventView; ///< Only the event header is needed, so the event is read in place
 char outName[FILENAME_MAX];
 UInt_t realTime;
 Int_t runNumber;
@@ -59,7 +60,6 @@ const char *filename;
 
 int main(int argc, char **argv) {
   dataBuffer = new char[200000];
-  theEvent=0;
   if(argc<4) {
     std::cout << "Usage: " << basename(argv[0]) << " <file list> <outFileName> <run>" << std::endl;
     return -1;
@@ -74,7 +74,6 @@ int main(int argc, char **argv) {
 void processFileList(char *inputName, char *outFileName, int run) {
   cout << inputName << "\t" << outFileName << endl;
 
-  theEvent = new RawAtriStationEvent();
 
   ifstream SillyFile(inputName);
   outFile = new TFile(outFileName, "RECREATE");
@@ -173,22 +172,20 @@ void process(int run) {
   if(!doneInit) {
     doneInit=1;
   }  
-  if(theEvent) delete theEvent;
-  
-  theEvent = new RawAtriStationEvent(&theEventHeader,dataBuffer);
+  theEventView.setBuffer(&theEventHeader,dataBuffer);
   //Create stats
   if(firstTime){
-    lastUnixTime=theEvent->unixTime;
+    lastUnixTime=theEventView.getUnixTime();
     thisUnixTime=lastUnixTime;
     
     outTree->Fill();
     firstTime=0;
   }
-  thisUnixTime=theEvent->unixTime;
+  thisUnixTime=theEventView.getUnixTime();
   numEvents++;
-  if(theEvent->numReadoutBlocks<80) numEvents_CPU++;
-  if(theEvent->numReadoutBlocks>=80 && theEvent->isCalpulserEvent()==false)numEvents_RF0++;
-  if(theEvent->isCalpulserEvent()) numEvents_CALPULSER++;
+  if(theEventView.getNumReadoutBlocks()<80) numEvents_CPU++;
+  if(theEventView.getNumReadoutBlocks()>=80 && theEventView.isCalpulserEvent()==false)numEvents_RF0++;
+  if(theEventView.isCalpulserEvent()) numEvents_CALPULSER++;
 
 
   if(thisUnixTime >= lastUnixTime + 60*30 || lastTime){
@@ -4,10 +4,18 @@
 
 #include "RawAtriStationEvent.h"
 #include "UsefulAtriStationEvent.h"
+#include "AraEventLoop.h"
+#include "AraAtriColumnarEvent.h"
+#include "RawAtriEventView.h"
+#include "AraQualCuts.h"
+#include "AraGeomTool.h"
+#include "FFTtools.h"
 
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
 
 /*
 	Global variables to control our expectations for this test
@@ -16,6 +24,9 @@
 int numEntries_expected = 100; // number of events in the file
 double max_mean = 1E-6; // required deviation from zero in the mean of a properly calibrated event
 double max_diff_cal = 0.1; // required difference between means of waveforms when to different cal strategies are used
+double max_diff_storage = 1E-9; // allowed difference between samples calibrated into the maps and into the flat arrays
+double max_diff_rolling_mean = 1E-6; // allowed difference between the rolling mean maximum made with and without graphs
+int numEntries_rolling_mean = 10; // number of events to compare the rolling means on, the graph version is slow
 
 int main(int argc, char **argv){
 
@@ -87,5 +98,300 @@ int main(int argc, char **argv){
 	}
 
 
+	// make sure the flat sample storage gives the same waveforms as the map storage
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		UsefulAtriStationEvent *usefulEvent_map = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		UsefulAtriStationEvent *usefulEvent_flat = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib, true);
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			int numSamples = usefulEvent_map->getNumSamplesInElecChan(ch);
+			if(numSamples != usefulEvent_flat->getNumSamplesInElecChan(ch)){
+				printf("Event %d, Elec Ch %d: flat storage has %d samples (%d expected). Test will fail.\n",
+					event, ch, usefulEvent_flat->getNumSamplesInElecChan(ch), numSamples);
+				exit(-1);
+			}
+			for(int samp=0; samp<numSamples; samp++){
+				if(TMath::Abs(usefulEvent_map->getTimesForElecChan(ch)[samp] - usefulEvent_flat->getTimesForElecChan(ch)[samp])>max_diff_storage
+					|| TMath::Abs(usefulEvent_map->getVoltsForElecChan(ch)[samp] - usefulEvent_flat->getVoltsForElecChan(ch)[samp])>max_diff_storage){
+					printf("Event %d, Elec Ch %d, Sample %d: flat storage differs from map storage. Test will fail.\n", event, ch, samp);
+					exit(-1);
+				}
+			}
+		}
+		delete usefulEvent_map;
+		delete usefulEvent_flat;
+	}
+
+	// make sure calibrating into one reused event gives the same waveforms as a freshly made event
+	UsefulAtriStationEvent *usefulEvent_reused = new UsefulAtriStationEvent();
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		AraEventCalibrator::Instance()->calibrateInto(*rawEvent, *usefulEvent_reused, AraCalType::kLatestCalib);
+		UsefulAtriStationEvent *usefulEvent_new = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			int numSamples = usefulEvent_new->getNumSamplesInElecChan(ch);
+			if(numSamples != usefulEvent_reused->getNumSamplesInElecChan(ch)){
+				printf("Event %d, Elec Ch %d: reused event has %d samples (%d expected). Test will fail.\n",
+					event, ch, usefulEvent_reused->getNumSamplesInElecChan(ch), numSamples);
+				exit(-1);
+			}
+			for(int samp=0; samp<numSamples; samp++){
+				if(TMath::Abs(usefulEvent_new->fVolts[ch][samp] - usefulEvent_reused->fVolts[ch][samp])>max_diff_storage){
+					printf("Event %d, Elec Ch %d, Sample %d: reused event differs from new event. Test will fail.\n", event, ch, samp);
+					exit(-1);
+				}
+			}
+		}
+		delete usefulEvent_new;
+	}
+	delete usefulEvent_reused;
+
+	// make sure the parallel event loop sees every event once, calibrated as in the serial loop, and merges them in order
+	std::vector<double> serial_sums(numEntries, 0);
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		UsefulAtriStationEvent *usefulEvent = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			for(int samp=0; samp<usefulEvent->getNumSamplesInElecChan(ch); samp++){
+				serial_sums[event] += TMath::Abs(usefulEvent->getVoltsForElecChan(ch)[samp]);
+			}
+		}
+		delete usefulEvent;
+	}
+	AraEventLoop loop(argv[1], AraCalType::kLatestCalib, 4);
+	std::vector<Long64_t> merged_entries;
+	Long64_t numProcessed = loop.processOrdered([&](Long64_t entry, UsefulAtriStationEvent *event, Int_t thread) -> AraEventLoop::MergeFunc_t {
+		double sum = 0;
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			for(int samp=0; samp<event->getNumSamplesInElecChan(ch); samp++){
+				sum += TMath::Abs(event->getVoltsForElecChan(ch)[samp]);
+			}
+		}
+		return [&merged_entries, &serial_sums, entry, sum]() {
+			if(TMath::Abs(sum - serial_sums[entry])>max_diff_storage*serial_sums[entry]){
+				printf("Entry %lld: parallel loop calibration differs from the serial one. Test will fail.\n", entry);
+				exit(-1);
+			}
+			merged_entries.push_back(entry);
+		};
+	});
+	if(numProcessed != numEntries || (int)merged_entries.size() != numEntries){
+		printf("Parallel loop processed %lld events and merged %d (%d expected). Test will fail.\n", numProcessed, (int)merged_entries.size(), numEntries);
+		exit(-1);
+	}
+	for(int event=0; event<numEntries; event++){
+		if(merged_entries[event] != event){
+			printf("Parallel loop merged entry %lld at position %d. Test will fail.\n", merged_entries[event], event);
+			exit(-1);
+		}
+	}
+
+	// make sure an event copied into the columnar layout and back calibrates exactly like the original
+	AraAtriColumnarEvent *columnarEvent = new AraAtriColumnarEvent();
+	RawAtriStationEvent *rebuiltEvent = new RawAtriStationEvent();
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		columnarEvent->setFromRawEvent(rawEvent);
+		columnarEvent->fillRawEvent(rebuiltEvent);
+		if(rebuiltEvent->eventNumber != rawEvent->eventNumber || rebuiltEvent->blockVec.size() != rawEvent->blockVec.size()){
+			printf("Event %d: columnar copy has a different header or number of blocks. Test will fail.\n", event);
+			exit(-1);
+		}
+		UsefulAtriStationEvent *usefulEvent_raw = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		UsefulAtriStationEvent *usefulEvent_columnar = new UsefulAtriStationEvent(rebuiltEvent, AraCalType::kLatestCalib);
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			int numSamples = usefulEvent_raw->getNumSamplesInElecChan(ch);
+			if(numSamples != usefulEvent_columnar->getNumSamplesInElecChan(ch)){
+				printf("Event %d, Elec Ch %d: columnar copy has %d samples (%d expected). Test will fail.\n",
+					event, ch, usefulEvent_columnar->getNumSamplesInElecChan(ch), numSamples);
+				exit(-1);
+			}
+			for(int samp=0; samp<numSamples; samp++){
+				if(usefulEvent_raw->getVoltsForElecChan(ch)[samp] != usefulEvent_columnar->getVoltsForElecChan(ch)[samp]){
+					printf("Event %d, Elec Ch %d, Sample %d: columnar copy differs from the original event. Test will fail.\n", event, ch, samp);
+					exit(-1);
+				}
+			}
+		}
+		delete usefulEvent_raw;
+		delete usefulEvent_columnar;
+	}
+	delete columnarEvent;
+
+	// make sure the columnar tree layout round trips: write every event through makeBranches into a memory resident tree,
+	// then read it back through setBranchAddresses and compare with the raw event
+	AraAtriColumnarEvent *columnarWriter = new AraAtriColumnarEvent();
+	AraAtriColumnarEvent *columnarReader = new AraAtriColumnarEvent();
+	TTree *columnarTree = new TTree("columnarTree", "columnar round trip");
+	columnarTree->SetDirectory(0);
+	columnarWriter->makeBranches(columnarTree);
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		if(!columnarWriter->setFromRawEvent(rawEvent)){
+			printf("Event %d: too big for the columnar layout. Test will fail.\n", event);
+			exit(-1);
+		}
+		columnarTree->Fill();
+	}
+	columnarTree->ResetBranchAddresses();
+	if(!AraAtriColumnarEvent::isColumnarTree(columnarTree) || AraAtriColumnarEvent::isColumnarTree(eventTree)){
+		printf("isColumnarTree does not tell the columnar tree from the event tree. Test will fail.\n");
+		exit(-1);
+	}
+	columnarReader->setBranchAddresses(columnarTree);
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		columnarTree->GetEntry(event);
+		columnarReader->fillRawEvent(rebuiltEvent);
+		if(rebuiltEvent->eventNumber != rawEvent->eventNumber || rebuiltEvent->unixTime != rawEvent->unixTime
+			|| rebuiltEvent->timeStamp != rawEvent->timeStamp || rebuiltEvent->stationId != rawEvent->stationId
+			|| rebuiltEvent->blockVec.size() != rawEvent->blockVec.size()){
+			printf("Event %d: the columnar tree gives a different header or number of blocks. Test will fail.\n", event);
+			exit(-1);
+		}
+		for(size_t block=0; block<rawEvent->blockVec.size(); block++){
+			if(rebuiltEvent->blockVec[block].irsBlockNumber != rawEvent->blockVec[block].irsBlockNumber
+				|| rebuiltEvent->blockVec[block].channelMask != rawEvent->blockVec[block].channelMask
+				|| rebuiltEvent->blockVec[block].data != rawEvent->blockVec[block].data){
+				printf("Event %d, Block %d: the columnar tree gives different samples. Test will fail.\n", event, (int)block);
+				exit(-1);
+			}
+		}
+	}
+	delete columnarTree;
+	delete columnarWriter;
+	delete columnarReader;
+	delete rebuiltEvent;
+
+	// make sure an event calibrated in place from a DAQ buffer matches the one calibrated from the RawAtriStationEvent
+	// the buffer is rebuilt from the raw event, in the layout makeAtriEventTree reads
+	RawAtriEventView eventView;
+	UsefulAtriStationEvent *usefulEvent_view = new UsefulAtriStationEvent();
+	usefulEvent_view->setFlatStorage(kTRUE);
+	std::vector<char> dataBuffer;
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		AraStationEventHeader_t eventHeader;
+		memset(&eventHeader, 0, sizeof(eventHeader));
+		eventHeader.gHdr.typeId = rawEvent->typeId;
+		eventHeader.gHdr.verId = rawEvent->verId;
+		eventHeader.gHdr.subVerId = rawEvent->subVerId;
+		eventHeader.gHdr.stationId = rawEvent->stationId;
+		eventHeader.gHdr.numBytes = rawEvent->numBytes;
+		eventHeader.unixTime = rawEvent->unixTime;
+		eventHeader.unixTimeUs = rawEvent->unixTimeUs;
+		eventHeader.eventNumber = rawEvent->eventNumber;
+		eventHeader.ppsNumber = rawEvent->ppsNumber;
+		eventHeader.timeStamp = rawEvent->timeStamp ^ (rawEvent->timeStamp >> 1); // the DAQ writes the timeStamp as Gray code
+		eventHeader.eventId = rawEvent->eventId;
+		eventHeader.versionNumber = rawEvent->versionId;
+		eventHeader.numReadoutBlocks = rawEvent->blockVec.size();
+		dataBuffer.clear();
+		for(size_t block=0; block<rawEvent->blockVec.size(); block++){
+			AraStationEventBlockHeader_t blockHeader;
+			blockHeader.irsBlockNumber = rawEvent->blockVec[block].irsBlockNumber;
+			blockHeader.channelMask = rawEvent->blockVec[block].channelMask;
+			dataBuffer.insert(dataBuffer.end(), (char*)&blockHeader, (char*)&blockHeader + sizeof(blockHeader));
+			for(size_t chan=0; chan<rawEvent->blockVec[block].data.size(); chan++){
+				const std::vector<UShort_t> &samples = rawEvent->blockVec[block].data[chan];
+				dataBuffer.insert(dataBuffer.end(), (char*)samples.data(), (char*)(samples.data() + samples.size()));
+			}
+		}
+		eventHeader.numBytes = dataBuffer.size();
+		if(!eventView.setBuffer(&eventHeader, dataBuffer.data()) || eventView.getTimeStamp() != rawEvent->timeStamp){
+			printf("Event %d: the view of the rebuilt DAQ buffer does not match the raw event. Test will fail.\n", event);
+			exit(-1);
+		}
+		AraEventCalibrator::Instance()->calibrateInto(eventView, *usefulEvent_view, AraCalType::kLatestCalib);
+		UsefulAtriStationEvent *usefulEvent_raw = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		for(int ch=0; ch<CHANNELS_PER_ATRI; ch++){
+			int numSamples = usefulEvent_raw->getNumSamplesInElecChan(ch);
+			if(numSamples != usefulEvent_view->getNumSamplesInElecChan(ch)){
+				printf("Event %d, Elec Ch %d: the view gives %d samples (%d expected). Test will fail.\n",
+					event, ch, usefulEvent_view->getNumSamplesInElecChan(ch), numSamples);
+				exit(-1);
+			}
+			for(int samp=0; samp<numSamples; samp++){
+				if(usefulEvent_raw->getVoltsForElecChan(ch)[samp] != usefulEvent_view->getVoltsForElecChan(ch)[samp]){
+					printf("Event %d, Elec Ch %d, Sample %d: the view calibrates differently from the raw event. Test will fail.\n", event, ch, samp);
+					exit(-1);
+				}
+			}
+		}
+		delete usefulEvent_raw;
+	}
+	delete usefulEvent_view;
+
+	// make sure the raw level pre-screen only rejects events that the full quality cuts reject too
+	AraQualCuts *qualCuts = AraQualCuts::Instance();
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		if(qualCuts->isGoodRawEvent(rawEvent)) continue;
+		UsefulAtriStationEvent *usefulEvent = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		bool isGood = qualCuts->isGoodEvent(usefulEvent);
+		delete usefulEvent;
+		if(isGood){
+			printf("Event %d: rejected by the raw quality cuts but not by the full quality cuts. Test will fail.\n", event);
+			exit(-1);
+		}
+	}
+
+
+	// make sure the raw offset block detector fires on an event with an offset block injected into every channel
+	// (the test run is A2, where the offset block cut applies)
+	RawAtriStationEvent *offsetEvent = new RawAtriStationEvent();
+	const UShort_t *peds = AraEventCalibrator::Instance()->getAtriPedestals(rawEvent->stationId);
+	int offset_block = 2; // the third block read out of each DDA, the first one is trimmed by the calibration
+	double injected_offset = 300; // ADC counts, far above the thresholds
+	int numOffsetEvents = 0;
+	for(int event=0; event<numEntries; event++){
+		eventTree->GetEntry(event);
+		if(rawEvent->blockVec.size()<(offset_block+2)*DDA_PER_ATRI) continue;
+		*offsetEvent = *rawEvent;
+		if(qualCuts->hasOffsetBlocks(offsetEvent, peds)) continue; // already has offset blocks, nothing to inject
+		for(size_t block=offset_block*DDA_PER_ATRI; block<(offset_block+1)*DDA_PER_ATRI; block++){
+			for(size_t chan=0; chan<offsetEvent->blockVec[block].data.size(); chan++){
+				std::vector<UShort_t> &samples = offsetEvent->blockVec[block].data[chan];
+				for(size_t samp=0; samp<samples.size(); samp++) samples[samp] += injected_offset;
+			}
+		}
+		if(!qualCuts->hasOffsetBlocks(offsetEvent, peds)){
+			printf("Event %d: the raw offset block detector misses an injected offset block. Test will fail.\n", event);
+			exit(-1);
+		}
+		numOffsetEvents++;
+	}
+	if(numOffsetEvents==0){
+		printf("No event to inject an offset block into. Test will fail.\n");
+		exit(-1);
+	}
+	delete offsetEvent;
+
+	// make sure the rolling mean maximum of the offset block cut is the same as the one made from graphs
+	for(int event=0; event<numEntries_rolling_mean; event++){
+		eventTree->GetEntry(event);
+		UsefulAtriStationEvent *usefulEvent = new UsefulAtriStationEvent(rawEvent, AraCalType::kLatestCalib);
+		for(int ch=0; ch<16; ch++){
+			int elecChan = AraGeomTool::Instance()->getElecChanFromRFChan(ch, usefulEvent->stationId);
+			double deltaT = AraGeomTool::Instance()->getPolByRFChan(ch, usefulEvent->stationId)==AraAntPol::kHorizontal ? qualCuts->_HdeltaT : qualCuts->_VdeltaT;
+			TGraph *wave = usefulEvent->getGraphFromRFChan(ch);
+			TGraph *waveInt = FFTtools::getInterpolatedGraph(wave, deltaT);
+			TGraph *waveMean = qualCuts->getRollingMean(waveInt, SAMPLES_PER_BLOCK);
+			double maxTime_graph, maxTime;
+			double max_graph = qualCuts->getMax(waveMean, &maxTime_graph);
+			double max = qualCuts->getMaxRollingMean(usefulEvent->getTimesForElecChan(elecChan), usefulEvent->getVoltsForElecChan(elecChan),
+				usefulEvent->getNumSamplesInElecChan(elecChan), deltaT, SAMPLES_PER_BLOCK, &maxTime);
+			delete waveMean;
+			delete waveInt;
+			delete wave;
+			if(TMath::Abs(max - max_graph)>max_diff_rolling_mean || TMath::Abs(maxTime - maxTime_graph)>max_diff_storage){
+				printf("Event %d, Ch %d: rolling mean maximum %e at %.2f differs from the graph one %e at %.2f. Test will fail.\n",
+					event, ch, max, maxTime, max_graph, maxTime_graph);
+				exit(-1);
+			}
+		}
+		delete usefulEvent;
+	}
+
 }
 
@@ -0,0 +1,41 @@
+//////////////////////////////////////////////////////////////////////////////
+/////  makeAtriCalibCache.cxx        Calibration cache maker             /////
+/////                                                                    /////
+/////  Description:                                                      /////
+/////     Converts the text ATRI calibration files of a station into    /////
+/////     the binary cache that AraEventCalibrator maps at start up     /////
+//////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <libgen.h>
+
+#include "AraEventCalibrator.h"
+
+int main(int argc, char **argv) {
+  if(argc<2) {
+    std::cout << "Usage: " << basename(argv[0]) << " <station id> [unixtime] [cache file]" << std::endl;
+    std::cout << "\tunixtime selects the timing epoch (only matters for A3), the cache file defaults to the one the calibrator looks for" << std::endl;
+    std::cout << "\tA cache older than the text calibration files is ignored until it is regenerated" << std::endl;
+    return -1;
+  }
+  AraStationId_t stationId = atoi(argv[1]);
+  Double_t unixtime = 0;
+  if(argc>2) unixtime = atof(argv[2]);
+  const char *cacheFile = 0;
+  if(argc>3) cacheFile = argv[3];
+
+  char defaultFile[FILENAME_MAX];
+  if(!cacheFile) {
+    AraEventCalibrator::getAtriCalibCacheFile(defaultFile, stationId, AraEventCalibrator::getAtriTimingEpoch(stationId, unixtime));
+    cacheFile = defaultFile;
+  }
+
+  if(!AraEventCalibrator::Instance()->writeAtriCalibCache(stationId, unixtime, cacheFile)) {
+    std::cerr << "Failed to write " << cacheFile << std::endl;
+    return -1;
+  }
+  std::cout << "Wrote " << cacheFile << std::endl;
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include <zlib.h>
 #include <libgen.h>     
 #include <cstdlib>
+#include <cstring>
  
 using namespace std;
 
@@ -16,6 +17,7 @@ using namespace std;
 #include "AraGeomTool.h"
 #include "araAtriStructures.h"
 #include "RawAtriStationEvent.h"  
+#include "AraAtriColumnarEvent.h"
 
 void process();
 void makeTree(char *inputName, char *outDir);
@@ -32,12 +34,24 @@ Int_t runNumber;
 //Int_t lastRunNumber;
 Int_t stationIdInt;
 AraStationId_t stationId;
+AraAtriColumnarEvent *theColumnarEvent=0; //Only used with -c
 
 int main(int argc, char **argv) {
   dataBuffer = new char[200000];
   theEvent=0;
+  //-c selects the columnar layout (see AraAtriColumnarEvent) instead of the "event" object branch
+  int numArgs=0;
+  for(int arg=0;arg<argc;arg++) {
+    if(arg>0 && !strcmp(argv[arg],"-c")) {
+      theColumnarEvent = new AraAtriColumnarEvent();
+      continue;
+    }
+    argv[numArgs++]=argv[arg];
+  }
+  argc=numArgs;
   if(argc<3) {
-    std::cout << "Usage: " << basename(argv[0]) << " <file list> <out dir>" << std::endl;
+    std::cout << "Usage: " << basename(argv[0]) << " <file list> <out dir> [run number] [station id] [-c]" << std::endl;
+    std::cout << "\t-c writes the events as flat columns, which are much quicker to read, rather than as RawAtriStationEvent objects" << std::endl;
     return -1;
   }
   if(argc>=4) 
@@ -50,6 +64,7 @@ int main(int argc, char **argv) {
 
   makeTree(argv[1],argv[2]);
   delete [] dataBuffer;
+  delete theColumnarEvent;
   return 0;
 }
   
@@ -145,7 +160,10 @@ void process() {
     theFile = new TFile(outName,"RECREATE");
     eventTree = new TTree("eventTree","Tree of ARA Event's");
     eventTree->Branch("run",&runNumber,"run/I");
-    eventTree->Branch("event","RawAtriStationEvent",&theEvent);
+    if(theColumnarEvent)
+      theColumnarEvent->makeBranches(eventTree);
+    else
+      eventTree->Branch("event","RawAtriStationEvent",&theEvent);
     
     doneInit=1;
   }  
@@ -153,6 +171,8 @@ void process() {
   if(theEvent) delete theEvent;
   
   theEvent = new RawAtriStationEvent(&theEventHeader,dataBuffer);
+  if(theColumnarEvent)
+    theColumnarEvent->setFromRawEvent(theEvent);
   eventTree->Fill();  
   //  lastRunNumber=runNumber;
   //  delete theEvent;
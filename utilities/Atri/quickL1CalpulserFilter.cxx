@@ -13,6 +13,7 @@
 
 #include "araAtriStructures.h"
 #include "RawAtriStationEvent.h"  
+#include "RawAtriEventView.h"
 #include "UsefulAtriStationEvent.h"  
 
 
@@ -34,7 +35,7 @@ char *inBuffer;
 char *outBuffer;
 TFile *theFile;
 TTree *eventTree;
-RawAtriStationEvent *theEvent=0;
+RawAtriEventView theEventView; ///< The filter only looks at the header, so the event is read in place
 AraEventCalibrator *theCalibrator=0;
 char outName[FILENAME_MAX];
 
@@ -48,7 +49,6 @@ ARAWriterStruct_t eventWriter;
 int main(int argc, char **argv) {
   inBuffer = new char[200000];
   outBuffer = new char[200000];
-  theEvent=0;
   if(argc<4) {
     std::cout << "Usage: " << basename(argv[0]) << " <file list>  <out dir> <run Number>" << std::endl;
     return -1;
@@ -70,7 +70,6 @@ void processFileList(char *inputName,  char *outDir) {
 
   cout << inputName << "\t" << outName << endl;
 
-  theEvent = new RawAtriStationEvent();
 
   //    cout << sizeof(AraStationEventHeader_t) << endl;
   ifstream SillyFile(inputName);
@@ -160,10 +159,9 @@ void processFileList(char *inputName,  char *outDir) {
      doneInit=1;
    }  
    //  cout << "Here: "  << theEvent.eventNumber << endl;
-   if(theEvent) delete theEvent;
-   theEvent = new RawAtriStationEvent(&theEventHeader,inBuffer);
+   theEventView.setBuffer(&theEventHeader,inBuffer);
 
-   if(theEvent->isCalpulserEvent()){
+   if(theEventView.isCalpulserEvent()){
      int numToCopy = theEventHeader.gHdr.numBytes;
      int upToByte = sizeof(AraStationEventHeader_t);
      memcpy(  &outBuffer[0],&theEventHeader , sizeof(AraStationEventHeader_t)); 
@@ -14,6 +14,7 @@
 #include "araAtriStructures.h"
 #include "RawAtriStationEvent.h"  
 #include "UsefulAtriStationEvent.h"  
+#include "RawAtriEventView.h"
 
 
 extern "C" {
@@ -34,7 +35,7 @@ char *inBuffer;
 char *outBuffer;
 TFile *theFile;
 TTree *eventTree;
-RawAtriStationEvent *theEvent=0;
+RawAtriEventView theEventView; ///< The event is read in place and calibrated straight into theUsefulEvent
 UsefulAtriStationEvent *theUsefulEvent=0;
 AraEventCalibrator *theCalibrator=0;
 char outName[FILENAME_MAX];
@@ -49,7 +50,6 @@ ARAWriterStruct_t eventWriter;
 int main(int argc, char **argv) {
   inBuffer = new char[200000];
   outBuffer = new char[200000];
-  theEvent=0;
   if(argc<5) {
     std::cout << "Usage: " << basename(argv[0]) << " <file list> <ped file> <out dir> <run Number>" << std::endl;
     return -1;
@@ -71,7 +71,7 @@ void processFileList(char *inputName, char *pedName, char *outDir) {
 
   cout << inputName << "\t" << outName << endl;
 
-  theEvent = new RawAtriStationEvent();
+  theUsefulEvent = new UsefulAtriStationEvent();
 
   //    cout << sizeof(AraStationEventHeader_t) << endl;
   ifstream SillyFile(inputName);
@@ -164,11 +164,8 @@ void processFileList(char *inputName, char *pedName, char *outDir) {
      doneInit=1;
    }  
    //  cout << "Here: "  << theEvent.eventNumber << endl;
-   if(theEvent) delete theEvent;
-   if(theUsefulEvent) delete theUsefulEvent;
-
-   theEvent = new RawAtriStationEvent(&theEventHeader,inBuffer);
-   theUsefulEvent = new UsefulAtriStationEvent(theEvent, AraCalType::kLatestCalib);
+   theEventView.setBuffer(&theEventHeader,inBuffer);
+   AraEventCalibrator::Instance()->calibrateInto(theEventView, *theUsefulEvent, AraCalType::kLatestCalib);
 
 
 
@@ -4,10 +4,17 @@
 #include "TH2.h"
 #include "TFile.h"
 #include "RawAtriStationEvent.h"
+#include "AraEventCalibrator.h"
+#include "AraAtriColumnarEvent.h"
 #include "TGraphErrors.h"
 #include "araSoft.h"
 #include "TChain.h"
 #include "TROOT.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdlib.h>
+#include <unistd.h>
 
 /** program to recalculate pedestals for ATRI  from data*/
 
@@ -31,29 +38,126 @@ Long64_t max = -1;
 const char * input_file = 0;
 const char * pedestal_file = 0;
 bool use_median = false;
+bool binary_output = false;
 const char * root_output = 0;
 const char * qual_file = 0;
 
 bool use_calpulsers = false;
 int cache_size = 100;
+int num_workers = 1;
+bool parallel_unzip = false;
 
 TChain chain("eventTree");
+std::vector<const char *> input_files;
+
+/** The histograms are shared by the workers, each channel behind its own lock */
+TH2S * full_hists[nchan]  = {0};
+short * arrays[nchan] = {0};
+std::mutex hist_mutex[nchan];
+
+/** Streaming median (-s): per sample, a histogram of window_bins ADU (each 1 ADU wide) starting at window_low,
+ *  placed around the mean of the first warmup_events entries, with a count below (first) and above (last) it.
+ *  Shared by the workers, which add to them with relaxed atomic increments: a copy per worker would be
+ *  nchan*nsamp*(window_bins+2) counts (about 280 MB) each*/
+bool use_streaming_median = false;
+int window_bins = 64;
+Long64_t warmup_events = 2000;
+std::vector<unsigned> window_counts[nchan];
+std::vector<int> window_low[nchan];
+
+/** Checkpoints (-L to load, -S to save) of the sums and streaming median windows, so pedestals can be updated run by run */
+std::vector<const char *> checkpoint_inputs;
+const char * checkpoint_output = 0;
+
+#define REPEDER_CHECKPOINT_MAGIC "ARAPEDCK"
+#define REPEDER_CHECKPOINT_VERSION 2
+#define REPEDER_CHECKPOINT_PATH_LENGTH 1024
+
+/** Header of a checkpoint. It is followed by nsources RepederCheckpointSource_t,
+ *  sum, sum2 (doubles) and num (ints), each [nchan][nsamp], entries (Long64_t) [nchan],
+ *  then, if window_bins is not 0, window_low (ints) [nchan][nsamp] and window_counts (unsigned) [nchan][nsamp][window_bins+2]*/
+typedef struct
+{
+  char magic[8];       ///< REPEDER_CHECKPOINT_MAGIC
+  int version;         ///< REPEDER_CHECKPOINT_VERSION
+  int nchan;           ///< Channels in the checkpoint
+  int nsamp;           ///< Samples per channel in the checkpoint
+  int window_bins;     ///< Streaming median window width, 0 if there are no windows
+  Long64_t nentries;   ///< Entries read into the checkpoint, over all the runs it holds
+  int use_calpulsers;  ///< 1 if calpulser events were included (-p)
+  int nsources;        ///< Number of input file ranges the checkpoint was made from
+} RepederCheckpointHeader_t;
+
+/** One input file range a checkpoint was made from */
+typedef struct
+{
+  char file[REPEDER_CHECKPOINT_PATH_LENGTH];         ///< Input file (real path where it exists)
+  char quality_file[REPEDER_CHECKPOINT_PATH_LENGTH]; ///< Quality cut file (-q) applied to it, empty if none
+  Long64_t first;      ///< First entry of the file that was read
+  Long64_t last;       ///< One past the last entry of the file that was read
+} RepederCheckpointSource_t;
+
+/** The input file ranges of the checkpoints loaded and of the input files, so none is counted twice */
+std::vector<RepederCheckpointSource_t> checkpoint_sources;
+
+/** Quality cut result of each entry, read before the workers start */
+std::vector<char> passed_quality;
+
+/** Sums of one worker. Each worker only touches its own, and they are added together at the end*/
+struct PedAccumulator
+{
+  std::vector<std::vector<double> > sum;
+  std::vector<std::vector<double> > sum2;
+  std::vector<std::vector<int > > num;
+  Long64_t entries[nchan];
+
+  PedAccumulator()
+    : sum(nchan, std::vector<double> ( nsamp,0)),
+      sum2(nchan, std::vector<double> ( nsamp,0)),
+      num(nchan, std::vector<int> ( nsamp,0))
+  {
+    for (int ich = 0; ich < nchan; ich++) entries[ich] = 0;
+  }
+
+  void add(const PedAccumulator & other)
+  {
+    for (int ich = 0; ich < nchan; ich++)
+    {
+      for (int isamp = 0; isamp < nsamp; isamp++)
+      {
+        sum[ich][isamp] += other.sum[ich][isamp];
+        sum2[ich][isamp] += other.sum2[ich][isamp];
+        num[ich][isamp] += other.num[ich][isamp];
+      }
+      entries[ich] += other.entries[ich];
+    }
+  }
+};
 
 void usage()
 {
   std::cout << "Usage: repeder input_file.root [intput_file2.root ...]  output_pedestal_file.dat " << std::endl
-            << "      [-d] [-h] [-o output_file.root] [-x hist_channel_mask=0x0f0f0f0f] " << std::endl
-            << "      [-p] [-N num_events] [-C cache_size=100] [-t num_threads] " << std::endl
-            <<"       [-m min_hist_adu="<< min_adu << "] [-M max_hist_adu=" << max_adu <<" ] [-b hist_adu_bin="<< adu_bin <<"]" << std::endl;
+            << "      [-d] [-h] [-B] [-o output_file.root] [-x hist_channel_mask=0x0f0f0f0f] " << std::endl
+            << "      [-p] [-N num_events] [-C cache_size=100] [-t num_threads] [-j num_workers=1] " << std::endl
+            <<"       [-m min_hist_adu="<< min_adu << "] [-M max_hist_adu=" << max_adu <<" ] [-b hist_adu_bin="<< adu_bin <<"]" << std::endl
+            <<"       [-s] [-w median_window_adu="<< window_bins << "] [-W warmup_events=" << warmup_events << "]" << std::endl
+            <<"       [-L input_checkpoint [-L input_checkpoint2 ...]] [-S output_checkpoint]" << std::endl;
   std::cout << "-h :  Display this message" << std::endl;
   std::cout << "-d :  Use median instead of mean (for channels defined in hist mask only)" << std::endl;
+  std::cout << "-B :  Write the pedestal file in the binary format, which AraEventCalibrator loads much faster than text" << std::endl;
   std::cout << "-o :  Auxilliary ROOT output. Will contain histograms for channels in hist mask and also mean/rms graphs. " << std::endl;
   std::cout << "-x :  Histogram mask. Has no effect if neither -o nor -d are defined. " << std::endl;
   std::cout << "-p :  Include events marked as calpulsers. Default is to exclude. " << std::endl;
   std::cout << "-N :  Only process up to event N" << std::endl;
   std::cout << "-t :  Enable multithreading (in TTree reading). Specify number of threads (or 0 to choose automatically) " << std::endl;
-  std::cout << "-C :  Size in megabytes of TTreeCache" << std::endl;
+  std::cout << "-j :  Split the events over this many worker threads, each reading its own share of the entries (or 0 for one per core) " << std::endl;
+  std::cout << "-C :  Size in megabytes of TTreeCache (per worker)" << std::endl;
   std::cout << "-m,-M,-b :   Set histogram bounds /binning.  " << std::endl;
+  std::cout << "-s :  Use a streaming median for every channel, from a narrow histogram per sample (overrides -d)" << std::endl;
+  std::cout << "-w :  Width in ADU of the streaming median window, centred on the mean of the warmup events" << std::endl;
+  std::cout << "-W :  Number of entries read first to place the streaming median windows" << std::endl;
+  std::cout << "-L :  Add the sums of a checkpoint (from -S) to those of the input files. Can be given several times; the input files are then optional" << std::endl;
+  std::cout << "-S :  Save the sums (and streaming median windows) to a checkpoint" << std::endl;
   std::cout << "-q :  Input clean event list (txt file) by quality cut results" << std::endl; ///< -MK added 11-02-2022
 }
 
@@ -82,6 +186,29 @@ int get_median_slice(const TH2S * h, int bin)
 }
 
 
+/** Median of a streaming median window. Returns false if the median is below or above the window (or there are no entries) */
+bool get_window_median(int chan, int samp, int & median)
+{
+  const unsigned * counts = &window_counts[chan][samp * (window_bins+2)];
+  double sum = 0; ///< Need to be double to get half of cumulative frequency
+  for (int i = 0; i < window_bins+2; i++)
+  {
+    sum += counts[i];
+  }
+  if (sum == 0) return false;
+
+  double partial_sum = 0;
+  int i = 0;
+  while (partial_sum < sum/2)
+  {
+    partial_sum += counts[i++];
+  }
+  if (i-1 == 0 || i-1 == window_bins+1) return false;
+  median = window_low[chan][samp] + i-2;
+  return true;
+}
+
+
 int parse(int nargs, char ** args)
 {
 
@@ -121,6 +248,43 @@ int parse(int nargs, char ** args)
       continue;
     }
 
+    if (!strcmp(args[iarg],"-s"))
+    {
+      use_streaming_median = true;
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-w"))
+    {
+      window_bins = atoi(args[++iarg]);
+      if (window_bins < 1) window_bins = 1;
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-W"))
+    {
+      warmup_events = atoll(args[++iarg]);
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-L"))
+    {
+      checkpoint_inputs.push_back(args[++iarg]);
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-S"))
+    {
+      checkpoint_output = args[++iarg];
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-B"))
+    {
+      binary_output = true;
+      continue;
+    }
+
     if (!strcmp(args[iarg],"-p"))
     {
       use_calpulsers = true;
@@ -135,7 +299,15 @@ int parse(int nargs, char ** args)
     if (!strcmp(args[iarg],"-t"))
     {
       ROOT::EnableImplicitMT(atoi(args[++iarg]));
-      chain.SetParallelUnzip();
+      parallel_unzip = true;
+      continue;
+    }
+
+    if (!strcmp(args[iarg],"-j"))
+    {
+      num_workers = atoi(args[++iarg]);
+      if (num_workers <= 0) num_workers = std::thread::hardware_concurrency();
+      if (num_workers <= 0) num_workers = 1;
       continue;
     }
 
@@ -174,7 +346,8 @@ int parse(int nargs, char ** args)
     positional_args.push_back(args[iarg]);
   }
 
-  if (positional_args.size() < 2)
+  //with checkpoints to add, the input files are optional
+  if (positional_args.size() < (checkpoint_inputs.empty() ? 2 : 1))
   {
     usage();
     return -1;
@@ -185,12 +358,446 @@ int parse(int nargs, char ** args)
   for (unsigned ipositional = 0; ipositional < positional_args.size()-1; ipositional++)
   {
     chain.Add(positional_args[ipositional]);
+    input_files.push_back(positional_args[ipositional]);
   }
 
   return 0;
 }
 
 
+void accumulate_event(RawAtriStationEvent * ev, PedAccumulator & acc)
+{
+  //skip the first block from all 4 DDA board!
+  for (unsigned iblk = 4; iblk < ev->blockVec.size(); iblk++)
+  {
+
+    int chan_idx = 0;
+    unsigned nchannels = ev->blockVec[iblk].getNumChannels();
+    for (unsigned ich= 0; ich< nchannels; ich++)
+    {
+
+      if (ev->blockVec[iblk].channelMask && (1 << ich) == 0) continue;
+      int chan= chan_per_dda * ev->blockVec[iblk].getDda() + ich;
+      int offset = ev->blockVec[iblk].getBlock() * samp_per_block;
+      const std::vector<UShort_t> & data = ev->blockVec[iblk].data[chan_idx];
+      unsigned size = data.size();
+      for (unsigned isamp = 0; isamp < size; isamp++)
+      {
+        UShort_t val = data[isamp];
+        unsigned i = (offset+isamp) % nsamp;
+        acc.sum2[chan][i] += val*val;
+        acc.sum[chan][i] += val;
+        acc.num[chan][i] ++;
+      }
+
+      if (full_hists[chan])
+      {
+        std::lock_guard<std::mutex> lock(hist_mutex[chan]);
+        for (unsigned isamp = 0; isamp < size; isamp++)
+        {
+          UShort_t val = data[isamp];
+          unsigned i = (offset+isamp) % nsamp;
+          int bin = 1+(val-min_adu)/adu_bin;
+          if (bin < 0) bin = 0;
+          if (bin > n_adu_bins) bin = n_adu_bins+1;
+          arrays[chan][bin + (2 + n_adu_bins) * (i+1)]++;
+
+          /** Try to prefetch next row, assuming the next sample will be similar bin*/
+          __builtin_prefetch( arrays[chan] + bin-32 + (2 + n_adu_bins) * (i+2),1,0);
+        }
+      }
+
+      if (!window_counts[chan].empty())
+      {
+        unsigned * counts = &window_counts[chan][0];
+        for (unsigned isamp = 0; isamp < size; isamp++)
+        {
+          unsigned i = (offset+isamp) % nsamp;
+          int bin = 1 + data[isamp] - window_low[chan][i];
+          if (bin < 0) bin = 0;
+          if (bin > window_bins) bin = window_bins+1;
+          //only the totals matter (read after the workers are joined), so no ordering is needed
+          __atomic_fetch_add(&counts[i * (window_bins+2) + bin], 1u, __ATOMIC_RELAXED);
+        }
+      }
+
+      acc.entries[chan]+=size;
+      chan_idx++;
+    }
+  }
+}
+
+
+/** Reads entries first to last-1 with its own TChain, so the workers deserialize in parallel */
+void process_entries(Long64_t first, Long64_t last, PedAccumulator & acc, std::atomic<Long64_t> & nprocessed, Long64_t nev)
+{
+  TChain worker_chain("eventTree");
+  for (unsigned ifile = 0; ifile < input_files.size(); ifile++)
+  {
+    worker_chain.Add(input_files[ifile]);
+  }
+  if (parallel_unzip) worker_chain.SetParallelUnzip();
+
+  RawAtriStationEvent * ev = 0;
+  //columnar input (makeAtriEventTree -c) skips the object streamer, the columns are copied into ev
+  AraAtriColumnarEvent * col_ev = 0;
+  if (AraAtriColumnarEvent::isColumnarTree(&worker_chain))
+  {
+    col_ev = new AraAtriColumnarEvent;
+    col_ev->setBranchAddresses(&worker_chain);
+    ev = new RawAtriStationEvent;
+  }
+  else
+  {
+    worker_chain.SetBranchAddress("event",&ev);
+  }
+  worker_chain.SetCacheSize(cache_size*1024*1024);
+  worker_chain.AddBranchToCache(col_ev ? "*" : "event",true);
+  worker_chain.StopCacheLearningPhase();
+
+  for (Long64_t iev = first; iev < last; iev++)
+  {
+    worker_chain.GetEntry(iev);
+    if (col_ev) col_ev->fillRawEvent(ev);
+    Long64_t ndone = nprocessed++;
+    if (ndone % 100 == 0)
+    {
+      std::cout << ndone << "/"  <<  nev << "\r";
+      std::cout << std::flush;
+    }
+
+    //! pass the event by quality cut results. -MK added 11-02-2022
+    if (qual_file && !passed_quality[iev]) continue;
+
+    if (ev->isCalpulserEvent() && !use_calpulsers)  continue;
+
+    accumulate_event(ev, acc);
+  }
+
+  worker_chain.ResetBranchAddresses();
+  delete col_ev;
+  delete ev;
+}
+
+
+/** Reads entries first to last-1, split over num_workers workers, and adds their sums into total */
+void accumulate_entries(Long64_t first, Long64_t last, PedAccumulator & total)
+{
+  //each worker reads a contiguous share of the entries into its own sums
+  Long64_t nentries = last - first;
+  if (nentries <= 0) return;
+  int nworkers = num_workers < nentries ? num_workers : (nentries > 0 ? nentries : 1);
+  std::vector<PedAccumulator> accumulators(nworkers-1);
+  std::atomic<Long64_t> nprocessed(0);
+  if (nworkers == 1)
+  {
+    process_entries(first, last, total, nprocessed, nentries);
+  }
+  else
+  {
+    ROOT::EnableThreadSafety();
+    std::vector<std::thread> workers;
+    for (int iworker = 0; iworker < nworkers; iworker++)
+    {
+      workers.push_back(std::thread(process_entries,
+                                    first + nentries * iworker / nworkers, first + nentries * (iworker+1) / nworkers,
+                                    std::ref(iworker ? accumulators[iworker-1] : total), std::ref(nprocessed), nentries));
+    }
+    for (unsigned iworker = 0; iworker < workers.size(); iworker++)
+    {
+      workers[iworker].join();
+    }
+  }
+
+  //the sums are integers (well within double precision), so the order they are added in does not matter
+  for (int iworker = 1; iworker < nworkers; iworker++)
+  {
+    total.add(accumulators[iworker-1]);
+  }
+  std::cout << std::endl;
+}
+
+
+/** Places the streaming median window of each sample around its mean over the first warmup_events entries */
+void setup_median_windows(Long64_t nev)
+{
+  PedAccumulator warmup;
+  std::cout << "Reading " << TMath::Min(warmup_events, nev) << " entries to place the median windows" << std::endl;
+  accumulate_entries(0, TMath::Min(warmup_events, nev), warmup);
+
+  for (int ich = 0; ich < nchan; ich++)
+  {
+    //samples the warmup missed use the mean of the whole channel
+    double chan_sum = 0;
+    double chan_num = 0;
+    for (int isamp = 0; isamp < nsamp; isamp++)
+    {
+      chan_sum += warmup.sum[ich][isamp];
+      chan_num += warmup.num[ich][isamp];
+    }
+    int chan_mean = chan_num > 0 ? int(round(chan_sum / chan_num)) : (min_adu+max_adu)/2;
+
+    window_low[ich].resize(nsamp);
+    window_counts[ich].assign(size_t(nsamp) * (window_bins+2), 0);
+    for (int isamp = 0; isamp < nsamp; isamp++)
+    {
+      int mean = warmup.num[ich][isamp] > 0 ? int(round(warmup.sum[ich][isamp] / warmup.num[ich][isamp])) : chan_mean;
+      window_low[ich][isamp] = mean - window_bins/2;
+    }
+  }
+}
+
+
+
+
+/** Copies the real path of name (or name itself, if it can not be resolved) into a source path */
+void set_source_path(char * dest, const char * name)
+{
+  char * resolved = realpath(name, 0);
+  strncpy(dest, resolved ? resolved : name, REPEDER_CHECKPOINT_PATH_LENGTH-1);
+  dest[REPEDER_CHECKPOINT_PATH_LENGTH-1] = 0;
+  free(resolved);
+}
+
+
+/** Adds a source to checkpoint_sources. Returns false if its entries overlap those of a source already there,
+ *  or if it was cut with a quality file and the others were not (or the other way round) */
+bool add_source(const RepederCheckpointSource_t & source, const char * from)
+{
+  for (unsigned isource = 0; isource < checkpoint_sources.size(); isource++)
+  {
+    const RepederCheckpointSource_t & other = checkpoint_sources[isource];
+    if (!strcmp(source.file, other.file) && source.first < other.last && other.first < source.last)
+    {
+      std::cerr << "Entries " << source.first << " to " << source.last-1 << " of " << source.file << " (" << from
+                << ") were already read (entries " << other.first << " to " << other.last-1 << ")" << std::endl;
+      return false;
+    }
+    if (!source.quality_file[0] != !other.quality_file[0])
+    {
+      std::cerr << source.file << " (" << from << ") " << (source.quality_file[0] ? "has" : "does not have")
+                << " a quality cut, but " << other.file << " " << (other.quality_file[0] ? "has" : "does not have") << " one" << std::endl;
+      return false;
+    }
+  }
+  checkpoint_sources.push_back(source);
+  return true;
+}
+
+
+/** Adds the entries 0 to nev-1 of the input files to checkpoint_sources, one source per file */
+bool add_input_sources(Long64_t nev)
+{
+  const Long64_t * offsets = chain.GetTreeOffset();
+  for (int itree = 0; itree < chain.GetNtrees(); itree++)
+  {
+    Long64_t last = TMath::Min(offsets[itree+1], nev);
+    if (last <= offsets[itree]) break;
+    RepederCheckpointSource_t source;
+    memset(&source, 0, sizeof(source));
+    set_source_path(source.file, chain.GetListOfFiles()->At(itree)->GetTitle());
+    if (qual_file) set_source_path(source.quality_file, qual_file);
+    source.first = 0;
+    source.last = last - offsets[itree];
+    if (!add_source(source, "input file")) return false;
+  }
+  return true;
+}
+
+
+/** Writes the sums, and the streaming median windows if there are any, to a checkpoint */
+bool write_checkpoint(const char * path, const PedAccumulator & acc, Long64_t nentries)
+{
+  RepederCheckpointHeader_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, REPEDER_CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = REPEDER_CHECKPOINT_VERSION;
+  header.nchan = nchan;
+  header.nsamp = nsamp;
+  header.window_bins = window_counts[0].empty() ? 0 : window_bins;
+  header.nentries = nentries;
+
+  header.use_calpulsers = use_calpulsers;
+  header.nsources = checkpoint_sources.size();
+
+  //write to a temporary file and rename it, so an interrupted job never leaves half a checkpoint behind
+  //(the pid keeps jobs writing the same checkpoint from sharing a temporary file)
+  std::string temp_path = std::string(path) + ".tmp." + std::to_string(getpid());
+  FILE * out = fopen(temp_path.c_str(), "wb");
+  if (!out)
+  {
+    std::cerr << "Can not open: " << temp_path << std::endl;
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  if (ok && header.nsources)
+  {
+    ok = fwrite(&checkpoint_sources[0], sizeof(RepederCheckpointSource_t), header.nsources, out) == (size_t) header.nsources;
+  }
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fwrite(&acc.sum[ich][0], sizeof(double), nsamp, out) == (size_t) nsamp;
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fwrite(&acc.sum2[ich][0], sizeof(double), nsamp, out) == (size_t) nsamp;
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fwrite(&acc.num[ich][0], sizeof(int), nsamp, out) == (size_t) nsamp;
+  if (ok) ok = fwrite(acc.entries, sizeof(Long64_t), nchan, out) == (size_t) nchan;
+  for (int ich = 0; ok && header.window_bins && ich < nchan; ich++) ok = fwrite(&window_low[ich][0], sizeof(int), nsamp, out) == (size_t) nsamp;
+  for (int ich = 0; ok && header.window_bins && ich < nchan; ich++)
+  {
+    ok = fwrite(&window_counts[ich][0], sizeof(unsigned), window_counts[ich].size(), out) == window_counts[ich].size();
+  }
+  if (fclose(out) != 0) ok = false;
+  if (!ok || rename(temp_path.c_str(), path) != 0)
+  {
+    std::cerr << "Error writing: " << path << std::endl;
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+/** Adds the counts of a checkpoint window into the window of the same sample, which may start at a different ADU.
+ *  Counts that fall outside the window go to its below/above counts. Returns false if that moved any count */
+bool add_window(int chan, int samp, int low, const unsigned * counts)
+{
+  unsigned * dest = &window_counts[chan][samp * (window_bins+2)];
+  int shift = low - window_low[chan][samp];
+  bool exact = true;
+  for (int i = 0; i < window_bins+2; i++)
+  {
+    if (!counts[i]) continue;
+    int bin;
+    if (i == 0)
+    {
+      //values below a window that starts higher may be inside this one
+      bin = 0;
+      if (shift > 0) exact = false;
+    }
+    else if (i == window_bins+1)
+    {
+      bin = window_bins+1;
+      if (shift < 0) exact = false;
+    }
+    else
+    {
+      bin = i + shift;
+      if (bin < 1) bin = 0;
+      if (bin > window_bins) bin = window_bins+1;
+    }
+    dest[bin] += counts[i];
+  }
+  return exact;
+}
+
+
+/** Adds a checkpoint into acc. The first checkpoint with windows also places the streaming median windows (if -s) */
+bool read_checkpoint(const char * path, PedAccumulator & acc, Long64_t & nentries)
+{
+  FILE * in = fopen(path, "rb");
+  if (!in)
+  {
+    std::cerr << "Can not open: " << path << std::endl;
+    return false;
+  }
+  RepederCheckpointHeader_t header;
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || memcmp(header.magic, REPEDER_CHECKPOINT_MAGIC, sizeof(header.magic))
+      || header.version != REPEDER_CHECKPOINT_VERSION
+      || header.nchan != nchan || header.nsamp != nsamp)
+  {
+    std::cerr << path << " is not a repeder checkpoint (of version " << REPEDER_CHECKPOINT_VERSION << ")" << std::endl;
+    fclose(in);
+    return false;
+  }
+  if (header.use_calpulsers != use_calpulsers)
+  {
+    std::cerr << path << (header.use_calpulsers ? " includes" : " excludes") << " calpulser events, run "
+              << (header.use_calpulsers ? "with" : "without") << " -p to use it" << std::endl;
+    fclose(in);
+    return false;
+  }
+  for (int isource = 0; isource < header.nsources; isource++)
+  {
+    RepederCheckpointSource_t source;
+    if (fread(&source, sizeof(source), 1, in) != 1)
+    {
+      std::cerr << path << " is truncated" << std::endl;
+      fclose(in);
+      return false;
+    }
+    source.file[REPEDER_CHECKPOINT_PATH_LENGTH-1] = 0;
+    source.quality_file[REPEDER_CHECKPOINT_PATH_LENGTH-1] = 0;
+    if (!add_source(source, path))
+    {
+      fclose(in);
+      return false;
+    }
+  }
+
+  PedAccumulator loaded;
+  bool ok = true;
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fread(&loaded.sum[ich][0], sizeof(double), nsamp, in) == (size_t) nsamp;
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fread(&loaded.sum2[ich][0], sizeof(double), nsamp, in) == (size_t) nsamp;
+  for (int ich = 0; ok && ich < nchan; ich++) ok = fread(&loaded.num[ich][0], sizeof(int), nsamp, in) == (size_t) nsamp;
+  if (ok) ok = fread(loaded.entries, sizeof(Long64_t), nchan, in) == (size_t) nchan;
+
+  if (ok && !header.window_bins && use_streaming_median)
+  {
+    std::cerr << path << " has no median windows, its entries only count towards the means" << std::endl;
+  }
+  else if (ok && header.window_bins && !use_streaming_median)
+  {
+    std::cerr << "Ignoring the median windows of " << path << " (no -s)" << std::endl;
+  }
+  else if (ok && header.window_bins)
+  {
+    bool first_windows = window_counts[0].empty();
+    if (first_windows) window_bins = header.window_bins;
+    int checkpoint_bins = header.window_bins;
+    std::vector<int> low(nsamp);
+    std::vector<unsigned> counts(size_t(nsamp) * (checkpoint_bins+2));
+    std::vector<std::vector<int> > lows(nchan);
+    for (int ich = 0; ok && ich < nchan; ich++)
+    {
+      ok = fread(&low[0], sizeof(int), nsamp, in) == (size_t) nsamp;
+      lows[ich] = low;
+    }
+    int ninexact = 0;
+    for (int ich = 0; ok && ich < nchan; ich++)
+    {
+      ok = fread(&counts[0], sizeof(unsigned), counts.size(), in) == counts.size();
+      if (!ok) break;
+      if (first_windows)
+      {
+        window_low[ich] = lows[ich];
+        window_counts[ich] = counts;
+        continue;
+      }
+      if (checkpoint_bins != window_bins)
+      {
+        std::cerr << path << " has " << checkpoint_bins << " ADU median windows, not " << window_bins << std::endl;
+        fclose(in);
+        return false;
+      }
+      for (int isamp = 0; isamp < nsamp; isamp++)
+      {
+        if (!add_window(ich, isamp, lows[ich][isamp], &counts[isamp * (checkpoint_bins+2)])) ninexact++;
+      }
+    }
+    if (ninexact)
+    {
+      std::cerr << ninexact << " samples of " << path << " had median windows that did not line up; their medians are approximate" << std::endl;
+    }
+  }
+  fclose(in);
+
+  if (!ok)
+  {
+    std::cerr << path << " is truncated" << std::endl;
+    return false;
+  }
+  acc.add(loaded);
+  nentries += header.nentries;
+  return true;
+}
 
 
 int main (int nargs, char ** args)
@@ -203,18 +810,50 @@ int main (int nargs, char ** args)
 
 
 
-  if (!chain.GetEntries())
+  if (!chain.GetEntries() && checkpoint_inputs.empty())
   {
     std::cerr << "No entries found :(" << std::endl;
     return 1;
   }
 
+  Long64_t nev = max < 0 ? chain.GetEntries()+1+max : TMath::Min(max, chain.GetEntries());
+  if (!add_input_sources(nev)) return 1;
+
+  //the checkpoints are read first, so new entries use the median windows they were made with
+  PedAccumulator total;
+  Long64_t nentries_total = 0;
+  for (unsigned icheck = 0; icheck < checkpoint_inputs.size(); icheck++)
+  {
+    if (!read_checkpoint(checkpoint_inputs[icheck], total, nentries_total)) return 1;
+  }
+
+  //! Input quality cut results, one line per entry. -MK added 11-02-2022
+  std::ifstream qualFile(qual_file);
+  if (qual_file) {
+    if(!qualFile.is_open()) {
+        std::cout << "Can not open: " << qual_file << "\n";
+        abort();
+    }
+    std::cout<<"Applied quality cut file: "<<qual_file<<std::endl;
+  }
+
+  if (qual_file)
+  {
+    passed_quality.assign(nev, 0);
+    for (Long64_t iev = 0; iev < nev; iev++)
+    {
+      int passed_evt = 0;
+      if (!(qualFile >> passed_evt)) break;
+      passed_quality[iev] = (passed_evt == 1);
+    }
+  }
+
+  //done before the histograms exist, so the warmup entries are not histogrammed twice
+  if (use_streaming_median && window_counts[0].empty()) setup_median_windows(nev);
+
   bool do_full_hists = (use_median || root_output) && hist_mask;
 
-  TH2S * full_hists[nchan]  = {0};
   TH1I * median_difference_hists[nchan] = {0};
-  short * arrays[nchan];
-  Long64_t entries[nchan];
   TFile * full_hists_file = 0;
 
   if (do_full_hists)
@@ -246,95 +885,30 @@ int main (int nargs, char ** args)
     }
   }
 
-  std::vector<std::vector<double> > sum(nchan, std::vector<double> ( nsamp,0));
-  std::vector<std::vector<double> > sum2(nchan, std::vector<double> ( nsamp,0)) ;
-  std::vector<std::vector<int > >num(nchan, std::vector<int> ( nsamp,0));
-
-  RawAtriStationEvent * ev = 0;
-  chain.SetBranchAddress("event",&ev);
-  chain.SetCacheSize(cache_size*1024*1024);
-  chain.AddBranchToCache("event",true);
-  chain.StopCacheLearningPhase();
-
-  //! Input quality cut results. -MK added 11-02-2022
-  std::ifstream qualFile(qual_file);
-  if (qual_file) {
-    if(!qualFile.is_open()) {
-        std::cout << "Can not open: " << qual_file << "\n";
-        abort();
-    }
-    std::cout<<"Applied quality cut file: "<<qual_file<<std::endl;
-  }
-
-  int nhundred = 0;
-
-  int nev = max < 0 ? chain.GetEntries()+1+max : TMath::Min(max, chain.GetEntries());
+  accumulate_entries(0, nev, total);
+  nentries_total += nev;
 
-  for (int iev = 0; iev < nev; iev++)
+  if (checkpoint_output && !write_checkpoint(checkpoint_output, total, nentries_total))
   {
-    chain.GetEntry(iev);
-    if (iev >= nhundred*100)
-    {
-      std::cout << iev << "/"  <<  nev << "\r";
-      std::cout << std::flush;
-      nhundred++;
-    }
-
-    //! pass the event by quality cut results. -MK added 11-02-2022
-    if (qual_file) {
-      int passed_evt;
-      qualFile >> passed_evt;
-      if (passed_evt != 1) continue;
-    }
-
-    if (ev->isCalpulserEvent() && !use_calpulsers)  continue;
-
-    //skip the first block from all 4 DDA board!
-    for (unsigned iblk = 4; iblk < ev->blockVec.size(); iblk++)
-    {
-
-      int chan_idx = 0;
-      unsigned nchannels = ev->blockVec[iblk].getNumChannels();
-      for (unsigned ich= 0; ich< nchannels; ich++)
-      {
-
-        if (ev->blockVec[iblk].channelMask && (1 << ich) == 0) continue;
-        int chan= chan_per_dda * ev->blockVec[iblk].getDda() + ich;
-        int offset = ev->blockVec[iblk].getBlock() * samp_per_block;
-        unsigned size = ev->blockVec[iblk].data[chan_idx].size();
-        for (unsigned isamp = 0; isamp < size; isamp++)
-        {
-          UShort_t val = ev->blockVec[iblk].data[chan_idx][isamp];
-          unsigned i = (offset+isamp) % nsamp;
-          sum2[chan][i] += val*val;
-          sum[chan][i] += val;
-          num[chan][i] ++;
-
-          if (full_hists[chan])
-          {
-            int bin = 1+(val-min_adu)/adu_bin;
-            if (bin < 0) bin = 0;
-            if (bin > n_adu_bins) bin = n_adu_bins+1;
-            arrays[chan][bin + (2 + n_adu_bins) * (i+1)]++;
-
-            /** Try to prefetch next row, assuming the next sample will be similar bin*/
-            __builtin_prefetch( arrays[chan] + bin-32 + (2 + n_adu_bins) * (i+2),1,0);
-          }
-        }
-
-        entries[chan]+=ev->blockVec[iblk].data[chan_idx].size();
-        chan_idx++;
-      }
-    }
+    return 1;
   }
+  const std::vector<std::vector<double> > & sum = total.sum;
+  const std::vector<std::vector<int > > & num = total.num;
+  const Long64_t * entries = total.entries;
 
   qualFile.close();
 
-  std::cout << std::endl;
-
   //write out pedestal file. This probably isn't in the normal order but the way it's read in, it doesn't matter.
 
-  std::ofstream pf(pedestal_file);
+  //the binary file is written in one go at the end, in the order AraEventCalibrator uses
+  std::vector<UShort_t> binary_peds;
+  if (binary_output) binary_peds.resize(dda_per_atri*nblk*chan_per_dda*samp_per_block);
+
+  std::ofstream pf;
+  if (!binary_output) pf.open(pedestal_file);
+
+  //samples whose streaming median fell outside their window use the mean
+  int n_outside_window = 0;
 
   for (int blk = 0; blk < nblk; blk++)
 
@@ -342,7 +916,7 @@ int main (int nargs, char ** args)
     for (int ich = 0; ich < nchan; ich++)
 
     {
-      pf <<  ich / chan_per_dda <<  " " << blk << " " <<  ich % chan_per_dda;
+      if (!binary_output) pf <<  ich / chan_per_dda <<  " " << blk << " " <<  ich % chan_per_dda;
 
       for (int isamp = 0; isamp < samp_per_block; isamp++)
       {
@@ -350,26 +924,48 @@ int main (int nargs, char ** args)
         //! return mean = 0 if it is zero division. -MK added 11-02-2022
         int mean = 0;
         if (sum[ich][idx] != 0 || num[ich][idx] != 0) mean = int(round( sum[ich][idx] / num[ich][idx]));
+        int ped = mean;
         if (full_hists[ich])
         {
           int median = get_median_slice(full_hists[ich], idx+1);
           median_difference_hists[ich]->Fill(median-mean);
           if (use_median)
           {
-            pf << " " <<  median;
+            ped = median;
           }
         }
+        if (use_streaming_median)
+        {
+          int median = mean;
+          if (!get_window_median(ich, idx, median) && num[ich][idx] > 0) n_outside_window++;
+          ped = median;
+        }
 
-        if (!full_hists[ich] || !use_median)
+        if (binary_output)
         {
-          pf << " " << mean;
+          binary_peds[RawAtriStationEvent::getPedIndex(ich / chan_per_dda, blk, ich % chan_per_dda, isamp)] = short(ped);
+        }
+        else
+        {
+          pf << " " << ped;
         }
       }
 
-      pf << std::endl;
+      if (!binary_output) pf << std::endl;
     }
   }
 
+  if (n_outside_window)
+  {
+    std::cerr << n_outside_window << " samples had their median outside the " << window_bins
+              << " ADU window and use the mean instead (try a larger -w or -W)" << std::endl;
+  }
+
+  if (binary_output && !AraEventCalibrator::writeAtriBinaryPedestalFile(pedestal_file, binary_peds))
+  {
+    return 1;
+  }
+
 
 
   if (root_output)